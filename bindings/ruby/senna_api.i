@@ -591,6 +591,9 @@ sen_rc sen_index_update(sen_index *i, const void *key, unsigned int section,
                         sen_values *oldvalues, sen_values *newvalues);
 sen_rc sen_index_select(sen_index *i, const char *string, unsigned int string_len,
                         sen_records *r, sen_sel_operator op, sen_select_optarg *optarg);
+sen_rc sen_index_select_topk(sen_index *i, const char *string, unsigned int string_len,
+                             sen_records *r, sen_sel_operator op, sen_select_optarg *optarg,
+                             int limit);
 sen_rc sen_index_info(sen_index *i, int *key_size, int *flags,
                       int *initial_n_segments, sen_encoding *encoding,
                       unsigned *nrecords_keys, unsigned *file_size_keys,
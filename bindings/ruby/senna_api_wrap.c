@@ -5045,6 +5045,108 @@ fail:
 }
 
 
+SWIGINTERN VALUE
+_wrap_sen_index_select_topk(int argc, VALUE *argv, VALUE self) {
+  sen_index *arg1 = (sen_index *) 0 ;
+  char *arg2 = (char *) 0 ;
+  unsigned int arg3 ;
+  sen_records *arg4 = (sen_records *) 0 ;
+  sen_sel_operator arg5 ;
+  sen_select_optarg *arg6 = (sen_select_optarg *) 0 ;
+  int arg7 ;
+  sen_rc result;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  int res2 ;
+  char *buf2 = 0 ;
+  int alloc2 = 0 ;
+  unsigned int val3 ;
+  int ecode3 = 0 ;
+  void *argp4 = 0 ;
+  int res4 = 0 ;
+  int val5 ;
+  int ecode5 = 0 ;
+  int val7 ;
+  int ecode7 = 0 ;
+  VALUE vresult = Qnil;
+  
+  if ((argc < 7) || (argc > 7)) {
+    rb_raise(rb_eArgError, "wrong # of arguments(%d for 7)",argc); SWIG_fail;
+  }
+  res1 = SWIG_ConvertPtr(argv[0], &argp1,SWIGTYPE_p_sen_index, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "sen_index_select_topk" "', argument " "1"" of type '" "sen_index *""'"); 
+  }
+  arg1 = (sen_index *)(argp1);
+  res2 = SWIG_AsCharPtrAndSize(argv[1], &buf2, NULL, &alloc2);
+  if (!SWIG_IsOK(res2)) {
+    SWIG_exception_fail(SWIG_ArgError(res2), "in method '" "sen_index_select_topk" "', argument " "2"" of type '" "char const *""'");
+  }
+  arg2 = (char *)(buf2);
+  ecode3 = SWIG_AsVal_unsigned_SS_int(argv[2], &val3);
+  if (!SWIG_IsOK(ecode3)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode3), "in method '" "sen_index_select_topk" "', argument " "3"" of type '" "unsigned int""'");
+  } 
+  arg3 = (unsigned int)(val3);
+  res4 = SWIG_ConvertPtr(argv[3], &argp4,SWIGTYPE_p_sen_records, 0 |  0 );
+  if (!SWIG_IsOK(res4)) {
+    SWIG_exception_fail(SWIG_ArgError(res4), "in method '" "sen_index_select_topk" "', argument " "4"" of type '" "sen_records *""'"); 
+  }
+  arg4 = (sen_records *)(argp4);
+  ecode5 = SWIG_AsVal_int(argv[4], &val5);
+  if (!SWIG_IsOK(ecode5)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode5), "in method '" "sen_index_select_topk" "', argument " "5"" of type '" "sen_sel_operator""'");
+  } 
+  arg5 = (sen_sel_operator)(val5);
+  {
+    struct SelectOptarg *w;
+    int res = SWIG_ConvertPtr(argv[5], (void *)&w, SWIGTYPE_p_SelectOptarg, 0);
+    if (!SWIG_IsOK(res)) {
+      SWIG_exception_fail(SWIG_ArgError(res), "SelectOptarg expected");
+    }
+    if (w) {
+      arg6 = &w->optarg;
+      w->optarg.mode = w->mode;
+      w->optarg.similarity_threshold = w->similarity_threshold;
+      w->optarg.max_interval = w->max_interval;
+      if (TYPE(w->weight_vector) == T_ARRAY) {
+        int i, size = FIX2INT(rb_funcall(w->weight_vector, rb_intern("size"), 0));
+        w->optarg.vector_size = size;
+        w->optarg.weight_vector = malloc(sizeof(int) * size);
+        for (i = 0; i < size; i++) {
+          w->optarg.weight_vector[i] =
+          FIX2INT(rb_funcall(w->weight_vector, rb_intern("[]"), 1, INT2NUM(i)));
+        }
+      } else {
+        w->optarg.vector_size = 0;
+        w->optarg.weight_vector = NULL;
+      }
+      w->optarg.func = CLASS_OF(w->func) == rb_cProc ? select_handler : NULL;
+      w->optarg.func_arg = w;
+    } else {
+      arg6 = NULL;
+    }
+  }
+  ecode7 = SWIG_AsVal_int(argv[6], &val7);
+  if (!SWIG_IsOK(ecode7)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode7), "in method '" "sen_index_select_topk" "', argument " "7"" of type '" "int""'");
+  } 
+  arg7 = (int)(val7);
+  result = (sen_rc)sen_index_select_topk(arg1,(char const *)arg2,arg3,arg4,arg5,arg6,arg7);
+  vresult = SWIG_From_int((int)(result));
+  {
+    if (arg6 && (arg6)->weight_vector) {
+      free((arg6)->weight_vector); 
+    }
+  }
+  if (alloc2 == SWIG_NEWOBJ) free((char*)buf2);
+  return vresult;
+fail:
+  if (alloc2 == SWIG_NEWOBJ) free((char*)buf2);
+  return Qnil;
+}
+
+
 SWIGINTERN VALUE
 _wrap_sen_index_info(int argc, VALUE *argv, VALUE self) {
   sen_index *arg1 = (sen_index *) 0 ;
@@ -8731,6 +8833,7 @@ SWIGEXPORT void Init_senna(void) {
   rb_define_module_function(mSenna, "sen_index_open_with_keys", _wrap_sen_index_open_with_keys, -1);
   rb_define_module_function(mSenna, "sen_index_update", _wrap_sen_index_update, -1);
   rb_define_module_function(mSenna, "sen_index_select", _wrap_sen_index_select, -1);
+  rb_define_module_function(mSenna, "sen_index_select_topk", _wrap_sen_index_select_topk, -1);
   rb_define_module_function(mSenna, "sen_index_info", _wrap_sen_index_info, -1);
   rb_define_module_function(mSenna, "sen_index_path", _wrap_sen_index_path, -1);
   rb_define_module_function(mSenna, "sen_query_open", _wrap_sen_query_open, -1);
@@ -15,9 +15,10 @@
   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include "senna_in.h"
+
 #ifdef USE_AIO
 
-#include "senna_in.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,68 +32,174 @@
 #include <sys/shm.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <sys/file.h>
+#include <errno.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#else /* __linux__ */
+#include <sched.h>
+#endif /* __linux__ */
 
 #include "cache.h"
 
 #define SEN_ATOMIC_DEC(x) { uint32_t _n; SEN_ATOMIC_ADD_EX((x), -1, _n); }
+#define SEN_ATOMIC_INC(x) { uint32_t _n; SEN_ATOMIC_ADD_EX((x), 1, _n); }
 
 /* feature switch */
 int sen_aio_enabled;
 int sen_debug_print;
+int sen_aio_backend;
 
 /* cache structure  */
 int sen_cache_size;  /* size of cache (MB) */
 int sen_cache_block; /* alignment */
-int sen_hash_size;   /* size of hash array */
+int sen_hash_size;   /* number of shards */
 
 #define DEFAULT_CACHE_SIZE   256
 #define DEFAULT_CACHE_BLOCK  4096
-#define DEFAULT_HASH_SIZE    1024
+#define DEFAULT_HASH_SIZE    64
 
 #define MEM_ALIGN    sen_cache_block
 #define CACHE_SIZE   (sen_cache_size * 1024 * 1024)
 #define CACHE_NUM    (CACHE_SIZE / MEM_ALIGN) /* number of cache data */
 #define HASH_SIZE    sen_hash_size
+#define SHARD_NUM    (CACHE_NUM / HASH_SIZE)  /* number of cache data in a shard */
 
 /* shm namespaces */
-#define CACHE_DATA_SHM_NAME    "senna_cache_data"
+#define CACHE_DATA_SHM_NAME    "senna_cache_slot"
 #define CACHE_BIN_SHM_NAME     "senna_cache_bin"
-#define CACHE_COUNTER_SHM_NAME "senna_cache_counter"
-#define CACHE_HASH_SHM_NAME    "senna_cache_hash"
+#define CACHE_HASH_SHM_NAME    "senna_cache_shard"
+
+/*
+ * The CacheData are split into HASH_SIZE shards of SHARD_NUM. A block
+ * belongs to the shard of its hash, and is found by the open addressed
+ * index of the shard, which has index_size entries of CacheData number
+ * or -1. A victim is chosen by the clock hand of the shard, which gives
+ * a second chance to the CacheData hit since it passed them.
+ *
+ * The lock of a shard is held only for a lookup or an eviction, and the
+ * processes waiting for it sleep on a futex. ref is counted up with the
+ * lock, and counted down without it.
+ *
+ * The statistics of a shard are counted up with its lock. Those of the
+ * AIO have no lock, and are counted up atomically in the CacheHeader.
+ */
+
+/* head of the shard shm */
+typedef struct _CacheHeader CacheHeader;
+struct _CacheHeader {
+    uint64_t reads;
+    uint64_t bypasses;
+};
 
-/* hash block */
+/* shard */
 typedef struct _CacheHash CacheHash;
 struct _CacheHash {
-    int num; /* first CacheData number */
-    int lock;
+    int lock; /* 0: free, 1: locked, 2: locked and waited */
+    unsigned int hand; /* clock hand, in the shard */
+    /* statistics */
+    uint64_t hits;
+    uint64_t waits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t nomems;
+    uint64_t invalidations;
+    uint64_t lock_waits;
+    uint64_t lock_sleeps;
 };
 
-/* for debug  */
-
 /* mmaped to shm */
-unsigned int *ccount; /* global counter */
 void *cache_data; /* CacheData array */
 void *cache_bin;  /* Cache binary */
-void *cache_hash; /* Hash array */
+void *cache_hash; /* CacheHeader, shards and their indexes */
+
+static unsigned int index_size; /* power of 2, no less than SHARD_NUM * 2 */
 
 /* misc macro */
-#define HASH_VAL (1024 * 128)
-//#define CALC_HASH(x,y,z)  ((x + y + (z/sen_cache_block)) % HASH_SIZE)
-#define CALC_HASH(x,y,z)  ((x + y + (z/HASH_VAL)) % HASH_SIZE)
-#define GET_CD_NUM(num)   ((CacheData*)(cache_data + sizeof(CacheData)*num))
-#define GET_HASH_NUM(num) ((CacheHash*)(cache_hash + sizeof(CacheHash)*num))
-#define GET_HASH_CD(cd)   (GET_HASH_NUM(CALC_HASH(cd->dev,cd->inode,cd->offset)))
+#define GET_CD_NUM(num)   ((CacheData*)((byte *)cache_data + sizeof(CacheData)*(num)))
+#define GET_HEADER()      ((CacheHeader*)cache_hash)
+#define GET_HASH_NUM(num) ((CacheHash*)((byte *)cache_hash + sizeof(CacheHeader) + \
+                                        sizeof(CacheHash)*(num)))
+#define GET_INDEX(num)    ((int *)GET_HASH_NUM(HASH_SIZE) + index_size*(num))
+#define CACHE_HASH_HEAD_SIZE (sizeof(CacheHeader) + sizeof(CacheHash) * HASH_SIZE)
+#define CACHE_HASH_SHM_SIZE \
+  (CACHE_HASH_HEAD_SIZE + sizeof(int) * index_size * HASH_SIZE)
+
+static inline unsigned int
+calc_hash (dev_t dev, ino_t inode, size_t offset)
+{
+    uint64_t h = (uint64_t)dev * 0x9e3779b97f4a7c15ULL;
+    h ^= (uint64_t)inode * 0xc2b2ae3d27d4eb4fULL;
+    h ^= (uint64_t)(offset / MEM_ALIGN) * 0x165667b19e3779f9ULL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return (unsigned int)h;
+}
+
+#define CALC_SHARD(h)     ((h) % HASH_SIZE)
+#define CALC_HOME(h)      (((h) / HASH_SIZE) & (index_size - 1))
 
 /*
- * Initialize shm region. 
+ * shard lock, by futex.
  */
+static inline void
+futex_wait (int *addr, int val)
+{
+#ifdef __linux__
+    syscall (SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+#else /* __linux__ */
+    sched_yield ();
+#endif /* __linux__ */
+}
+
+static inline void
+futex_wake (int *addr)
+{
+#ifdef __linux__
+    syscall (SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif /* __linux__ */
+}
+
+#define LOCK_SPIN 100
+
 static void
-sen_cache_init (void)
+shard_lock (CacheHash *hash)
 {
-    int shmfd;
-    int ret;
-    char shm_name[PATH_MAX];
+    int c, i, sleeps = 0;
+    if (!(c = __sync_val_compare_and_swap (&hash->lock, 0, 1))) return;
+    for (i = 0; i < LOCK_SPIN; i++) {
+        if (!hash->lock && !(c = __sync_val_compare_and_swap (&hash->lock, 0, 1))) {
+            hash->lock_waits++;
+            return;
+        }
+    }
+    if (c != 2) c = __sync_lock_test_and_set (&hash->lock, 2);
+    while (c) {
+        futex_wait (&hash->lock, 2);
+        sleeps++;
+        c = __sync_lock_test_and_set (&hash->lock, 2);
+    }
+    hash->lock_waits++;
+    hash->lock_sleeps += sleeps;
+}
+
+static void
+shard_unlock (CacheHash *hash)
+{
+    if (__sync_fetch_and_sub (&hash->lock, 1) != 1) {
+        hash->lock = 0;
+        futex_wake (&hash->lock);
+    }
+}
 
+/*
+ * read the size of the cache from the environment.
+ */
+static void
+sen_cache_config (void)
+{
     if (getenv("SEN_CACHE_SIZE")) {
         sen_cache_size = atoi(getenv("SEN_CACHE_SIZE"));
     } else {
@@ -108,96 +215,118 @@ sen_cache_init (void)
     } else {
         sen_hash_size = DEFAULT_HASH_SIZE;
     }
-    dp ("cache size: %d MB, cache block: %d, hash size: %d\n", sen_cache_size, sen_cache_block, sen_hash_size);
+    for (index_size = 1; index_size < SHARD_NUM * 2; index_size <<= 1) ;
+    dp ("cache size: %d MB, cache block: %d, shards: %d\n", sen_cache_size, sen_cache_block, sen_hash_size);
+}
 
-    /* Array of CacheData */
-    snprintf (shm_name, PATH_MAX, "%s_%d", CACHE_DATA_SHM_NAME, MEM_ALIGN);
-    shmfd = shm_open (shm_name, O_CREAT|O_RDWR|O_EXCL, 0666);
-    if (shmfd < 0 && errno == EEXIST) {
-        /* exist : no op */
-    } else {
-        int h;
-        int num;
-        size_t s = sizeof(CacheData) * CACHE_NUM;
-        void *p = malloc (s);
-
-        for (h = 0; h < HASH_SIZE; h++) {
-            /* Initialize with INVALID */
-            for (num = 0; num < CACHE_NUM / HASH_SIZE; num++) {
-                int number = num + (h * (CACHE_NUM / HASH_SIZE));
-                CacheData *cd = p + sizeof(CacheData) * number;
-                
-                cd->num = number; /* unique number */
-                cd->ref = 0; 
-
-                /* vector list */
-                if (cd->num + 1 < (h+1) * (CACHE_NUM / HASH_SIZE)) {
-                    cd->next = cd->num + 1;
-                } else {
-                    cd->next = -1; /* end of list */
-                }
-                cd->flag = CACHE_INVALID;
-            }
-        }
-        
-        ret = write (shmfd, p, s);
-        free (p);
-        if (ret < 0) {
-            perror ("sen_cache_init: write");
-            exit (1);
-        }
+/*
+ * Initialize shm regions.
+ *
+ * The process which finds a region empty sizes it by ftruncate() and
+ * fills it with an exclusive flock() held. The others wait for the lock
+ * in sen_cache_map(), so that they never see a region half filled.
+ */
+static void
+fill_data (void *p, size_t s)
+{
+    int number;
+    for (number = 0; number < CACHE_NUM; number++) {
+        CacheData *cd = (CacheData *)((byte *)p + sizeof(CacheData) * number);
+        cd->num = number; /* unique number */
+        cd->ref = 0;
+        cd->used = 0;
+        cd->flag = CACHE_INVALID;
     }
-    
-    /* Cache binary */
-    snprintf (shm_name, PATH_MAX, "%s_%d", CACHE_BIN_SHM_NAME, MEM_ALIGN);
-    shmfd = shm_open (shm_name, O_CREAT|O_RDWR|O_EXCL, 0666);
-    if (shmfd < 0 && errno == EEXIST) {
-        /* exist : no op */
-    } else {
-        size_t s = CACHE_SIZE;
-        void *p = malloc (s);
-        ret = write (shmfd, p, s);
-        free (p);
-	if (ret < 0) {
-            perror ("sen_cache_init: write");
+}
+
+static void
+fill_hash (void *p, size_t s)
+{
+    memset ((byte *)p + CACHE_HASH_HEAD_SIZE, 0xff, s - CACHE_HASH_HEAD_SIZE);
+}
+
+static void
+sen_cache_create (const char *name, size_t size, void (*fill)(void *, size_t))
+{
+    int shmfd;
+    struct stat st;
+    void *p;
+    char shm_name[PATH_MAX];
+
+    snprintf (shm_name, PATH_MAX, "%s_%d", name, MEM_ALIGN);
+    if ((shmfd = shm_open (shm_name, O_CREAT|O_RDWR, 0666)) < 0) {
+        perror ("sen_cache_init: shm_open");
+        exit (1);
+    }
+    if (flock (shmfd, LOCK_EX) < 0 || fstat (shmfd, &st) < 0) {
+        perror ("sen_cache_init: flock");
+        exit (1);
+    }
+    if (!st.st_size) {
+        /* zero filled */
+        if (ftruncate (shmfd, size) < 0) {
+            perror ("sen_cache_init: ftruncate");
             exit (1);
-	}
+        }
+        if (fill) {
+            p = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, shmfd, 0);
+            if (p == (void *)-1) {
+                perror ("sen_cache_init: mmap");
+                exit (1);
+            }
+            fill (p, size);
+            munmap (p, size);
+        }
     }
+    flock (shmfd, LOCK_UN);
+    close (shmfd);
+}
 
-    /* global counter */
-    snprintf (shm_name, PATH_MAX, "%s_%d", CACHE_COUNTER_SHM_NAME, MEM_ALIGN);
-    shmfd = shm_open (shm_name, O_CREAT|O_RDWR|O_EXCL, 0666);
-    if (shmfd < 0 && errno == EEXIST) {
-        /* exist : no op */
-    } else {
-        unsigned int i = 1;
-        ret = write (shmfd, &i, sizeof(unsigned int));
-	if (ret < 0) {
-	  perror ("sen_cache_init: write");
-	  exit (1);
-	}
-    }
+static void
+sen_cache_init (void)
+{
+    sen_cache_config ();
+    sen_cache_create (CACHE_DATA_SHM_NAME, sizeof(CacheData) * CACHE_NUM, fill_data);
+    sen_cache_create (CACHE_BIN_SHM_NAME, CACHE_SIZE, NULL);
+    sen_cache_create (CACHE_HASH_SHM_NAME, CACHE_HASH_SHM_SIZE, fill_hash);
+}
 
-    /* Array of CacheHash */
-    snprintf (shm_name, PATH_MAX, "%s_%d", CACHE_HASH_SHM_NAME, MEM_ALIGN);
-    shmfd = shm_open (shm_name, O_CREAT|O_RDWR|O_EXCL, 0666);
-    if (shmfd < 0 && errno == EEXIST) {
-        /* exist : no op */
-    } else {
-        int i;
-        size_t s = sizeof(CacheHash) * HASH_SIZE;
-        void *p = malloc(s);
-        for (i = 0; i < HASH_SIZE; i++) {
-            CacheHash *hash = p + sizeof(CacheHash) * i;
+#define CACHE_MAP_RETRY 100
 
-            /* first CacheData */
-            hash->num = i * (CACHE_NUM / HASH_SIZE);
+/*
+ * mmap() a shm region of size, waiting for it to be initialized.
+ *
+ * return: address or NULL (no shm, or of another size)
+ */
+static void *
+sen_cache_map (const char *name, size_t size, int oflag)
+{
+    int shmfd, retry;
+    struct stat st;
+    void *p;
+    char shm_name[PATH_MAX];
 
-            hash->lock = 0;
+    snprintf (shm_name, PATH_MAX, "%s_%d", name, MEM_ALIGN);
+    if ((shmfd = shm_open (shm_name, oflag, 0666)) < 0) return NULL;
+    for (retry = 0;; retry++) {
+        if (flock (shmfd, LOCK_SH) < 0 || fstat (shmfd, &st) < 0) {
+            close (shmfd);
+            return NULL;
+        }
+        flock (shmfd, LOCK_UN);
+        if (st.st_size == size) break;
+        /* an empty one is just created, and is to be sized soon */
+        if (st.st_size || retry == CACHE_MAP_RETRY) {
+            dp ("shm %s is not of the size %lu\n", shm_name, (long)size);
+            close (shmfd);
+            errno = EINVAL;
+            return NULL;
         }
-        write (shmfd, p, s);
-        free (p);
+        usleep (10000);
     }
+    p = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, shmfd, 0);
+    close (shmfd);
+    return p == (void *)-1 ? NULL : p;
 }
 
 /*
@@ -206,160 +335,191 @@ sen_cache_init (void)
 void
 sen_cache_open (void)
 {
-    int shmfd;
-    char shm_name[PATH_MAX];
-
     /* no op when disabled */
     if (!sen_aio_enabled) return;
     
     sen_cache_init ();
 
-    /* global counter */
-    snprintf (shm_name, PATH_MAX, "%s_%d", CACHE_COUNTER_SHM_NAME, MEM_ALIGN);
-    shmfd = shm_open (shm_name, O_CREAT|O_RDWR, 0666);
-    if ( (ccount = (unsigned int *)mmap(NULL, sizeof(unsigned int),
-                                PROT_READ|PROT_WRITE, MAP_SHARED, shmfd, 0)) == (unsigned int *)-1) {
-        perror("mmap (counter)");
-        exit (1);
-    }
-
     /* Cache binary */
-    snprintf (shm_name, PATH_MAX, "%s_%d", CACHE_BIN_SHM_NAME, MEM_ALIGN);
-    shmfd = shm_open (shm_name, O_CREAT|O_RDWR, 0666);
-    if ( (cache_bin = mmap (NULL, CACHE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED,
-			    shmfd, 0)) == (void *)-1) {
+    if (!(cache_bin = sen_cache_map (CACHE_BIN_SHM_NAME, CACHE_SIZE, O_CREAT|O_RDWR))) {
         perror("mmap (cache)");
         exit (1);
     }
 
-    /* CacheHash */
-    snprintf (shm_name, PATH_MAX, "%s_%d", CACHE_HASH_SHM_NAME, MEM_ALIGN);
-    shmfd = shm_open (shm_name, O_CREAT|O_RDWR, 0666);
-    cache_hash = mmap (NULL, sizeof(CacheHash) * HASH_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED,
-                       shmfd, 0);
+    /* shards */
+    if (!(cache_hash = sen_cache_map (CACHE_HASH_SHM_NAME, CACHE_HASH_SHM_SIZE,
+                                      O_CREAT|O_RDWR))) {
+        perror("mmap (CacheHash)");
+        exit (1);
+    }
 
     /* CacheData */
-    snprintf (shm_name, PATH_MAX, "%s_%d", CACHE_DATA_SHM_NAME, MEM_ALIGN);    
-    shmfd = shm_open (shm_name, O_CREAT|O_RDWR, 0666);
-    if ( (cache_data = mmap(NULL, sizeof(CacheData) * CACHE_NUM,
-                            PROT_READ|PROT_WRITE, MAP_SHARED, shmfd, 0)) == (void *)-1) {
+    if (!(cache_data = sen_cache_map (CACHE_DATA_SHM_NAME, sizeof(CacheData) * CACHE_NUM,
+                                      O_CREAT|O_RDWR))) {
         perror("mmap (CacheData)");
         exit (1);
     }
 }
 
 /*
- * search Hit, Free or LRU node.
+ * attach to shm region, only if it exists.
  *
- * @dev: device number
- * @inode: inode number
- * @offset: file offset
- *
- * return: CacheData or NULL (Cache region is full of referenced)
+ * return: 0 or -1
  */
-static CacheData *
-sen_cache_hash_search (dev_t dev, ino_t inode, size_t offset, size_t size)
+int
+sen_cache_attach (void)
 {
-    int h = CALC_HASH(dev,inode,offset);
-    CacheData *cd = NULL;   /* expire CacheData */
-    CacheData *fcd = NULL;  /* free CacheData */
-    CacheHash *hash = GET_HASH_NUM(h);
-    unsigned int c = *ccount; /* current stamp */
-    unsigned int l = 0; /* oldest stamp */
-    int i;
-    int r = 0; /* retry count */
-
-LRU_retry:
-    SEN_ATOMIC_ADD_EX(&(hash->lock), 1, i);
-    if (i > 0) {
-        SEN_ATOMIC_DEC(&(hash->lock));
-        usleep (1);
-        goto LRU_retry;
+    sen_cache_config ();
+    if (!(cache_hash = sen_cache_map (CACHE_HASH_SHM_NAME, CACHE_HASH_SHM_SIZE, O_RDWR)) ||
+        !(cache_data = sen_cache_map (CACHE_DATA_SHM_NAME, sizeof(CacheData) * CACHE_NUM,
+                                      O_RDWR))) {
+        return -1;
     }
+    /* cache binary is not needed to see statistics */
+    return 0;
+}
 
-    l = 0;
-    for (i = 0; i < CACHE_NUM / HASH_SIZE; i++) {
-        int number = i + (h * (CACHE_NUM / HASH_SIZE));
-        CacheData *tmp = GET_CD_NUM(number);
-
-        if (tmp->offset == offset &&
-            tmp->inode == inode &&
-            tmp->dev == dev &&
-            tmp->flag != CACHE_INVALID) {
-
-            if (tmp->flag == CACHE_LOCKED) {
-                /* still in locked */
-                SEN_ATOMIC_DEC(&(hash->lock));
-                usleep(1);
-                goto LRU_retry;
-            }
-            
-            tmp->stamp = (*ccount)++;            
-             
-            /*
-             *  should ignore CACHE_READ reference,
-             *  because it will be upped by other process.
-             */
-            if (tmp->flag == CACHE_VALID) {
-                tmp->ref++;
-                dp ("CacheData[%d]: ref: %d\n", tmp->num, tmp->ref); 
-            }
+/*
+ * index of a shard. must be called with the lock of the shard.
+ */
 
-            SEN_ATOMIC_DEC(&(hash->lock));
-            return tmp;
-        }
+/* returns the position of the key in the index, or of the empty entry
+   where it would be put. */
+static unsigned int
+index_probe (int *index, unsigned int h, dev_t dev, ino_t inode, size_t offset)
+{
+    unsigned int i;
+    for (i = CALC_HOME(h); index[i] >= 0; i = (i + 1) & (index_size - 1)) {
+        CacheData *cd = GET_CD_NUM(index[i]);
+        if (cd->offset == offset && cd->inode == inode && cd->dev == dev) break;
+    }
+    return i;
+}
 
-        /* LRU or INVALID search */
-        if (fcd) continue; /* already found free area */
-        
-        if (tmp->flag == CACHE_INVALID && tmp->ref == 0) {
-            fcd = tmp;
-        } else if (!fcd && (unsigned int)(c - tmp->stamp) > l) {
-            l = (unsigned int)(c - tmp->stamp);
-            cd = tmp;
+/* removes the entry at i, and shifts back the entries after it. */
+static void
+index_remove (int *index, unsigned int i)
+{
+    unsigned int j = i, k;
+    for (;;) {
+        index[i] = -1;
+        for (;;) {
+            CacheData *cd;
+            j = (j + 1) & (index_size - 1);
+            if (index[j] < 0) return;
+            cd = GET_CD_NUM(index[j]);
+            k = CALC_HOME(calc_hash (cd->dev, cd->inode, cd->offset));
+            /* stays if its home is in (i, j] */
+            if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+            break;
         }
+        index[i] = index[j];
+        i = j;
     }
+}
 
-    if (fcd || (cd && cd->flag == CACHE_VALID && cd->ref == 0)) {
-
-        if (!fcd) {
-            /* Expire LRU and unreferenced CacheData */
-            dp ("Expire[%d] CacheData[%d] stamp=%u dev=%lu inode=%lu offset=%u size=%u\n",
-                h, cd->num, cd->stamp, (long)cd->dev, (long)cd->inode, cd->offset, cd->size);
+/* removes cd from the index if it is there. */
+static void
+index_del (int *index, CacheData *cd)
+{
+    unsigned int i;
+    i = index_probe (index, calc_hash (cd->dev, cd->inode, cd->offset),
+                     cd->dev, cd->inode, cd->offset);
+    if (index[i] == (int)cd->num) index_remove (index, i);
+}
 
-            fcd = cd;
+/*
+ * choose a victim by the clock hand. must be called with the lock of
+ * the shard.
+ *
+ * return: CacheData or NULL (the shard is full of referenced)
+ */
+static CacheData *
+clock_evict (CacheHash *hash, int h)
+{
+    int i;
+    for (i = 0; i < SHARD_NUM * 2; i++) {
+        CacheData *cd = GET_CD_NUM(h * SHARD_NUM + hash->hand);
+        if (++hash->hand == SHARD_NUM) hash->hand = 0;
+        if (cd->ref || cd->flag == CACHE_READ) continue;
+        if (cd->used) {
+            cd->used = 0;
+            continue;
         }
+        return cd;
+    }
+    return NULL;
+}
 
-        /* free CacheData is now available */
-        fcd->ref++;
-        fcd->stamp = (*ccount)++;
-
-        fcd->flag = CACHE_LOCKED;
-
-        fcd->dev = dev;
-        fcd->inode = inode;
-        fcd->offset = offset;
-        fcd->size = size;
-
-        dp ("CacheData[%d]: ref: %d\n", fcd->num, fcd->ref);         
+/*
+ * search Hit, or take a node for the block.
+ *
+ * @dev: device number
+ * @inode: inode number
+ * @offset: file offset
+ * @missp: set to 1 if the block has to be read
+ *
+ * return: CacheData or NULL (the shard is full of referenced)
+ */
+static CacheData *
+sen_cache_hash_search (dev_t dev, ino_t inode, size_t offset, size_t size, int *missp)
+{
+    unsigned int hv = calc_hash (dev, inode, offset), i;
+    int h = CALC_SHARD(hv);
+    CacheHash *hash = GET_HASH_NUM(h);
+    int *index = GET_INDEX(h);
+    CacheData *cd;
 
-        SEN_ATOMIC_DEC(&(hash->lock));
-        return fcd;
-    } else {
-        /* Not found Free CacheDate &&  LRU CacheData is used, cannot expire. */
-        SEN_ATOMIC_DEC(&(hash->lock));
-        usleep(2);
-        cd->stamp = c; /* update counter stamp with current */
-        if (++r > CACHE_NUM / HASH_SIZE) {
-            /* no space for new cache in this hash block */
-            dp ("No room for new CacheData: hash[%d] is full of used\n", h);
-            return NULL;
+    shard_lock (hash);
+    i = index_probe (index, hv, dev, inode, offset);
+    if (index[i] >= 0) {
+        cd = GET_CD_NUM(index[i]);
+        cd->used = 1;
+        /*
+         *  should ignore CACHE_READ reference,
+         *  because it will be upped by other process.
+         */
+        if (cd->flag == CACHE_VALID) {
+            SEN_ATOMIC_INC(&cd->ref);
+            dp ("CacheData[%d]: ref: %d\n", cd->num, cd->ref);
+            hash->hits++;
+        } else {
+            hash->waits++;
         }
-        goto LRU_retry;
+        shard_unlock (hash);
+        *missp = 0;
+        return cd;
     }
 
-    /* should not be reached */
-    return NULL;
+    hash->misses++;
+    if (!(cd = clock_evict (hash, h))) {
+        hash->nomems++;
+        shard_unlock (hash);
+        dp ("No room for new CacheData: shard[%d] is full of used\n", h);
+        return NULL;
+    }
+    if (cd->flag != CACHE_INVALID) {
+        /* Expire unreferenced CacheData */
+        dp ("Expire[%d] CacheData[%d] dev=%lu inode=%lu offset=%u size=%u\n",
+            h, cd->num, (long)cd->dev, (long)cd->inode, cd->offset, cd->size);
+        index_del (index, cd);
+        i = index_probe (index, hv, dev, inode, offset);
+        hash->evictions++;
+    }
+
+    SEN_ATOMIC_INC(&cd->ref);
+    cd->used = 0;
+    cd->flag = CACHE_READ;
+    cd->dev = dev;
+    cd->inode = inode;
+    cd->offset = offset;
+    cd->size = size;
+    index[i] = cd->num;
+    dp ("CacheData[%d]: ref: %d\n", cd->num, cd->ref);
+
+    shard_unlock (hash);
+    *missp = 1;
+    return cd;
 }
 
 /*
@@ -378,47 +538,34 @@ sen_cache_read (CacheIOOper *oper, dev_t dev, ino_t inode, size_t offset, size_t
 {
     void *p = NULL;
     CacheData *cd = NULL;
+    int miss;
 
-    cd = sen_cache_hash_search (dev, inode, offset, size);
+    cd = sen_cache_hash_search (dev, inode, offset, size, &miss);
 
     if (!cd) return NULL; /* no room */
 
-    switch (cd->flag) {
-    case CACHE_INVALID:
-    case CACHE_LOCKED:
+    p = (byte *)cache_bin + (cd->num * MEM_ALIGN);
+    if (miss) {
         /* Cache Miss */
 
-        /* Initialize CacheData */
-        cd->flag = CACHE_READ;
-
         /* set aiocb */
-        oper->iocb->aio_buf = p = cache_bin + (cd->num * MEM_ALIGN);
+        oper->iocb->aio_buf = p;
         oper->iocb->aio_nbytes = size;
         oper->iocb->aio_offset = offset;
         
         /* real read() is required */
         oper->read = 1;
         
-        dp ("Miss CacheData[%d] stamp=%u dev=%lu inode=%lu offset=%d size=%d flag=CACHE_INVALID ref=%d\n",
-            cd->num, cd->stamp, (long)dev, (long)inode, offset, size, cd->ref);
-        break;
-    case CACHE_VALID:
+        dp ("Miss CacheData[%d] dev=%lu inode=%lu offset=%d size=%d ref=%d\n",
+            cd->num, (long)dev, (long)inode, offset, size, cd->ref);
+    } else if (cd->flag == CACHE_VALID) {
         /* Hit complete Cache */
-        dp ("Hit CacheData[%d] stamp=%u dev=%lu inode=%lu offset=%d size=%d flag=CACHE_VALID ref=%d\n",
-            cd->num, cd->stamp, (long)dev, (long)inode, offset, size, cd->ref);
-        p = cache_bin + (cd->num * MEM_ALIGN);
-        break;
-    case CACHE_READ:
-        /* Hit but reading by other operation */
-
-        dp ("Hit CacheData[%d] stamp=%u dev=%lu inode=%lu offset=%d size=%d flag=CACHE_READ ref=%d\n",
-            cd->num, cd->stamp, (long)dev, (long)inode, offset, size, cd->ref);
-
-        /* will be ignored, but should not return NULL */
-        p = cache_bin + (cd->num * MEM_ALIGN); 
-        break;
-    default:
-        break;
+        dp ("Hit CacheData[%d] dev=%lu inode=%lu offset=%d size=%d flag=CACHE_VALID ref=%d\n",
+            cd->num, (long)dev, (long)inode, offset, size, cd->ref);
+    } else {
+        /* Hit but reading by other operation, will be ignored */
+        dp ("Hit CacheData[%d] dev=%lu inode=%lu offset=%d size=%d flag=CACHE_READ ref=%d\n",
+            cd->num, (long)dev, (long)inode, offset, size, cd->ref);
     }
     
     /* IOOper : CacheData */
@@ -428,7 +575,7 @@ sen_cache_read (CacheIOOper *oper, dev_t dev, ino_t inode, size_t offset, size_t
 }
 
 /*
- * count up reference
+ * count down reference
  *
  * @number: CacheData number
  */
@@ -436,29 +583,12 @@ void
 sen_cache_data_unref (int number)
 {
     CacheData *cd = GET_CD_NUM(number);
-    CacheHash *hash = GET_HASH_CD(cd);
-    int c;
-
-    /* 
-     * FIXME: assert cd and hash.
-     */
-    
-unref_retry:
-    SEN_ATOMIC_ADD_EX(&(hash->lock), 1, c);
-    if (c > 0) {
-        // printf ("in unref_retry: hash=%d pid=%d\n",
-        //          hash->num, getpid());
-        SEN_ATOMIC_DEC(&(hash->lock));
-        usleep (1);
-        goto unref_retry;
-    }
-    cd->ref--;
-    SEN_ATOMIC_DEC(&(hash->lock));
+    SEN_ATOMIC_DEC(&cd->ref);
     dp ("CacheData[%d]: unref: %d\n", cd->num, cd->ref);
 }
 
 /*
- * count up reference
+ * count up reference. cd must be referenced already.
  *
  * @number: CacheData number
  */
@@ -466,24 +596,7 @@ void
 sen_cache_data_ref (int number)
 {
     CacheData *cd = GET_CD_NUM(number);
-    CacheHash *hash = GET_HASH_CD(cd);
-    int c;
-    
-    /* 
-     * FIXME: assert cd and hash.
-     */
-
-ref_retry:
-    SEN_ATOMIC_ADD_EX(&(hash->lock), 1, c);
-    if (c > 0) {
-        //printf ("in ref_retry: hash=%d pid=%d\n",
-        // hash->num, getpid());
-        SEN_ATOMIC_DEC(&(hash->lock));
-        usleep (1);
-        goto ref_retry;
-    }
-    cd->ref++;
-    SEN_ATOMIC_DEC(&(hash->lock));
+    SEN_ATOMIC_INC(&cd->ref);
     dp ("CacheData[%d]: ref: %d\n", cd->num, cd->ref); 
 }
 
@@ -500,42 +613,26 @@ void
 sen_cache_mark_invalid (dev_t dev, ino_t inode, off_t offset, size_t size)
 {
     off_t voffset = offset - (offset % MEM_ALIGN);
-    size_t vsize = offset + size;
-    int number, hash_begin, hash_end;
-    CacheData *cd;
-
-    vsize = ((vsize -1) / MEM_ALIGN + 1) *  MEM_ALIGN;
-    vsize = vsize - voffset;
-
-    hash_begin = CALC_HASH(dev, inode, voffset);
-    hash_end   = CALC_HASH(dev, inode, (voffset+vsize-1));
-    if (hash_end < hash_begin)
-        hash_end = hash_end + HASH_SIZE;
-    /*
-     *  h_b  |     |h_e  |h_e+1     // begin | end | end+1
-     *  oooo  oooo  oooo  oooo      // hash
-     *  n       n++     <           // cd number
-     */
-    /*
-     * CACHE_NUM / HASH_SIZE = number of cd in a HASH.
-     */
-    for (number = hash_begin * (CACHE_NUM / HASH_SIZE);
-         number < (hash_end + 1) * (CACHE_NUM / HASH_SIZE);
-         number++) {
-
-        if (number >= CACHE_NUM)
-            cd = GET_CD_NUM(number - CACHE_NUM);
-        else
-            cd = GET_CD_NUM(number);
-        
-        if (cd->offset >= voffset &&
-            cd->offset < voffset + vsize &&
-            cd->inode == inode &&
-            cd->dev == dev) {
-            dp ("MAI CacheData[%d] stamp=%u dev=%lu inode=%lu offset=%d size=%d flag=CACHE_READ ref=%d\n",
-                cd->num, cd->stamp, (long)cd->dev, (long)cd->inode, cd->offset, cd->size, cd->ref);
+    off_t vend = offset + size;
+
+    /* each CacheData holds a block at an aligned offset */
+    for (; voffset < vend; voffset += MEM_ALIGN) {
+        unsigned int hv = calc_hash (dev, inode, voffset), i;
+        int h = CALC_SHARD(hv);
+        CacheHash *hash = GET_HASH_NUM(h);
+        int *index = GET_INDEX(h);
+
+        shard_lock (hash);
+        i = index_probe (index, hv, dev, inode, voffset);
+        if (index[i] >= 0) {
+            CacheData *cd = GET_CD_NUM(index[i]);
+            dp ("MAI CacheData[%d] dev=%lu inode=%lu offset=%d size=%d flag=%d ref=%d\n",
+                cd->num, (long)cd->dev, (long)cd->inode, cd->offset, cd->size, cd->flag, cd->ref);
             cd->flag = CACHE_INVALID;
+            index_remove (index, i);
+            hash->invalidations++;
         }
+        shard_unlock (hash);
     }
 }
 
@@ -551,7 +648,7 @@ sen_cache_dump (void)
     int allofused = 0;
     for (i = 0; i < HASH_SIZE; i++) {
         used = 0;
-        for (l = i * (CACHE_NUM / HASH_SIZE); l < (i +1) * (CACHE_NUM/HASH_SIZE); l++) {
+        for (l = i * SHARD_NUM; l < (i + 1) * SHARD_NUM; l++) {
             CacheData *cd = GET_CD_NUM(l);
             if (cd->flag != CACHE_INVALID)
                 used++;
@@ -559,9 +656,107 @@ sen_cache_dump (void)
                     i, l, (long)cd->dev, (long)cd->inode, cd->offset, cd->flag, cd->ref);
         }
         allofused = allofused + used;
-        printf ("HASH %d: %d/%d used.\n---\n", i, used, CACHE_NUM / HASH_SIZE);
+        printf ("HASH %d: %d/%d used.\n---\n", i, used, SHARD_NUM);
     }
     printf ("ALL: %d/%d used.\n", allofused, CACHE_NUM);
 }
 
+/*
+ * count up the AIO reads.
+ *
+ * @nreads: reads into CacheData.
+ * @nbypasses: reads into the buffers out of the cache.
+ */
+void
+sen_cache_count_aio (int nreads, int nbypasses)
+{
+    CacheHeader *header = GET_HEADER();
+    if (nreads) __sync_fetch_and_add (&header->reads, (uint64_t)nreads);
+    if (nbypasses) __sync_fetch_and_add (&header->bypasses, (uint64_t)nbypasses);
+}
+
+/*
+ * statistics, summed up without the locks.
+ *
+ * @stat: filled with them.
+ */
+void
+sen_cache_stat (CacheStat *stat)
+{
+    int i;
+    memset (stat, 0, sizeof(CacheStat));
+    stat->cache_size = sen_cache_size;
+    stat->cache_block = MEM_ALIGN;
+    stat->nshards = HASH_SIZE;
+    stat->nblocks = CACHE_NUM;
+    for (i = 0; i < HASH_SIZE; i++) {
+        CacheHash *hash = GET_HASH_NUM(i);
+        stat->hits += hash->hits;
+        stat->waits += hash->waits;
+        stat->misses += hash->misses;
+        stat->evictions += hash->evictions;
+        stat->nomems += hash->nomems;
+        stat->invalidations += hash->invalidations;
+        stat->lock_waits += hash->lock_waits;
+        stat->lock_sleeps += hash->lock_sleeps;
+    }
+    stat->reads = GET_HEADER()->reads;
+    stat->bypasses = GET_HEADER()->bypasses;
+    for (i = 0; i < CACHE_NUM; i++) {
+        CacheData *cd = GET_CD_NUM(i);
+        if (cd->flag == CACHE_VALID) stat->nvalid++;
+        if (cd->flag == CACHE_READ) stat->nreading++;
+        if (cd->ref > 0) stat->nreferenced++;
+    }
+}
+
+typedef struct {
+    dev_t dev;
+    ino_t inode;
+    int flag;
+} CacheFile;
+
+static int
+cache_file_cmp (const void *a, const void *b)
+{
+    const CacheFile *x = a, *y = b;
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    if (x->inode != y->inode) return x->inode < y->inode ? -1 : 1;
+    return 0;
+}
+
+/*
+ * the blocks in the cache by file, without the locks.
+ *
+ * @func: called for each file, in the order of dev and inode.
+ * @arg: passed to func.
+ *
+ * return: 0 or -1 (no memory)
+ */
+int
+sen_cache_residency (CacheResidencyFunc func, void *arg)
+{
+    int i, n = 0;
+    CacheFile *files, *f, *e;
+    if (!(files = malloc (sizeof(CacheFile) * CACHE_NUM))) return -1;
+    for (i = 0; i < CACHE_NUM; i++) {
+        CacheData *cd = GET_CD_NUM(i);
+        if (cd->flag == CACHE_INVALID) continue;
+        files[n].dev = cd->dev;
+        files[n].inode = cd->inode;
+        files[n].flag = cd->flag;
+        n++;
+    }
+    qsort (files, n, sizeof(CacheFile), cache_file_cmp);
+    for (f = files; f < files + n; f = e) {
+        unsigned int nvalid = 0, nreading = 0;
+        for (e = f; e < files + n && !cache_file_cmp (e, f); e++) {
+            if (e->flag == CACHE_VALID) nvalid++; else nreading++;
+        }
+        func (f->dev, f->inode, nvalid, nreading, arg);
+    }
+    free (files);
+    return 0;
+}
+
 #endif /* USE_AIO */
@@ -24,6 +24,14 @@
 extern int sen_aio_enabled;
 extern int sen_debug_print;
 extern int sen_cache_block;
+extern int sen_aio_backend; /* given by SEN_AIO_BACKEND */
+
+/* backends of sen_io_win_mapv */
+enum {
+    sen_aio_uring, /* io_uring, or sen_aio_posix if it is not available */
+    sen_aio_posix, /* lio_listio */
+    sen_aio_pread  /* pread, one by one */
+};
 
 #include <aio.h>
 
@@ -32,7 +40,7 @@ typedef struct _CacheData CacheData;
 #pragma pack(1)
 struct _CacheData {
     int flag; /* status */
-    unsigned int stamp; /* global counter stamp */
+    int used; /* hit since the clock hand passed it */
 
     /* key */
     dev_t dev;
@@ -43,7 +51,6 @@ struct _CacheData {
 
     /* number */
     unsigned int num;
-    int next; /* -1 : no more next */
 
     /* number of references */
     int ref;
@@ -54,8 +61,7 @@ struct _CacheData {
 enum {
     CACHE_INVALID, /* empty, unused  */
     CACHE_VALID,   /* data in */
-    CACHE_READ,    /* reading */
-    CACHE_LOCKED   /* locked */
+    CACHE_READ     /* reading */
 };
 
 /* Cache IO Operation */
@@ -84,6 +90,42 @@ sen_cache_mark_invalid (dev_t dev, ino_t inode, off_t offset, size_t size);
 /* used for debug */
 void sen_cache_dump (void);
 
+/* statistics, summed up over the shards */
+typedef struct _CacheStat CacheStat;
+struct _CacheStat {
+    unsigned int cache_size;  /* MB */
+    unsigned int cache_block;
+    unsigned int nshards;
+    unsigned int nblocks;     /* number of CacheData */
+    unsigned int nvalid;      /* CacheData in CACHE_VALID */
+    unsigned int nreading;    /* CacheData in CACHE_READ */
+    unsigned int nreferenced; /* CacheData referenced now */
+    uint64_t hits;            /* found in CACHE_VALID */
+    uint64_t waits;           /* found in CACHE_READ, and waited for */
+    uint64_t misses;
+    uint64_t evictions;       /* misses which expired a block */
+    uint64_t nomems;          /* misses with no room in the shard */
+    uint64_t invalidations;
+    uint64_t lock_waits;      /* contended shard locks */
+    uint64_t lock_sleeps;     /* sleeps on contended shard locks */
+    uint64_t reads;           /* AIO reads issued into the cache */
+    uint64_t bypasses;        /* AIO reads issued outside of the cache */
+};
+
+/* attach to the shm of a running cache without creating it.
+   return: 0 or -1 (no cache of the size given by SEN_CACHE_* exists) */
+int sen_cache_attach (void);
+
+void sen_cache_stat (CacheStat *stat);
+
+/* calls func for each file which has blocks in the cache. */
+typedef void (*CacheResidencyFunc) (dev_t dev, ino_t inode, unsigned int nvalid,
+                                    unsigned int nreading, void *arg);
+int sen_cache_residency (CacheResidencyFunc func, void *arg);
+
+/* counts the AIO reads issued by sen_io_win_mapv. */
+void sen_cache_count_aio (int nreads, int nbypasses);
+
 #include <stdarg.h>
 
 inline static void
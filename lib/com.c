@@ -115,7 +115,7 @@ sen_com_fin(void)
 sen_rc
 sen_com_event_init(sen_com_event *ev, int max_nevents, int data_size)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_rc rc = sen_memory_exhausted;
   ev->max_nevents = max_nevents;
   if ((ev->set = sen_set_open(sizeof(sen_sock), data_size, 0))) {
@@ -151,7 +151,7 @@ exit :
 sen_rc
 sen_com_event_fin(sen_com_event *ev)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (ev->set) { sen_set_close(ev->set); }
 #ifndef USE_SELECT
   if (ev->events) { SEN_FREE(ev->events); }
@@ -478,7 +478,7 @@ exit :
 sen_com_sqtp *
 sen_com_sqtp_copen(sen_com_event *ev, const char *dest, int port)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_sock fd;
   sen_com_sqtp *cs = NULL;
   struct hostent *he;
@@ -568,7 +568,7 @@ sen_com_sqtp_acceptor(sen_com_event *ev, sen_com *c)
 sen_com_sqtp *
 sen_com_sqtp_sopen(sen_com_event *ev, int port, sen_com_callback *func)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_sock lfd;
   sen_com_sqtp *cs = NULL;
   struct sockaddr_in addr;
@@ -629,7 +629,7 @@ exit :
 sen_rc
 sen_com_sqtp_close(sen_com_event *ev, sen_com_sqtp *cs)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_sock fd = cs->com.fd;
   sen_rbuf_fin(&cs->msg);
   if (ev) {
@@ -24,9 +24,26 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <time.h>
+#include "cache.h"
 
 sen_ctx sen_gctx;
 
+#ifdef HAVE_PTHREAD_H
+static sen_thread_key ctx_key;
+static int ctx_key_created = 0;
+
+/* called when a thread exits with a ctx of its own current. */
+static void
+ctx_key_destroy(void *value)
+{
+  ((sen_ctx *)value)->used = 0;
+}
+#endif /* HAVE_PTHREAD_H */
+
+/* guards select_ctxs and select_busy of the ctxs, since a ctx such as
+   sen_gctx may be current on several threads. */
+static sen_mutex select_ctxs_lock;
+
 /* fixme by 2038 */
 
 sen_rc
@@ -127,6 +144,141 @@ char *sen_fmalloc_file = NULL;
 int sen_fmalloc_line = 0;
 #endif /* USE_FAIL_MALLOC */
 
+static int alloc_count = 0;
+
+/* allocations through a local ctx are counted in the ctx without locking,
+   and folded into alloc_count when the ctx is finished. */
+inline static void
+alloc_count_add(sen_ctx *ctx, int i)
+{
+  if (ctx && ctx != &sen_gctx) {
+    ctx->alloc_count += i;
+  } else {
+#ifdef SEN_ATOMIC_ADD_EX
+    uint32_t r;
+    SEN_ATOMIC_ADD_EX(&alloc_count, i, r);
+#else /* SEN_ATOMIC_ADD_EX */
+    alloc_count += i;
+#endif /* SEN_ATOMIC_ADD_EX */
+  }
+}
+
+inline static void
+alloc_count_fold(sen_ctx *ctx)
+{
+  if (ctx != &sen_gctx) {
+    alloc_count_add(&sen_gctx, ctx->alloc_count);
+    ctx->alloc_count = 0;
+  }
+}
+
+/* arena */
+
+#define ARENA_CHUNK_SIZE   0x10000
+#define ARENA_MAX_SPARES   16
+#define ARENA_ALIGN(s)     (((s) + 15) & ~((size_t)15))
+#define ARENA_HEADER_SIZE  ARENA_ALIGN(sizeof(sen_arena_chunk))
+
+struct _sen_arena_chunk {
+  sen_arena_chunk *next;
+  size_t size;
+  size_t used;
+};
+
+#define ARENA_ALLOCATED(ctx) ((ctx) && (ctx) != &sen_gctx)
+
+inline static sen_arena_chunk *
+arena_chunk_open(sen_ctx *ctx, size_t size, const char* file, int line)
+{
+  sen_arena_chunk *c;
+  if (size <= ARENA_CHUNK_SIZE - ARENA_HEADER_SIZE && ctx->arena_spares) {
+    c = ctx->arena_spares;
+    ctx->arena_spares = c->next;
+    ctx->arena_nspares--;
+  } else {
+    size_t s = ARENA_HEADER_SIZE + size;
+    if (s < ARENA_CHUNK_SIZE) { s = ARENA_CHUNK_SIZE; }
+    if (!(c = sen_malloc(ctx, s, file, line))) { return NULL; }
+    c->size = s;
+  }
+  c->used = ARENA_HEADER_SIZE;
+  c->next = ctx->arena;
+  ctx->arena = c;
+  return c;
+}
+
+inline static void
+arena_chunk_close(sen_ctx *ctx, sen_arena_chunk *c)
+{
+  if (c->size == ARENA_CHUNK_SIZE && ctx->arena_nspares < ARENA_MAX_SPARES) {
+    c->next = ctx->arena_spares;
+    ctx->arena_spares = c;
+    ctx->arena_nspares++;
+  } else {
+    SEN_FREE(c);
+  }
+}
+
+void *
+sen_arena_alloc(sen_ctx *ctx, size_t size, const char* file, int line)
+{
+  void *res;
+  sen_arena_chunk *c;
+  if (!ARENA_ALLOCATED(ctx)) { return sen_malloc(ctx, size, file, line); }
+  size = ARENA_ALIGN(size);
+  if (!(c = ctx->arena) || c->size - c->used < size) {
+    if (!(c = arena_chunk_open(ctx, size, file, line))) { return NULL; }
+  }
+  res = (byte *)c + c->used;
+  c->used += size;
+  return res;
+}
+
+void
+sen_arena_free(sen_ctx *ctx, void *ptr, const char* file, int line)
+{
+  if (!ARENA_ALLOCATED(ctx)) { sen_free(ctx, ptr, file, line); }
+}
+
+void
+sen_arena_save(sen_ctx *ctx, sen_arena_mark *mark)
+{
+  if (ARENA_ALLOCATED(ctx) && (mark->chunk = ctx->arena)) {
+    mark->used = ctx->arena->used;
+  } else {
+    mark->chunk = NULL;
+    mark->used = 0;
+  }
+}
+
+/* releases everything taken from the arena since sen_arena_save(). */
+void
+sen_arena_restore(sen_ctx *ctx, sen_arena_mark *mark)
+{
+  sen_arena_chunk *c;
+  if (!ARENA_ALLOCATED(ctx)) { return; }
+  while ((c = ctx->arena) && c != mark->chunk) {
+    ctx->arena = c->next;
+    arena_chunk_close(ctx, c);
+  }
+  if (c) { c->used = mark->used; }
+}
+
+inline static void
+arena_fin(sen_ctx *ctx)
+{
+  sen_arena_chunk *c;
+  while ((c = ctx->arena)) {
+    ctx->arena = c->next;
+    SEN_FREE(c);
+  }
+  while ((c = ctx->arena_spares)) {
+    ctx->arena_spares = c->next;
+    SEN_FREE(c);
+  }
+  ctx->arena_nspares = 0;
+}
+
 void
 sen_ctx_init(sen_ctx *ctx)
 {
@@ -156,14 +308,35 @@ sen_ctx_init(sen_ctx *ctx)
   ctx->objects = NULL;
   ctx->symbols = NULL;
   ctx->com = NULL;
+  ctx->alloc_count = 0;
+  ctx->arena = NULL;
+  ctx->arena_spares = NULL;
+  ctx->arena_nspares = 0;
+  ctx->select_nthreads = 1;
+  ctx->select_ctxs = NULL;
+  ctx->select_busy = 0;
+  ctx->used = 0;
   sen_rbuf_init(&ctx->outbuf, 0);
   sen_rbuf_init(&ctx->subbuf, 0);
 }
 
+static void
+select_ctxs_close(sen_ctx *ctx)
+{
+  int k;
+  if (!ctx->select_ctxs) { return; }
+  for (k = 0; k < ctx->select_nthreads - 1; k++) {
+    if (ctx->select_ctxs[k]) { sen_ctx_close(ctx->select_ctxs[k]); }
+  }
+  SEN_GFREE(ctx->select_ctxs);
+  ctx->select_ctxs = NULL;
+}
+
 sen_rc
 sen_ctx_fin(sen_ctx *ctx)
 {
   sen_rc rc = sen_success;
+  select_ctxs_close(ctx);
   if (ctx->objects) {
     sen_obj *o;
     sen_set_cursor *sc;
@@ -191,6 +364,8 @@ sen_ctx_fin(sen_ctx *ctx)
   }
   rc = sen_rbuf_fin(&ctx->outbuf);
   rc = sen_rbuf_fin(&ctx->subbuf);
+  arena_fin(ctx);
+  alloc_count_fold(ctx);
   return rc;
 }
 
@@ -245,8 +420,33 @@ sen_init(void)
   sen_rc rc;
   sen_ql_init_const();
   sen_ctx_init(&sen_gctx);
+  MUTEX_INIT(select_ctxs_lock);
+#ifdef HAVE_PTHREAD_H
+  if (!ctx_key_created && !THREAD_KEY_CREATE(&ctx_key, ctx_key_destroy)) { ctx_key_created = 1; }
+#endif /* HAVE_PTHREAD_H */
   sen_gctx.encoding = sen_strtoenc(SENNA_DEFAULT_ENCODING);
   expand_stack();
+  if (getenv("SEN_MAP_POPULATE")) {
+    if (atoi(getenv("SEN_MAP_POPULATE"))) {
+      sen_io_map_options |= SEN_IO_POPULATE;
+    } else {
+      sen_io_map_options &= ~SEN_IO_POPULATE;
+    }
+  }
+  if (getenv("SEN_MAP_HUGEPAGE")) {
+    if (atoi(getenv("SEN_MAP_HUGEPAGE"))) {
+      sen_io_map_options |= SEN_IO_HUGEPAGE;
+    } else {
+      sen_io_map_options &= ~SEN_IO_HUGEPAGE;
+    }
+  }
+  if (getenv("SEN_SYM_CACHE")) {
+    sen_sym_cache_max = (uint32_t) atoi(getenv("SEN_SYM_CACHE"));
+  }
+  if (getenv("SEN_HOT_PROFILE")) {
+    sen_index_profile_interval = (unsigned int) atoi(getenv("SEN_HOT_PROFILE"));
+  }
+  sen_index_profile_init();
 #ifdef USE_AIO
   if (getenv("SEN_DEBUG_PRINT")) {
     sen_debug_print = atoi(getenv("SEN_DEBUG_PRINT"));
@@ -261,6 +461,7 @@ sen_init(void)
   if (sen_aio_enabled) {
     SEN_LOG(sen_log_notice, "AIO and DIO enabled");
     sen_cache_open();
+    sen_io_aio_init();
   }
 #endif /* USE_AIO */
 #ifdef USE_FAIL_MALLOC
@@ -299,12 +500,19 @@ sen_init(void)
   return rc;
 }
 
-static int alloc_count = 0;
-
 sen_rc
 sen_fin(void)
 {
   sen_ctx_fin(&sen_gctx);
+#ifdef USE_AIO
+  if (sen_aio_enabled) { sen_io_aio_fin(); }
+#endif /* USE_AIO */
+#ifdef HAVE_PTHREAD_H
+  if (ctx_key_created) {
+    THREAD_KEY_DELETE(ctx_key);
+    ctx_key_created = 0;
+  }
+#endif /* HAVE_PTHREAD_H */
   sen_lex_fin();
   sen_str_fin();
   sen_com_fin();
@@ -347,14 +555,54 @@ sen_ctx_connect(const char *host, int port, int flags)
   return ctx;
 }
 
+/* a ctx current on another thread is not closed, since the thread
+   would go on using it. */
 sen_rc
 sen_ctx_close(sen_ctx *ctx)
 {
-  sen_rc rc = sen_ctx_fin(ctx);
+  sen_rc rc;
+  if (sen_ctx_current() == ctx) {
+    sen_ctx_use(NULL);
+  } else if (ctx->used) {
+    SEN_LOG(sen_log_warning, "sen_ctx_close: ctx is current on another thread");
+    return sen_invalid_argument;
+  }
+  rc = sen_ctx_fin(ctx);
   SEN_GFREE(ctx);
   return rc;
 }
 
+/* returns the ctx installed on the calling thread by sen_ctx_use(),
+   or sen_gctx if none. */
+sen_ctx *
+sen_ctx_current(void)
+{
+#ifdef HAVE_PTHREAD_H
+  sen_ctx *ctx;
+  if (ctx_key_created && (ctx = THREAD_GETSPECIFIC(ctx_key))) { return ctx; }
+#endif /* HAVE_PTHREAD_H */
+  return &sen_gctx;
+}
+
+sen_rc
+sen_ctx_use(sen_ctx *ctx)
+{
+#ifdef HAVE_PTHREAD_H
+  sen_ctx *prev;
+#endif /* HAVE_PTHREAD_H */
+  if (ctx == &sen_gctx) { ctx = NULL; }
+#ifdef HAVE_PTHREAD_H
+  if (!ctx_key_created) { return sen_invalid_argument; }
+  prev = sen_ctx_current();
+  if (THREAD_SETSPECIFIC(ctx_key, ctx)) { return sen_other_error; }
+  if (prev != &sen_gctx) { prev->used = 0; }
+  if (ctx) { ctx->used = 1; }
+  return sen_success;
+#else /* HAVE_PTHREAD_H */
+  return ctx ? sen_other_error : sen_success;
+#endif /* HAVE_PTHREAD_H */
+}
+
 sen_rc
 sen_ctx_send(sen_ctx *ctx, char *str, unsigned int str_len, int flags)
 {
@@ -376,7 +624,10 @@ sen_ctx_send(sen_ctx *ctx, char *str, unsigned int str_len, int flags)
     goto exit;
   } else {
     if (ctx->objects) {
+      sen_ctx *prev = sen_ctx_current();
+      sen_ctx_use(ctx);
       sen_ql_feed(ctx, str, str_len, flags);
+      sen_ctx_use(prev);
       if (ctx->stat == SEN_QL_QUITTING) { ctx->stat = SEN_CTX_QUIT; }
       if (!ERRP(ctx, SEN_CRIT)) {
         if (!(flags & SEN_CTX_QUIET) && ctx->output) {
@@ -468,6 +719,67 @@ sen_ctx_recv_handler_set(sen_ctx *ctx, void (*func)(sen_ctx *, int, void *), voi
   ctx->data.ptr = func_arg;
 }
 
+/* the ctxs of the workers are opened by the first parallel select, and
+   kept for the later ones until ctx is closed. they can't be replaced
+   while a select on another thread uses them. */
+sen_rc
+sen_ctx_select_threads_set(sen_ctx *ctx, int nthreads)
+{
+  sen_rc rc = sen_success;
+  sen_ctx **ctxs = NULL;
+  if (!ctx) { ctx = sen_ctx_current(); }
+  if (nthreads < 1) { return sen_invalid_argument; }
+  if (nthreads > 1) {
+    if (!(ctxs = SEN_GMALLOCN(sen_ctx *, nthreads - 1))) { return sen_memory_exhausted; }
+    memset(ctxs, 0, sizeof(sen_ctx *) * (nthreads - 1));
+  }
+  MUTEX_LOCK(select_ctxs_lock);
+  if (ctx->select_busy) {
+    rc = sen_other_error;
+  } else if (nthreads != ctx->select_nthreads) {
+    select_ctxs_close(ctx);
+    ctx->select_ctxs = ctxs;
+    ctx->select_nthreads = nthreads;
+    ctxs = NULL;
+  }
+  MUTEX_UNLOCK(select_ctxs_lock);
+  if (ctxs) { SEN_GFREE(ctxs); }
+  return rc;
+}
+
+/* returns the ctxs of the workers of a parallel select on ctx, which are
+   opened if not yet, and puts the number of the threads to *nthreads.
+   returns NULL if they are used by a select on another thread, since a
+   ctx can't be used by two threads at once, or can't be opened. they are
+   used until sen_ctx_select_ctxs_put is called. */
+sen_ctx **
+sen_ctx_select_ctxs_get(sen_ctx *ctx, int *nthreads)
+{
+  int k;
+  sen_ctx **ctxs = NULL;
+  MUTEX_LOCK(select_ctxs_lock);
+  *nthreads = ctx->select_nthreads;
+  if (*nthreads > 1 && !ctx->select_busy) {
+    for (k = 0; k < *nthreads - 1; k++) {
+      if (!ctx->select_ctxs[k] && !(ctx->select_ctxs[k] = sen_ctx_open(NULL, 0))) { break; }
+    }
+    if (k == *nthreads - 1) {
+      ctx->select_busy = 1;
+      ctxs = ctx->select_ctxs;
+    }
+  }
+  MUTEX_UNLOCK(select_ctxs_lock);
+  return ctxs;
+}
+
+void
+sen_ctx_select_ctxs_put(sen_ctx *ctx)
+{
+  MUTEX_LOCK(select_ctxs_lock);
+  ctx->select_busy = 0;
+  MUTEX_UNLOCK(select_ctxs_lock);
+}
+
 sen_rc
 sen_ctx_info_get(sen_ctx *ctx, sen_ctx_info *info)
 {
@@ -528,7 +840,7 @@ sen_malloc(sen_ctx *ctx, size_t size, const char* file, int line)
 {
   void *res = malloc(size);
   if (res) {
-    alloc_count++;
+    alloc_count_add(ctx, 1);
   } else {
     sen_index_expire();
     if (!(res = malloc(size))) {
@@ -543,7 +855,7 @@ sen_calloc(sen_ctx *ctx, size_t size, const char* file, int line)
 {
   void *res = calloc(size, 1);
   if (res) {
-    alloc_count++;
+    alloc_count_add(ctx, 1);
   } else {
     sen_index_expire();
     if (!(res = calloc(size, 1))) {
@@ -558,7 +870,7 @@ sen_free(sen_ctx *ctx, void *ptr, const char* file, int line)
 {
   free(ptr);
   if (ptr) {
-    alloc_count--;
+    alloc_count_add(ctx, -1);
   } else {
     SEN_LOG(sen_log_alert, "free fail (%p) (%s:%d) <%d>", ptr, file, line, alloc_count);
   }
@@ -569,14 +881,14 @@ sen_realloc(sen_ctx *ctx, void *ptr, size_t size, const char* file, int line)
 {
   void *res;
   if (!size) {
-    alloc_count--;
+    alloc_count_add(ctx, -1);
 #if defined __FreeBSD__
     free(ptr);
     return NULL;
 #endif /* __FreeBSD__ */
   }
   res = realloc(ptr, size);
-  if (!ptr && res) { alloc_count++; }
+  if (!ptr && res) { alloc_count_add(ctx, 1); }
   if (size && !res) {
     sen_index_expire();
     if (!(res = realloc(ptr, size))) {
@@ -595,7 +907,7 @@ sen_strdup(sen_ctx *ctx, const char *s, const char* file, int line)
 {
   char *res = strdup(s);
   if (res) {
-    alloc_count++;
+    alloc_count_add(ctx, 1);
   } else  {
     sen_index_expire();
     if (!(res = strdup(s))) {
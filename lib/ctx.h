@@ -110,6 +110,8 @@ enum {
 #define SEN_MALLOCN(t,n) ((t *)(SEN_MALLOC(sizeof(t) * (n))))
 #define SEN_GFREE(p) sen_free(&sen_gctx,p,__FILE__,__LINE__)
 #define SEN_GMALLOCN(t,n) ((t *)(SEN_GMALLOC(sizeof(t) * (n))))
+#define SEN_AMALLOC(s) sen_arena_alloc(ctx,s,__FILE__,__LINE__)
+#define SEN_AFREE(p) sen_arena_free(ctx,p,__FILE__,__LINE__)
 
 #ifdef DEBUG
 #define SEN_ASSERT(s) sen_assert((s),__FILE__,__LINE__,__FUNCTION__)
@@ -130,10 +132,32 @@ void *sen_realloc(sen_ctx *ctx, void *ptr, size_t size, const char* file, int li
 char *sen_strdup(sen_ctx *ctx, const char *s, const char* file, int line);
 void sen_free(sen_ctx *ctx, void *ptr, const char* file, int line);
 
+/* arena for the transient objects of a query. objects taken by
+   SEN_AMALLOC are released together by sen_arena_restore(), SEN_AFREE
+   is a no-op for them. sen_gctx is shared by threads, so it has no
+   arena and SEN_AMALLOC/SEN_AFREE fall back on SEN_MALLOC/SEN_FREE. */
+
+typedef struct _sen_arena_chunk sen_arena_chunk;
+
+typedef struct {
+  sen_arena_chunk *chunk;
+  size_t used;
+} sen_arena_mark;
+
+void *sen_arena_alloc(sen_ctx *ctx, size_t size, const char* file, int line);
+void sen_arena_free(sen_ctx *ctx, void *ptr, const char* file, int line);
+void sen_arena_save(sen_ctx *ctx, sen_arena_mark *mark);
+void sen_arena_restore(sen_ctx *ctx, sen_arena_mark *mark);
+
 void sen_assert(int cond, const char* file, int line, const char* func);
 
 void sen_index_expire(void);
 
+/* the interval in seconds of the hot segment profiles of the indexes
+   opened. 0, the default, if they are not profiled */
+extern unsigned int sen_index_profile_interval;
+void sen_index_profile_init(void);
+
 /**** sen_obj ****/
 
 typedef struct {
@@ -256,10 +280,26 @@ struct _sen_ctx {
     uint32_t u32;
     uint64_t u64;
   } data;
+
+  int alloc_count;     /* allocations not yet folded into the global count */
+
+  sen_arena_chunk *arena;        /* chunk in use, linked to the older ones */
+  sen_arena_chunk *arena_spares; /* released chunks kept for reuse */
+  int arena_nspares;
+
+  int select_nthreads;           /* threads a sen_index_select may use */
+  sen_ctx **select_ctxs;         /* ctxs of the select_nthreads - 1 workers */
+  int select_busy;               /* select_ctxs are used by a select */
+
+  int used;                      /* current on a thread by sen_ctx_use */
 };
 
 extern sen_ctx sen_gctx;
 
+sen_ctx *sen_ctx_current(void);
+sen_ctx **sen_ctx_select_ctxs_get(sen_ctx *ctx, int *nthreads);
+void sen_ctx_select_ctxs_put(sen_ctx *ctx);
+
 sen_obj *sen_get(const char *key);
 sen_obj *sen_at(const char *key);
 sen_rc sen_del(const char *key);
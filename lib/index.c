@@ -22,6 +22,7 @@
 #include "senna_in.h"
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "sym.h"
 #include "inv.h"
 #include "str.h"
@@ -49,12 +50,12 @@ typedef struct {
 static inline cursor_heap *
 cursor_heap_open(int max)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
-  cursor_heap *h = SEN_MALLOC(sizeof(cursor_heap));
+  sen_ctx *ctx = sen_ctx_current();
+  cursor_heap *h = SEN_AMALLOC(sizeof(cursor_heap));
   if (!h) { return NULL; }
-  h->bins = SEN_MALLOC(sizeof(sen_inv_cursor *) * max);
+  h->bins = SEN_AMALLOC(sizeof(sen_inv_cursor *) * max);
   if (!h->bins) {
-    SEN_FREE(h);
+    SEN_AFREE(h);
     return NULL;
   }
   h->n_entries = 0;
@@ -66,13 +67,15 @@ static inline sen_rc
 cursor_heap_push(cursor_heap *h, sen_inv *inv, sen_id tid, uint32_t offset2)
 {
   int n, n2;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_inv_cursor *c, *c2;
   if (h->n_entries >= h->n_bins) {
     int max = h->n_bins * 2;
-    sen_inv_cursor **bins = SEN_REALLOC(h->bins, sizeof(sen_inv_cursor *) * max);
+    sen_inv_cursor **bins = SEN_AMALLOC(sizeof(sen_inv_cursor *) * max);
     SEN_LOG(sen_log_debug, "expanded cursor_heap to %d,%p", max, bins);
     if (!bins) { return sen_memory_exhausted; }
+    memcpy(bins, h->bins, sizeof(sen_inv_cursor *) * h->n_entries);
+    SEN_AFREE(h->bins);
     h->n_bins = max;
     h->bins = bins;
   }
@@ -86,7 +89,8 @@ cursor_heap_push(cursor_heap *h, sen_inv *inv, sen_id tid, uint32_t offset2)
   } else
 #endif /* USE_AIO */
   {
-    if (!(c = sen_inv_cursor_open(inv, tid, 1))) {
+    if (!(c = sen_inv_cursor_open(inv, tid,
+                                  SEN_INV_CURSOR_WITH_POS|SEN_INV_CURSOR_ARENA))) {
       SEN_LOG(sen_log_error, "cursor open failed");
       return sen_internal_error;
     }
@@ -113,6 +117,8 @@ cursor_heap_push(cursor_heap *h, sen_inv *inv, sen_id tid, uint32_t offset2)
   return sen_success;
 }
 
+/* the chunks of the cursors pushed under AIO have to be read by
+   sen_inv_cursor_openv2 before this. */
 static inline sen_rc
 cursor_heap_push2(cursor_heap *h)
 {
@@ -122,8 +128,6 @@ cursor_heap_push2(cursor_heap *h)
     int i, j, n, n2;
     sen_inv_cursor *c, *c2;
     if (h && h->n_entries) {
-      rc = sen_inv_cursor_openv2(h->bins, h->n_entries);
-      SEN_ASSERT(rc);
       for (i = 0, j = 0; i < h->n_entries; i++) {
         c = h->bins[i];
         if (sen_inv_cursor_next(c)) {
@@ -207,6 +211,23 @@ cursor_heap_pop(cursor_heap *h)
   }
 }
 
+static inline void
+cursor_heap_skip(cursor_heap *h, sen_id rid, uint32_t sid)
+{
+  if (h->n_entries) {
+    sen_inv_cursor *c = h->bins[0];
+    if (sen_inv_cursor_skip(c, rid, sid)) {
+      sen_inv_cursor_close(c);
+      h->bins[0] = h->bins[--h->n_entries];
+    } else if (sen_inv_cursor_next_pos(c)) {
+      SEN_LOG(sen_log_error, "invalid inv_cursor e");
+      sen_inv_cursor_close(c);
+      h->bins[0] = h->bins[--h->n_entries];
+    }
+    if (h->n_entries > 1) { cursor_heap_recalc_min(h); }
+  }
+}
+
 static inline void
 cursor_heap_pop_pos(cursor_heap *h)
 {
@@ -230,11 +251,11 @@ static inline void
 cursor_heap_close(cursor_heap *h)
 {
   int i;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!h) { return; }
   for (i = h->n_entries; i--;) { sen_inv_cursor_close(h->bins[i]); }
-  SEN_FREE(h->bins);
-  SEN_FREE(h);
+  SEN_AFREE(h->bins);
+  SEN_AFREE(h);
 }
 
 /* token_info */
@@ -303,23 +324,23 @@ token_info_expand_both(sen_index *i, const char *key, token_info *ti)
 inline static sen_rc
 token_info_close(token_info *ti)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   cursor_heap_close(ti->cursors);
-  SEN_FREE(ti);
+  SEN_AFREE(ti);
   return sen_success;
 }
 
 inline static token_info *
 token_info_open(sen_index *i, const char *key, uint32_t offset, int mode)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   int s = 0;
   sen_set *h;
   token_info *ti;
   sen_id tid;
   sen_id *tp;
   if (!key) { return NULL; }
-  if (!(ti = SEN_MALLOC(sizeof(token_info)))) { return NULL; }
+  if (!(ti = SEN_AMALLOC(sizeof(token_info)))) { return NULL; }
   ti->cursors = NULL;
   ti->size = 0;
   ti->ntoken = 0;
@@ -372,22 +393,46 @@ token_info_open(sen_index *i, const char *key, uint32_t offset, int mode)
     }
     break;
   }
-  if (cursor_heap_push2(ti->cursors)) {
+  if (!ti->cursors) {
     token_info_close(ti);
     return NULL;
   }
-  {
-    sen_inv_cursor *ic;
-    if (ti->cursors && (ic = cursor_heap_min(ti->cursors))) {
-      sen_inv_posting *p = ic->post;
-      ti->pos = p->pos - ti->offset;
-      ti->p = p;
-    } else {
-      token_info_close(ti);
-      ti = NULL;
+  return ti;
+}
+
+/* token_info_open only opens the cursors. the first postings of them are
+   read here, after all the tokens of a query are opened. */
+inline static sen_rc
+token_info_start(token_info **tis, uint32_t n)
+{
+  token_info *ti, **tip, **tie = tis + n;
+  sen_inv_cursor *ic;
+#ifdef USE_AIO
+  if (sen_aio_enabled) {
+    /* the chunks of all the tokens are read by one sen_io_win_mapv */
+    int nc = 0;
+    sen_ctx *ctx = sen_ctx_current();
+    sen_inv_cursor **cs, **cp;
+    for (tip = tis; tip < tie; tip++) { nc += (*tip)->cursors->n_entries; }
+    if (nc) {
+      if (!(cs = SEN_AMALLOC(sizeof(sen_inv_cursor *) * nc))) { return sen_memory_exhausted; }
+      for (cp = cs, tip = tis; tip < tie; tip++) {
+        memcpy(cp, (*tip)->cursors->bins, sizeof(sen_inv_cursor *) * (*tip)->cursors->n_entries);
+        cp += (*tip)->cursors->n_entries;
+      }
+      sen_inv_cursor_openv2(cs, nc);
+      SEN_AFREE(cs);
     }
   }
-  return ti;
+#endif /* USE_AIO */
+  for (tip = tis; tip < tie; tip++) {
+    ti = *tip;
+    if (cursor_heap_push2(ti->cursors)) { return sen_internal_error; }
+    if (!(ic = cursor_heap_min(ti->cursors))) { return sen_internal_error; }
+    ti->p = ic->post;
+    ti->pos = ti->p->pos - ti->offset;
+  }
+  return sen_success;
 }
 
 static inline sen_rc
@@ -399,7 +444,7 @@ token_info_skip(token_info *ti, uint32_t rid, uint32_t sid)
     if (!(c = cursor_heap_min(ti->cursors))) { return sen_internal_error; }
     p = c->post;
     if (p->rid > rid || (p->rid == rid && p->sid >= sid)) { break; }
-    cursor_heap_pop(ti->cursors);
+    cursor_heap_skip(ti->cursors, rid, sid);
   }
   // sen_log("r=%d s=%d pr=%d ps=%d", rid, sid, p->rid, p->sid);
   ti->pos = p->pos - ti->offset;
@@ -432,19 +477,54 @@ token_compare(const void *a, const void *b)
   return t1->size - t2->size;
 }
 
+typedef struct {
+  const char *key;
+  sen_id tid;       /* SEN_SYM_NIL if key isn't from the lexicon */
+  uint32_t offset;
+  int mode;
+} token_spec;
+
+/* lets the chunks of the tokens be read in parallel, while the cursors are
+   opened one by one. */
+inline static void
+token_info_prefetch(sen_index *i, token_spec *specs, token_spec *se)
+{
+  token_spec *sp;
+#ifdef USE_AIO
+  /* token_info_start reads them at once */
+  if (sen_aio_enabled) { return; }
+#endif /* USE_AIO */
+  if (se - specs < 2) { return; }
+  for (sp = specs; sp < se; sp++) {
+    if (sp->mode == EX_NONE && sp->tid) { sen_inv_prefetch(i->inv, sp->tid); }
+  }
+}
+
+#define TOKEN_SPEC_ADD(k,t,o,m) do {\
+  se->key = (k);\
+  se->tid = (t);\
+  se->offset = (o);\
+  se->mode = (m);\
+  se++;\
+} while (0)
+
 inline static sen_rc
 token_info_build(sen_index *i, const char *string, size_t string_len, token_info **tis, uint32_t *n,
                  sen_sel_mode mode)
 {
+  sen_ctx *ctx = sen_ctx_current();
   token_info *ti;
+  token_spec *specs, *sp, *se;
   sen_rc rc = sen_internal_error;
   sen_lex *lex = sen_lex_open(i->lexicon, string, string_len, 0);
   if (!lex) { return sen_memory_exhausted; }
+  if (!(specs = SEN_AMALLOC(sizeof(token_spec) * string_len * 2))) {
+    rc = sen_memory_exhausted;
+    goto exit;
+  }
+  se = specs;
   if (mode == sen_sel_unsplit) {
-    if ((ti = token_info_open(i, (char *)lex->orig, 0, EX_BOTH))) {
-      tis[(*n)++] = ti;
-      rc = sen_success;
-    }
+    TOKEN_SPEC_ADD((char *)lex->orig, SEN_SYM_NIL, 0, EX_BOTH);
   } else {
     sen_id tid;
     int ef;
@@ -466,40 +546,42 @@ token_info_build(sen_index *i, const char *string, size_t string_len, token_info
     if (lex->force_prefix) { ef |= EX_PREFIX; }
     switch (lex->status) {
     case sen_lex_doing :
-      ti = token_info_open(i, _sen_sym_key(i->lexicon, tid), lex->pos, ef & EX_SUFFIX);
+      TOKEN_SPEC_ADD(_sen_sym_key(i->lexicon, tid), tid, lex->pos, ef & EX_SUFFIX);
       break;
     case sen_lex_done :
-      ti = token_info_open(i, _sen_sym_key(i->lexicon, tid), lex->pos, ef);
+      TOKEN_SPEC_ADD(_sen_sym_key(i->lexicon, tid), tid, lex->pos, ef);
       break;
     case sen_lex_not_found :
-      ti = token_info_open(i, (char *)lex->orig, 0, ef);
+      TOKEN_SPEC_ADD((char *)lex->orig, SEN_SYM_NIL, 0, ef);
       break;
     default :
       goto exit;
     }
-    if (!ti) { goto exit ; }
-    tis[(*n)++] = ti;
     // sen_log("%d:%s(%d)", lex->pos, (tid == SEN_SYM_NIL) ? lex->orig : _sen_sym_key(i->lexicon, tid), tid);
     while (lex->status == sen_lex_doing) {
       tid = sen_lex_next(lex);
       switch (lex->status) {
       case sen_lex_doing :
-        ti = token_info_open(i, _sen_sym_key(i->lexicon, tid), lex->pos, EX_NONE);
+        TOKEN_SPEC_ADD(_sen_sym_key(i->lexicon, tid), tid, lex->pos, EX_NONE);
         break;
       case sen_lex_done :
-        ti = token_info_open(i, _sen_sym_key(i->lexicon, tid), lex->pos, ef & EX_PREFIX);
+        TOKEN_SPEC_ADD(_sen_sym_key(i->lexicon, tid), tid, lex->pos, ef & EX_PREFIX);
         break;
       default :
-        ti = token_info_open(i, (char *)lex->token, lex->pos, ef & EX_PREFIX);
+        TOKEN_SPEC_ADD((char *)lex->token, SEN_SYM_NIL, lex->pos, ef & EX_PREFIX);
         break;
       }
-      if (!ti) { goto exit; }
-      tis[(*n)++] = ti;
       // sen_log("%d:%s(%d)", lex->pos, (tid == SEN_SYM_NIL) ? lex->token : _sen_sym_key(i->lexicon, tid), tid);
     }
-    rc = sen_success;
   }
+  token_info_prefetch(i, specs, se);
+  for (sp = specs; sp < se; sp++) {
+    if (!(ti = token_info_open(i, sp->key, sp->offset, sp->mode))) { goto exit; }
+    tis[(*n)++] = ti;
+  }
+  rc = token_info_start(tis, *n);
 exit :
+  if (specs) { SEN_AFREE(specs); }
   sen_lex_close(lex);
   return rc;
 }
@@ -605,6 +687,7 @@ sen_index_create(const char *path, int key_size,
         }
         if (!(flags & SEN_INDEX_WITH_VGRAM) || i->vgram) {
           SEN_LOG(sen_log_notice, "index created (%s) flags=%x", path, i->lexicon->flags);
+          if (sen_index_profile_interval) { sen_index_profile_start(i, sen_index_profile_interval); }
           return i;
         }
         sen_inv_close(i->inv);
@@ -648,6 +731,7 @@ sen_index_open(const char *path)
         }
         if (!(i->lexicon->flags & SEN_INDEX_WITH_VGRAM) || i->vgram) {
           SEN_LOG(sen_log_notice, "index opened (%p:%s) flags=%x", i, path, i->lexicon->flags);
+          if (sen_index_profile_interval) { sen_index_profile_start(i, sen_index_profile_interval); }
           return i;
         }
         sen_inv_close(i->inv);
@@ -697,6 +781,7 @@ sen_index_create_with_keys(const char *path, sen_sym *keys,
       }
       if (!(flags & SEN_INDEX_WITH_VGRAM) || i->vgram) {
         SEN_LOG(sen_log_notice, "index created (%s) flags=%x", path, i->lexicon->flags);
+        if (sen_index_profile_interval) { sen_index_profile_start(i, sen_index_profile_interval); }
         return i;
       }
       sen_inv_close(i->inv);
@@ -739,6 +824,7 @@ sen_index_open_with_keys(const char *path, sen_sym *keys)
       }
       if(!(i->lexicon->flags & SEN_INDEX_WITH_VGRAM) || i->vgram) {
         SEN_LOG(sen_log_notice, "index opened (%p:%s) flags=%x", i, path, i->lexicon->flags);
+        if (sen_index_profile_interval) { sen_index_profile_start(i, sen_index_profile_interval); }
         return i;
       }
       sen_inv_close(i->inv);
@@ -769,6 +855,7 @@ sen_index_create_with_keys_lexicon(const char *path, sen_sym *keys, sen_sym *lex
   if ((i->inv = sen_inv_create(path, i->lexicon, initial_n_segments))) {
     index_open(path, i);
     SEN_LOG(sen_log_notice, "index created (%s) flags=%x", path, i->lexicon->flags);
+    if (sen_index_profile_interval) { sen_index_profile_start(i, sen_index_profile_interval); }
     return i;
   }
   SEN_GFREE(i);
@@ -791,6 +878,7 @@ sen_index_open_with_keys_lexicon(const char *path, sen_sym *keys, sen_sym *lexic
   if ((i->inv = sen_inv_open(path, i->lexicon))) {
     index_open(path, i);
     SEN_LOG(sen_log_notice, "index opened (%p:%s) flags=%x", i, path, i->lexicon->flags);
+    if (sen_index_profile_interval) { sen_index_profile_start(i, sen_index_profile_interval); }
     return i;
   }
   SEN_GFREE(i);
@@ -801,6 +889,9 @@ sen_rc
 sen_index_close(sen_index *i)
 {
   if (!i) { return sen_invalid_argument; }
+  sen_index_profile_stop(i); /* if it is profiled */
+  /* the pending merges are settled with the lexicon */
+  if (i->inv) { sen_inv_merger_stop(i->inv); }
   if (!(i->foreign_flags & FOREIGN_KEY)) { sen_sym_close(i->keys); }
   if (!(i->foreign_flags & FOREIGN_LEXICON)) { sen_sym_close(i->lexicon); }
   index_close(i);
@@ -824,6 +915,8 @@ sen_index_remove(const char *path)
   if ((rc = sen_sym_remove(buffer))) { goto exit; }
   snprintf(buffer, PATH_MAX, "%s.SEN.v", path);
   sen_io_remove(buffer); // sen_vgram_remove
+  snprintf(buffer, PATH_MAX, "%s.SEN.i.hot", path);
+  remove(buffer);
 exit :
   return rc;
 }
@@ -850,6 +943,9 @@ sen_index_rename(const char *old_name, const char *new_name)
   snprintf(old_buffer, PATH_MAX, "%s.SEN.v", old_name);
   snprintf(new_buffer, PATH_MAX, "%s.SEN.v", new_name);
   sen_io_rename(old_buffer, new_buffer);
+  snprintf(old_buffer, PATH_MAX, "%s.SEN.i.hot", old_name);
+  snprintf(new_buffer, PATH_MAX, "%s.SEN.i.hot", new_name);
+  rename(old_buffer, new_buffer);
   return sen_success;
 }
 
@@ -914,6 +1010,309 @@ sen_index_clear_lock(sen_index *i)
   return sen_sym_clear_lock(i->keys);
 }
 
+sen_rc
+sen_index_merger_start(sen_index *i)
+{
+  sen_rc rc;
+  if (!i) { return sen_invalid_argument; }
+  if ((rc = sen_index_lock(i, -1))) { return rc; }
+  rc = sen_inv_merger_start(i->inv);
+  sen_index_unlock(i);
+  return rc;
+}
+
+sen_rc
+sen_index_merger_stop(sen_index *i)
+{
+  sen_rc rc;
+  if (!i) { return sen_invalid_argument; }
+  if ((rc = sen_index_lock(i, -1))) { return rc; }
+  rc = sen_inv_merger_stop(i->inv);
+  sen_index_unlock(i);
+  return rc;
+}
+
+sen_rc
+sen_index_merger_info(sen_index *i, unsigned *nqueued, unsigned *max_queued,
+                      unsigned *nmerges, unsigned *nwaits,
+                      unsigned long long *total_usec, unsigned long long *max_usec)
+{
+  sen_rc rc;
+  uint32_t q, mq, nm, nw;
+  uint64_t tu, mu;
+  if (!i) { return sen_invalid_argument; }
+  if ((rc = sen_inv_merger_info(i->inv, &q, &mq, &nm, &nw, &tu, &mu))) { return rc; }
+  if (nqueued) { *nqueued = q; }
+  if (max_queued) { *max_queued = mq; }
+  if (nmerges) { *nmerges = nm; }
+  if (nwaits) { *nwaits = nw; }
+  if (total_usec) { *total_usec = tu; }
+  if (max_usec) { *max_usec = mu; }
+  return sen_success;
+}
+
+sen_rc
+sen_index_set_map_budget(sen_index *i, unsigned int size_mb)
+{
+  if (!i) { return sen_invalid_argument; }
+  return sen_inv_set_map_budget(i->inv, size_mb);
+}
+
+/* preload */
+
+#define PRELOAD_NFILES 4
+#define PRELOAD_MAX_HOTS 0x10000
+
+typedef struct {
+  const char *name;
+  sen_io *io;
+  int flags;
+} preload_file;
+
+typedef struct {
+  uint32_t file;
+  uint32_t segno;
+} preload_seg;
+
+static int
+preload_seg_compare(const void *a, const void *b)
+{
+  const preload_seg *x = a, *y = b;
+  if (x->file != y->file) { return x->file < y->file ? -1 : 1; }
+  return x->segno < y->segno ? -1 : x->segno > y->segno ? 1 : 0;
+}
+
+/* the files in the order of preload. the chunks are not mapped, but read
+   by pread. */
+inline static int
+preload_files(sen_index *i, int flags, preload_file *pf)
+{
+  int n = 0;
+  sen_io *seg, *chunk;
+  pf[n].name = "keys";
+  pf[n].io = i->keys->io;
+  pf[n++].flags = flags;
+  pf[n].name = "lexicon";
+  pf[n].io = i->lexicon->io;
+  pf[n++].flags = flags;
+  if (!sen_inv_ios(i->inv, &seg, &chunk)) {
+    pf[n].name = "inv";
+    pf[n].io = seg;
+    pf[n++].flags = flags;
+    if ((flags & SEN_PRELOAD_CHUNK)) {
+      pf[n].name = "chunk";
+      pf[n].io = chunk;
+      pf[n++].flags = flags & ~SEN_PRELOAD_MAP;
+    }
+  }
+  return n;
+}
+
+/* reads the segments listed in path, a line of "<file> <segment>" each,
+   in the order of the files. */
+static sen_rc
+preload_hots(preload_file *pf, int nfiles, const char *path, uint64_t *budget)
+{
+  FILE *fp;
+  char line[256], name[16];
+  unsigned int segno;
+  int f, n = 0, k, l;
+  preload_seg *hots;
+  sen_rc rc = sen_success;
+  if (!(fp = fopen(path, "r"))) {
+    SEN_LOG(sen_log_error, "cannot open hot set file (%s)", path);
+    return sen_file_operation_error;
+  }
+  if (!(hots = SEN_GMALLOC(sizeof(preload_seg) * PRELOAD_MAX_HOTS))) {
+    fclose(fp);
+    return sen_memory_exhausted;
+  }
+  while (n < PRELOAD_MAX_HOTS && fgets(line, sizeof(line), fp)) {
+    if (*line == '#' || sscanf(line, "%15s %u", name, &segno) != 2) { continue; }
+    for (f = 0; f < nfiles; f++) {
+      if (!strcmp(name, pf[f].name)) {
+        hots[n].file = f;
+        hots[n++].segno = segno;
+        break;
+      }
+    }
+  }
+  fclose(fp);
+  qsort(hots, n, sizeof(preload_seg), preload_seg_compare);
+  /* the consecutive segments are read at once */
+  for (k = 0; k < n && *budget && !rc; k = l) {
+    for (l = k + 1; l < n && hots[l].file == hots[k].file &&
+         hots[l].segno <= hots[l - 1].segno + 1; l++) ;
+    rc = sen_io_preload(pf[hots[k].file].io, hots[k].segno,
+                        hots[l - 1].segno - hots[k].segno + 1, pf[hots[k].file].flags, budget);
+  }
+  SEN_GFREE(hots);
+  return rc;
+}
+
+sen_rc
+sen_index_preload(sen_index *i, int flags, unsigned int budget_mb, const char *hot_path)
+{
+  int f, nfiles;
+  sen_rc rc = sen_success;
+  preload_file pf[PRELOAD_NFILES];
+  uint64_t budget = budget_mb ? (uint64_t) budget_mb << 20 : (uint64_t) -1;
+  if (!i) { return sen_invalid_argument; }
+  nfiles = preload_files(i, flags, pf);
+  if (hot_path) { return preload_hots(pf, nfiles, hot_path, &budget); }
+  for (f = 0; f < nfiles && budget && !rc; f++) {
+    rc = sen_io_preload(pf[f].io, 0, 0xffffffff, pf[f].flags, &budget);
+  }
+  return rc;
+}
+
+/* hot segment profile */
+
+unsigned int sen_index_profile_interval = 0;
+
+typedef struct _sen_index_profiler sen_index_profiler;
+
+struct _sen_index_profiler {
+  sen_index_profiler *next;
+  sen_index *index;
+  sen_thread thread;
+  sen_mutex lock;          /* guards stop */
+  sen_cond cond;
+  int stop;
+  unsigned int interval;
+  char path[PATH_MAX];
+};
+
+/* the profilers started, which are looked up by their indexes, so that
+   sen_index has no room for them. */
+static sen_index_profiler *profilers = NULL;
+static sen_mutex profilers_lock;
+
+void
+sen_index_profile_init(void)
+{
+  MUTEX_INIT(profilers_lock);
+}
+
+/* writes the segments mapped now, in the format of the hot set of
+   sen_index_preload. it is written to a temporary file and renamed, so
+   that a process which opens the index never reads a partial one. */
+static sen_rc
+profile_save(sen_index *i, const char *path)
+{
+  FILE *fp;
+  uint32_t *segs, n, k, total = 0;
+  int f, nfiles;
+  char tmp[PATH_MAX];
+  preload_file pf[PRELOAD_NFILES];
+  sen_rc rc = sen_success;
+  if (!(segs = SEN_GMALLOC(sizeof(uint32_t) * PRELOAD_MAX_HOTS))) {
+    return sen_memory_exhausted;
+  }
+  snprintf(tmp, PATH_MAX, "%s.tmp", path);
+  if (!(fp = fopen(tmp, "w"))) {
+    SEN_LOG(sen_log_error, "cannot open hot set file (%s)", tmp);
+    SEN_GFREE(segs);
+    return sen_file_operation_error;
+  }
+  fprintf(fp, "# hot segments of %s\n", sen_inv_path(i->inv));
+  nfiles = preload_files(i, 0, pf);
+  for (f = 0; f < nfiles; f++) {
+    n = sen_io_hot_segs(pf[f].io, segs, PRELOAD_MAX_HOTS - total);
+    for (k = 0; k < n; k++) { fprintf(fp, "%s %u\n", pf[f].name, segs[k]); }
+    total += n;
+  }
+  if (fclose(fp) || rename(tmp, path)) {
+    SEN_LOG(sen_log_error, "cannot write hot set file (%s)", path);
+    remove(tmp);
+    rc = sen_file_operation_error;
+  }
+  SEN_GFREE(segs);
+  return rc;
+}
+
+/* faults the segments of the last profile in, then writes the profile
+   every interval seconds until it is stopped. */
+static void *
+profile_work(void *arg)
+{
+  struct stat s;
+  sen_index_profiler *p = arg;
+  sen_ctx *ctx = sen_ctx_open(NULL, 0);
+  if (ctx) { sen_ctx_use(ctx); }
+  if (!stat(p->path, &s)) {
+    sen_index_preload(p->index, SEN_PRELOAD_MAP, 0, p->path);
+  }
+  MUTEX_LOCK(p->lock);
+  while (!p->stop) {
+    time_t t = time(NULL) + p->interval;
+    while (!p->stop && time(NULL) < t) { COND_TIMEDWAIT(p->cond, p->lock, t); }
+    if (!p->stop) {
+      MUTEX_UNLOCK(p->lock);
+      profile_save(p->index, p->path);
+      MUTEX_LOCK(p->lock);
+    }
+  }
+  MUTEX_UNLOCK(p->lock);
+  if (ctx) { sen_ctx_close(ctx); }
+  return NULL;
+}
+
+sen_rc
+sen_index_profile_start(sen_index *i, unsigned int interval)
+{
+  sen_rc rc = sen_success;
+  sen_index_profiler *p;
+  if (!i || !interval) { return sen_invalid_argument; }
+  MUTEX_LOCK(profilers_lock);
+  for (p = profilers; p && p->index != i; p = p->next) ;
+  if (p) { goto exit; }
+  if (!(p = SEN_GMALLOC(sizeof(sen_index_profiler)))) {
+    rc = sen_memory_exhausted;
+    goto exit;
+  }
+  p->index = i;
+  p->stop = 0;
+  p->interval = interval;
+  snprintf(p->path, PATH_MAX, "%s.hot", sen_inv_path(i->inv));
+  MUTEX_INIT(p->lock);
+  COND_INIT(p->cond);
+  if (THREAD_CREATE(p->thread, profile_work, p)) {
+    SEN_LOG(sen_log_alert, "sen_index_profile_start: thread create failed");
+    MUTEX_DESTROY(p->lock);
+    SEN_GFREE(p);
+    rc = sen_other_error;
+    goto exit;
+  }
+  p->next = profilers;
+  profilers = p;
+exit :
+  MUTEX_UNLOCK(profilers_lock);
+  return rc;
+}
+
+sen_rc
+sen_index_profile_stop(sen_index *i)
+{
+  sen_rc rc;
+  sen_index_profiler *p, **pp;
+  if (!i) { return sen_invalid_argument; }
+  MUTEX_LOCK(profilers_lock);
+  for (pp = &profilers; (p = *pp) && p->index != i; pp = &p->next) ;
+  if (p) { *pp = p->next; }
+  MUTEX_UNLOCK(profilers_lock);
+  if (!p) { return sen_invalid_argument; }
+  MUTEX_LOCK(p->lock);
+  p->stop = 1;
+  COND_SIGNAL(p->cond);
+  MUTEX_UNLOCK(p->lock);
+  THREAD_JOIN(p->thread);
+  rc = profile_save(i, p->path);
+  MUTEX_DESTROY(p->lock);
+  SEN_GFREE(p);
+  return rc;
+}
+
 int
 sen_index_path(sen_index *i, char *pathbuf, int bufsize)
 {
@@ -946,7 +1345,8 @@ index_add(sen_index *i, const void *key, const char *value, size_t value_len)
   sen_vgram_buf *sbuf = NULL;
   //  sen_log("add > (%x:%x)", i, key);
   if (!(rid = sen_sym_get(i->keys, key))) { return sen_invalid_argument; }
-  if (!(lex = sen_lex_open(i->lexicon, value, value_len, SEN_LEX_ADD|SEN_LEX_UPD))) {
+  if (!(lex = sen_lex_open(i->lexicon, value, value_len,
+                           SEN_LEX_ADD|SEN_LEX_UPD|SEN_LEX_BATCH))) {
     return sen_memory_exhausted;
   }
   if (i->vgram) { sbuf = sen_vgram_buf_open(value_len); }
@@ -1008,7 +1408,7 @@ index_del(sen_index *i, const void *key, const char *value, size_t value_len)
     return sen_invalid_argument;
   }
   // sen_log("del > (%x:%d:%d) %d", key, rid, *((int *)key), strlen(value));
-  if (!(lex = sen_lex_open(i->lexicon, value, value_len, SEN_LEX_UPD))) {
+  if (!(lex = sen_lex_open(i->lexicon, value, value_len, SEN_LEX_UPD|SEN_LEX_BATCH))) {
     return sen_memory_exhausted;
   }
   h = sen_set_open(sizeof(sen_id), sizeof(sen_inv_updspec *), 0);
@@ -1095,7 +1495,7 @@ sen_index_del(sen_index *i, const void *key)
 sen_values *
 sen_values_open(void)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_values *v = SEN_MALLOC(sizeof(sen_values));
   if (v) {
     v->n_values = 0;
@@ -1107,7 +1507,7 @@ sen_values_open(void)
 sen_rc
 sen_values_close(sen_values *v)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!v) { return sen_invalid_argument; }
   if (v->values) { SEN_FREE(v->values); }
   SEN_FREE(v);
@@ -1117,7 +1517,7 @@ sen_values_close(sen_values *v)
 sen_rc
 sen_values_add(sen_values *v, const char *str, unsigned int str_len, unsigned int weight)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_value *vp;
   if (!v || !str) { SEN_LOG(sen_log_warning, "sen_values_add: invalid argument"); return sen_invalid_argument; }
   if (!(v->n_values & (INITIAL_VALUE_SIZE - 1))) {
@@ -1165,7 +1565,8 @@ sen_index_update(sen_index *i, const void *key, unsigned int section,
       goto exit;
     }
     for (j = newvalues->n_values, v = newvalues->values; j; j--, v++) {
-      if ((lex = sen_lex_open(i->lexicon, v->str, v->str_len, SEN_LEX_ADD|SEN_LEX_UPD))) {
+      if ((lex = sen_lex_open(i->lexicon, v->str, v->str_len,
+                              SEN_LEX_ADD|SEN_LEX_UPD|SEN_LEX_BATCH))) {
         while (!lex->status) {
           if ((tid = sen_lex_next(lex))) {
             if (!sen_set_get(new, &tid, (void **) &u)) { break; }
@@ -1210,7 +1611,7 @@ sen_index_update(sen_index *i, const void *key, unsigned int section,
       goto exit;
     }
     for (j = oldvalues->n_values, v = oldvalues->values; j; j--, v++) {
-      if ((lex = sen_lex_open(i->lexicon, v->str, v->str_len, SEN_LEX_UPD))) {
+      if ((lex = sen_lex_open(i->lexicon, v->str, v->str_len, SEN_LEX_UPD|SEN_LEX_BATCH))) {
         while (!lex->status) {
           if ((tid = sen_lex_next(lex))) {
             if (!sen_set_get(old, &tid, (void **) &u)) { break; }
@@ -1276,96 +1677,766 @@ exit :
   return rc;
 }
 
-/* sen_records */
+/* bulk */
 
-#define SCORE_SIZE (sizeof(int))
+/* the documents given to sen_index_bulk_add() are put in batches, which
+   are tokenized by the worker threads. each worker collects the
+   (tid, rid, pos) of the tokens, and sorts and writes them to a run file
+   when it has run_memory / nthreads bytes of them. the buffer of a worker
+   starts at BULK_RUN_INITIAL bytes and is doubled as the tokens come, so
+   that a small input doesn't take the whole run_memory. the runs are
+   merged in sen_index_bulk_finish(), BULK_MAX_RUNS at a time, and the
+   postings of each term are put in the inv by sen_inv_loader. */
+
+#define BULK_BATCH_SIZE 0x100000
+#define BULK_RUN_MEMORY 0x10000000
+#define BULK_RUN_INITIAL 0x100000
+#define BULK_MAX_THREADS 64
+#define BULK_MAX_RUNS 128
+#define BULK_IO_SIZE 0x10000
 
 typedef struct {
-  int score;
-  int n_subrecs;
-  byte subrecs[1];
-} recinfo;
+  sen_id tid;
+  sen_id rid;
+  uint32_t pos;
+} bulk_posting;
 
-inline static int
-rec_unit_size(sen_rec_unit unit)
+#define BULK_POSTING_LT(a,b) ((a).tid < (b).tid ||\
+  ((a).tid == (b).tid && ((a).rid < (b).rid ||\
+                          ((a).rid == (b).rid && (a).pos < (b).pos))))
+
+typedef struct {
+  uint8_t *buf;     /* documents, as rid, length and value padded to 4 */
+  uint32_t size;
+  uint32_t len;
+} bulk_batch;
+
+typedef struct {
+  sen_index_bulk *bulk;
+  sen_thread thread;
+  bulk_posting *postings;
+  uint32_t n;
+  uint32_t size;
+  uint32_t max;            /* size can be grown up to this */
+} bulk_worker;
+
+struct _sen_index_bulk {
+  sen_index *index;
+  sen_ctx *ctx;
+  sen_inv_loader *loader;  /* NULL if the documents are added one by one */
+  int nthreads;
+  bulk_worker *workers;
+  bulk_batch *batches;
+  int nbatches;
+  int cur;                 /* batch being filled */
+  int *ready;              /* ring of the batches to be tokenized */
+  int ready_head;
+  int nready;
+  int *idle;               /* batches to be filled */
+  int nidle;
+  int closing;
+  int nruns;
+  sen_rc rc;
+  sen_mutex lock;          /* guards the above */
+  sen_cond cond;
+  sen_mutex lex_lock;      /* guards the lexicon */
+  uint8_t *rids;           /* bitmap of the rids added */
+  uint32_t rids_size;
+};
+
+typedef struct {
+  FILE *fp;
+  uint8_t *p;
+  bulk_posting last;
+  uint8_t buf[BULK_IO_SIZE];
+} bulk_run_writer;
+
+typedef struct {
+  FILE *fp;
+  uint8_t *p;
+  uint8_t *e;
+  int eof;
+  bulk_posting cur;
+  uint8_t buf[BULK_IO_SIZE];
+} bulk_run_reader;
+
+typedef struct {
+  int n;
+  bulk_run_reader *readers;
+  bulk_run_reader **heap;
+  sen_id tid;
+  sen_rc rc;
+} bulk_merger;
+
+inline static void
+bulk_run_path(sen_index_bulk *b, int n, char *path)
 {
-  switch (unit) {
-  case sen_rec_document :
-    return sizeof(sen_id);
-  case sen_rec_section :
-    return sizeof(sen_id) + sizeof(int);
-  case sen_rec_position :
-    return sizeof(sen_id) + sizeof(int) + sizeof(int);
-  default :
-    return -1;
-  }
+  snprintf(path, PATH_MAX, "%s.b%d", sen_inv_path(b->index->inv), n);
 }
 
-sen_records *
-sen_records_open(sen_rec_unit record_unit,
-                 sen_rec_unit subrec_unit, unsigned int max_n_subrecs)
+static sen_rc
+bulk_run_open(sen_index_bulk *b, int n, bulk_run_writer *w)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
-  sen_records *r;
-  int record_size = rec_unit_size(record_unit);
-  int subrec_size = rec_unit_size(subrec_unit);
-  if (record_size < 0) { return NULL; }
-  if (max_n_subrecs && subrec_size <= record_size) { return NULL; }
-  if (!(r = SEN_MALLOC(sizeof(sen_records)))) { return NULL; }
-  r->record_unit = record_unit;
-  r->subrec_unit = subrec_unit;
-  r->record_size = record_size;
-  r->subrec_size = subrec_size - record_size;
-  r->max_n_subrecs = max_n_subrecs;
-  r->keys = NULL;
-  r->cursor = NULL;
-  r->sorted = NULL;
-  r->curr_rec = NULL;
-  r->ignore_deleted_records = 0;
-  if (!(r->records = sen_set_open(r->record_size,
-                                  SCORE_SIZE + sizeof(int) +
-                                  max_n_subrecs * (SCORE_SIZE + r->subrec_size), 0))) {
-    SEN_FREE(r);
-    return NULL;
+  char path[PATH_MAX];
+  bulk_run_path(b, n, path);
+  if (!(w->fp = fopen(path, "wb"))) {
+    SEN_LOG(sen_log_alert, "fopen(%s) failed on bulk_run_open", path);
+    return sen_file_operation_error;
   }
-  return r;
+  w->p = w->buf;
+  w->last.tid = 0;
+  w->last.rid = 0;
+  w->last.pos = 0;
+  return sen_success;
 }
 
-inline static void
-sen_records_cursor_clear(sen_records *r)
+/* a posting is written as
+     B(tid gap) B(rid) B(pos)
+   or if tid is unchanged,
+     B(0) B(rid gap) B(pos)
+   or if rid is also unchanged,
+     B(0) B(0) B(pos gap) */
+inline static sen_rc
+bulk_run_put(bulk_run_writer *w, bulk_posting *q)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
-  if (r->sorted) {
-    SEN_FREE(r->sorted);
-    r->sorted = NULL;
+  uint32_t x;
+  if (w->p + 15 > w->buf + BULK_IO_SIZE) {
+    if (fwrite(w->buf, w->p - w->buf, 1, w->fp) != 1) { return sen_file_operation_error; }
+    w->p = w->buf;
   }
-  if (r->cursor) {
-    sen_set_cursor_close(r->cursor);
-    r->cursor = NULL;
+  if (q->tid != w->last.tid) {
+    x = q->tid - w->last.tid;
+    SEN_B_ENC(x, w->p);
+    SEN_B_ENC(q->rid, w->p);
+    SEN_B_ENC(q->pos, w->p);
+  } else {
+    *w->p++ = 0;
+    if (q->rid != w->last.rid) {
+      x = q->rid - w->last.rid;
+      SEN_B_ENC(x, w->p);
+      SEN_B_ENC(q->pos, w->p);
+    } else {
+      *w->p++ = 0;
+      x = q->pos - w->last.pos;
+      SEN_B_ENC(x, w->p);
+    }
   }
-  r->curr_rec = NULL;
+  w->last = *q;
+  return sen_success;
 }
 
-sen_rc
-sen_records_close(sen_records *r)
+static sen_rc
+bulk_run_close(bulk_run_writer *w)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
-  if (!r) { return sen_invalid_argument; }
-  if (r->curr_rec) {
-    sen_id *rid;
-    recinfo *ri;
-    if (!sen_set_element_info(r->records, r->curr_rec, (void **)&rid, (void **)&ri)) {
-      SEN_LOG(sen_log_debug, "curr_rec: %d:%d", *rid, ri->score);
-      // sen_log("sen_record_next=%d,%d", *rid, *(_sen_sym_key(r->keys, *rid)));
-    }
+  sen_rc rc = sen_success;
+  if (w->p > w->buf && fwrite(w->buf, w->p - w->buf, 1, w->fp) != 1) {
+    rc = sen_file_operation_error;
   }
-  sen_records_cursor_clear(r);
-  sen_set_close(r->records);
-  SEN_FREE(r);
-  return sen_success;
+  if (fclose(w->fp)) { rc = sen_file_operation_error; }
+  return rc;
 }
 
-sen_rc
+/* reads the next posting of r into r->cur. returns 0 at the end. */
+inline static int
+bulk_run_next(bulk_run_reader *r)
+{
+  uint32_t x;
+  if (r->e - r->p < 15 && !r->eof) {
+    size_t n = r->e - r->p, m = BULK_IO_SIZE - n;
+    memmove(r->buf, r->p, n);
+    r->p = r->buf;
+    r->e = r->buf + n;
+    if ((n = fread(r->e, 1, m, r->fp)) < m) { r->eof = 1; }
+    r->e += n;
+  }
+  if (r->p >= r->e) { return 0; }
+  SEN_B_DEC(x, r->p);
+  if (x) {
+    r->cur.tid += x;
+    SEN_B_DEC(r->cur.rid, r->p);
+    SEN_B_DEC(r->cur.pos, r->p);
+  } else {
+    SEN_B_DEC(x, r->p);
+    if (x) {
+      r->cur.rid += x;
+      SEN_B_DEC(r->cur.pos, r->p);
+    } else {
+      SEN_B_DEC(x, r->p);
+      r->cur.pos += x;
+    }
+  }
+  return 1;
+}
+
+inline static void
+bulk_merger_down(bulk_merger *m, int n)
+{
+  int n2;
+  bulk_run_reader *r = m->heap[n];
+  while ((n2 = n * 2 + 1) < m->n) {
+    if (n2 + 1 < m->n && BULK_POSTING_LT(m->heap[n2 + 1]->cur, m->heap[n2]->cur)) { n2++; }
+    if (!BULK_POSTING_LT(m->heap[n2]->cur, r->cur)) { break; }
+    m->heap[n] = m->heap[n2];
+    n = n2;
+  }
+  m->heap[n] = r;
+}
+
+/* reads the first posting of r, or closes it if there is none. */
+inline static int
+bulk_merger_read(bulk_merger *m, bulk_run_reader *r)
+{
+  if (bulk_run_next(r)) { return 1; }
+  if (ferror(r->fp)) { m->rc = sen_file_operation_error; }
+  fclose(r->fp);
+  return 0;
+}
+
+static void
+bulk_merger_close(sen_index_bulk *b, bulk_merger *m)
+{
+  int i;
+  sen_ctx *ctx = b->ctx;
+  for (i = 0; i < m->n; i++) { fclose(m->heap[i]->fp); }
+  SEN_FREE(m->heap);
+  SEN_FREE(m->readers);
+}
+
+/* merges the runs [first, first + n). */
+static sen_rc
+bulk_merger_open(sen_index_bulk *b, int first, int n, bulk_merger *m)
+{
+  int i;
+  char path[PATH_MAX];
+  sen_ctx *ctx = b->ctx;
+  m->n = 0;
+  m->tid = SEN_SYM_NIL;
+  m->rc = sen_success;
+  if (!(m->readers = SEN_MALLOC(sizeof(bulk_run_reader) * n))) {
+    return sen_memory_exhausted;
+  }
+  if (!(m->heap = SEN_MALLOC(sizeof(bulk_run_reader *) * n))) {
+    SEN_FREE(m->readers);
+    return sen_memory_exhausted;
+  }
+  for (i = 0; i < n && !m->rc; i++) {
+    bulk_run_reader *r = &m->readers[i];
+    bulk_run_path(b, first + i, path);
+    if (!(r->fp = fopen(path, "rb"))) {
+      SEN_LOG(sen_log_alert, "fopen(%s) failed on bulk_merger_open", path);
+      m->rc = sen_file_operation_error;
+      break;
+    }
+    r->p = r->e = r->buf;
+    r->eof = 0;
+    memset(&r->cur, 0, sizeof(bulk_posting));
+    if (bulk_merger_read(m, r)) { m->heap[m->n++] = r; }
+  }
+  if (m->rc) {
+    bulk_merger_close(b, m);
+    return m->rc;
+  }
+  for (i = m->n / 2; i--;) { bulk_merger_down(m, i); }
+  return sen_success;
+}
+
+inline static void
+bulk_merger_advance(bulk_merger *m)
+{
+  if (!bulk_merger_read(m, m->heap[0])) {
+    m->heap[0] = m->heap[--m->n];
+  }
+  if (m->n) { bulk_merger_down(m, 0); }
+}
+
+/* sen_inv_loader_next */
+static int
+bulk_merger_next(void *arg, sen_id *rid, uint32_t *sid, uint32_t *pos)
+{
+  bulk_merger *m = arg;
+  if (!m->n || m->heap[0]->cur.tid != m->tid) { return 0; }
+  *rid = m->heap[0]->cur.rid;
+  *sid = 1;
+  *pos = m->heap[0]->cur.pos;
+  bulk_merger_advance(m);
+  return 1;
+}
+
+static int
+bulk_posting_compare(const void *a, const void *b)
+{
+  const bulk_posting *p = a, *q = b;
+  if (p->tid != q->tid) { return p->tid < q->tid ? -1 : 1; }
+  if (p->rid != q->rid) { return p->rid < q->rid ? -1 : 1; }
+  if (p->pos != q->pos) { return p->pos < q->pos ? -1 : 1; }
+  return 0;
+}
+
+/* sorts the postings of w and writes them to a new run. */
+static sen_rc
+bulk_spill(bulk_worker *w)
+{
+  int n;
+  uint32_t i;
+  sen_rc rc;
+  bulk_run_writer *rw;
+  sen_index_bulk *b = w->bulk;
+  sen_ctx *ctx = sen_ctx_current();
+  qsort(w->postings, w->n, sizeof(bulk_posting), bulk_posting_compare);
+  if (!(rw = SEN_MALLOC(sizeof(bulk_run_writer)))) { return sen_memory_exhausted; }
+  MUTEX_LOCK(b->lock);
+  n = b->nruns++;
+  MUTEX_UNLOCK(b->lock);
+  if (!(rc = bulk_run_open(b, n, rw))) {
+    for (i = 0; i < w->n && !rc; i++) { rc = bulk_run_put(rw, &w->postings[i]); }
+    if (bulk_run_close(rw) && !rc) { rc = sen_file_operation_error; }
+  }
+  SEN_FREE(rw);
+  w->n = 0;
+  return rc;
+}
+
+/* doubles the buffer of postings, or spills them if it can't grow any
+   more. */
+static sen_rc
+bulk_grow(bulk_worker *w)
+{
+  uint32_t size;
+  bulk_posting *postings;
+  sen_ctx *ctx = sen_ctx_current();
+  if (w->size < w->max) {
+    size = (w->size < w->max / 2) ? w->size * 2 : w->max;
+    if ((postings = SEN_REALLOC(w->postings, sizeof(bulk_posting) * size))) {
+      w->postings = postings;
+      w->size = size;
+      return sen_success;
+    }
+    w->max = w->size;
+  }
+  return bulk_spill(w);
+}
+
+static sen_rc
+bulk_tokenize(bulk_worker *w, bulk_batch *batch, sen_set *cache)
+{
+  sen_rc rc;
+  sen_id rid, tid;
+  uint32_t len;
+  sen_lex *lex;
+  sen_index_bulk *b = w->bulk;
+  uint8_t *p = batch->buf, *e = batch->buf + batch->len;
+  while (p < e) {
+    memcpy(&rid, p, sizeof(sen_id));
+    memcpy(&len, p + sizeof(sen_id), sizeof(uint32_t));
+    p += sizeof(sen_id) + sizeof(uint32_t);
+    if (!(lex = sen_lex_open(b->index->lexicon, (char *)p, len,
+                             SEN_LEX_ADD|SEN_LEX_UPD|SEN_LEX_BATCH))) {
+      return sen_memory_exhausted;
+    }
+    lex->cache = cache;
+    lex->lock = &b->lex_lock;
+    while (!lex->status) {
+      if ((tid = sen_lex_next(lex))) {
+        if (w->n == w->size && (rc = bulk_grow(w))) {
+          sen_lex_close(lex);
+          return rc;
+        }
+        w->postings[w->n].tid = tid;
+        w->postings[w->n].rid = rid;
+        w->postings[w->n].pos = lex->pos;
+        w->n++;
+      }
+    }
+    sen_lex_close(lex);
+    p += (len + 3) & ~3;
+  }
+  return sen_success;
+}
+
+static void *
+bulk_work(void *arg)
+{
+  int k;
+  bulk_worker *w = arg;
+  sen_index_bulk *b = w->bulk;
+  sen_rc rc = sen_success;
+  sen_set *cache = NULL;
+  sen_ctx *ctx = sen_ctx_open(NULL, 0);
+  if (ctx) { sen_ctx_use(ctx); }
+  if (!ctx || !(cache = sen_set_open(0, sizeof(sen_id), 0))) { rc = sen_memory_exhausted; }
+  for (;;) {
+    MUTEX_LOCK(b->lock);
+    if (rc && !b->rc) { b->rc = rc; }
+    while (!b->nready && !b->closing) { COND_WAIT(b->cond, b->lock); }
+    if (!b->nready) {
+      MUTEX_UNLOCK(b->lock);
+      break;
+    }
+    k = b->ready[b->ready_head];
+    b->ready_head = (b->ready_head + 1) % b->nbatches;
+    b->nready--;
+    rc = b->rc;
+    MUTEX_UNLOCK(b->lock);
+    if (!rc) { rc = bulk_tokenize(w, &b->batches[k], cache); }
+    MUTEX_LOCK(b->lock);
+    b->batches[k].len = 0;
+    b->idle[b->nidle++] = k;
+    COND_BROADCAST(b->cond);
+    MUTEX_UNLOCK(b->lock);
+  }
+  if (!rc && w->n) { rc = bulk_spill(w); }
+  if (rc) {
+    MUTEX_LOCK(b->lock);
+    if (!b->rc) { b->rc = rc; }
+    MUTEX_UNLOCK(b->lock);
+  }
+  if (cache) { sen_set_close(cache); }
+  if (ctx) {
+    sen_ctx_use(NULL);
+    sen_ctx_close(ctx);
+  }
+  return NULL;
+}
+
+static void
+bulk_free(sen_index_bulk *b)
+{
+  int k;
+  sen_ctx *ctx = b->ctx;
+  if (b->batches) {
+    for (k = 0; k < b->nbatches; k++) {
+      if (b->batches[k].buf) { SEN_FREE(b->batches[k].buf); }
+    }
+    SEN_FREE(b->batches);
+  }
+  if (b->workers) {
+    for (k = 0; k < b->nthreads; k++) {
+      if (b->workers[k].postings) { SEN_FREE(b->workers[k].postings); }
+    }
+    SEN_FREE(b->workers);
+  }
+  if (b->ready) { SEN_FREE(b->ready); }
+  if (b->idle) { SEN_FREE(b->idle); }
+  if (b->rids) { SEN_FREE(b->rids); }
+  SEN_FREE(b);
+}
+
+sen_index_bulk *
+sen_index_bulk_open(sen_index *i, int nthreads, unsigned int run_memory)
+{
+  int k;
+  sen_index_bulk *b;
+  sen_ctx *ctx = sen_ctx_current();
+  if (!i) {
+    SEN_LOG(sen_log_warning, "sen_index_bulk_open: invalid argument");
+    return NULL;
+  }
+  if (nthreads < 1) { nthreads = 1; }
+  if (nthreads > BULK_MAX_THREADS) { nthreads = BULK_MAX_THREADS; }
+  if (!(b = SEN_MALLOC(sizeof(sen_index_bulk)))) { return NULL; }
+  memset(b, 0, sizeof(sen_index_bulk));
+  b->index = i;
+  b->ctx = ctx;
+  if (sen_index_lock(i, -1)) {
+    SEN_LOG(sen_log_crit, "sen_index_bulk_open: index lock failed");
+    SEN_FREE(b);
+    return NULL;
+  }
+  if (i->vgram || !(b->loader = sen_inv_loader_open(i->inv))) {
+    SEN_LOG(sen_log_notice, "sen_index_bulk_open: documents are added one by one");
+    sen_index_unlock(i);
+    return b;
+  }
+  b->nbatches = nthreads * 2 + 1;
+  if (!(b->batches = SEN_MALLOC(sizeof(bulk_batch) * b->nbatches)) ||
+      !(b->ready = SEN_MALLOC(sizeof(int) * b->nbatches)) ||
+      !(b->idle = SEN_MALLOC(sizeof(int) * b->nbatches)) ||
+      !(b->workers = SEN_MALLOC(sizeof(bulk_worker) * nthreads))) {
+    goto exit;
+  }
+  memset(b->batches, 0, sizeof(bulk_batch) * b->nbatches);
+  memset(b->workers, 0, sizeof(bulk_worker) * nthreads);
+  for (k = 0; k < b->nbatches; k++) {
+    if (!(b->batches[k].buf = SEN_MALLOC(BULK_BATCH_SIZE))) { goto exit; }
+    b->batches[k].size = BULK_BATCH_SIZE;
+    if (k) { b->idle[b->nidle++] = k; }
+  }
+  b->nthreads = nthreads;
+  for (k = 0; k < nthreads; k++) {
+    bulk_worker *w = &b->workers[k];
+    w->bulk = b;
+    w->max = (run_memory ? run_memory : BULK_RUN_MEMORY) / nthreads / sizeof(bulk_posting);
+    if (w->max < 0x100) { w->max = 0x100; }
+    w->size = BULK_RUN_INITIAL / sizeof(bulk_posting);
+    if (w->size > w->max) { w->size = w->max; }
+    if (!(w->postings = SEN_MALLOC(sizeof(bulk_posting) * w->size))) { goto exit; }
+  }
+  MUTEX_INIT(b->lock);
+  MUTEX_INIT(b->lex_lock);
+  COND_INIT(b->cond);
+  for (k = 0; k < nthreads; k++) {
+    if (THREAD_CREATE(b->workers[k].thread, bulk_work, &b->workers[k])) {
+      SEN_LOG(sen_log_alert, "sen_index_bulk_open: thread create failed");
+      break;
+    }
+  }
+  if (k < nthreads) {
+    MUTEX_LOCK(b->lock);
+    b->closing = 1;
+    COND_BROADCAST(b->cond);
+    MUTEX_UNLOCK(b->lock);
+    while (k--) { THREAD_JOIN(b->workers[k].thread); }
+    MUTEX_DESTROY(b->lock);
+    MUTEX_DESTROY(b->lex_lock);
+    goto exit;
+  }
+  return b;
+exit :
+  sen_inv_loader_close(b->loader);
+  sen_index_unlock(i);
+  bulk_free(b);
+  return NULL;
+}
+
+/* hands the batch being filled to the workers, and takes an idle one. */
+static sen_rc
+bulk_submit(sen_index_bulk *b)
+{
+  sen_rc rc;
+  MUTEX_LOCK(b->lock);
+  b->ready[(b->ready_head + b->nready++) % b->nbatches] = b->cur;
+  COND_BROADCAST(b->cond);
+  while (!b->nidle) { COND_WAIT(b->cond, b->lock); }
+  b->cur = b->idle[--b->nidle];
+  rc = b->rc;
+  MUTEX_UNLOCK(b->lock);
+  return rc;
+}
+
+sen_rc
+sen_index_bulk_add(sen_index_bulk *b, const void *key,
+                   const char *value, unsigned int value_len)
+{
+  sen_id rid;
+  sen_rc rc;
+  uint32_t size;
+  bulk_batch *batch;
+  sen_ctx *ctx;
+  if (!b || !key) {
+    SEN_LOG(sen_log_warning, "sen_index_bulk_add: invalid argument");
+    return sen_invalid_argument;
+  }
+  if (!b->loader) {
+    return sen_index_upd(b->index, key, NULL, 0, value, value_len);
+  }
+  if (!value || !*value) { return sen_success; }
+  ctx = b->ctx;
+  if (!(rid = sen_sym_get(b->index->keys, key))) { return sen_invalid_argument; }
+  if ((rid >> 3) >= b->rids_size) {
+    uint32_t n = b->rids_size ? b->rids_size : 0x1000;
+    uint8_t *rids;
+    while ((rid >> 3) >= n) { n *= 2; }
+    if (!(rids = SEN_REALLOC(b->rids, n))) { return sen_memory_exhausted; }
+    memset(rids + b->rids_size, 0, n - b->rids_size);
+    b->rids = rids;
+    b->rids_size = n;
+  }
+  if (b->rids[rid >> 3] & (1 << (rid & 7))) {
+    SEN_LOG(sen_log_warning, "sen_index_bulk_add: duplicated key (%d)", rid);
+    return sen_invalid_argument;
+  }
+  b->rids[rid >> 3] |= 1 << (rid & 7);
+  size = sizeof(sen_id) + sizeof(uint32_t) + ((value_len + 3) & ~3);
+  batch = &b->batches[b->cur];
+  if (batch->len && batch->len + size > batch->size) {
+    if ((rc = bulk_submit(b))) { return rc; }
+    batch = &b->batches[b->cur];
+  }
+  if (batch->len + size > batch->size) {
+    uint8_t *buf;
+    if (!(buf = SEN_REALLOC(batch->buf, batch->len + size))) { return sen_memory_exhausted; }
+    batch->buf = buf;
+    batch->size = batch->len + size;
+  }
+  memcpy(batch->buf + batch->len, &rid, sizeof(sen_id));
+  memcpy(batch->buf + batch->len + sizeof(sen_id), &value_len, sizeof(uint32_t));
+  memcpy(batch->buf + batch->len + sizeof(sen_id) + sizeof(uint32_t), value, value_len);
+  batch->len += size;
+  return sen_success;
+}
+
+/* merges the runs down to BULK_MAX_RUNS, and then into the inv. */
+static sen_rc
+bulk_merge(sen_index_bulk *b)
+{
+  int first = 0, k;
+  sen_rc rc = sen_success;
+  bulk_merger m;
+  char path[PATH_MAX];
+  sen_ctx *ctx = b->ctx;
+  while (!rc && b->nruns - first > BULK_MAX_RUNS) {
+    bulk_run_writer *w;
+    if (!(w = SEN_MALLOC(sizeof(bulk_run_writer)))) { return sen_memory_exhausted; }
+    if (!(rc = bulk_merger_open(b, first, BULK_MAX_RUNS, &m))) {
+      if (!(rc = bulk_run_open(b, b->nruns, w))) {
+        b->nruns++;
+        while (m.n && !rc) {
+          rc = bulk_run_put(w, &m.heap[0]->cur);
+          bulk_merger_advance(&m);
+        }
+        if (bulk_run_close(w) && !rc) { rc = sen_file_operation_error; }
+        if (m.rc && !rc) { rc = m.rc; }
+      }
+      bulk_merger_close(b, &m);
+    }
+    SEN_FREE(w);
+    for (k = first; k < first + BULK_MAX_RUNS; k++) {
+      bulk_run_path(b, k, path);
+      unlink(path);
+    }
+    first += BULK_MAX_RUNS;
+  }
+  if (!rc && b->nruns > first &&
+      !(rc = bulk_merger_open(b, first, b->nruns - first, &m))) {
+    while (m.n && !rc) {
+      m.tid = m.heap[0]->cur.tid;
+      rc = sen_inv_loader_add(b->loader, m.tid, bulk_merger_next, &m);
+      if (m.rc && !rc) { rc = m.rc; }
+    }
+    bulk_merger_close(b, &m);
+  }
+  return rc;
+}
+
+sen_rc
+sen_index_bulk_finish(sen_index_bulk *b)
+{
+  int k;
+  sen_rc rc, r;
+  sen_index *i;
+  char path[PATH_MAX];
+  if (!b) {
+    SEN_LOG(sen_log_warning, "sen_index_bulk_finish: invalid argument");
+    return sen_invalid_argument;
+  }
+  i = b->index;
+  if (!b->loader) {
+    bulk_free(b);
+    return sen_success;
+  }
+  MUTEX_LOCK(b->lock);
+  if (b->batches[b->cur].len) {
+    b->ready[(b->ready_head + b->nready++) % b->nbatches] = b->cur;
+  }
+  b->closing = 1;
+  COND_BROADCAST(b->cond);
+  MUTEX_UNLOCK(b->lock);
+  for (k = 0; k < b->nthreads; k++) { THREAD_JOIN(b->workers[k].thread); }
+  MUTEX_DESTROY(b->lock);
+  MUTEX_DESTROY(b->lex_lock);
+  SEN_LOG(sen_log_notice, "sen_index_bulk_finish: merging %d runs", b->nruns);
+  if (!(rc = b->rc)) { rc = bulk_merge(b); }
+  if ((r = sen_inv_loader_close(b->loader)) && !rc) { rc = r; }
+  for (k = 0; k < b->nruns; k++) {
+    bulk_run_path(b, k, path);
+    unlink(path);
+  }
+  sen_index_unlock(i);
+  sen_inv_seg_expire(i->inv, -1);
+  bulk_free(b);
+  return rc;
+}
+
+/* sen_records */
+
+#define SCORE_SIZE (sizeof(int))
+
+typedef struct {
+  int score;
+  int n_subrecs;
+  byte subrecs[1];
+} recinfo;
+
+inline static int
+rec_unit_size(sen_rec_unit unit)
+{
+  switch (unit) {
+  case sen_rec_document :
+    return sizeof(sen_id);
+  case sen_rec_section :
+    return sizeof(sen_id) + sizeof(int);
+  case sen_rec_position :
+    return sizeof(sen_id) + sizeof(int) + sizeof(int);
+  default :
+    return -1;
+  }
+}
+
+sen_records *
+sen_records_open(sen_rec_unit record_unit,
+                 sen_rec_unit subrec_unit, unsigned int max_n_subrecs)
+{
+  sen_ctx *ctx = sen_ctx_current();
+  sen_records *r;
+  int record_size = rec_unit_size(record_unit);
+  int subrec_size = rec_unit_size(subrec_unit);
+  if (record_size < 0) { return NULL; }
+  if (max_n_subrecs && subrec_size <= record_size) { return NULL; }
+  if (!(r = SEN_MALLOC(sizeof(sen_records)))) { return NULL; }
+  r->record_unit = record_unit;
+  r->subrec_unit = subrec_unit;
+  r->record_size = record_size;
+  r->subrec_size = subrec_size - record_size;
+  r->max_n_subrecs = max_n_subrecs;
+  r->keys = NULL;
+  r->cursor = NULL;
+  r->sorted = NULL;
+  r->curr_rec = NULL;
+  r->ignore_deleted_records = 0;
+  if (!(r->records = sen_set_open(r->record_size,
+                                  SCORE_SIZE + sizeof(int) +
+                                  max_n_subrecs * (SCORE_SIZE + r->subrec_size), 0))) {
+    SEN_FREE(r);
+    return NULL;
+  }
+  return r;
+}
+
+inline static void
+sen_records_cursor_clear(sen_records *r)
+{
+  sen_ctx *ctx = sen_ctx_current();
+  if (r->sorted) {
+    SEN_FREE(r->sorted);
+    r->sorted = NULL;
+  }
+  if (r->cursor) {
+    sen_set_cursor_close(r->cursor);
+    r->cursor = NULL;
+  }
+  r->curr_rec = NULL;
+}
+
+sen_rc
+sen_records_close(sen_records *r)
+{
+  sen_ctx *ctx = sen_ctx_current();
+  if (!r) { return sen_invalid_argument; }
+  if (r->curr_rec) {
+    sen_id *rid;
+    recinfo *ri;
+    if (!sen_set_element_info(r->records, r->curr_rec, (void **)&rid, (void **)&ri)) {
+      SEN_LOG(sen_log_debug, "curr_rec: %d:%d", *rid, ri->score);
+      // sen_log("sen_record_next=%d,%d", *rid, *(_sen_sym_key(r->keys, *rid)));
+    }
+  }
+  sen_records_cursor_clear(r);
+  sen_set_close(r->records);
+  SEN_FREE(r);
+  return sen_success;
+}
+
+sen_rc
 sen_records_reopen(sen_records *r, sen_rec_unit record_unit,
                    sen_rec_unit subrec_unit, unsigned int max_n_subrecs)
 {
@@ -1628,7 +2699,7 @@ subrecs_replace_min(byte *subrecs, int size, int n_subrecs, int score, void *bod
 sen_rc
 sen_records_group(sen_records *r, int limit, sen_group_optarg *optarg)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_set *g;
   recinfo *ri;
   sen_rec_unit unit;
@@ -1956,12 +3027,12 @@ bt_zap(btr *bt)
 inline static btr *
 bt_open(int size)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
-  btr *bt = SEN_MALLOC(sizeof(btr));
+  sen_ctx *ctx = sen_ctx_current();
+  btr *bt = SEN_AMALLOC(sizeof(btr));
   if (bt) {
     bt_zap(bt);
-    if (!(bt->nodes = SEN_MALLOC(sizeof(btr_node) * size))) {
-      SEN_FREE(bt);
+    if (!(bt->nodes = SEN_AMALLOC(sizeof(btr_node) * size))) {
+      SEN_AFREE(bt);
       bt = NULL;
     }
   }
@@ -1971,10 +3042,10 @@ bt_open(int size)
 inline static void
 bt_close(btr *bt)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!bt) { return; }
-  SEN_FREE(bt->nodes);
-  SEN_FREE(bt);
+  SEN_AFREE(bt->nodes);
+  SEN_AFREE(bt);
 }
 
 inline static void
@@ -2055,15 +3126,203 @@ get_weight(sen_records *r, sen_id rid, int sid,
   }
 }
 
-sen_rc
-sen_index_similar_search(sen_index *i, const char *string,
-                         unsigned int string_len, sen_records *r,
-                         sen_sel_operator op, sen_select_optarg *optarg)
-{
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
-  int *w1, limit;
-  sen_id tid, *tp;
-  sen_rc rc = sen_success;
+/* the records of the highest scores of sen_index_select_topk.
+   they are kept in a min-heap of the scores, until they are put to the
+   records by topk_close. */
+
+typedef struct {
+  int score;
+  sen_id rid;
+  int n_subrecs;
+} topk_entry;
+
+typedef struct {
+  int n;
+  int max;
+  sen_id rid;        /* the record being scored */
+  int score;
+  int n_subrecs;
+  topk_entry *entries;
+} topk;
+
+inline static int
+topk_limit(sen_records *r, sen_sel_operator op, int limit)
+{
+  if (limit <= 0 || op != sen_sel_or ||
+      r->records->n_entries || r->records->garbages ||
+      r->record_unit != sen_rec_document || r->subrec_unit != sen_rec_none ||
+      r->max_n_subrecs) {
+    return 0;
+  }
+  return limit;
+}
+
+static topk *
+topk_open(int max)
+{
+  sen_ctx *ctx = sen_ctx_current();
+  topk *h = SEN_MALLOC(sizeof(topk));
+  if (!h) { return NULL; }
+  if (!(h->entries = SEN_MALLOC(sizeof(topk_entry) * max))) {
+    SEN_FREE(h);
+    return NULL;
+  }
+  h->n = 0;
+  h->max = max;
+  h->rid = 0;
+  h->score = 0;
+  h->n_subrecs = 0;
+  return h;
+}
+
+/* whether a record of the score can't get in the heap. */
+inline static int
+topk_below(topk *h, int64_t score)
+{
+  return h->n == h->max && score <= h->entries->score;
+}
+
+static void
+topk_push(topk *h, sen_records *r)
+{
+  int n, n2;
+  topk_entry *e = h->entries, x = {h->score, h->rid, h->n_subrecs};
+  if (!h->rid || topk_below(h, h->score)) { return; }
+  if (r->ignore_deleted_records &&
+      sen_sym_pocket_get(r->keys, h->rid) == DELETE_FLAG) { return; }
+  if (h->n < h->max) {
+    for (n = h->n++; n; n = n2) {
+      n2 = (n - 1) >> 1;
+      if (e[n2].score <= x.score) { break; }
+      e[n] = e[n2];
+    }
+  } else {
+    for (n = 0; (n2 = n * 2 + 1) < h->n; n = n2) {
+      if (n2 + 1 < h->n && e[n2 + 1].score < e[n2].score) { n2++; }
+      if (x.score <= e[n2].score) { break; }
+      e[n] = e[n2];
+    }
+  }
+  e[n] = x;
+}
+
+/* adds score to the record rid. the postings come in the order of rid,
+   so the last record is pushed to the heap when another one comes. */
+inline static void
+topk_add(topk *h, sen_records *r, sen_id rid, int score)
+{
+  if (rid != h->rid) {
+    topk_push(h, r);
+    h->rid = rid;
+    h->score = 0;
+    h->n_subrecs = 0;
+  }
+  h->score += score;
+  h->n_subrecs++;
+}
+
+static sen_rc
+topk_close(topk *h, sen_records *r)
+{
+  int n;
+  recinfo *ri;
+  sen_rc rc = sen_success;
+  sen_ctx *ctx = sen_ctx_current();
+  topk_push(h, r);
+  for (n = 0; n < h->n; n++) {
+    posinfo pi = {h->entries[n].rid, 0, 0};
+    if (!sen_set_get(r->records, &pi, (void **)&ri)) {
+      rc = sen_memory_exhausted;
+      break;
+    }
+    ri->score = h->entries[n].score;
+    ri->n_subrecs = h->entries[n].n_subrecs;
+  }
+  SEN_FREE(h->entries);
+  SEN_FREE(h);
+  return rc;
+}
+
+/* the cursors of the terms of sen_index_similar_search with top,
+   in a min-heap of their current postings. */
+
+typedef struct {
+  sen_inv_cursor *c;
+  int w1;
+} term_cursor;
+
+#define TERM_CURSOR_LT(a,b) \
+  (((a)->c->post->rid < (b)->c->post->rid) || \
+   (((a)->c->post->rid == (b)->c->post->rid) && \
+    ((a)->c->post->sid < (b)->c->post->sid)))
+
+/* merges the postings of the terms, so that the scores of a document are
+   summed up at once, and only the records of the highest scores are
+   put to r. */
+static sen_rc
+similar_search_topk(sen_index *i, sen_records *r, sen_set *h, sen_set_eh *sorted,
+                    int limit, int k, sen_wv_mode wvm, sen_select_optarg *optarg)
+{
+  sen_ctx *ctx = sen_ctx_current();
+  int j, n = 0, m, m2, w2, *w1;
+  sen_id *tp;
+  topk *th;
+  term_cursor *tc, x;
+  sen_inv_posting *pos;
+  if (!(tc = SEN_MALLOC(sizeof(term_cursor) * limit))) { return sen_memory_exhausted; }
+  if (!(th = topk_open(k))) {
+    SEN_FREE(tc);
+    return sen_memory_exhausted;
+  }
+  for (j = 0; j < limit; j++, sorted++) {
+    sen_set_element_info(h, sorted, (void **) &tp, (void **) &w1);
+    if (!*tp || !(x.c = sen_inv_cursor_open(i->inv, *tp, 0))) {
+      SEN_LOG(sen_log_error, "cursor open failed (%d)", *tp);
+      continue;
+    }
+    if (sen_inv_cursor_next(x.c)) {
+      sen_inv_cursor_close(x.c);
+      continue;
+    }
+    x.w1 = *w1;
+    for (m = n++; m; m = m2) {
+      m2 = (m - 1) >> 1;
+      if (!TERM_CURSOR_LT(&x, &tc[m2])) { break; }
+      tc[m] = tc[m2];
+    }
+    tc[m] = x;
+  }
+  while (n) {
+    pos = tc->c->post;
+    if ((w2 = get_weight(r, pos->rid, pos->sid, wvm, optarg))) {
+      topk_add(th, r, pos->rid, tc->w1 * w2 * (pos->tf + pos->score));
+    }
+    x = *tc;
+    if (sen_inv_cursor_next(x.c)) {
+      sen_inv_cursor_close(x.c);
+      if (!--n) { break; }
+      x = tc[n];
+    }
+    for (m = 0; (m2 = m * 2 + 1) < n; m = m2) {
+      if (m2 + 1 < n && TERM_CURSOR_LT(&tc[m2 + 1], &tc[m2])) { m2++; }
+      if (!TERM_CURSOR_LT(&tc[m2], &x)) { break; }
+      tc[m] = tc[m2];
+    }
+    tc[m] = x;
+  }
+  SEN_FREE(tc);
+  return topk_close(th, r);
+}
+
+sen_rc
+sen_index_similar_search(sen_index *i, const char *string,
+                         unsigned int string_len, sen_records *r,
+                         sen_sel_operator op, sen_select_optarg *optarg, int top)
+{
+  sen_ctx *ctx = sen_ctx_current();
+  int *w1, limit;
+  sen_id tid, *tp;
+  sen_rc rc = sen_success;
   sen_set *h;
   sen_lex *lex;
   if (!i || !string || !r || !optarg) { return sen_invalid_argument; }
@@ -2114,7 +3373,7 @@ sen_index_similar_search(sen_index *i, const char *string,
        : optarg->similarity_threshold)
     : (h->n_entries >> 3) + 1;
   if (h->n_entries) {
-    int j, w2, rep;
+    int j, k, w2, rep;
     sen_inv_cursor *c;
     sen_inv_posting *pos;
     sen_wv_mode wvm = sen_wv_none;
@@ -2131,30 +3390,34 @@ sen_index_similar_search(sen_index *i, const char *string,
     } else if (optarg->vector_size) {
       wvm = optarg->weight_vector ? sen_wv_static : sen_wv_constant;
     }
-    for (j = 0, eh = sorted; j < limit; j++, eh++) {
-      sen_set_element_info(h, eh, (void **) &tp, (void **) &w1);
-      if (!*tp || !(c = sen_inv_cursor_open(i->inv, *tp, rep))) {
-        SEN_LOG(sen_log_error, "cursor open failed (%d)", *tp);
-        continue;
-      }
-      if (rep) {
-        while (!sen_inv_cursor_next(c)) {
-          pos = c->post;
-          if ((w2 = get_weight(r, pos->rid, pos->sid, wvm, optarg))) {
-            while (!sen_inv_cursor_next_pos(c)) {
-              res_add(r, (posinfo *) pos, *w1 * w2 * (1 + pos->score), op);
+    if ((k = topk_limit(r, op, top))) {
+      rc = similar_search_topk(i, r, h, sorted, limit, k, wvm, optarg);
+    } else {
+      for (j = 0, eh = sorted; j < limit; j++, eh++) {
+        sen_set_element_info(h, eh, (void **) &tp, (void **) &w1);
+        if (!*tp || !(c = sen_inv_cursor_open(i->inv, *tp, rep))) {
+          SEN_LOG(sen_log_error, "cursor open failed (%d)", *tp);
+          continue;
+        }
+        if (rep) {
+          while (!sen_inv_cursor_next(c)) {
+            pos = c->post;
+            if ((w2 = get_weight(r, pos->rid, pos->sid, wvm, optarg))) {
+              while (!sen_inv_cursor_next_pos(c)) {
+                res_add(r, (posinfo *) pos, *w1 * w2 * (1 + pos->score), op);
+              }
             }
           }
-        }
-      } else {
-        while (!sen_inv_cursor_next(c)) {
-          pos = c->post;
-          if ((w2 = get_weight(r, pos->rid, pos->sid, wvm, optarg))) {
-            res_add(r, (posinfo *) pos, *w1 * w2 * (pos->tf + pos->score), op);
+        } else {
+          while (!sen_inv_cursor_next(c)) {
+            pos = c->post;
+            if ((w2 = get_weight(r, pos->rid, pos->sid, wvm, optarg))) {
+              res_add(r, (posinfo *) pos, *w1 * w2 * (pos->tf + pos->score), op);
+            }
           }
         }
+        sen_inv_cursor_close(c);
       }
-      sen_inv_cursor_close(c);
     }
     SEN_FREE(sorted);
   }
@@ -2266,84 +3529,50 @@ exit :
   return rc;
 }
 
-sen_rc
-sen_index_select(sen_index *i, const char *string, unsigned int string_len,
-                 sen_records *r, sen_sel_operator op, sen_select_optarg *optarg)
+/* sets up the tokens of string for sen_index_select, in the order of
+   their sizes. returns sen_other_error if nothing can match. */
+static sen_rc
+select_tokens(sen_index *i, const char *string, unsigned int string_len,
+              sen_sel_mode *mode, token_info **tis, uint32_t *n, btr **bt)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
-  btr *bt = NULL;
-  sen_rc rc = sen_success;
-  int rep, orp, weight, max_interval = 0;
-  token_info *ti, **tis, **tip, **tie;
-  uint32_t n = 0, rid, sid, nrid, nsid;
-  sen_sel_mode mode = sen_sel_exact;
-  sen_wv_mode wvm = sen_wv_none;
-  if (!i || !r) { return sen_invalid_argument; }
-  if (optarg) {
-    mode = optarg->mode;
-    if (optarg->func) {
-      wvm = sen_wv_dynamic;
-    } else if (optarg->vector_size) {
-      wvm = optarg->weight_vector ? sen_wv_static : sen_wv_constant;
-    }
-  }
-  if (mode == sen_sel_similar) {
-    return sen_index_similar_search(i, string, string_len, r, op, optarg);
+  if (token_info_build(i, string, string_len, tis, n, *mode) || !*n) {
+    return sen_other_error;
   }
-  if (mode == sen_sel_term_extract) {
-    return sen_index_term_extract(i, string, string_len, r, op, optarg);
-  }
-  rep = (r->record_unit == sen_rec_position || r->subrec_unit == sen_rec_position);
-  orp = (r->record_unit == sen_rec_position || op == sen_sel_or);
-  if (!(tis = SEN_MALLOC(sizeof(token_info *) * string_len * 2))) {
-    return sen_memory_exhausted;
-  }
-  r->keys = i->keys;
-  if (token_info_build(i, string, string_len, tis, &n, mode) || !n) { goto exit; }
-  switch (mode) {
+  switch (*mode) {
   case sen_sel_near2 :
-    token_info_clear_offset(tis, n);
-    mode = sen_sel_near;
+    token_info_clear_offset(tis, *n);
+    *mode = sen_sel_near;
     /* fallthru */
   case sen_sel_near :
-    if (!(bt = bt_open(n))) { rc = sen_memory_exhausted; goto exit; }
-    max_interval = optarg->max_interval;
+    if (!(*bt = bt_open(*n))) { return sen_memory_exhausted; }
     break;
   default :
     break;
   }
-  qsort(tis, n, sizeof(token_info *), token_compare);
-  tie = tis + n;
-  /*
-  for (tip = tis; tip < tie; tip++) {
-    ti = *tip;
-    sen_log("o=%d n=%d s=%d r=%d", ti->offset, ti->ntoken, ti->size, ti->rid);
-  }
-  */
-  SEN_LOG(sen_log_info, "n=%d (%s)", n, string);
-  if (n == 1 && (*tis)->cursors->n_entries == 1 && op == sen_sel_or
-      && !r->records->n_entries && !r->records->garbages
-      && r->record_unit == sen_rec_document && !r->max_n_subrecs
-      && sen_inv_max_section(i->inv) == 1) {
-    sen_inv_cursor *c = (*tis)->cursors->bins[0];
-    if ((rc = sen_set_array_init(r->records, (*tis)->size + 32768))) { goto exit; }
-    do {
-      recinfo *ri;
-      sen_inv_posting *p = c->post;
-      if ((weight = get_weight(r, p->rid, p->sid, wvm, optarg))) {
-        SEN_SET_INT_ADD(r->records, p, ri);
-        ri->score = (p->tf + p->score) * weight;
-        ri->n_subrecs = 1;
-      }
-    } while (!sen_inv_cursor_next(c));
-    goto exit;
-  }
+  qsort(tis, *n, sizeof(token_info *), token_compare);
+  return sen_success;
+}
+
+/* merges the cursors of the tokens of sen_index_select, and adds the
+   records matched to r, or to h. it stops at the rid hi, unless it is 0. */
+static void
+select_loop(token_info **tis, uint32_t n, btr *bt, topk *h, int prune,
+            sen_records *r, sen_sel_operator op, sen_sel_mode mode,
+            sen_wv_mode wvm, sen_select_optarg *optarg, sen_id hi)
+{
+  int rep, orp, weight, max_interval = 0;
+  token_info *ti, **tip, **tie = tis + n;
+  uint32_t rid, sid, nrid, nsid;
+  rep = (r->record_unit == sen_rec_position || r->subrec_unit == sen_rec_position);
+  orp = (r->record_unit == sen_rec_position || op == sen_sel_or);
+  if (mode == sen_sel_near) { max_interval = optarg->max_interval; }
   for (;;) {
     rid = (*tis)->p->rid;
     sid = (*tis)->p->sid;
+    if (hi && rid >= hi) { return; }
     for (tip = tis + 1, nrid = rid, nsid = sid + 1; tip < tie; tip++) {
       ti = *tip;
-      if (token_info_skip(ti, rid, sid)) { goto exit; }
+      if (token_info_skip(ti, rid, sid)) { return; }
       if (ti->p->rid != rid || ti->p->sid != sid) {
         nrid = ti->p->rid;
         nsid = ti->p->sid;
@@ -2353,6 +3582,17 @@ sen_index_select(sen_index *i, const char *string, unsigned int string_len,
     weight = get_weight(r, rid, sid, wvm, optarg);
     if (tip == tie && weight) {
       posinfo pi = {rid, sid, 0};
+      if (prune && h->n == h->max) {
+        int64_t bound;
+        uint32_t tf = (*tis)->p->tf, ts = 1;
+        for (tip = tis; tip < tie; tip++) {
+          if ((*tip)->p->tf < tf) { tf = (*tip)->p->tf; }
+          ts += (*tip)->p->score;
+        }
+        bound = (int64_t)(int)ts * weight;
+        if (bound > 0) { bound *= tf; }
+        if (topk_below(h, bound)) { goto next; }
+      }
       if (orp || sen_set_at(r->records, &pi, NULL)) {
         int count = 0, noccur = 0, pos = 0, score = 0, tscore = 0, min, max;
 
@@ -2412,16 +3652,278 @@ sen_index_select(sen_index *i, const char *string, unsigned int string_len,
             }
           }
         }
-        if (noccur && !rep) { res_add(r, &pi, (noccur + tscore) * weight, op); }
+        if (noccur && !rep) {
+          if (h) {
+            topk_add(h, r, rid, (noccur + tscore) * weight);
+          } else {
+            res_add(r, &pi, (noccur + tscore) * weight, op);
+          }
+        }
+      }
+    }
+  next :
+    if (token_info_skip(*tis, nrid, nsid)) { return; }
+  }
+}
+
+#define SELECT_PARALLEL_MIN_SIZE 0x10000
+
+/* a range of the rids of a parallel sen_index_select */
+typedef struct {
+  sen_index *i;
+  const char *string;
+  unsigned int string_len;
+  sen_select_optarg *optarg;
+  sen_wv_mode wvm;
+  sen_id lo;
+  sen_id hi;               /* 0 for the last range */
+  sen_records *r;
+  sen_ctx *ctx;            /* of the worker, kept by the ctx of the select */
+  sen_thread thread;
+  int started;
+  sen_rc rc;
+} select_part;
+
+/* opens the cursors of the tokens again in the ctx of the part, skips
+   them to the range, and merges them into the records of the range. */
+static void *
+select_work(void *arg)
+{
+  select_part *sp = arg;
+  sen_ctx *ctx = sp->ctx, *prev = sen_ctx_current();
+  sen_arena_mark mark;
+  btr *bt = NULL;
+  token_info **tis, **tip, **tie;
+  uint32_t n = 0;
+  sen_sel_mode mode = sp->optarg ? sp->optarg->mode : sen_sel_exact;
+  sen_ctx_use(ctx);
+  sen_arena_save(ctx, &mark);
+  if (!(tis = SEN_AMALLOC(sizeof(token_info *) * sp->string_len * 2))) {
+    sp->rc = sen_memory_exhausted;
+  } else {
+    if (!(sp->rc = select_tokens(sp->i, sp->string, sp->string_len, &mode, tis, &n, &bt))) {
+      for (tip = tis, tie = tis + n; tip < tie; tip++) {
+        if (token_info_skip(*tip, sp->lo, 0)) { break; }
+      }
+      if (tip == tie) {
+        select_loop(tis, n, bt, NULL, 0, sp->r, sen_sel_or, mode, sp->wvm, sp->optarg, sp->hi);
+      }
+    }
+    if (sp->rc == sen_other_error) { sp->rc = sen_success; }
+    for (tip = tis; tip < tis + n; tip++) {
+      if (*tip) { token_info_close(*tip); }
+    }
+    SEN_AFREE(tis);
+  }
+  bt_close(bt);
+  sen_arena_restore(ctx, &mark);
+  sen_ctx_use(prev);
+  return NULL;
+}
+
+/* the records of documents are added in the order of the rids, so they
+   are kept in a sorted array, until a rid out of the order is added. the
+   set stays a hash if the array can't be allocated. */
+inline static void
+records_array_init(sen_index *i, sen_records *r, sen_sel_operator op, uint32_t size)
+{
+  sen_id n = sen_sym_curr_id(i->keys);
+  if (op != sen_sel_or || r->record_unit != sen_rec_document ||
+      r->records->n_entries || r->records->garbages) { return; }
+  sen_set_array_init(r->records, (size < n ? size : n) + 1);
+}
+
+/* adds the records of s to r. */
+static sen_rc
+records_merge(sen_records *r, sen_records *s)
+{
+  void *key;
+  recinfo *ri, *si;
+  sen_set_cursor *c;
+  if (!(c = sen_set_cursor_open(s->records))) { return sen_memory_exhausted; }
+  while (sen_set_cursor_next(c, &key, (void **)&si)) {
+    if (!sen_set_get(r->records, key, (void **)&ri)) {
+      sen_set_cursor_close(c);
+      return sen_memory_exhausted;
+    }
+    ri->score += si->score;
+    ri->n_subrecs += si->n_subrecs;
+  }
+  sen_set_cursor_close(c);
+  return sen_success;
+}
+
+/* splits the rids into nthreads ranges. the first one is merged by the
+   cursors already opened in this thread, and each of the others by a
+   thread into records of its own, which are added to r at the end. the
+   threads use ctxs, which are the ctxs of the workers kept by the ctx of
+   this thread. */
+static sen_rc
+select_parallel(sen_index *i, const char *string, unsigned int string_len,
+                token_info **tis, uint32_t n, btr *bt, sen_records *r,
+                sen_sel_mode mode, sen_wv_mode wvm, sen_select_optarg *optarg,
+                sen_ctx **ctxs, int nthreads)
+{
+  int k;
+  sen_rc rc = sen_success;
+  sen_ctx *ctx = sen_ctx_current();
+  sen_id width = sen_sym_curr_id(i->keys) / nthreads + 1;
+  select_part *parts;
+  if (!(parts = SEN_MALLOC(sizeof(select_part) * nthreads))) { return sen_memory_exhausted; }
+  for (k = 1; k < nthreads; k++) {
+    select_part *sp = &parts[k];
+    sp->i = i;
+    sp->string = string;
+    sp->string_len = string_len;
+    sp->optarg = optarg;
+    sp->wvm = wvm;
+    sp->lo = 1 + width * k;
+    sp->hi = k + 1 < nthreads ? sp->lo + width : 0;
+    sp->started = 0;
+    sp->rc = sen_success;
+    sp->r = NULL;
+    sp->ctx = ctxs[k - 1];
+    if (!(sp->r = sen_records_open(r->record_unit, r->subrec_unit, 0))) {
+      rc = sen_memory_exhausted;
+      continue;
+    }
+    sp->r->keys = i->keys;
+    sp->r->ignore_deleted_records = r->ignore_deleted_records;
+    records_array_init(i, sp->r, sen_sel_or, (*tis)->size);
+    sp->started = !THREAD_CREATE(sp->thread, select_work, sp);
+  }
+  select_loop(tis, n, bt, NULL, 0, r, sen_sel_or, mode, wvm, optarg, 1 + width);
+  for (k = 1; k < nthreads; k++) {
+    select_part *sp = &parts[k];
+    if (!sp->r) { continue; }
+    if (sp->started) {
+      THREAD_JOIN(sp->thread);
+    } else {
+      select_work(sp);
+    }
+    if (!sp->rc) { sp->rc = records_merge(r, sp->r); }
+    if (sp->rc && !rc) { rc = sp->rc; }
+    sen_records_close(sp->r);
+  }
+  SEN_FREE(parts);
+  return rc;
+}
+
+sen_rc
+sen_index_select(sen_index *i, const char *string, unsigned int string_len,
+                 sen_records *r, sen_sel_operator op, sen_select_optarg *optarg)
+{
+  return sen_index_select_topk(i, string, string_len, r, op, optarg, 0);
+}
+
+sen_rc
+sen_index_select_topk(sen_index *i, const char *string, unsigned int string_len,
+                      sen_records *r, sen_sel_operator op, sen_select_optarg *optarg,
+                      int limit)
+{
+  sen_ctx *ctx = sen_ctx_current(), **ctxs;
+  sen_arena_mark mark;
+  btr *bt = NULL;
+  topk *h = NULL;
+  sen_rc rc = sen_success;
+  int weight, prune = 0, nthreads;
+  token_info **tis, **tip, **tie;
+  uint32_t n = 0;
+  sen_sel_mode mode = sen_sel_exact;
+  sen_wv_mode wvm = sen_wv_none;
+  if (!i || !r) { return sen_invalid_argument; }
+  if (optarg) {
+    mode = optarg->mode;
+    if (optarg->func) {
+      wvm = sen_wv_dynamic;
+    } else if (optarg->vector_size) {
+      wvm = optarg->weight_vector ? sen_wv_static : sen_wv_constant;
+    }
+  }
+  if (mode == sen_sel_similar) {
+    return sen_index_similar_search(i, string, string_len, r, op, optarg, limit);
+  }
+  if (mode == sen_sel_term_extract) {
+    return sen_index_term_extract(i, string, string_len, r, op, optarg);
+  }
+  limit = topk_limit(r, op, limit);
+  sen_arena_save(ctx, &mark);
+  if (!(tis = SEN_AMALLOC(sizeof(token_info *) * string_len * 2))) {
+    return sen_memory_exhausted;
+  }
+  r->keys = i->keys;
+  if ((rc = select_tokens(i, string, string_len, &mode, tis, &n, &bt))) {
+    if (rc == sen_other_error) { rc = sen_success; }
+    goto exit;
+  }
+  tie = tis + n;
+  /*
+  for (tip = tis; tip < tie; tip++) {
+    ti = *tip;
+    sen_log("o=%d n=%d s=%d r=%d", ti->offset, ti->ntoken, ti->size, ti->rid);
+  }
+  */
+  SEN_LOG(sen_log_info, "n=%d (%s)", n, string);
+  if (limit) {
+    if (!(h = topk_open(limit))) { rc = sen_memory_exhausted; goto exit; }
+    /* a phrase occurs no more times in a section than the least tf of its
+       tokens, unless a token has the postings of several terms. the
+       sections of a document are scored one by one, so it can be pruned
+       by it only if the document has one section. */
+    if (n > 1 && mode != sen_sel_near && sen_inv_max_section(i->inv) == 1) {
+      for (prune = 1, tip = tis; tip < tie; tip++) {
+        if ((*tip)->cursors->n_entries != 1) { prune = 0; }
       }
     }
-    if (token_info_skip(*tis, nrid, nsid)) { goto exit; }
+    if (n == 1 && (*tis)->cursors->n_entries == 1) {
+      sen_inv_cursor *c = (*tis)->cursors->bins[0];
+      do {
+        sen_inv_posting *p = c->post;
+        if ((weight = get_weight(r, p->rid, p->sid, wvm, optarg))) {
+          topk_add(h, r, p->rid, (p->tf + p->score) * weight);
+        }
+      } while (!sen_inv_cursor_next(c));
+      goto exit;
+    }
+  } else if (n == 1 && (*tis)->cursors->n_entries == 1 && op == sen_sel_or
+      && !r->records->n_entries && !r->records->garbages
+      && r->record_unit == sen_rec_document && !r->max_n_subrecs
+      && sen_inv_max_section(i->inv) == 1) {
+    sen_inv_cursor *c = (*tis)->cursors->bins[0];
+    if ((rc = sen_set_array_init(r->records, (*tis)->size + 32768))) { goto exit; }
+    do {
+      recinfo *ri;
+      sen_inv_posting *p = c->post;
+      if ((weight = get_weight(r, p->rid, p->sid, wvm, optarg))) {
+        SEN_SET_INT_ADD(r->records, p, ri);
+        ri->score = (p->tf + p->score) * weight;
+        ri->n_subrecs = 1;
+      }
+    } while (!sen_inv_cursor_next(c));
+    goto exit;
+  }
+  if (!h) { records_array_init(i, r, op, (*tis)->size); }
+  /* optarg->func may not be thread-safe, so it is called in this thread
+     only. the ctxs of the workers may be used by a select on another
+     thread sharing ctx, then this one is not run in parallel. */
+  if (ctx->select_nthreads > 1 && !h && op == sen_sel_or && !r->max_n_subrecs &&
+      wvm != sen_wv_dynamic && (*tis)->size >= SELECT_PARALLEL_MIN_SIZE &&
+      (ctxs = sen_ctx_select_ctxs_get(ctx, &nthreads))) {
+    rc = select_parallel(i, string, string_len, tis, n, bt, r, mode, wvm, optarg,
+                         ctxs, nthreads);
+    sen_ctx_select_ctxs_put(ctx);
+  } else {
+    select_loop(tis, n, bt, h, prune, r, op, mode, wvm, optarg, 0);
   }
 exit :
   for (tip = tis; tip < tis + n; tip++) {
     if (*tip) { token_info_close(*tip); }
   }
-  SEN_FREE(tis);
+  SEN_AFREE(tis);
+  if (h) {
+    sen_rc rc2 = topk_close(h, r);
+    if (!rc) { rc = rc2; }
+  }
   if (op == sen_sel_and) {
     recinfo *ri;
     sen_set_eh *eh;
@@ -2442,6 +3944,7 @@ exit :
   }
   sen_records_cursor_clear(r);
   bt_close(bt);
+  sen_arena_restore(ctx, &mark);
 #ifdef DEBUG
   {
     uint32_t segno = SEN_INV_MAX_SEGMENT, nnref = 0;
@@ -2457,7 +3960,7 @@ exit :
 sen_records *
 sen_index_sel(sen_index *i, const char *string, unsigned int string_len)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   ERRCLR(ctx);
   SEN_LOG(sen_log_info, "sen_index_sel > (%s)", string);
   {
@@ -2531,7 +4034,7 @@ records_heap_cmp(sen_records_heap *h, sen_records *r1, sen_records *r2)
 sen_records_heap *
 sen_records_heap_open(int size, int limit, sen_sort_optarg *optarg)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_records_heap *h = SEN_MALLOC(sizeof(sen_records_heap));
   if (!h) { return NULL; }
   h->bins = SEN_MALLOC(sizeof(sen_records *) * size);
@@ -2558,7 +4061,7 @@ sen_records_heap_open(int size, int limit, sen_sort_optarg *optarg)
 sen_rc
 sen_records_heap_add(sen_records_heap *h, sen_records *r)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (h->n_entries >= h->n_bins) {
     int size = h->n_bins * 2;
     sen_records **bins = SEN_REALLOC(h->bins, sizeof(sen_records *) * size);
@@ -2639,7 +4142,7 @@ sen_records_heap_head(sen_records_heap *h)
 sen_rc
 sen_records_heap_close(sen_records_heap *h)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   int i;
   if (!h) { return sen_invalid_argument; }
   for (i = h->n_entries; i--;) { sen_records_close(h->bins[i]); }
@@ -18,11 +18,15 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stddef.h>
 #include <sys/stat.h>
 
 #include "ctx.h"
 #include "sym.h"
 #include "inv.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
 
 /* v08 functions */
 
@@ -44,12 +48,31 @@ int sen_inv_entry_info08(sen_inv *inv, unsigned key, unsigned *a, unsigned *pock
                          unsigned *size_in_chunk, unsigned *pos_in_chunk,
                          unsigned *size_in_buffer, unsigned *pos_in_buffer);
 
+/* a thread of its own unmaps the segments beyond the map budget, so
+   that the selects and the updates don't. it is started by the first
+   sen_inv_seg_expire which finds them beyond it. */
+struct sen_inv_expirer {
+  sen_thread thread;
+  sen_mutex lock;               /* guards the below */
+  sen_cond cond;
+  int started;
+  int expiring;                 /* sen_inv_seg_expire is requested */
+  int closing;
+};
+
 struct _sen_inv {
   uint8_t v08p;
   sen_io *seg;
   sen_io *chunk;
   sen_sym *lexicon;
   struct sen_inv_header *header;
+  struct sen_inv_merger *merger;
+  volatile uint32_t epoch;
+  volatile uint32_t nreaders[2];       /* by the parity of the epoch */
+  struct _inv_retired *retired;        /* oldest first */
+  struct _inv_retired *retired_last;
+  uint32_t max_nmaps;                  /* or 0 for initial_n_segments * 2 */
+  struct sen_inv_expirer expirer;
 };
 
 struct sen_inv_header {
@@ -59,13 +82,76 @@ struct sen_inv_header {
   uint32_t amax;
   uint32_t bmax;
   uint32_t smax;
-  uint32_t reserved[7];
+  uint32_t flags;
+  uint32_t reserved[6];
   uint16_t ainfo[SEN_INV_MAX_SEGMENT];
   uint16_t binfo[SEN_INV_MAX_SEGMENT];
   uint8_t chunks[1]; /* dummy */
 };
 
+/* the outcome of a term in buffer_merge(), which is settled later by
+   merger_publish(). ndf is the number of its postings, and rid, sid
+   and pos are those of the only posting when it can be a sole one. */
+typedef struct {
+  uint32_t ndf;
+  uint32_t rid;
+  uint32_t sid;
+  uint32_t pos;
+} merge_term;
+
+/* a buffer segment handed to the merger thread. the segment is frozen,
+   and the updates to its terms go to the pending segment, which has the
+   same terms, until the merged chunk is published. */
+typedef struct _merger_job merger_job;
+
+struct _merger_job {
+  merger_job *next;
+  uint16_t seg;                 /* logical segment */
+  uint16_t sseg;                /* frozen segment */
+  uint16_t dseg;                /* pending segment */
+  uint8_t started;
+  uint8_t done;
+  sen_rc rc;
+  struct sen_inv_buffer *sb;
+  struct sen_inv_buffer *pb;
+  struct sen_inv_buffer *db;    /* the terms of sb in the merged chunk */
+  merge_term *mt;
+};
+
+struct sen_inv_merger {
+  sen_thread thread;
+  sen_mutex lock;               /* guards the below and header->chunks */
+  sen_cond cond;
+  merger_job *head;
+  merger_job *tail;
+  int closing;
+  uint32_t nqueued;             /* jobs not published yet */
+  uint32_t ndone;               /* jobs merged and not published yet */
+  uint32_t max_queued;
+  uint32_t nmerges;
+  uint32_t nwaits;
+  uint64_t total_usec;
+  uint64_t max_usec;
+  uint16_t pending[SEN_INV_MAX_SEGMENT];
+};
+
+/* a buffer segment and/or a chunk which a writer has replaced, and which
+   is not reused until the readers of the epoch have left. */
+typedef struct _inv_retired inv_retired;
+
+struct _inv_retired {
+  inv_retired *next;
+  uint32_t epoch;
+  uint16_t seg;                 /* or SEG_NOT_ASSIGNED */
+  uint32_t chunk;               /* or CHUNK_NOT_ASSIGNED */
+  uint32_t chunk_size;
+};
+
 #define SEN_INV_IDSTR "SENNA:INV:01.00"
+/* the idstr of the files whose header->flags is set, so that the
+   versions which don't know the flags don't take their chunks for the
+   plain layout */
+#define SEN_INV_IDSTR_FLAGS "SENNA:INV:01.01"
 #define SEN_INV_SEGMENT_SIZE 0x40000
 #define SEN_INV_CHUNK_SIZE   0x40000
 #define N_CHUNKS_PER_FILE (SEN_IO_FILE_SIZE / SEN_INV_CHUNK_SIZE)
@@ -76,6 +162,8 @@ struct sen_inv_header {
 #define CHUNK_NOT_ASSIGNED 0xffffffff
 #define SEG_NOT_ASSIGNED 0xffff
 
+#define INV_NREADERS(inv) ((inv)->nreaders[0] + (inv)->nreaders[1])
+
 #define SEGMENT_ARRAY 0x8000
 #define SEGMENT_BUFFER 0x4000
 #define SEGMENT_MASK (SEN_INV_MAX_SEGMENT - 1)
@@ -86,11 +174,22 @@ struct sen_inv_header {
 #define SEN_INV_INITIAL_N_SEGMENTS 512
 #define MAX_CHUNK_RATIO 64
 
+/* header->flags */
+#define CHUNK_WITH_SKIP 1
+#define CHUNK_BLOCK 2
+
+/* a skip entry is put at every SKIP_INTERVAL postings of a term in chunk */
+#define SKIP_INTERVAL 128
+
+/* with CHUNK_BLOCK, the terms which have BLOCK_SIZE postings or more
+   are put in blocks of BLOCK_SIZE postings, if they get smaller */
+#define BLOCK_SIZE 128
+
 #define NEXT_ADDR(p) (((byte *)(p)) + sizeof *(p))
 
 /* segment */
 
-inline static uint16_t
+static uint16_t
 segment_get(sen_inv *inv)
 {
   int i;
@@ -100,6 +199,14 @@ segment_get(sen_inv *inv)
   for (i = 0; i < SEN_INV_MAX_SEGMENT; i++) {
     if ((seg = inv->header->ainfo[i]) != SEG_NOT_ASSIGNED) { used[seg] = 1; }
     if ((seg = inv->header->binfo[i]) != SEG_NOT_ASSIGNED) { used[seg] = 1; }
+    if (inv->merger &&
+        (seg = inv->merger->pending[i]) != SEG_NOT_ASSIGNED) { used[seg] = 1; }
+  }
+  {
+    inv_retired *r;
+    for (r = inv->retired; r; r = r->next) {
+      if (r->seg != SEG_NOT_ASSIGNED) { used[r->seg] = 1; }
+    }
   }
   for (seg = 0; used[seg] && seg < SEN_INV_MAX_SEGMENT; seg++) ;
   return seg;
@@ -148,31 +255,151 @@ buffer_segment_new(sen_inv *inv, uint16_t *segno)
   }
 }
 
+/* the segments of the buffers and the arrays are kept mapped up to
+   max_nmaps. beyond it, the unreferenced ones are expired in the order of
+   their last reference (sen_io_mapinfo.count) down to 3/4 of max_nmaps,
+   so that the hot segments stay mapped, and the expiration runs only once
+   in a while. it is done by the expirer thread of inv. */
+
+#define NMAPS_LOW(n) ((n) - ((n) >> 2))
+
+typedef struct {
+  uint32_t age;
+  uint16_t pseg;
+} seg_age;
+
+static int
+seg_age_compare(const void *a, const void *b)
+{
+  uint32_t x = ((const seg_age *)a)->age, y = ((const seg_age *)b)->age;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+inline static uint32_t
+inv_max_nmaps(sen_inv *inv)
+{
+  return inv->max_nmaps ? inv->max_nmaps : inv->header->initial_n_segments * 2;
+}
+
+inline static int
+seg_age_add(sen_inv *inv, seg_age *ages, int n, uint16_t pseg)
+{
+  sen_io_mapinfo *info;
+  if (pseg == SEG_NOT_ASSIGNED) { return n; }
+  info = &inv->seg->maps[pseg];
+  if (!info->map || info->nref) { return n; }
+  ages[n].age = inv->seg->count - info->count;
+  ages[n].pseg = pseg;
+  return n + 1;
+}
+
+/* a reader which refers a segment being unmapped has to wait for it.
+   so that the segments are left mapped while there are readers, unless
+   it is done in background. amax and bmax may grow meanwhile by an
+   update. */
+static void
+seg_expire_lru(sen_inv *inv, uint32_t th, int background)
+{
+  seg_age *ages;
+  uint32_t i, n = 0, nmaps = inv->seg->nmaps;
+  uint32_t amax = inv->header->amax, bmax = inv->header->bmax;
+  if (nmaps <= th || (!background && INV_NREADERS(inv))) { return; }
+  if (!(ages = SEN_GMALLOC(sizeof(seg_age) * (amax + bmax + 1)))) { return; }
+  for (i = 0; i < bmax; i++) {
+    n = seg_age_add(inv, ages, n, inv->header->binfo[i]);
+  }
+  for (i = 0; i < amax; i++) {
+    n = seg_age_add(inv, ages, n, inv->header->ainfo[i]);
+  }
+  qsort(ages, n, sizeof(seg_age), seg_age_compare);
+  for (i = 0; i < n && inv->seg->nmaps > th; i++) {
+    if (!background && INV_NREADERS(inv)) { break; }
+    sen_io_seg_expire(inv->seg, ages[i].pseg, 0);
+  }
+  SEN_GFREE(ages);
+  SEN_LOG(sen_log_notice, "expired(%u) (%u -> %u)", th, nmaps, inv->seg->nmaps);
+}
+
+static void *
+expirer_work(void *arg)
+{
+  sen_inv *inv = arg;
+  struct sen_inv_expirer *e = &inv->expirer;
+  MUTEX_LOCK(e->lock);
+  for (;;) {
+    while (!e->expiring && !e->closing) { COND_WAIT(e->cond, e->lock); }
+    if (e->closing) { break; }
+    MUTEX_UNLOCK(e->lock);
+    seg_expire_lru(inv, NMAPS_LOW(inv_max_nmaps(inv)), 1);
+    MUTEX_LOCK(e->lock);
+    e->expiring = 0;
+  }
+  MUTEX_UNLOCK(e->lock);
+  return NULL;
+}
+
+inline static void
+expirer_init(sen_inv *inv)
+{
+  struct sen_inv_expirer *e = &inv->expirer;
+  e->started = 0;
+  e->expiring = 0;
+  e->closing = 0;
+  MUTEX_INIT(e->lock);
+  COND_INIT(e->cond);
+}
+
+static void
+expirer_stop(sen_inv *inv)
+{
+  int started;
+  struct sen_inv_expirer *e = &inv->expirer;
+  MUTEX_LOCK(e->lock);
+  e->closing = 1;
+  started = e->started;
+  COND_BROADCAST(e->cond);
+  MUTEX_UNLOCK(e->lock);
+  if (started) { THREAD_JOIN(e->thread); }
+  MUTEX_DESTROY(e->lock);
+}
+
+/* threshold < 0 for the budget given by sen_inv_set_map_budget, which is
+   kept by the expirer thread. they are expired by the caller only if the
+   thread can't be started. */
 void
 sen_inv_seg_expire(sen_inv *inv, int32_t threshold)
 {
-  uint16_t seg;
-  uint32_t th, nmaps;
+  uint32_t max;
+  struct sen_inv_expirer *e = &inv->expirer;
   if (inv->v08p) { sen_inv_seg_expire08(inv); return; }
-  th = (threshold < 0) ? (inv->header->initial_n_segments * 2) : (uint32_t) threshold;
-  if ((nmaps = inv->seg->nmaps) <= th) { return; }
-  for (seg = inv->header->bmax; seg && (inv->seg->nmaps > th); seg--) {
-    uint16_t pseg = inv->header->binfo[seg - 1];
-    if (pseg != SEG_NOT_ASSIGNED) {
-      sen_io_mapinfo *info = &inv->seg->maps[pseg];
-      uint32_t *pnref = &inv->seg->nrefs[pseg];
-      if (info->map && !*pnref) { sen_io_seg_expire(inv->seg, pseg, 0); }
+  if (threshold >= 0) {
+    seg_expire_lru(inv, (uint32_t) threshold, 0);
+    return;
+  }
+  if (inv->seg->nmaps <= (max = inv_max_nmaps(inv))) { return; }
+  MUTEX_LOCK(e->lock);
+  if (!e->started && !e->closing) {
+    if (THREAD_CREATE(e->thread, expirer_work, inv)) {
+      MUTEX_UNLOCK(e->lock);
+      SEN_LOG(sen_log_alert, "sen_inv_seg_expire: thread create failed");
+      seg_expire_lru(inv, NMAPS_LOW(max), 0);
+      return;
     }
+    e->started = 1;
   }
-  for (seg = inv->header->amax; seg && (inv->seg->nmaps > th); seg--) {
-    uint16_t pseg = inv->header->ainfo[seg - 1];
-    if (pseg != SEG_NOT_ASSIGNED) {
-      sen_io_mapinfo *info = &inv->seg->maps[pseg];
-      uint32_t *pnref = &inv->seg->nrefs[pseg];
-      if (info->map && !*pnref) { sen_io_seg_expire(inv->seg, pseg, 0); }
-    }
+  if (!e->expiring) {
+    e->expiring = 1;
+    COND_BROADCAST(e->cond);
   }
-  SEN_LOG(sen_log_notice, "expired(%d) (%u -> %u)", threshold, nmaps, inv->seg->nmaps);
+  MUTEX_UNLOCK(e->lock);
+}
+
+sen_rc
+sen_inv_set_map_budget(sen_inv *inv, uint32_t size_mb)
+{
+  if (!inv || inv->v08p) { return sen_invalid_argument; }
+  inv->max_nmaps = size_mb * ((1 << 20) / SEN_INV_SEGMENT_SIZE);
+  return sen_success;
 }
 
 /* chunk */
@@ -216,6 +443,90 @@ chunk_free(sen_inv *inv, int start, uint32_t size)
   return sen_success;
 }
 
+/* epoch */
+
+/* the readers take no lock. a buffer segment or a chunk which a writer
+   has replaced is retired, and is not reused until the readers which
+   might have seen it have left. a reader enters the current epoch, and
+   the writer moves to the next epoch only when no reader is left in the
+   one before the current. what is retired in an epoch is reclaimed two
+   epochs later. the readers are counted in process memory, so that the
+   readers in other processes are not waited for. */
+
+inline static uint32_t
+inv_enter(sen_inv *inv)
+{
+  uint32_t e, n;
+  for (;;) {
+    e = inv->epoch;
+    SEN_ATOMIC_ADD_EX(&inv->nreaders[e & 1], 1, n);
+    SEN_MEMORY_BARRIER();
+    if (inv->epoch == e) { return e; }
+    SEN_ATOMIC_ADD_EX(&inv->nreaders[e & 1], -1, n);
+  }
+}
+
+inline static void
+inv_leave(sen_inv *inv, uint32_t e)
+{
+  uint32_t n;
+  SEN_MEMORY_BARRIER();
+  SEN_ATOMIC_ADD_EX(&inv->nreaders[e & 1], -1, n);
+}
+
+/* called by the writer after seg and chunk are unlinked. they are freed
+   at once if it runs out of memory, as they were before. */
+static void
+inv_retire(sen_inv *inv, uint16_t seg, uint32_t chunk, uint32_t chunk_size)
+{
+  inv_retired *r;
+  if (!(r = SEN_GMALLOC(sizeof(inv_retired)))) {
+    if (chunk != CHUNK_NOT_ASSIGNED) {
+      if (inv->merger) { MUTEX_LOCK(inv->merger->lock); }
+      chunk_free(inv, chunk, chunk_size);
+      if (inv->merger) { MUTEX_UNLOCK(inv->merger->lock); }
+    }
+    return;
+  }
+  SEN_MEMORY_BARRIER();
+  r->next = NULL;
+  r->epoch = inv->epoch;
+  r->seg = seg;
+  r->chunk = chunk;
+  r->chunk_size = chunk_size;
+  if (inv->retired_last) {
+    inv->retired_last->next = r;
+  } else {
+    inv->retired = r;
+  }
+  inv->retired_last = r;
+}
+
+/* reclaims what no reader can see. all of them if allp. */
+static void
+inv_reclaim(sen_inv *inv, int allp)
+{
+  inv_retired *r;
+  uint32_t e = inv->epoch;
+  while ((r = inv->retired)) {
+    if (!allp && e - r->epoch < 2) {
+      if (inv->nreaders[(e + 1) & 1]) { break; }
+      SEN_MEMORY_BARRIER();
+      inv->epoch = ++e;
+      SEN_MEMORY_BARRIER();
+      continue;
+    }
+    if (r->chunk != CHUNK_NOT_ASSIGNED) {
+      if (inv->merger) { MUTEX_LOCK(inv->merger->lock); }
+      chunk_free(inv, r->chunk, r->chunk_size);
+      if (inv->merger) { MUTEX_UNLOCK(inv->merger->lock); }
+    }
+    inv->retired = r->next;
+    SEN_GFREE(r);
+  }
+  if (!inv->retired) { inv->retired_last = NULL; }
+}
+
 /* buffer */
 
 typedef struct {
@@ -261,6 +572,24 @@ buffer_open(sen_inv *inv, uint32_t pos, buffer_term **bt, buffer **b)
   return pseg;
 }
 
+/* opens the buffer which the updates to the term at pos go to. it is the
+   pending segment while the buffer of the term is being merged. */
+inline static uint16_t
+buffer_open_pending(sen_inv *inv, uint32_t pos, buffer_term **bt, buffer **b)
+{
+  byte *p = NULL;
+  uint16_t pseg;
+  if (!inv->merger ||
+      (pseg = inv->merger->pending[pos >> W_OF_SEGMENT]) == SEG_NOT_ASSIGNED) {
+    return buffer_open(inv, pos, bt, b);
+  }
+  SEN_IO_SEG_REF(inv->seg, pseg, p);
+  if (!p) { return SEG_NOT_ASSIGNED; }
+  if (b) { *b = (buffer *)p; }
+  if (bt) { *bt = (buffer_term *)(p + (pos & BUFFER_MASK_IN_A_SEGMENT)); }
+  return pseg;
+}
+
 inline static sen_rc
 buffer_close(sen_inv *inv, uint16_t pseg)
 {
@@ -277,6 +606,9 @@ buffer_open_if_capable(sen_inv *inv, int32_t seg, int size, buffer **b)
 {
   uint16_t pseg;
   uint32_t pos = ((uint32_t) seg) * SEN_INV_SEGMENT_SIZE;
+  if (inv->merger && inv->merger->pending[seg] != SEG_NOT_ASSIGNED) {
+    return SEG_NOT_ASSIGNED;
+  }
   if ((pseg = buffer_open(inv, pos, NULL, b)) != SEG_NOT_ASSIGNED) {
     uint16_t nterms = (*b)->header.nterms - (*b)->header.nterms_void;
     if (!((nterms < 4096 ||
@@ -459,6 +791,7 @@ sen_inv_check(sen_inv *inv)
   uint16_t nseg0 = inv->header->initial_n_segments;
   uint16_t pseg, seg, nsegs = 0;
   uint16_t segmax = (uint16_t) (inv->header->total_chunk_size >> 7) + nseg0;
+  uint32_t e = inv_enter(inv);
   for (seg = 0; seg < segmax; seg++) {
     if (inv->header->binfo[seg] == SEG_NOT_ASSIGNED) { continue; }
     pos = ((uint32_t) seg) * SEN_INV_SEGMENT_SIZE;
@@ -467,6 +800,7 @@ sen_inv_check(sen_inv *inv)
     total_nterms += buffer_check(b, &nerrors);
     buffer_close(inv, pseg);
   }
+  inv_leave(inv, e);
   sen_log("sen_inv_check done nsegs=%d total_nterms=%d", nsegs, total_nterms);
   return nerrors;
 }
@@ -519,6 +853,7 @@ buffer_put(buffer *b, buffer_term *bt, buffer_rec *rnew, uint8_t *bs,
     if (!*lastp) {
       rnew->step = 0;
       rnew->jump = 0;
+      SEN_MEMORY_BARRIER();
       *lastp = pos;
       if (bt->size_in_buffer++ > 1) {
         buffer_rec *rhead = BUFFER_REC_AT(b, bt->pos_in_buffer);
@@ -574,6 +909,7 @@ buffer_put(buffer *b, buffer_term *bt, buffer_rec *rnew, uint8_t *bs,
       }
       rnew->step = step;
       rnew->jump = check_jump(b, rnew, jump) ? 0 : jump;
+      SEN_MEMORY_BARRIER();
       *lastp = pos;
       break;
     }
@@ -669,7 +1005,7 @@ sen_inv_updspec *
 sen_inv_updspec_open(uint32_t rid, uint32_t sid)
 {
   sen_inv_updspec *u;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!(u = SEN_MALLOC(sizeof(sen_inv_updspec)))) { return NULL; }
   u->rid = rid;
   u->sid = sid;
@@ -688,7 +1024,7 @@ sen_rc
 sen_inv_updspec_add(sen_inv_updspec *u, int pos, int32_t weight)
 {
   struct _sen_inv_pos *p;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   u->atf++;
   if (u->tf >= SEN_INV_MAX_TF) { return sen_success; }
   if (!(p = SEN_MALLOC(sizeof(struct _sen_inv_pos)))) {
@@ -726,7 +1062,7 @@ sen_inv_updspec_cmp(sen_inv_updspec *a, sen_inv_updspec *b)
 sen_rc
 sen_inv_updspec_close(sen_inv_updspec *u)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   struct _sen_inv_pos *p = u->pos, *q;
   while (p) {
     q = p->next;
@@ -740,7 +1076,7 @@ sen_inv_updspec_close(sen_inv_updspec *u)
 inline static uint8_t *
 encode_rec(sen_inv_updspec *u, unsigned int *size, int deletep)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   uint8_t *br, *p;
   struct _sen_inv_pos *pp;
   uint32_t lpos, tf, score;
@@ -774,7 +1110,7 @@ encode_rec(sen_inv_updspec *u, unsigned int *size, int deletep)
 inline static int
 sym_deletable(uint32_t tid, sen_set *h)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_inv_updspec **u;
   if (!h) { return 1; }
   if (!sen_set_at(h, &tid, (void **) &u)) {
@@ -917,61 +1253,469 @@ typedef struct {
   p = p2;\
 }
 
-inline static sen_rc
-buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
+/* a term in chunk is laid out as
+     B(doc size) doc pos
+   or, with CHUNK_WITH_SKIP,
+     B(doc size << 1 | 1) B(skip size) skip doc pos
+     B(doc size << 1) doc pos
+   the skip is a list of
+     B(rid gap) B(sid << 2 | flags >> 1) B(doc gap) B(pos gap)
+   rid, sid and flags are the state of the decoder before the first
+   posting of a block, and doc and pos are the offsets of the block
+   in doc and pos. */
+
+#define SKIP_ENC(sk,lsk,p) {\
+  uint32_t _g;\
+  _g = (sk).rid - (lsk).rid; SEN_B_ENC(_g, p);\
+  _g = ((sk).sid << 2) + ((sk).flags >> 1); SEN_B_ENC(_g, p);\
+  _g = (sk).doc - (lsk).doc; SEN_B_ENC(_g, p);\
+  _g = (sk).pos - (lsk).pos; SEN_B_ENC(_g, p);\
+}
+
+#define SKIP_DEC(sk,p) {\
+  uint32_t _g;\
+  SEN_B_DEC(_g, p); (sk).rid += _g;\
+  SEN_B_DEC(_g, p); (sk).sid = _g >> 2; (sk).flags = (_g & 3) << 1;\
+  SEN_B_DEC(_g, p); (sk).doc += _g;\
+  SEN_B_DEC(_g, p); (sk).pos += _g;\
+}
+
+/* with CHUNK_BLOCK, a term in chunk is laid out as
+     B(doc size << 1) doc pos
+     B(number of postings << 1 | 1) B(size) block...
+   where size is what the term takes in the former layout, which it
+   gets back in buffer_flush. a block holds BLOCK_SIZE postings, or
+   the rest of them, as
+     B(rid gap) B(sid) B(flags) B(doc size) doc B(pos size) pos
+   rid gap and sid are of the last posting of the block, doc is the
+   packed rid gaps, tf - 1, sid gaps - 1 and scores of the postings,
+   the last two only if flags say so, and pos is the packed position
+   gaps, BLOCK_SIZE at a time.
+   n integers are packed as
+     b B(number of exceptions) word... (index B(v >> b))...
+   that is, each of them is cut to b bits, and the bits above are put
+   in the exceptions. the i-th integer goes to the lane i % 4 of the
+   words, so that four of them are unpacked at a time. */
+
+#define BLOCK_WITH_SID   1
+#define BLOCK_WITH_SCORE 2
+
+#define PACK_WORDS(n,b) ((((((n) + 3) >> 2) * (b) + 31) >> 5) << 2)
+
+struct sen_inv_block {
+  uint32_t rest;     /* postings of the blocks not loaded yet */
+  uint32_t n;        /* postings of the loaded block */
+  uint32_t i;        /* next posting of the loaded block */
+  sen_id rid;        /* last rid loaded or skipped */
+  uint32_t sid;      /* last sid loaded or skipped */
+  uint8_t *pp;       /* positions of the loaded block not unpacked yet */
+  uint32_t prest;
+  uint32_t pn;       /* positions unpacked */
+  uint32_t pi;
+  uint32_t rids[BLOCK_SIZE];
+  uint32_t sids[BLOCK_SIZE];
+  uint32_t tfs[BLOCK_SIZE];
+  uint32_t scores[BLOCK_SIZE];
+  uint32_t pos[BLOCK_SIZE];
+};
+
+inline static uint32_t
+b_enc_size(uint32_t v)
 {
-  buffer *sb, *db = NULL;
-  sen_rc rc = sen_success;
-  sen_io_win sw, dw;
-  uint8_t *tc, *tp, *dc, *sc = NULL;
-  uint16_t ss, ds, pseg;
-  uint32_t scn, dcn, max_dest_chunk_size;
-  ss = inv->header->binfo[seg];
-  if (ss == SEG_NOT_ASSIGNED) { return sen_invalid_format; }
-  pseg = buffer_open(inv, seg * SEN_INV_SEGMENT_SIZE, NULL, &sb);
-  if (pseg == SEG_NOT_ASSIGNED) { return sen_memory_exhausted; }
-  if ((ds = segment_get(inv)) == SEN_INV_MAX_SEGMENT) {
-    buffer_close(inv, pseg);
-    return sen_memory_exhausted;
+  return v < 0x8f ? 1 : v < 0x408f ? 2 : v < 0x20408f ? 3 : v < 0x1020408f ? 4 : 5;
+}
+
+inline static uint32_t
+bit_length(uint32_t v)
+{
+#ifdef __GNUC__
+  return v ? 32 - __builtin_clz(v) : 0;
+#else /* __GNUC__ */
+  uint32_t l = 0;
+  while (v) { l++; v >>= 1; }
+  return l;
+#endif /* __GNUC__ */
+}
+
+/* packs v[0..n) at p. returns NULL if it doesn't fit before pe. */
+static uint8_t *
+pack(const uint32_t *v, uint32_t n, uint8_t *p, uint8_t *pe)
+{
+  uint32_t i, l, b, o, x, w, size, nexc = 0, best = 0, bits[33];
+  uint32_t words[BLOCK_SIZE];
+  memset(bits, 0, sizeof(bits));
+  for (i = 0; i < n; i++) { bits[bit_length(v[i])]++; }
+  /* the size of an exception is estimated by the bit length of v >> b */
+  for (b = 0, w = 0; w <= 32; w++) {
+    size = PACK_WORDS(n, w) * 4;
+    for (l = w + 1; l <= 32; l++) {
+      x = l - w;
+      size += bits[l] * (x <= 7 ? 2 : x <= 14 ? 3 : x <= 21 ? 4 : x <= 28 ? 5 : 6);
+    }
+    if (!w || size < best) {
+      best = size;
+      b = w;
+    }
   }
-  SEN_IO_SEG_REF(inv->seg, ds, db);
-  if (!db) {
-    buffer_close(inv, pseg);
-    return sen_memory_exhausted;
+  size = 1 + PACK_WORDS(n, b) * 4;
+  if (b < 32) {
+    for (i = 0; i < n; i++) {
+      if ((x = v[i] >> b)) {
+        nexc++;
+        size += 1 + b_enc_size(x);
+      }
+    }
   }
-  memset(db, 0, SEN_INV_SEGMENT_SIZE);
-  max_dest_chunk_size = sb->header.chunk_size + SEN_INV_SEGMENT_SIZE;
-  if (!(tc = SEN_MALLOC(max_dest_chunk_size * 2))) {
-    buffer_close(inv, pseg);
-    SEN_IO_SEG_UNREF(inv->seg, ds);
-    return sen_memory_exhausted;
+  size += b_enc_size(nexc);
+  if (p + size > pe) { return NULL; }
+  *p++ = b;
+  SEN_B_ENC(nexc, p);
+  if (b) {
+    w = PACK_WORDS(n, b);
+    memset(words, 0, w * sizeof(uint32_t));
+    for (l = 0; l < 4; l++) {
+      for (i = l, o = 0; i < n; i += 4, o += b) {
+        x = b < 32 ? v[i] & ((1U << b) - 1) : v[i];
+        words[((o >> 5) << 2) + l] |= x << (o & 31);
+        if ((o & 31) + b > 32) { words[((o >> 5) << 2) + 4 + l] |= x >> (32 - (o & 31)); }
+      }
+    }
+    memcpy(p, words, w * sizeof(uint32_t));
+    p += w * sizeof(uint32_t);
+  }
+  for (i = 0; nexc && i < n; i++) {
+    if ((x = v[i] >> b)) {
+      *p++ = i;
+      SEN_B_ENC(x, p);
+      nexc--;
+    }
   }
-  tp = tc + max_dest_chunk_size;
-  if (chunk_new(inv, &dcn, max_dest_chunk_size)) {
-    buffer_close(inv, pseg);
-    SEN_IO_SEG_UNREF(inv->seg, ds);
-    SEN_FREE(tc);
-    return sen_memory_exhausted;
+  return p;
+}
+
+/* unpacks n integers at p into v, which must have room for them
+   rounded up to a multiple of 4. returns the end of them. */
+inline static uint8_t *
+unpack(uint8_t *p, uint32_t n, uint32_t *v)
+{
+  uint32_t i, b = *p++, m = (n + 3) >> 2, nexc, x;
+  SEN_B_DEC(nexc, p);
+  if (!b) {
+    memset(v, 0, m * 4 * sizeof(uint32_t));
+  } else {
+    uint32_t mask = b < 32 ? (1U << b) - 1 : 0xffffffff, o = 0;
+#ifdef __SSE2__
+    uint8_t *wp = p;
+    __m128i in = _mm_loadu_si128((__m128i *)wp), y;
+    __m128i vmask = _mm_set1_epi32((int)mask);
+    for (i = 0; i < m; i++) {
+      y = _mm_srl_epi32(in, _mm_cvtsi32_si128(o));
+      o += b;
+      if (o > 32) {
+        wp += 16;
+        in = _mm_loadu_si128((__m128i *)wp);
+        o -= 32;
+        y = _mm_or_si128(y, _mm_sll_epi32(in, _mm_cvtsi32_si128(b - o)));
+      } else if (o == 32) {
+        if (i + 1 < m) {
+          wp += 16;
+          in = _mm_loadu_si128((__m128i *)wp);
+        }
+        o = 0;
+      }
+      _mm_storeu_si128((__m128i *)(v + (i << 2)), _mm_and_si128(y, vmask));
+    }
+#else /* __SSE2__ */
+    uint32_t l, y;
+    for (l = 0; l < 4; l++) {
+      for (i = 0, o = 0; i < m; i++, o += b) {
+        uint8_t *wp = p + (((o >> 5) << 2) + l) * sizeof(uint32_t);
+        memcpy(&x, wp, sizeof(uint32_t));
+        x >>= o & 31;
+        if ((o & 31) + b > 32) {
+          memcpy(&y, wp + 4 * sizeof(uint32_t), sizeof(uint32_t));
+          x |= y << (32 - (o & 31));
+        }
+        v[(i << 2) + l] = x & mask;
+      }
+    }
+#endif /* __SSE2__ */
+    p += PACK_WORDS(n, b) * sizeof(uint32_t);
   }
-  //  sen_log("db=%p ds=%d sb=%p seg=%d", db, ds, sb, seg);
+  while (nexc--) {
+    i = *p++;
+    SEN_B_DEC(x, p);
+    v[i] |= x << b;
+  }
+  return p;
+}
+
+inline static uint8_t *
+unpack_skip(uint8_t *p, uint32_t n)
+{
+  uint32_t b = *p++, nexc;
+  SEN_B_DEC(nexc, p);
+  p += PACK_WORDS(n, b) * sizeof(uint32_t);
+  while (nexc--) {
+    p++;
+    SEN_B_SKIP(p);
+  }
+  return p;
+}
+
+/* puts the postings d[0..n) and their positions, B encoded at tp, in
+   blocks at p. returns NULL if they don't fit before pe. */
+static uint8_t *
+block_term_enc(docinfo *d, uint32_t n, uint8_t *tp, uint8_t *p, uint8_t *pe)
+{
+  uint32_t size = (uint32_t)(pe - p);
+  uint32_t i, j, k, m, x, flags, npos;
+  uint32_t v[4][BLOCK_SIZE];
+  uint8_t doc[4 * (BLOCK_SIZE * 4 + 8)], *q;
+  sen_id lrid = 0, brid = 0;
+  uint32_t lsid = 0;
+  if (p + 10 > pe) { return NULL; }
+  x = (n << 1) + 1;
+  SEN_B_ENC(x, p);
+  SEN_B_ENC(size, p);
+  for (i = 0; i < n; i += m) {
+    m = n - i < BLOCK_SIZE ? n - i : BLOCK_SIZE;
+    flags = 0;
+    npos = 0;
+    for (j = 0; j < m; j++, d++) {
+      v[0][j] = d->rid - lrid;
+      v[1][j] = d->tf - 1;
+      v[2][j] = (v[0][j] ? d->sid : d->sid - lsid) - 1;
+      v[3][j] = d->score;
+      if (v[2][j]) { flags |= BLOCK_WITH_SID; }
+      if (v[3][j]) { flags |= BLOCK_WITH_SCORE; }
+      npos += d->tf;
+      lrid = d->rid;
+      lsid = d->sid;
+    }
+    if (!(q = pack(v[0], m, doc, doc + sizeof(doc))) ||
+        !(q = pack(v[1], m, q, doc + sizeof(doc))) ||
+        ((flags & BLOCK_WITH_SID) && !(q = pack(v[2], m, q, doc + sizeof(doc)))) ||
+        ((flags & BLOCK_WITH_SCORE) && !(q = pack(v[3], m, q, doc + sizeof(doc))))) {
+      return NULL;
+    }
+    x = (uint32_t)(q - doc);
+    if (p + 25 + x > pe) { return NULL; }
+    k = lrid - brid;
+    SEN_B_ENC(k, p);
+    SEN_B_ENC(lsid, p);
+    SEN_B_ENC(flags, p);
+    SEN_B_ENC(x, p);
+    memcpy(p, doc, x);
+    p += x;
+    /* the positions are packed after room for their size */
+    for (q = p + 5, j = 0; j < npos; j += k) {
+      k = npos - j < BLOCK_SIZE ? npos - j : BLOCK_SIZE;
+      for (x = 0; x < k; x++) { SEN_B_DEC(v[0][x], tp); }
+      if (!(q = pack(v[0], k, q, pe))) { return NULL; }
+    }
+    x = (uint32_t)(q - (p + 5));
+    q = p;
+    SEN_B_ENC(x, q);
+    memmove(q, p + 5, x);
+    p = q + x;
+    brid = lrid;
+  }
+  return p;
+}
+
+/* loads the block at p into blk. returns the next block. */
+static uint8_t *
+block_load(struct sen_inv_block *blk, uint8_t *p)
+{
+  uint32_t j, x, flags, npos = 0;
+  uint32_t m = blk->rest < BLOCK_SIZE ? blk->rest : BLOCK_SIZE;
+  sen_id rid = blk->rid;
+  uint32_t sid = blk->sid;
+  SEN_B_SKIP(p);
+  SEN_B_SKIP(p);
+  SEN_B_DEC(flags, p);
+  SEN_B_SKIP(p);
+  p = unpack(p, m, blk->rids);
+  p = unpack(p, m, blk->tfs);
+  if (flags & BLOCK_WITH_SID) { p = unpack(p, m, blk->sids); }
+  if (flags & BLOCK_WITH_SCORE) {
+    p = unpack(p, m, blk->scores);
+  } else {
+    memset(blk->scores, 0, m * sizeof(uint32_t));
+  }
+  for (j = 0; j < m; j++) {
+    if (blk->rids[j]) {
+      rid += blk->rids[j];
+      sid = 0;
+    }
+    sid += (flags & BLOCK_WITH_SID) ? blk->sids[j] + 1 : 1;
+    blk->rids[j] = rid;
+    blk->sids[j] = sid;
+    npos += ++blk->tfs[j];
+  }
+  SEN_B_DEC(x, p);
+  blk->pp = p;
+  blk->prest = npos;
+  blk->pn = 0;
+  blk->pi = 0;
+  blk->rid = rid;
+  blk->sid = sid;
+  blk->rest -= m;
+  blk->n = m;
+  blk->i = 0;
+  return p + x;
+}
+
+inline static uint32_t
+block_next_pos(struct sen_inv_block *blk)
+{
+  if (blk->pi == blk->pn) {
+    uint32_t m = blk->prest < BLOCK_SIZE ? blk->prest : BLOCK_SIZE;
+    blk->pp = unpack(blk->pp, m, blk->pos);
+    blk->prest -= m;
+    blk->pn = m;
+    blk->pi = 0;
+  }
+  return blk->pos[blk->pi++];
+}
+
+/* passes over k positions. the whole packs of them are not unpacked. */
+inline static void
+block_skip_pos(struct sen_inv_block *blk, uint32_t k)
+{
+  uint32_t m;
+  while (k > blk->pn - blk->pi) {
+    k -= blk->pn - blk->pi;
+    if (!(m = blk->prest < BLOCK_SIZE ? blk->prest : BLOCK_SIZE)) { return; }
+    if (k >= m) {
+      blk->pp = unpack_skip(blk->pp, m);
+      blk->pn = 0;
+      k -= m;
+    } else {
+      blk->pp = unpack(blk->pp, m, blk->pos);
+      blk->pn = m;
+    }
+    blk->pi = 0;
+    blk->prest -= m;
+  }
+  blk->pi += k;
+}
+
+/* returns the doc part of a term in chunk at p, and sets its size.
+   if the term is block coded, n is set to the number of postings
+   and the first block is returned. */
+inline static uint8_t *
+chunk_term_open(sen_inv *inv, uint8_t *p, uint32_t *size, uint32_t *n,
+                uint8_t **sp, uint8_t **spe)
+{
+  uint32_t o, s;
+  uint8_t *sp_ = NULL, *spe_ = NULL;
+  SEN_B_DEC(o, p);
+  *n = 0;
+  if (inv->header->flags & CHUNK_BLOCK) {
+    if (o & 1) {
+      *n = o >> 1;
+      o = 0;
+      SEN_B_SKIP(p);
+    } else {
+      o >>= 1;
+    }
+  } else if (inv->header->flags & CHUNK_WITH_SKIP) {
+    if (o & 1) {
+      SEN_B_DEC(s, p);
+      sp_ = p;
+      spe_ = p += s;
+    }
+    o >>= 1;
+  }
+  if (sp) {
+    *sp = sp_;
+    *spe = spe_;
+  }
+  *size = o;
+  return p;
+}
+
+/* returns how much the block coded terms in chunk sc grow when they are
+   put back in the former layout. */
+static uint32_t
+chunk_expansion(buffer *sb, uint8_t *sc)
+{
+  uint32_t i, x, size, e = 0;
+  buffer_term *bt;
+  for (i = 0, bt = sb->terms; i < sb->header.nterms; i++, bt++) {
+    if (bt->tid && bt->size_in_chunk) {
+      uint8_t *p = sc + bt->pos_in_chunk;
+      SEN_B_DEC(x, p);
+      if (x & 1) {
+        SEN_B_DEC(size, p);
+        if (size > bt->size_in_chunk) { e += size - bt->size_in_chunk; }
+      }
+    }
+  }
+  return e;
+}
+
+#define MERGER_LOCK(inv,mt) if (mt) { MUTEX_LOCK((inv)->merger->lock); }
+#define MERGER_UNLOCK(inv,mt) if (mt) { MUTEX_UNLOCK((inv)->merger->lock); }
+
+/* merges the buffer sb and its chunk into a new chunk, and puts the
+   terms of sb with their places in the new chunk to db. the old chunk
+   is left to the caller. if mt is given, the terms are not removed nor
+   made sole postings here, but their outcomes are put to mt. */
+static sen_rc
+buffer_merge(sen_inv *inv, sen_ctx *ctx, buffer *sb, buffer *db, merge_term *mt, sen_set *h)
+{
+  sen_rc rc = sen_success;
+  sen_io_win sw, dw;
+  uint8_t *tc, *tp, *ts, *dc, *sc = NULL;
+  uint32_t scn, dcn, max_dest_chunk_size, nod = 0;
+  docinfo *od = NULL;
+  int skipp = inv->header->flags & CHUNK_WITH_SKIP;
+  int blockp = inv->header->flags & CHUNK_BLOCK;
   if ((scn = sb->header.chunk) != CHUNK_NOT_ASSIGNED) {
     sc = sen_io_win_map(inv->chunk, ctx, &sw, scn, 0, sb->header.chunk_size, SEN_IO_COPY);
     if (!sc) {
       SEN_LOG(sen_log_alert, "io_win_map(%d, %d) failed!", scn, sb->header.chunk_size);
-      buffer_close(inv, pseg);
-      SEN_IO_SEG_UNREF(inv->seg, ds);
+      return sen_memory_exhausted;
+    }
+  }
+  max_dest_chunk_size = sb->header.chunk_size + SEN_INV_SEGMENT_SIZE;
+  /* skip entries take less than 1/8 of the postings */
+  if (skipp) { max_dest_chunk_size += max_dest_chunk_size >> 2; }
+  if (blockp && sc) { max_dest_chunk_size += chunk_expansion(sb, sc); }
+  if (!(tc = SEN_MALLOC(max_dest_chunk_size * 2 + (max_dest_chunk_size >> 2)))) {
+    if (scn != CHUNK_NOT_ASSIGNED) { sen_io_win_unmap(&sw); }
+    return sen_memory_exhausted;
+  }
+  if (blockp) {
+    if (!(od = SEN_MALLOC(sizeof(docinfo) * BLOCK_SIZE * 8))) {
       SEN_FREE(tc);
-      chunk_free(inv, dcn, max_dest_chunk_size);
+      if (scn != CHUNK_NOT_ASSIGNED) { sen_io_win_unmap(&sw); }
       return sen_memory_exhausted;
     }
+    nod = BLOCK_SIZE * 8;
+  }
+  tp = tc + max_dest_chunk_size;
+  ts = tp + max_dest_chunk_size;
+  MERGER_LOCK(inv, mt);
+  rc = chunk_new(inv, &dcn, max_dest_chunk_size);
+  MERGER_UNLOCK(inv, mt);
+  if (rc) {
+    if (od) { SEN_FREE(od); }
+    SEN_FREE(tc);
+    if (scn != CHUNK_NOT_ASSIGNED) { sen_io_win_unmap(&sw); }
+    return sen_memory_exhausted;
   }
   dc = sen_io_win_map(inv->chunk, ctx, &dw, dcn, 0, max_dest_chunk_size, SEN_IO_UPDATE);
   if (!dc) {
     SEN_LOG(sen_log_alert, "io_win_map(%d, %d) failed!!", dcn, max_dest_chunk_size);
-    buffer_close(inv, pseg);
-    SEN_IO_SEG_UNREF(inv->seg, ds);
+    if (od) { SEN_FREE(od); }
     SEN_FREE(tc);
+    MERGER_LOCK(inv, mt);
     chunk_free(inv, dcn, max_dest_chunk_size);
+    MERGER_UNLOCK(inv, mt);
     if (scn != CHUNK_NOT_ASSIGNED) { sen_io_win_unmap(&sw); }
     return sen_memory_exhausted;
   }
@@ -982,24 +1726,33 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
     buffer_term *bt;
     int n = sb->header.nterms;
     int nterms_void = 0;
-    uint8_t *tpp, *tcp, *spp = NULL;
+    uint8_t *tpp, *tcp, *tsp, *spp = NULL;
+    struct sen_inv_block sblk;
     memcpy(db->terms, sb->terms, n * sizeof(buffer_term));
     // sen_log(" scn=%d, dcn=%d, nterms=%d", sb->header.chunk, dcn, n);
     for (bt = db->terms; n; n--, bt++) {
       uint32_t ndf = 0, dgap_ = 0, sgap_ = 0;
       docinfo cid = {0, 0, 0, 0, 0}, lid = {0, 0, 0, 0, 0}, bid = {0, 0};
-      tpp = tp; tcp = tc;
+      sen_inv_skip sk = {0, 0, 0, 0, 0}, lsk = {0, 0, 0, 0, 0};
+      int sk_pending = 0, sblockp = 0, dblockp = nod != 0;
+      tpp = tp; tcp = tc; tsp = ts;
       if (!bt->tid) {
         nterms_void++;
         continue;
       }
       if (sc) {
-        uint32_t o;
+        uint32_t o, sn;
         scp = sc + bt->pos_in_chunk;
         sce = scp + bt->size_in_chunk;
         if (bt->size_in_chunk) {
-          SEN_B_DEC(o, scp);
-          sce = spp = scp + o;
+          scp = chunk_term_open(inv, scp, &o, &sn, NULL, NULL);
+          if (sn) {
+            sblockp = 1;
+            memset(&sblk, 0, offsetof(struct sen_inv_block, rids));
+            sblk.rest = sn;
+          } else {
+            sce = spp = scp + o;
+          }
         }
       }
       nextb = bt->pos_in_buffer;
@@ -1008,7 +1761,18 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
       bt->pos_in_buffer = 0;
 
 #define GETNEXTC_() {\
-  if (scp < sce) {\
+  if (sblockp) {\
+    if (sblk.i == sblk.n && sblk.rest) { scp = block_load(&sblk, scp); }\
+    if (sblk.i < sblk.n) {\
+      cid.rid = sblk.rids[sblk.i];\
+      cid.sid = sblk.sids[sblk.i];\
+      cid.tf = sblk.tfs[sblk.i];\
+      cid.score = sblk.scores[sblk.i];\
+      sblk.i++;\
+    } else {\
+      cid.rid = 0;\
+    }\
+  } else if (scp < sce) {\
     uint32_t dgap;\
     if (*scp == 0x8c) { cid.flags |= 1; scp++; } else { cid.flags &= ~1; }\
     if (*scp == 0x8d) { cid.flags ^= 2; scp++; }\
@@ -1024,13 +1788,18 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
   }\
 }
 #define GETNEXTC() {\
-  if (scp < sce && cid.rid) { while (cid.tf--) { SEN_B_SKIP(spp); } }\
+  if (sblockp) {\
+    if (cid.rid) { block_skip_pos(&sblk, cid.tf); }\
+  } else {\
+    if (scp < sce && cid.rid) { while (cid.tf--) { SEN_B_SKIP(spp); } }\
+  }\
   GETNEXTC_();\
 }
-#define PUTNEXT_(id,pp) {\
+#define PUTNEXT_(id) {\
   uint32_t dgap = id.rid - lid.rid;\
   uint32_t sgap = (dgap ? id.sid : id.sid - lid.sid);\
   if (sgap_) {\
+    if (sk_pending) { PUTSKIP(); }\
     lid.flags &= ~1;\
     if (lid.score) {\
       if (!(lid.flags & 2)) {\
@@ -1053,14 +1822,38 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
     if (lid.flags & 4) { SEN_B_ENC(sgap_, tcp); }\
     if (lid.flags & 3) { SEN_B_ENC(lid.score, tcp); }\
   }\
+  if (skipp && ndf > SKIP_INTERVAL && !((ndf - 1) % SKIP_INTERVAL)) {\
+    sk.rid = lid.rid;\
+    sk.sid = lid.sid;\
+    sk.pos = (uint32_t)(tpp - tp);\
+    sk_pending = 1;\
+  }\
+  if (dblockp) {\
+    if (ndf > nod) {\
+      docinfo *_od = SEN_REALLOC(od, sizeof(docinfo) * nod * 2);\
+      if (_od) {\
+        od = _od;\
+        nod *= 2;\
+      } else {\
+        dblockp = 0;\
+      }\
+    }\
+    if (dblockp) { od[ndf - 1] = id; }\
+  }\
   dgap_ = dgap;\
   lid.tf = id.tf;\
   sgap_ = sgap;\
   lid.score = id.score;\
-  while (id.tf--) { SEN_B_COPY(tpp, pp); }\
   lid.rid = id.rid;\
   lid.sid = id.sid;\
 }
+#define PUTSKIP() {\
+  sk.flags = lid.flags & 6;\
+  sk.doc = (uint32_t)(tcp - tc);\
+  SKIP_ENC(sk, lsk, tsp);\
+  lsk = sk;\
+  sk_pending = 0;\
+}
 #define PUTNEXTC() {\
   if (cid.rid) {\
     if (cid.tf) {\
@@ -1070,7 +1863,15 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
         break;\
       }\
       ndf++;\
-      PUTNEXT_(cid, spp);\
+      PUTNEXT_(cid);\
+      if (sblockp) {\
+        while (cid.tf--) {\
+          uint32_t _pos = block_next_pos(&sblk);\
+          SEN_B_ENC(_pos, tpp);\
+        }\
+      } else {\
+        while (cid.tf--) { SEN_B_COPY(tpp, spp); }\
+      }\
     } else {\
       SEN_LOG(sen_log_crit, "invalid chunk(%d,%d)", bt->tid, cid.rid);\
       rc = sen_invalid_format;\
@@ -1108,12 +1909,25 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
       if (bid.tf & 1) { SEN_B_DEC(bid.score, sbp); } else { bid.score = 0; }\
       bid.tf >>= 1;\
       ndf++;\
-      PUTNEXT_(bid, sbp);\
+      PUTNEXT_(bid);\
+      while (bid.tf--) { SEN_B_COPY(tpp, sbp); }\
     }\
   }\
   GETNEXTB();\
 }
 
+#define PUTLAST() {\
+  if (sgap_) {\
+    if (sk_pending) { PUTSKIP(); }\
+    if (lid.score && !(lid.flags & 2)) { lid.flags |= 2; *tcp++ = 0x8d; }\
+    sgap_--;\
+    if (sgap_ && !(lid.flags & 4)) { lid.flags |= 4; *tcp++ = 0x8e; }\
+    SEN_C_ENC(dgap_, lid.tf, tcp);\
+    if (lid.flags & 4) { SEN_B_ENC(sgap_, tcp); }\
+    if (lid.flags & 2) { SEN_B_ENC(lid.score, tcp); }\
+  }\
+}
+
       GETNEXTC();
       GETNEXTB();
       for (;;) {
@@ -1149,14 +1963,7 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
         }
       }
 
-      if (sgap_) {
-        if (lid.score && !(lid.flags & 2)) { lid.flags |= 2; *tcp++ = 0x8d; }
-        sgap_--;
-        if (sgap_ && !(lid.flags & 4)) { lid.flags |= 4; *tcp++ = 0x8e; }
-        SEN_C_ENC(dgap_, lid.tf, tcp);
-        if (lid.flags & 4) { SEN_B_ENC(sgap_, tcp); }
-        if (lid.flags & 2) { SEN_B_ENC(lid.score, tcp); }
-      }
+      PUTLAST();
 
 #define BTCLR {\
   bt->tid = 0;\
@@ -1166,16 +1973,55 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
 }
 #define BTSET {\
   uint32_t o = tcp - tc;\
-  SEN_B_ENC(o, dcp);\
-  memcpy(dcp, tc, o);\
-  dcp += o;\
-  o = tpp - tp;\
-  memcpy(dcp, tp, o);\
-  dcp += o;\
+  uint8_t *_p = NULL;\
+  if (dblockp && ndf >= BLOCK_SIZE) {\
+    _p = dcp + b_enc_size(o << 1) + o + (tpp - tp);\
+    _p = block_term_enc(od, ndf, tp, dcp, _p);\
+  }\
+  if (_p) {\
+    dcp = _p;\
+  } else {\
+    if (blockp) {\
+      o <<= 1;\
+      SEN_B_ENC(o, dcp);\
+      o = tcp - tc;\
+    } else if (skipp) {\
+      uint32_t s = tsp - ts;\
+      if (s) {\
+        o = (o << 1) + 1;\
+        SEN_B_ENC(o, dcp);\
+        SEN_B_ENC(s, dcp);\
+        memcpy(dcp, ts, s);\
+        dcp += s;\
+      } else {\
+        o <<= 1;\
+        SEN_B_ENC(o, dcp);\
+      }\
+      o = tcp - tc;\
+    } else {\
+      SEN_B_ENC(o, dcp);\
+    }\
+    memcpy(dcp, tc, o);\
+    dcp += o;\
+    o = tpp - tp;\
+    memcpy(dcp, tp, o);\
+    dcp += o;\
+  }\
   bt->size_in_chunk = (uint32_t)((dcp - dc) - bt->pos_in_chunk);\
 }
 
-      {
+      if (mt) {
+        merge_term *m = &mt[bt - db->terms];
+        BTSET;
+        m->ndf = ndf;
+        m->rid = 0;
+        if (ndf == 1 && lid.rid < 0x100000 && lid.sid < 0x800 && lid.tf == 1 && lid.score == 0) {
+          spp = tp;
+          SEN_B_DEC(m->pos, spp);
+          m->rid = lid.rid;
+          m->sid = lid.sid;
+        }
+      } else {
         uint32_t *a;
         if (!ndf) {
           if ((a = array_at(inv, bt->tid))) {
@@ -1216,15 +2062,17 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
         }
       }
     }
+    if (od) { SEN_FREE(od); }
     db->header.chunk_size = (uint32_t)(dcp - dc);
     db->header.nterms_void = nterms_void;
-    inv->header->total_chunk_size += db->header.chunk_size >> 10;
   }
   db->header.chunk = db->header.chunk_size ? dcn : CHUNK_NOT_ASSIGNED;
   db->header.buffer_free = SEN_INV_SEGMENT_SIZE
     - sizeof(buffer_header) - sb->header.nterms * sizeof(buffer_term);
   db->header.nterms = sb->header.nterms;
 
+  MERGER_LOCK(inv, mt);
+  inv->header->total_chunk_size += db->header.chunk_size >> 10;
   {
     uint32_t mc, ec;
     mc = (max_dest_chunk_size + SEN_INV_CHUNK_SIZE - 1) / SEN_INV_CHUNK_SIZE;
@@ -1233,16 +2081,603 @@ buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
       inv->header->chunks[dcn + ec++] = 0;
     }
   }
-  buffer_close(inv, pseg);
+  MERGER_UNLOCK(inv, mt);
   SEN_FREE(tc);
+  if (scn != CHUNK_NOT_ASSIGNED) { sen_io_win_unmap(&sw); }
+  sen_io_win_unmap(&dw);
+  return rc;
+}
+
+inline static sen_rc
+buffer_flush(sen_inv *inv, sen_ctx *ctx, uint32_t seg, sen_set *h)
+{
+  buffer *sb, *db = NULL;
+  sen_rc rc;
+  uint16_t ss, ds, pseg;
+  ss = inv->header->binfo[seg];
+  if (ss == SEG_NOT_ASSIGNED) { return sen_invalid_format; }
+  pseg = buffer_open(inv, seg * SEN_INV_SEGMENT_SIZE, NULL, &sb);
+  if (pseg == SEG_NOT_ASSIGNED) { return sen_memory_exhausted; }
+  if ((ds = segment_get(inv)) == SEN_INV_MAX_SEGMENT) {
+    buffer_close(inv, pseg);
+    return sen_memory_exhausted;
+  }
+  SEN_IO_SEG_REF(inv->seg, ds, db);
+  if (!db) {
+    buffer_close(inv, pseg);
+    return sen_memory_exhausted;
+  }
+  memset(db, 0, SEN_INV_SEGMENT_SIZE);
+  //  sen_log("db=%p ds=%d sb=%p seg=%d", db, ds, sb, seg);
+  if ((rc = buffer_merge(inv, ctx, sb, db, NULL, h))) {
+    buffer_close(inv, pseg);
+    SEN_IO_SEG_UNREF(inv->seg, ds);
+    return rc;
+  }
   SEN_IO_SEG_UNREF(inv->seg, ds);
+  SEN_MEMORY_BARRIER();
   inv->header->binfo[seg] = ds;
-  if (scn != CHUNK_NOT_ASSIGNED) {
-    sen_io_win_unmap(&sw);
-    chunk_free(inv, scn, sb->header.chunk_size);
+  if (sb->header.chunk != CHUNK_NOT_ASSIGNED) {
     inv->header->total_chunk_size -= sb->header.chunk_size >> 10;
   }
-  sen_io_win_unmap(&dw);
+  inv_retire(inv, ss, sb->header.chunk, sb->header.chunk_size);
+  buffer_close(inv, pseg);
+  return rc;
+}
+
+/* merger */
+
+/* with the merger, a full buffer segment is not flushed by the writer,
+   but frozen and merged with its chunk by the merger thread, while the
+   updates to its terms go to a pending segment. the writer publishes
+   the merged chunk under the pending segment afterwards, so that the
+   merger never touches the lexicon nor the array. */
+
+static void *
+merger_work(void *arg)
+{
+  sen_inv *inv = arg;
+  struct sen_inv_merger *m = inv->merger;
+  sen_ctx *ctx = sen_ctx_open(NULL, 0);
+  merger_job *j;
+  if (ctx) { sen_ctx_use(ctx); }
+  for (;;) {
+    sen_timeval t0, t1;
+    uint64_t usec;
+    int closing;
+    MUTEX_LOCK(m->lock);
+    for (;;) {
+      for (j = m->head; j && j->started; j = j->next) ;
+      if (j || m->closing) { break; }
+      COND_WAIT(m->cond, m->lock);
+    }
+    if (j) { j->started = 1; }
+    closing = m->closing;
+    MUTEX_UNLOCK(m->lock);
+    if (!j) {
+      if (closing) { break; }
+      continue;
+    }
+    sen_timeval_now(&t0);
+    j->rc = ctx ? buffer_merge(inv, ctx, j->sb, j->db, j->mt, NULL) : sen_memory_exhausted;
+    sen_timeval_now(&t1);
+    usec = (uint64_t) (t1.tv_sec - t0.tv_sec) * 1000000 + t1.tv_usec - t0.tv_usec;
+    MUTEX_LOCK(m->lock);
+    j->done = 1;
+    if (!j->rc) { m->ndone++; }
+    m->nmerges++;
+    m->total_usec += usec;
+    if (usec > m->max_usec) { m->max_usec = usec; }
+    COND_BROADCAST(m->cond);
+    MUTEX_UNLOCK(m->lock);
+  }
+  if (ctx) {
+    sen_ctx_use(NULL);
+    sen_ctx_close(ctx);
+  }
+  return NULL;
+}
+
+inline static void
+merger_job_free(sen_inv *inv, merger_job *j)
+{
+  if (j->sb) { buffer_close(inv, j->sseg); }
+  if (j->pb) { SEN_IO_SEG_UNREF(inv->seg, j->dseg); }
+  if (j->db) { SEN_GFREE(j->db); }
+  if (j->mt) { SEN_GFREE(j->mt); }
+  SEN_GFREE(j);
+}
+
+/* freezes the buffer segment seg, and hands it to the merger thread. */
+static sen_rc
+merger_freeze(sen_inv *inv, uint16_t seg, uint32_t size)
+{
+  struct sen_inv_merger *m = inv->merger;
+  merger_job *j;
+  buffer_term *bt;
+  uint32_t n;
+  if (!(j = SEN_GMALLOC(sizeof(merger_job)))) { return sen_memory_exhausted; }
+  memset(j, 0, sizeof(merger_job));
+  j->seg = seg;
+  j->sseg = buffer_open(inv, seg * SEN_INV_SEGMENT_SIZE, NULL, &j->sb);
+  if (j->sseg == SEG_NOT_ASSIGNED) {
+    j->sb = NULL;
+    merger_job_free(inv, j);
+    return sen_memory_exhausted;
+  }
+  n = j->sb->header.nterms;
+  if (!(j->db = SEN_GMALLOC(sizeof(buffer))) ||
+      !(j->mt = SEN_GMALLOC(sizeof(merge_term) * (n + 1))) ||
+      (j->dseg = segment_get(inv)) == SEN_INV_MAX_SEGMENT) {
+    merger_job_free(inv, j);
+    return sen_memory_exhausted;
+  }
+  SEN_IO_SEG_REF(inv->seg, j->dseg, j->pb);
+  if (!j->pb) {
+    merger_job_free(inv, j);
+    return sen_memory_exhausted;
+  }
+  memset(j->pb, 0, SEN_INV_SEGMENT_SIZE);
+  memcpy(j->pb, j->sb, sizeof(buffer_header) + n * sizeof(buffer_term));
+  for (bt = j->pb->terms; n; n--, bt++) {
+    bt->size_in_buffer = 0;
+    bt->pos_in_buffer = 0;
+  }
+  j->pb->header.buffer_free = SEN_INV_SEGMENT_SIZE
+    - sizeof(buffer_header) - j->pb->header.nterms * sizeof(buffer_term);
+  MUTEX_LOCK(m->lock);
+  if (m->tail) { m->tail->next = j; } else { m->head = j; }
+  m->tail = j;
+  if (++m->nqueued > m->max_queued) { m->max_queued = m->nqueued; }
+  m->pending[seg] = j->dseg;
+  COND_BROADCAST(m->cond);
+  MUTEX_UNLOCK(m->lock);
+  if (j->pb->header.buffer_free < size) {
+    SEN_LOG(sen_log_crit, "buffer(%d) is full (%d < %d) in merger_freeze",
+            seg, j->pb->header.buffer_free, size);
+    return sen_memory_exhausted;
+  }
+  return sen_success;
+}
+
+/* makes the pending segment of j the buffer of its terms. the terms which
+   have got no updates since j was frozen are removed or made sole
+   postings here, as buffer_flush() does. */
+static void
+merger_settle(sen_inv *inv, merger_job *j, sen_set *h)
+{
+  uint32_t k, *a;
+  buffer *pb = j->pb;
+  for (k = 0; k < pb->header.nterms; k++) {
+    buffer_term *bt = &pb->terms[k];
+    merge_term *mt = &j->mt[k];
+    if (!bt->tid) { continue; }
+    if (!bt->pos_in_buffer) {
+      if (!mt->ndf) {
+        if ((a = array_at(inv, bt->tid))) {
+          if (!(inv->lexicon->flags & SEN_INDEX_SHARED_LEXICON)) {
+            sen_sym_pocket_set(inv->lexicon, bt->tid, 0);
+          }
+          *a = 0;
+          sym_delete(inv, bt->tid, h);
+          array_unref(inv, bt->tid);
+          goto cleared;
+        }
+      } else if (mt->rid) {
+        if (inv->lexicon->flags & SEN_INDEX_SHARED_LEXICON) {
+          if (mt->sid == 1 && mt->pos < 0x800 && (a = array_at(inv, bt->tid))) {
+            *a = (mt->rid << 12) + (mt->pos << 1) + 1;
+            array_unref(inv, bt->tid);
+            goto cleared;
+          }
+        } else {
+          if (mt->pos < 0x4000 && (a = array_at(inv, bt->tid))) {
+            sen_sym_pocket_set(inv->lexicon, bt->tid, mt->pos);
+            *a = (mt->rid << 12) + (mt->sid << 1) + 1;
+            array_unref(inv, bt->tid);
+            goto cleared;
+          }
+        }
+      }
+    }
+    bt->pos_in_chunk = j->db->terms[k].pos_in_chunk;
+    bt->size_in_chunk = j->db->terms[k].size_in_chunk;
+    continue;
+  cleared :
+    bt->tid = 0;
+    bt->pos_in_chunk = 0;
+    bt->size_in_chunk = 0;
+    pb->header.nterms_void++;
+  }
+  pb->header.chunk = j->db->header.chunk;
+  pb->header.chunk_size = j->db->header.chunk_size;
+  MUTEX_LOCK(inv->merger->lock);
+  inv->header->binfo[j->seg] = j->dseg;
+  inv->merger->pending[j->seg] = SEG_NOT_ASSIGNED;
+  if (j->sb->header.chunk != CHUNK_NOT_ASSIGNED) {
+    inv->header->total_chunk_size -= j->sb->header.chunk_size >> 10;
+  }
+  MUTEX_UNLOCK(inv->merger->lock);
+  inv_retire(inv, j->sseg, j->sb->header.chunk, j->sb->header.chunk_size);
+}
+
+/* publishes the jobs merged so far. */
+static void
+merger_publish(sen_inv *inv, sen_set *h)
+{
+  struct sen_inv_merger *m = inv->merger;
+  merger_job *j, **jp, *done = NULL, **tail = &done;
+  MUTEX_LOCK(m->lock);
+  for (jp = &m->head; (j = *jp);) {
+    if (j->done && !j->rc) {
+      *jp = j->next;
+      *tail = j;
+      tail = &j->next;
+      m->nqueued--;
+      m->ndone--;
+    } else {
+      m->tail = j;
+      jp = &j->next;
+    }
+  }
+  if (!m->head) { m->tail = NULL; }
+  *tail = NULL;
+  MUTEX_UNLOCK(m->lock);
+  while ((j = done)) {
+    done = j->next;
+    merger_settle(inv, j, h);
+    merger_job_free(inv, j);
+  }
+}
+
+/* waits for the merge of seg to be done, and publishes it. a merge which
+   failed in the merger thread is tried again here. */
+static sen_rc
+merger_wait(sen_inv *inv, uint16_t seg, sen_set *h)
+{
+  sen_ctx *ctx = sen_ctx_current();
+  struct sen_inv_merger *m = inv->merger;
+  merger_job *j;
+  MUTEX_LOCK(m->lock);
+  for (j = m->head; j && j->seg != seg; j = j->next) ;
+  if (j) {
+    m->nwaits++;
+    while (!j->done) { COND_WAIT(m->cond, m->lock); }
+  }
+  MUTEX_UNLOCK(m->lock);
+  if (j && j->rc) {
+    if ((j->rc = buffer_merge(inv, ctx, j->sb, j->db, j->mt, NULL))) { return j->rc; }
+    MUTEX_LOCK(m->lock);
+    m->ndone++;
+    MUTEX_UNLOCK(m->lock);
+  }
+  merger_publish(inv, h);
+  return sen_success;
+}
+
+/* takes the place of buffer_flush() with the merger. */
+inline static sen_rc
+merger_flush(sen_inv *inv, uint16_t seg, uint32_t size, sen_set *h)
+{
+  if (inv->merger->pending[seg] != SEG_NOT_ASSIGNED) {
+    return merger_wait(inv, seg, h);
+  }
+  return merger_freeze(inv, seg, size);
+}
+
+sen_rc
+sen_inv_merger_start(sen_inv *inv)
+{
+  struct sen_inv_merger *m;
+  if (!inv || inv->v08p) { return sen_invalid_argument; }
+  if (inv->merger) { return sen_success; }
+  if (!(m = SEN_GMALLOC(sizeof(struct sen_inv_merger)))) { return sen_memory_exhausted; }
+  memset(m, 0, sizeof(struct sen_inv_merger));
+  memset(m->pending, 0xff, sizeof(m->pending));
+  MUTEX_INIT(m->lock);
+  COND_INIT(m->cond);
+  inv->merger = m;
+  if (THREAD_CREATE(m->thread, merger_work, inv)) {
+    SEN_LOG(sen_log_alert, "sen_inv_merger_start: thread create failed");
+    inv->merger = NULL;
+    MUTEX_DESTROY(m->lock);
+    SEN_GFREE(m);
+    return sen_other_error;
+  }
+  return sen_success;
+}
+
+sen_rc
+sen_inv_merger_stop(sen_inv *inv)
+{
+  sen_rc rc = sen_success;
+  struct sen_inv_merger *m;
+  if (!inv || inv->v08p) { return sen_invalid_argument; }
+  if (!(m = inv->merger)) { return sen_success; }
+  MUTEX_LOCK(m->lock);
+  m->closing = 1;
+  COND_BROADCAST(m->cond);
+  MUTEX_UNLOCK(m->lock);
+  THREAD_JOIN(m->thread);
+  while (m->head) {
+    merger_job *j = m->head;
+    if (merger_wait(inv, j->seg, NULL)) {
+      SEN_LOG(sen_log_crit, "merge of buffer(%d) failed. the updates to it are lost.",
+              j->seg);
+      rc = j->rc;
+      m->head = j->next;
+      m->pending[j->seg] = SEG_NOT_ASSIGNED;
+      inv_retire(inv, j->dseg, CHUNK_NOT_ASSIGNED, 0);
+      merger_job_free(inv, j);
+    }
+  }
+  inv->merger = NULL;
+  MUTEX_DESTROY(m->lock);
+  SEN_GFREE(m);
+  return rc;
+}
+
+sen_rc
+sen_inv_merger_info(sen_inv *inv, uint32_t *nqueued, uint32_t *max_queued,
+                    uint32_t *nmerges, uint32_t *nwaits,
+                    uint64_t *total_usec, uint64_t *max_usec)
+{
+  struct sen_inv_merger *m;
+  if (!inv || inv->v08p) { return sen_invalid_argument; }
+  if (!(m = inv->merger)) { return sen_invalid_argument; }
+  MUTEX_LOCK(m->lock);
+  if (nqueued) { *nqueued = m->nqueued; }
+  if (max_queued) { *max_queued = m->max_queued; }
+  if (nmerges) { *nmerges = m->nmerges; }
+  if (nwaits) { *nwaits = m->nwaits; }
+  if (total_usec) { *total_usec = m->total_usec; }
+  if (max_usec) { *max_usec = m->max_usec; }
+  MUTEX_UNLOCK(m->lock);
+  return sen_success;
+}
+
+/* loader */
+
+/* an empty inv is loaded term by term in ascending order of tid. each
+   buffer segment gets LOADER_MAX_TERMS terms, or fewer if their chunk
+   gets LOADER_CHUNK_SIZE bytes, with no postings left in the buffer.
+   the chunk is built in memory and written at once. */
+
+#define LOADER_MAX_TERMS 4096
+#define LOADER_CHUNK_SIZE (SEN_INV_CHUNK_SIZE * 16)
+
+struct _sen_inv_loader {
+  sen_inv *inv;
+  sen_ctx *ctx;
+  buffer *b;           /* buffer segment being filled */
+  uint16_t seg;
+  uint16_t pseg;
+  uint8_t *dc;         /* its chunk */
+  uint32_t dc_size;
+  uint32_t dc_len;
+  uint8_t *tc;         /* doc, pos and skip of the term being put */
+  uint8_t *tp;
+  uint8_t *ts;
+  uint32_t tc_size;
+  uint32_t tp_size;
+  uint32_t ts_size;
+  uint32_t *pos;       /* positions of the posting being put */
+  uint32_t npos;
+  docinfo *od;         /* postings of the term, for block coding */
+  uint32_t nod;
+};
+
+sen_inv_loader *
+sen_inv_loader_open(sen_inv *inv)
+{
+  sen_inv_loader *l;
+  sen_ctx *ctx = sen_ctx_current();
+  if (inv->v08p || (inv->lexicon->flags & SEN_INDEX_SHARED_LEXICON) ||
+      inv->header->amax || inv->header->bmax) {
+    return NULL;
+  }
+  if (!(l = SEN_MALLOC(sizeof(sen_inv_loader)))) { return NULL; }
+  memset(l, 0, sizeof(sen_inv_loader));
+  l->inv = inv;
+  l->ctx = ctx;
+  l->dc_size = SEN_INV_CHUNK_SIZE * 2;
+  l->tc_size = l->tp_size = l->ts_size = SEN_INV_SEGMENT_SIZE;
+  l->npos = BLOCK_SIZE;
+  l->dc = SEN_MALLOC(l->dc_size);
+  l->tc = SEN_MALLOC(l->tc_size);
+  l->tp = SEN_MALLOC(l->tp_size);
+  l->ts = SEN_MALLOC(l->ts_size);
+  l->pos = SEN_MALLOC(sizeof(uint32_t) * l->npos);
+  if ((inv->header->flags & CHUNK_BLOCK) &&
+      (l->od = SEN_MALLOC(sizeof(docinfo) * BLOCK_SIZE * 8))) {
+    l->nod = BLOCK_SIZE * 8;
+  }
+  if (!l->dc || !l->tc || !l->tp || !l->ts || !l->pos ||
+      ((inv->header->flags & CHUNK_BLOCK) && !l->od)) {
+    sen_inv_loader_close(l);
+    return NULL;
+  }
+  return l;
+}
+
+inline static sen_rc
+loader_segment_open(sen_inv_loader *l)
+{
+  uint16_t seg = SEN_INV_MAX_SEGMENT, pseg;
+  buffer *b;
+  if (buffer_segment_new(l->inv, &seg) ||
+      (pseg = buffer_open(l->inv, seg * SEN_INV_SEGMENT_SIZE, NULL, &b)) == SEG_NOT_ASSIGNED) {
+    return sen_memory_exhausted;
+  }
+  memset(b, 0, SEN_INV_SEGMENT_SIZE);
+  b->header.buffer_free = SEN_INV_SEGMENT_SIZE - sizeof(buffer_header);
+  b->header.chunk = CHUNK_NOT_ASSIGNED;
+  b->header.chunk_size = 0;
+  l->b = b;
+  l->seg = seg;
+  l->pseg = pseg;
+  l->dc_len = 0;
+  return sen_success;
+}
+
+inline static sen_rc
+loader_segment_close(sen_inv_loader *l)
+{
+  sen_inv *inv = l->inv;
+  sen_ctx *ctx = l->ctx;
+  sen_rc rc = sen_success;
+  if (!l->b) { return sen_success; }
+  if (l->dc_len) {
+    uint32_t dcn;
+    uint8_t *dc;
+    sen_io_win dw;
+    if (chunk_new(inv, &dcn, l->dc_len)) {
+      rc = sen_memory_exhausted;
+    } else if (!(dc = sen_io_win_map(inv->chunk, ctx, &dw, dcn, 0, l->dc_len, SEN_IO_UPDATE))) {
+      SEN_LOG(sen_log_alert, "io_win_map(%d, %d) failed!", dcn, l->dc_len);
+      chunk_free(inv, dcn, l->dc_len);
+      rc = sen_memory_exhausted;
+    } else {
+      memcpy(dc, l->dc, l->dc_len);
+      sen_io_win_unmap(&dw);
+      l->b->header.chunk = dcn;
+      l->b->header.chunk_size = l->dc_len;
+      inv->header->total_chunk_size += l->dc_len >> 10;
+    }
+  }
+  buffer_close(inv, l->pseg);
+  l->b = NULL;
+  l->dc_len = 0;
+  return rc;
+}
+
+#define LOADER_RESERVE(buf,p,size,n) {\
+  uint32_t _o = (uint32_t)((p) - (buf)), _s = (size);\
+  if (_o + (n) > _s) {\
+    uint8_t *_b;\
+    while (_o + (n) > _s) { _s *= 2; }\
+    if (!(_b = SEN_REALLOC((buf), _s))) { rc = sen_memory_exhausted; goto exit; }\
+    (buf) = _b;\
+    (p) = _b + _o;\
+    (size) = _s;\
+  }\
+}
+
+/* puts the postings of tid, which next gives in ascending order of rid,
+   sid and pos, and returns 0 after the last of them. */
+sen_rc
+sen_inv_loader_add(sen_inv_loader *l, sen_id tid, sen_inv_loader_next *next, void *arg)
+{
+  sen_inv *inv = l->inv;
+  sen_ctx *ctx = l->ctx;
+  sen_rc rc = sen_success;
+  int skipp = inv->header->flags & CHUNK_WITH_SKIP;
+  int blockp = inv->header->flags & CHUNK_BLOCK;
+  int sk_pending = 0, dblockp = l->nod != 0, morep, solep;
+  uint32_t ndf = 0, dgap_ = 0, sgap_ = 0, i, x, atf, lpos, *a;
+  docinfo cid = {0, 0, 0, 0, 0}, lid = {0, 0, 0, 0, 0};
+  sen_inv_skip sk = {0, 0, 0, 0, 0}, lsk = {0, 0, 0, 0, 0};
+  uint8_t *tc = l->tc, *tp = l->tp, *ts = l->ts, *dc = l->dc;
+  uint8_t *tcp = tc, *tpp = tp, *tsp = ts, *dcp = NULL;
+  docinfo *od = l->od;
+  uint32_t nod = l->nod;
+  buffer_term *bt;
+  sen_id rid;
+  uint32_t sid, pos;
+  for (morep = next(arg, &rid, &sid, &pos); morep;) {
+    if (ndf && (rid < lid.rid || (rid == lid.rid && sid <= lid.sid))) {
+      SEN_LOG(sen_log_crit, "unordered postings (%d:%d) -> (%d:%d) on %d",
+              lid.rid, lid.sid, rid, sid, tid);
+      rc = sen_invalid_argument;
+      goto exit;
+    }
+    cid.rid = rid;
+    cid.sid = sid;
+    for (cid.tf = 0, atf = 0; morep && rid == cid.rid && sid == cid.sid; atf++) {
+      if (cid.tf < SEN_INV_MAX_TF) {
+        if (cid.tf == l->npos) {
+          uint32_t *p = SEN_REALLOC(l->pos, sizeof(uint32_t) * l->npos * 2);
+          if (!p) { rc = sen_memory_exhausted; goto exit; }
+          l->pos = p;
+          l->npos *= 2;
+        }
+        l->pos[cid.tf++] = pos;
+      }
+      morep = next(arg, &rid, &sid, &pos);
+    }
+    if (atf != cid.tf) {
+      SEN_LOG(sen_log_warning, "too many postings(%d) on '%s'. discarded %d.",
+              atf, _sen_sym_key(inv->lexicon, tid), atf - cid.tf);
+    }
+    LOADER_RESERVE(tc, tcp, l->tc_size, 32);
+    LOADER_RESERVE(ts, tsp, l->ts_size, 32);
+    LOADER_RESERVE(tp, tpp, l->tp_size, cid.tf * 5);
+    ndf++;
+    PUTNEXT_(cid);
+    for (i = 0, lpos = 0; i < cid.tf; lpos = l->pos[i++]) {
+      x = l->pos[i] - lpos;
+      SEN_B_ENC(x, tpp);
+    }
+  }
+  if (!ndf) { goto exit; }
+  PUTLAST();
+  if (lid.sid > inv->header->smax) { inv->header->smax = lid.sid; }
+  solep = (ndf == 1 && lid.rid < 0x100000 && lid.sid < 0x800 && lid.tf == 1 &&
+           lid.score == 0 && l->pos[0] < 0x4000);
+  if (!solep) {
+    if (!l->b && (rc = loader_segment_open(l))) { goto exit; }
+    x = (uint32_t)((tcp - tc) + (tpp - tp) + (tsp - ts)) + 20;
+    dcp = dc + l->dc_len;
+    LOADER_RESERVE(dc, dcp, l->dc_size, x);
+  }
+  if (!(a = array_get(inv, tid))) {
+    rc = sen_memory_exhausted;
+    goto exit;
+  }
+  if (solep) {
+    sen_sym_pocket_set(inv->lexicon, tid, l->pos[0]);
+    *a = (lid.rid << 12) + (lid.sid << 1) + 1;
+  } else {
+    bt = &l->b->terms[l->b->header.nterms];
+    bt->tid = tid;
+    bt->pos_in_chunk = l->dc_len;
+    bt->size_in_buffer = 0;
+    bt->pos_in_buffer = 0;
+    BTSET;
+    l->dc_len = (uint32_t)(dcp - dc);
+    sen_sym_pocket_set(inv->lexicon, tid, 0);
+    *a = l->seg * SEN_INV_SEGMENT_SIZE
+      + sizeof(buffer_header) + sizeof(buffer_term) * l->b->header.nterms;
+    l->b->header.nterms++;
+    l->b->header.buffer_free -= sizeof(buffer_term);
+  }
+  array_unref(inv, tid);
+  if (!solep &&
+      (l->b->header.nterms == LOADER_MAX_TERMS || l->dc_len >= LOADER_CHUNK_SIZE)) {
+    rc = loader_segment_close(l);
+  }
+exit :
+  l->tc = tc;
+  l->tp = tp;
+  l->ts = ts;
+  l->dc = dc;
+  l->od = od;
+  l->nod = nod;
+  return rc;
+}
+
+sen_rc
+sen_inv_loader_close(sen_inv_loader *l)
+{
+  sen_ctx *ctx = l->ctx;
+  sen_rc rc = loader_segment_close(l);
+  if (l->dc) { SEN_FREE(l->dc); }
+  if (l->tc) { SEN_FREE(l->tc); }
+  if (l->tp) { SEN_FREE(l->tp); }
+  if (l->ts) { SEN_FREE(l->ts); }
+  if (l->pos) { SEN_FREE(l->pos); }
+  if (l->od) { SEN_FREE(l->od); }
+  SEN_FREE(l);
   return rc;
 }
 
@@ -1269,7 +2704,7 @@ sen_inv_create(const char *path, sen_sym *lexicon, uint32_t initial_n_segments)
   max_chunk = initial_n_segments * MAX_CHUNK_RATIO;
   seg = sen_io_create(path, sizeof(struct sen_inv_header) + max_chunk,
                       SEN_INV_SEGMENT_SIZE, SEN_INV_MAX_SEGMENT,
-                      sen_io_auto, SEN_INV_MAX_SEGMENT);
+                      sen_io_auto|SEN_IO_POPULATE, SEN_INV_MAX_SEGMENT);
   if (!seg) { return NULL; }
   chunk = sen_io_create(path2, 0, SEN_INV_CHUNK_SIZE,
                         max_chunk, sen_io_auto, max_chunk);
@@ -1278,12 +2713,19 @@ sen_inv_create(const char *path, sen_sym *lexicon, uint32_t initial_n_segments)
     return NULL;
   }
   header = sen_io_header(seg);
-  memcpy(header->idstr, SEN_INV_IDSTR, 16);
   for (i = 0; i < SEN_INV_MAX_SEGMENT; i++) {
     header->ainfo[i] = SEG_NOT_ASSIGNED;
     header->binfo[i] = SEG_NOT_ASSIGNED;
   }
   header->initial_n_segments = initial_n_segments;
+  if (lexicon->flags & SEN_INDEX_BLOCK_CODEC) {
+    header->flags = CHUNK_BLOCK;
+  } else if (lexicon->flags & SEN_INDEX_SKIP_ENTRIES) {
+    header->flags = CHUNK_WITH_SKIP;
+  } else {
+    header->flags = 0;
+  }
+  memcpy(header->idstr, header->flags ? SEN_INV_IDSTR_FLAGS : SEN_INV_IDSTR, 16);
   if (!(inv = SEN_GMALLOC(sizeof(sen_inv)))) {
     sen_io_close(seg);
     sen_io_close(chunk);
@@ -1294,6 +2736,14 @@ sen_inv_create(const char *path, sen_sym *lexicon, uint32_t initial_n_segments)
   inv->chunk = chunk;
   inv->header = header;
   inv->lexicon = lexicon;
+  inv->merger = NULL;
+  inv->epoch = 0;
+  inv->nreaders[0] = 0;
+  inv->nreaders[1] = 0;
+  inv->retired = NULL;
+  inv->retired_last = NULL;
+  inv->max_nmaps = 0;
+  expirer_init(inv);
   inv->header->total_chunk_size = 0;
   return inv;
 }
@@ -1324,7 +2774,7 @@ sen_inv_open(const char *path, sen_sym *lexicon)
   if (strlen(path) + 6 >= PATH_MAX) { return NULL; }
   strcpy(path2, path);
   strcat(path2, ".c");
-  seg = sen_io_open(path, sen_io_auto, SEN_INV_MAX_SEGMENT);
+  seg = sen_io_open(path, sen_io_auto|SEN_IO_POPULATE, SEN_INV_MAX_SEGMENT);
   if (!seg) { return NULL; }
   chunk = sen_io_open(path2, sen_io_auto, SEN_INV_MAX_SEGMENT);
   if (!chunk) {
@@ -1332,7 +2782,8 @@ sen_inv_open(const char *path, sen_sym *lexicon)
     return NULL;
   }
   header = sen_io_header(seg);
-  if (memcmp(header->idstr, SEN_INV_IDSTR, 16)) {
+  if (memcmp(header->idstr, SEN_INV_IDSTR, 16) &&
+      memcmp(header->idstr, SEN_INV_IDSTR_FLAGS, 16)) {
     SEN_LOG(sen_log_notice, "inv_idstr (%s)", header->idstr);
     sen_io_close(seg);
     sen_io_close(chunk);
@@ -1348,6 +2799,14 @@ sen_inv_open(const char *path, sen_sym *lexicon)
   inv->chunk = chunk;
   inv->header = header;
   inv->lexicon = lexicon;
+  inv->merger = NULL;
+  inv->epoch = 0;
+  inv->nreaders[0] = 0;
+  inv->nreaders[1] = 0;
+  inv->retired = NULL;
+  inv->retired_last = NULL;
+  inv->max_nmaps = 0;
+  expirer_init(inv);
   return inv;
 }
 
@@ -1356,6 +2815,11 @@ sen_inv_close(sen_inv *inv)
 {
   sen_rc rc;
   if (!inv) { return sen_invalid_argument; }
+  if (!inv->v08p) {
+    expirer_stop(inv);
+    sen_inv_merger_stop(inv);
+    inv_reclaim(inv, 1);
+  }
   if ((rc = sen_io_close(inv->seg))) { return rc; }
   if ((rc = sen_io_close(inv->chunk))) { return rc; }
   SEN_GFREE(inv);
@@ -1385,7 +2849,7 @@ sen_inv_info(sen_inv *inv, uint64_t *seg_size, uint64_t *chunk_size)
 sen_rc
 sen_inv_update(sen_inv *inv, uint32_t key, sen_inv_updspec *u, sen_set *h, int hint)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_rc rc = sen_success;
   buffer *b;
   uint8_t *bs;
@@ -1399,13 +2863,15 @@ sen_inv_update(sen_inv *inv, uint32_t key, sen_inv_updspec *u, sen_set *h, int h
   // sen_log("key=%d tf=%d pos0=%d rid=%d", key, u->tf, u->pos->pos, u->rid);
   if (!u->tf || !u->sid) { return sen_inv_delete(inv, key, u, h); }
   if (u->sid > inv->header->smax) { inv->header->smax = u->sid; }
+  if (inv->merger && inv->merger->ndone) { merger_publish(inv, h); }
+  if (inv->retired) { inv_reclaim(inv, 0); }
   if (!(a = array_get(inv, key))) { return sen_memory_exhausted; }
   if (!(bs = encode_rec(u, &size, 0))) { rc = sen_memory_exhausted; goto exit; }
   for (;;) {
     if (*a) {
       if (!(*a & 1)) {
         pos = *a;
-        if ((pseg = buffer_open(inv, pos, &bt, &b)) == SEG_NOT_ASSIGNED) {
+        if ((pseg = buffer_open_pending(inv, pos, &bt, &b)) == SEG_NOT_ASSIGNED) {
           rc = sen_memory_exhausted;
           goto exit;
         }
@@ -1414,6 +2880,10 @@ sen_inv_update(sen_inv *inv, uint32_t key, sen_inv_updspec *u, sen_set *h, int h
           SEN_LOG(sen_log_debug, "flushing *a=%d seg=%d(%p) free=%d",
                   *a, *a >> W_OF_SEGMENT, b, b->header.buffer_free);
           buffer_close(inv, pseg);
+          if (inv->merger) {
+            if ((rc = merger_flush(inv, pos >> W_OF_SEGMENT, size, h))) { goto exit; }
+            continue;
+          }
           if ((rc = buffer_flush(inv, ctx, pos >> W_OF_SEGMENT, h))) { goto exit; }
           if (*a != pos) {
             SEN_LOG(sen_log_debug, "sen_inv_update: *a changed %d->%d", *a, pos);
@@ -1518,6 +2988,7 @@ sen_inv_update(sen_inv *inv, uint32_t key, sen_inv_updspec *u, sen_set *h, int h
   rc = buffer_put(b, bt, br, bs, u, size);
   buffer_close(inv, pseg);
   if (!*a || (*a & 1)) {
+    SEN_MEMORY_BARRIER();
     *a = pos;
     if (!(inv->lexicon->flags & SEN_INDEX_SHARED_LEXICON)) {
       sen_sym_pocket_set(inv->lexicon, key, 0);
@@ -1535,7 +3006,7 @@ exit :
 sen_rc
 sen_inv_delete(sen_inv *inv, uint32_t key, sen_inv_updspec *u, sen_set *h)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_rc rc = sen_success;
   buffer *b;
   uint16_t pseg;
@@ -1546,6 +3017,8 @@ sen_inv_delete(sen_inv *inv, uint32_t key, sen_inv_updspec *u, sen_set *h)
   if (inv->v08p) {
     return sen_inv_delete08(inv, key, u, h);
   }
+  if (inv->merger && inv->merger->ndone) { merger_publish(inv, h); }
+  if (inv->retired) { inv_reclaim(inv, 0); }
   if (!(a = array_at(inv, key))) { return sen_invalid_argument; }
   for (;;) {
     if (!*a) { goto exit; }
@@ -1562,7 +3035,7 @@ sen_inv_delete(sen_inv *inv, uint32_t key, sen_inv_updspec *u, sen_set *h)
       rc = sen_memory_exhausted;
       goto exit;
     }
-    if ((pseg = buffer_open(inv, *a, &bt, &b)) == SEG_NOT_ASSIGNED) {
+    if ((pseg = buffer_open_pending(inv, *a, &bt, &b)) == SEG_NOT_ASSIGNED) {
       rc = sen_memory_exhausted;
       goto exit;
     }
@@ -1571,6 +3044,12 @@ sen_inv_delete(sen_inv *inv, uint32_t key, sen_inv_updspec *u, sen_set *h)
       uint32_t _a = *a;
       SEN_LOG(sen_log_debug, "flushing! b=%p free=%d, seg(%d)", b, b->header.buffer_free, *a >> W_OF_SEGMENT);
       buffer_close(inv, pseg);
+      if (inv->merger) {
+        SEN_FREE(bs);
+        bs = NULL;
+        if ((rc = merger_flush(inv, *a >> W_OF_SEGMENT, size, h))) { goto exit; }
+        continue;
+      }
       if ((rc = buffer_flush(inv, ctx, *a >> W_OF_SEGMENT, h))) { goto exit; }
       if (*a != _a) {
         SEN_LOG(sen_log_debug, "sen_inv_delete: *a changed %d->%d)", *a, _a);
@@ -1614,10 +3093,82 @@ sen_inv_initial_n_segments(sen_inv *inv)
 #define SOLE_DOC_USED 4
 #define SOLE_POS_USED 8
 
+inline static void
+inv_cursor_free(sen_ctx *ctx, sen_inv_cursor *c)
+{
+  if (c->sub) { sen_inv_cursor_close(c->sub); }
+  if (c->in_epoch) { inv_leave(c->inv, c->epoch); }
+  if (c->in_arena) {
+    if (c->blk) { SEN_AFREE(c->blk); }
+    SEN_AFREE(c);
+  } else {
+    if (c->blk) { SEN_FREE(c->blk); }
+    SEN_FREE(c);
+  }
+}
+
+/* while the buffer of a term is being merged, c, which has been opened on
+   the frozen buffer and its chunk, is moved to c->sub, and c reads the
+   pending buffer over it. */
+inline static sen_inv_cursor *
+inv_cursor_open_pending(sen_ctx *ctx, sen_inv_cursor *c, uint32_t pos, uint16_t dseg)
+{
+  byte *p = NULL;
+  sen_inv_cursor *sub;
+  SEN_IO_SEG_REF(c->inv->seg, dseg, p);
+  if (!p) {
+    sen_inv_cursor_close(c);
+    return NULL;
+  }
+  sub = c->in_arena ? SEN_AMALLOC(sizeof(sen_inv_cursor)) : SEN_MALLOC(sizeof(sen_inv_cursor));
+  if (!sub) {
+    SEN_IO_SEG_UNREF(c->inv->seg, dseg);
+    sen_inv_cursor_close(c);
+    return NULL;
+  }
+  memcpy(sub, c, sizeof(sen_inv_cursor));
+  memset(c, 0, sizeof(sen_inv_cursor));
+  c->inv = sub->inv;
+  c->iw.ctx = ctx;
+  c->with_pos = sub->with_pos;
+  c->in_arena = sub->in_arena;
+  c->sub = sub;
+  c->buf = (buffer *)p;
+  c->buffer_pseg = dseg;
+  c->nextb = ((buffer_term *)(p + (pos & BUFFER_MASK_IN_A_SEGMENT)))->pos_in_buffer;
+  c->stat = CHUNK_USED|BUFFER_USED;
+  return c;
+}
+
+/* sets up c for the term in the chunk mapped between c->cp and c->cpe */
+inline static sen_rc
+cursor_chunk_open(sen_ctx *ctx, sen_inv_cursor *c)
+{
+  uint32_t o, n;
+  c->dp = c->cp = chunk_term_open(c->inv, c->cp, &o, &n, &c->sp, &c->spe);
+  if (n) {
+    if (c->in_arena) {
+      c->blk = SEN_AMALLOC(sizeof(struct sen_inv_block));
+    } else {
+      c->blk = SEN_MALLOC(sizeof(struct sen_inv_block));
+    }
+    if (!c->blk) { return sen_memory_exhausted; }
+    memset(c->blk, 0, offsetof(struct sen_inv_block, rids));
+    c->blk->rest = n;
+  } else {
+    c->cpe = c->cpp = c->cp + o;
+    if (c->sp < c->spe) { SKIP_DEC(c->sk, c->sp); }
+  }
+  c->flags = 0;
+  c->pc.rid = 0;
+  c->pc.sid = 0;
+  return sen_success;
+}
+
 sen_inv_cursor *
-sen_inv_cursor_open(sen_inv *inv, uint32_t key, int with_pos)
+sen_inv_cursor_open(sen_inv *inv, uint32_t key, int flags)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_inv_cursor *c  = NULL;
   uint32_t pos, *a;
   if (inv->v08p) {
@@ -1625,11 +3176,17 @@ sen_inv_cursor_open(sen_inv *inv, uint32_t key, int with_pos)
   }
   if (!(a = array_at(inv, key))) { return NULL; }
   if (!(pos = *a)) { goto exit; }
-  if (!(c = SEN_MALLOC(sizeof(sen_inv_cursor)))) { goto exit; }
+  if (flags & SEN_INV_CURSOR_ARENA) {
+    c = SEN_AMALLOC(sizeof(sen_inv_cursor));
+  } else {
+    c = SEN_MALLOC(sizeof(sen_inv_cursor));
+  }
+  if (!c) { goto exit; }
   memset(c, 0, sizeof(sen_inv_cursor));
   c->inv = inv;
   c->iw.ctx = ctx;
-  c->with_pos = (uint16_t) with_pos;
+  c->with_pos = (uint16_t) (flags & SEN_INV_CURSOR_WITH_POS);
+  c->in_arena = (uint16_t) (flags & SEN_INV_CURSOR_ARENA);
   if (pos & 1) {
     c->stat = 0;
     c->pb.rid = BIT31_12(pos);
@@ -1645,9 +3202,13 @@ sen_inv_cursor_open(sen_inv *inv, uint32_t key, int with_pos)
   } else {
     uint32_t chunk;
     buffer_term *bt;
+    uint16_t dseg = SEG_NOT_ASSIGNED;
+    c->epoch = inv_enter(inv);
+    c->in_epoch = 1;
+    if (inv->merger) { dseg = inv->merger->pending[pos >> W_OF_SEGMENT]; }
     c->pb.rid = 0; c->pb.sid = 0; /* for check */
     if ((c->buffer_pseg = buffer_open(inv, pos, &bt, &c->buf)) == SEG_NOT_ASSIGNED) {
-      SEN_FREE(c);
+      inv_cursor_free(ctx, c);
       c = NULL;
       goto exit;
     }
@@ -1656,22 +3217,24 @@ sen_inv_cursor_open(sen_inv *inv, uint32_t key, int with_pos)
                              chunk, bt->pos_in_chunk, bt->size_in_chunk, sen_io_rdonly);
       if (!c->cp) {
         buffer_close(inv, c->buffer_pseg);
-        SEN_FREE(c);
+        inv_cursor_free(ctx, c);
         c = NULL;
         goto exit;
       }
       c->cpe = c->cp + bt->size_in_chunk;
-      if (bt->size_in_chunk) {
-        uint32_t o;
-        SEN_B_DEC(o, c->cp);
-        c->cpe = c->cpp = c->cp + o;
+      if (cursor_chunk_open(ctx, c)) {
+        sen_io_win_unmap(&c->iw);
+        buffer_close(inv, c->buffer_pseg);
+        inv_cursor_free(ctx, c);
+        c = NULL;
+        goto exit;
       }
-      c->flags = 0;
-      c->pc.rid = 0;
-      c->pc.sid = 0;
     }
     c->nextb = bt->pos_in_buffer;
     c->stat = CHUNK_USED|BUFFER_USED;
+    if (dseg != SEG_NOT_ASSIGNED && dseg != c->buffer_pseg) {
+      c = inv_cursor_open_pending(ctx, c, pos, dseg);
+    }
   }
 exit :
   array_unref(inv, key);
@@ -1682,13 +3245,22 @@ exit :
 sen_inv_cursor *
 sen_inv_cursor_openv1(sen_inv *inv, uint32_t key)
 {
+  sen_ctx *ctx = sen_ctx_current();
   sen_inv_cursor *c  = NULL;
   uint32_t pos, *a = array_at(inv, key);
   if (!a) { return NULL; }
   if (!(pos = *a)) { goto exit; }
+  if (!(pos & 1) && inv->merger &&
+      inv->merger->pending[pos >> W_OF_SEGMENT] != SEG_NOT_ASSIGNED) {
+    /* the pending buffer has to be read over the chunk */
+    array_unref(inv, key);
+    return sen_inv_cursor_open(inv, key, SEN_INV_CURSOR_WITH_POS);
+  }
   if (!(c = SEN_MALLOC(sizeof(sen_inv_cursor)))) { goto exit; }
   memset(c, 0, sizeof(sen_inv_cursor));
   c->inv = inv;
+  c->iw.ctx = ctx;
+  c->with_pos = 1;
   if (pos & 1) {
     c->stat = 0;
     c->pb.rid = BIT31_12(pos);
@@ -1704,7 +3276,10 @@ sen_inv_cursor_openv1(sen_inv *inv, uint32_t key)
   } else {
     buffer_term *bt;
     c->pb.rid = 0; c->pb.sid = 0;
+    c->epoch = inv_enter(inv);
+    c->in_epoch = 1;
     if ((c->buffer_pseg = buffer_open(inv, pos, &bt, &c->buf)) == SEG_NOT_ASSIGNED) {
+      inv_leave(inv, c->epoch);
       SEN_FREE(c);
       c = NULL;
       goto exit;
@@ -1725,7 +3300,7 @@ exit :
 sen_rc
 sen_inv_cursor_openv2(sen_inv_cursor **cursors, int ncursors)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_rc rc = sen_success;
   int i, j = 0;
   sen_inv_cursor *c;
@@ -1733,18 +3308,17 @@ sen_inv_cursor_openv2(sen_inv_cursor **cursors, int ncursors)
   if (!iws) { return sen_memory_exhausted; }
   for (i = 0; i < ncursors; i++) {
     c = cursors[i];
-    if (c->stat && c->iw.size && c->iw.segment != CHUNK_NOT_ASSIGNED) {
+    if (c->stat && !c->cp && c->iw.size && c->iw.segment != CHUNK_NOT_ASSIGNED) {
       iws[j++] = &c->iw;
     }
   }
   if (j) { rc = sen_io_win_mapv(iws, ctx, j); }
   for (i = 0; i < ncursors; i++) {
     c = cursors[i];
-    if (c->iw.addr) {
+    if (!c->cp && c->iw.addr) {
       c->cp = c->iw.addr + c->iw.diff;
       c->cpe = c->cp + c->iw.size;
-      c->pc.rid = 0;
-      c->pc.sid = 0;
+      if (cursor_chunk_open(ctx, c)) { rc = sen_memory_exhausted; }
     }
   }
   SEN_FREE(iws);
@@ -1761,7 +3335,36 @@ sen_inv_cursor_next(sen_inv_cursor *c)
   if (c->buf) {
     for (;;) {
       if (c->stat & CHUNK_USED) {
-        if (c->cp < c->cpe) {
+        if (c->sub) {
+          if (!sen_inv_cursor_next(c->sub)) {
+            c->pc.rid = c->sub->post->rid;
+            c->pc.sid = c->sub->post->sid;
+            c->pc.tf = c->sub->post->tf;
+            c->pc.score = c->sub->post->score;
+            c->pc.rest = c->pc.tf;
+            c->pc.pos = 0;
+          } else {
+            c->pc.rid = 0;
+          }
+        } else if (c->blk) {
+          struct sen_inv_block *blk = c->blk;
+          if (blk->i == blk->n) {
+            if (blk->rest) { c->cp = block_load(blk, c->cp); }
+          } else if (c->with_pos && c->pc.rest) {
+            block_skip_pos(blk, c->pc.rest);
+          }
+          if (blk->i < blk->n) {
+            c->pc.rid = blk->rids[blk->i];
+            c->pc.sid = blk->sids[blk->i];
+            c->pc.tf = blk->tfs[blk->i];
+            c->pc.score = blk->scores[blk->i];
+            c->pc.rest = c->pc.tf;
+            c->pc.pos = 0;
+            blk->i++;
+          } else {
+            c->pc.rid = 0;
+          }
+        } else if (c->cp < c->cpe) {
           uint32_t dgap;
           if (c->with_pos) { while (c->pc.rest--) { SEN_B_SKIP(c->cpp); } }
           if (*c->cp == 0x8c) { c->flags |= 1; c->cp++; } else { c->flags &= ~1; }
@@ -1862,7 +3465,14 @@ sen_inv_cursor_next_pos(sen_inv_cursor *c)
       if (c->post == &c->pc) {
         if (c->pc.rest) {
           c->pc.rest--;
-          SEN_B_DEC(gap, c->cpp);
+          if (c->sub) {
+            rc = sen_inv_cursor_next_pos(c->sub);
+            gap = c->sub->post->pos - c->pc.pos;
+          } else if (c->blk) {
+            gap = block_next_pos(c->blk);
+          } else {
+            SEN_B_DEC(gap, c->cpp);
+          }
           c->pc.pos += gap;
         } else {
           rc = sen_abnormal_error;
@@ -1889,6 +3499,65 @@ sen_inv_cursor_next_pos(sen_inv_cursor *c)
   return rc;
 }
 
+/* moves the cursor to the first posting at or after (rid, sid).
+   the postings in chunk are passed over by the skip entries or by the
+   blocks without being decoded, if the index has them. */
+sen_rc
+sen_inv_cursor_skip(sen_inv_cursor *c, sen_id rid, uint32_t sid)
+{
+  sen_inv_posting *p = c->post;
+  if (p && (p->rid > rid || (p->rid == rid && p->sid >= sid))) { return sen_success; }
+  if (!c->inv->v08p && c->blk &&
+      (c->pc.rid < rid || (c->pc.rid == rid && c->pc.sid < sid))) {
+    struct sen_inv_block *blk = c->blk;
+    if (blk->rid < rid || (blk->rid == rid && blk->sid < sid)) {
+      blk->i = blk->n;
+      while (blk->rest) {
+        uint8_t *cp = c->cp;
+        uint32_t gap, lsid, size;
+        SEN_B_DEC(gap, cp);
+        SEN_B_DEC(lsid, cp);
+        if (blk->rid + gap > rid || (blk->rid + gap == rid && lsid >= sid)) { break; }
+        SEN_B_SKIP(cp);
+        SEN_B_DEC(size, cp);
+        cp += size;
+        SEN_B_DEC(size, cp);
+        c->cp = cp + size;
+        blk->rid += gap;
+        blk->sid = lsid;
+        blk->rest -= blk->rest < BLOCK_SIZE ? blk->rest : BLOCK_SIZE;
+      }
+    }
+    c->stat |= CHUNK_USED;
+  }
+  if (!c->inv->v08p && c->sk.doc &&
+      (c->pc.rid < rid || (c->pc.rid == rid && c->pc.sid < sid))) {
+    sen_inv_skip sk = {0, 0, 0, 0, 0};
+    while (c->sk.doc && (c->sk.rid < rid || (c->sk.rid == rid && c->sk.sid < sid))) {
+      sk = c->sk;
+      if (c->sp < c->spe) {
+        SKIP_DEC(c->sk, c->sp);
+      } else {
+        c->sk.doc = 0;
+      }
+    }
+    if (sk.doc && c->dp + sk.doc >= c->cp) {
+      c->cp = c->dp + sk.doc;
+      c->cpp = c->cpe + sk.pos;
+      c->pc.rid = sk.rid;
+      c->pc.sid = sk.sid;
+      c->pc.rest = 0;
+      c->flags = sk.flags;
+      c->stat |= CHUNK_USED;
+    }
+  }
+  do {
+    if (sen_inv_cursor_next(c)) { return sen_abnormal_error; }
+    p = c->post;
+  } while (p->rid < rid || (p->rid == rid && p->sid < sid));
+  return sen_success;
+}
+
 sen_rc
 sen_inv_cursor_close(sen_inv_cursor *c)
 {
@@ -1899,7 +3568,7 @@ sen_inv_cursor_close(sen_inv_cursor *c)
   if (!c) { return sen_invalid_argument; }
   if (c->cp) { sen_io_win_unmap(&c->iw); }
   if (c->buf) { buffer_close(c->inv, c->buffer_pseg); }
-  SEN_FREE(c);
+  inv_cursor_free(ctx, c);
   return sen_success;
 }
 
@@ -1919,12 +3588,19 @@ sen_inv_estimate_size(sen_inv *inv, uint32_t key)
       buffer *buf;
       uint16_t pseg;
       buffer_term *bt;
+      uint32_t e = inv_enter(inv);
       if ((pseg = buffer_open(inv, pos, &bt, &buf)) == SEG_NOT_ASSIGNED) {
         res = 0;
       } else {
         res = (bt->size_in_chunk >> 1) + bt->size_in_buffer + 2;
         buffer_close(inv, pseg);
+        if (inv->merger && inv->merger->pending[pos >> W_OF_SEGMENT] != SEG_NOT_ASSIGNED &&
+            (pseg = buffer_open_pending(inv, pos, &bt, &buf)) != SEG_NOT_ASSIGNED) {
+          res += bt->size_in_buffer;
+          buffer_close(inv, pseg);
+        }
       }
+      inv_leave(inv, e);
     }
   } else {
     res = 0;
@@ -1933,6 +3609,32 @@ sen_inv_estimate_size(sen_inv *inv, uint32_t key)
   return res;
 }
 
+/* hints the chunk window of key, which sen_inv_cursor_open will read. */
+sen_rc
+sen_inv_prefetch(sen_inv *inv, uint32_t key)
+{
+  sen_rc rc = sen_success;
+  uint32_t pos, chunk, *a;
+  if (inv->v08p) { return sen_success; }
+  a = array_at(inv, key);
+  if (!a) { return sen_invalid_argument; }
+  if ((pos = *a) && !(pos & 1)) {
+    buffer *buf;
+    uint16_t pseg;
+    buffer_term *bt;
+    uint32_t e = inv_enter(inv);
+    if ((pseg = buffer_open(inv, pos, &bt, &buf)) != SEG_NOT_ASSIGNED) {
+      if (bt->size_in_chunk && (chunk = buf->header.chunk) != CHUNK_NOT_ASSIGNED) {
+        rc = sen_io_win_prefetch(inv->chunk, chunk, bt->pos_in_chunk, bt->size_in_chunk);
+      }
+      buffer_close(inv, pseg);
+    }
+    inv_leave(inv, e);
+  }
+  array_unref(inv, key);
+  return rc;
+}
+
 int
 sen_inv_entry_info(sen_inv *inv, unsigned key, unsigned *a, unsigned *pocket,
                    unsigned *chunk, unsigned *chunk_size, unsigned *buffer_free,
@@ -1942,7 +3644,7 @@ sen_inv_entry_info(sen_inv *inv, unsigned key, unsigned *a, unsigned *pocket,
 {
   buffer *b;
   buffer_term *bt;
-  uint32_t *ap;
+  uint32_t *ap, e;
   uint16_t pseg;
   ERRCLR(NULL);
   if (inv->v08p) {
@@ -1959,7 +3661,11 @@ sen_inv_entry_info(sen_inv *inv, unsigned key, unsigned *a, unsigned *pocket,
   array_unref(inv, key);
   if (!*a) { return 1; }
   if (*a & 1) { return 2; }
-  if ((pseg = buffer_open(inv, *a, &bt, &b)) == SEG_NOT_ASSIGNED) { return 3; }
+  e = inv_enter(inv);
+  if ((pseg = buffer_open(inv, *a, &bt, &b)) == SEG_NOT_ASSIGNED) {
+    inv_leave(inv, e);
+    return 3;
+  }
   *chunk = b->header.chunk;
   *chunk_size = b->header.chunk_size;
   *buffer_free = b->header.buffer_free;
@@ -1970,6 +3676,7 @@ sen_inv_entry_info(sen_inv *inv, unsigned key, unsigned *a, unsigned *pocket,
   *size_in_buffer = bt->size_in_buffer;
   *pos_in_buffer = bt->pos_in_buffer;
   buffer_close(inv, pseg);
+  inv_leave(inv, e);
   return 4;
 }
 
@@ -1979,6 +3686,15 @@ sen_inv_path(sen_inv *inv)
   return sen_io_path(inv->seg);
 }
 
+sen_rc
+sen_inv_ios(sen_inv *inv, sen_io **seg, sen_io **chunk)
+{
+  if (inv->v08p) { return sen_invalid_argument; }
+  *seg = inv->seg;
+  *chunk = inv->chunk;
+  return sen_success;
+}
+
 uint32_t
 sen_inv_max_section(sen_inv *inv)
 {
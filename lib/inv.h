@@ -76,8 +76,23 @@ sen_rc sen_inv_updspec_add(sen_inv_updspec *u, int pos, int32_t weight);
 int sen_inv_updspec_cmp(sen_inv_updspec *a, sen_inv_updspec *b);
 
 uint32_t sen_inv_estimate_size(sen_inv *inv, uint32_t key);
+sen_rc sen_inv_prefetch(sen_inv *inv, uint32_t key);
 
 void sen_inv_seg_expire(sen_inv *inv, int32_t threshold);
+sen_rc sen_inv_set_map_budget(sen_inv *inv, uint32_t size_mb);
+
+sen_rc sen_inv_merger_start(sen_inv *inv);
+sen_rc sen_inv_merger_stop(sen_inv *inv);
+sen_rc sen_inv_merger_info(sen_inv *inv, uint32_t *nqueued, uint32_t *max_queued,
+                           uint32_t *nmerges, uint32_t *nwaits,
+                           uint64_t *total_usec, uint64_t *max_usec);
+
+typedef struct _sen_inv_loader sen_inv_loader;
+typedef int sen_inv_loader_next(void *arg, sen_id *rid, uint32_t *sid, uint32_t *pos);
+
+sen_inv_loader *sen_inv_loader_open(sen_inv *inv);
+sen_rc sen_inv_loader_add(sen_inv_loader *l, sen_id tid, sen_inv_loader_next *next, void *arg);
+sen_rc sen_inv_loader_close(sen_inv_loader *l);
 
 typedef struct {
   sen_id rid;
@@ -89,6 +104,16 @@ typedef struct {
 } sen_inv_posting;
 
 typedef struct {
+  sen_id rid;
+  uint32_t sid;
+  uint32_t flags;
+  uint32_t doc;
+  uint32_t pos;
+} sen_inv_skip;
+
+typedef struct _sen_inv_cursor sen_inv_cursor;
+
+struct _sen_inv_cursor {
   sen_inv *inv;
   sen_inv_posting pc;
   sen_inv_posting pb;
@@ -97,14 +122,23 @@ typedef struct {
   uint8_t *cpp;
   uint8_t *cpe;
   uint8_t *bp;
+  uint8_t *dp;
+  uint8_t *sp;
+  uint8_t *spe;
+  sen_inv_skip sk;
+  struct sen_inv_block *blk;
   sen_io_win iw;
   struct sen_inv_buffer *buf;
   uint16_t stat;
   uint16_t nextb;
   uint16_t buffer_pseg;
   uint16_t with_pos;
+  uint16_t in_arena;
+  uint16_t in_epoch;
   int flags;
-} sen_inv_cursor;
+  uint32_t epoch;             /* the epoch of inv which it has entered */
+  sen_inv_cursor *sub;        /* the frozen buffer while it is merged */
+};
 
 #define SEN_INV_CURSOR_CMP(c1,c2) \
   (((c1)->post->rid > (c2)->post->rid) || \
@@ -113,16 +147,22 @@ typedef struct {
      (((c1)->post->sid == (c2)->post->sid) && \
       ((c1)->post->pos > (c2)->post->pos)))))
 
-sen_inv_cursor *sen_inv_cursor_open(sen_inv *inv, uint32_t key, int with_pos);
+/* flags for sen_inv_cursor_open */
+#define SEN_INV_CURSOR_WITH_POS 1
+#define SEN_INV_CURSOR_ARENA    2
+
+sen_inv_cursor *sen_inv_cursor_open(sen_inv *inv, uint32_t key, int flags);
 sen_inv_cursor *sen_inv_cursor_openv1(sen_inv *inv, uint32_t key);
 sen_rc sen_inv_cursor_openv2(sen_inv_cursor **cursors, int ncursors);
 sen_rc sen_inv_cursor_next(sen_inv_cursor *c);
 sen_rc sen_inv_cursor_next_pos(sen_inv_cursor *c);
+sen_rc sen_inv_cursor_skip(sen_inv_cursor *c, sen_id rid, uint32_t sid);
 sen_rc sen_inv_cursor_close(sen_inv_cursor *c);
 uint32_t sen_inv_max_section(sen_inv *inv);
 
 int sen_inv_check(sen_inv *inv);
 const char *sen_inv_path(sen_inv *inv);
+sen_rc sen_inv_ios(sen_inv *inv, sen_io **seg, sen_io **chunk);
 
 #ifdef __cplusplus
 }
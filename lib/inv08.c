@@ -733,7 +733,7 @@ sym_delete(sen_inv *inv, uint32_t tid, sen_set *h)
 inline static sen_rc
 buffer_flush(sen_inv *inv, uint32_t seg, sen_set *h)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   buffer *sb, *db = NULL;
   sen_rc rc = sen_success;
   sen_io_win sw, dw;
@@ -1288,7 +1288,7 @@ exit :
 sen_inv_cursor *
 sen_inv_cursor_open08(sen_inv *inv, uint32_t key)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_inv_cursor08 *c  = NULL;
   uint32_t pos, *a = array_at(inv, key);
   if (!a) { return NULL; }
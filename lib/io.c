@@ -28,17 +28,29 @@
 #include "io.h"
 #include "cache.h"
 
+#ifdef USE_AIO
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(HAVE_PTHREAD_H)
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#include <sched.h>
+#define USE_IO_URING
+#endif /* defined(__NR_io_uring_setup) && defined(HAVE_PTHREAD_H) */
+#endif /* __linux__ */
+#endif /* USE_AIO */
+
 #define SEN_IO_IDSTR "SENNA:IO:01.000"
 
 /* VA hack */
-/* max aio request (/proc/sys/fs/aio-max-nr) */
-#define MAX_REQUEST     (64*1024)
 
 #define MEM_ALIGN    sen_cache_block
 
 /* end VA hack */
 
 static unsigned int pagesize = 0;
+int sen_io_map_options = 0;
 
 typedef struct _sen_io_fileinfo {
 #ifdef WIN32
@@ -96,6 +108,8 @@ inline static void * sen_fail_mmap(fileinfo *fi, off_t offset, size_t length,
 inline static int sen_msync(void *start, size_t length);
 inline static sen_rc sen_pread(fileinfo *fi, void *buf, size_t count, off_t offset);
 inline static sen_rc sen_pwrite(fileinfo *fi, void *buf, size_t count, off_t offset);
+inline static void sen_fadvise_willneed(fileinfo *fi, off_t offset, size_t count);
+inline static void sen_madvise_seg(void *start, size_t length, uint32_t options);
 
 sen_io *
 sen_io_create(const char *path, uint32_t header_size, uint32_t segment_size,
@@ -132,7 +146,8 @@ sen_io_create(const char *path, uint32_t header_size, uint32_t segment_size,
             io->user_header = ((byte *) io->nrefs) + max_segment * sizeof(uint32_t);
             io->base = b;
             io->base_seg = bs;
-            io->mode = mode;
+            io->mode = mode & SEN_IO_MODE_MASK;
+            io->options = mode & (SEN_IO_POPULATE|SEN_IO_HUGEPAGE);
             io->cache_size = cache_size;
             io->header->curr_size = b;
             io->fis = fis;
@@ -210,7 +225,8 @@ sen_io_open(const char *path, sen_io_mode mode, uint32_t cache_size)
           if (io->nrefs) {
             io->base = b;
             io->base_seg = bs;
-            io->mode = mode;
+            io->mode = mode & SEN_IO_MODE_MASK;
+            io->options = mode & (SEN_IO_POPULATE|SEN_IO_HUGEPAGE);
             io->cache_size = cache_size;
             io->fis = fis;
             io->nmaps = 0;
@@ -638,19 +654,350 @@ sen_io_win_map(sen_io *io, sen_ctx *ctx, sen_io_win *iw, uint32_t segment,
 }
 
 #ifdef USE_AIO
+/* reads the rest of the short read of cb, whose first done bytes are
+   read. the part beyond the end of the file is filled with zeros, as
+   sen_mmap() extends the file with zeros. */
+static sen_rc
+read_rest(struct aiocb *cb, size_t done)
+{
+  ssize_t r;
+  byte *buf = (byte *)cb->aio_buf;
+  while (done < cb->aio_nbytes) {
+    if ((r = pread(cb->aio_fildes, buf + done, cb->aio_nbytes - done,
+                   cb->aio_offset + done)) < 0) {
+      if (errno == EINTR) { continue; }
+      SEN_LOG(sen_log_error, "pread failed (%s)", strerror(errno));
+      return sen_file_operation_error;
+    }
+    if (!r) {
+      memset(buf + done, 0, cb->aio_nbytes - done);
+      break;
+    }
+    done += r;
+  }
+  return sen_success;
+}
+
+#ifdef USE_IO_URING
+/*
+ * io_uring, by the bare syscalls. each thread has its own ring, since
+ * a ring cannot be submitted to by the threads at once. the rings are
+ * also linked in uring_list, so that sen_io_aio_fin() can close those
+ * of the threads still alive.
+ */
+#define URING_ENTRIES 256
+
+typedef struct _uring uring;
+
+struct _uring {
+  uring *next;
+  int fd;
+  unsigned int entries;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr;
+  void *cq_ptr;
+  size_t sq_len;
+  size_t cq_len;
+};
+
+static sen_thread_key uring_key;
+static int uring_key_created = 0;
+static int uring_unavailable = 0;
+static uring *uring_list = NULL;
+static sen_mutex uring_lock;     /* guards uring_list */
+
+static void
+uring_free(uring *r)
+{
+  munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+  if (r->cq_ptr != r->sq_ptr) { munmap(r->cq_ptr, r->cq_len); }
+  munmap(r->sq_ptr, r->sq_len);
+  close(r->fd);
+  free(r);
+}
+
+/* called at the exit of a thread. the ring may be closed already by
+   sen_io_aio_fin(). */
+static void
+uring_close(void *arg)
+{
+  uring **p;
+  MUTEX_LOCK(uring_lock);
+  for (p = &uring_list; *p; p = &(*p)->next) {
+    if (*p == arg) {
+      *p = (*p)->next;
+      uring_free(arg);
+      break;
+    }
+  }
+  MUTEX_UNLOCK(uring_lock);
+}
+
+static uring *
+uring_open(void)
+{
+  uring *r;
+  struct io_uring_params p;
+  if (!(r = malloc(sizeof(uring)))) { return NULL; }
+  memset(&p, 0, sizeof(p));
+  if ((r->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0) {
+    SEN_LOG(sen_log_warning, "io_uring_setup failed (%s)", strerror(errno));
+    free(r);
+    return NULL;
+  }
+  r->entries = p.sq_entries;
+  r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_len > r->sq_len) { r->sq_len = r->cq_len; }
+    r->cq_len = r->sq_len;
+  }
+  r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                   r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_ptr == MAP_FAILED) { goto err_fd; }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    r->cq_ptr = r->sq_ptr;
+  } else {
+    r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                     r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) { goto err_sq; }
+  }
+  r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+                 MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) { goto err_cq; }
+  r->sq_head = (unsigned int *)((byte *)r->sq_ptr + p.sq_off.head);
+  r->sq_tail = (unsigned int *)((byte *)r->sq_ptr + p.sq_off.tail);
+  r->sq_mask = (unsigned int *)((byte *)r->sq_ptr + p.sq_off.ring_mask);
+  r->sq_array = (unsigned int *)((byte *)r->sq_ptr + p.sq_off.array);
+  r->cq_head = (unsigned int *)((byte *)r->cq_ptr + p.cq_off.head);
+  r->cq_tail = (unsigned int *)((byte *)r->cq_ptr + p.cq_off.tail);
+  r->cq_mask = (unsigned int *)((byte *)r->cq_ptr + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)((byte *)r->cq_ptr + p.cq_off.cqes);
+  return r;
+err_cq :
+  if (r->cq_ptr != r->sq_ptr) { munmap(r->cq_ptr, r->cq_len); }
+err_sq :
+  munmap(r->sq_ptr, r->sq_len);
+err_fd :
+  SEN_LOG(sen_log_warning, "io_uring mmap failed (%s)", strerror(errno));
+  close(r->fd);
+  free(r);
+  return NULL;
+}
+
+/* returns the ring of the current thread, or NULL */
+static uring *
+uring_get(void)
+{
+  uring *r;
+  if (uring_unavailable || !uring_key_created) { return NULL; }
+  if (!(r = THREAD_GETSPECIFIC(uring_key))) {
+    if (!(r = uring_open())) {
+      uring_unavailable = 1;
+      SEN_LOG(sen_log_notice, "io_uring is not available. falls back to posix aio");
+      return NULL;
+    }
+    THREAD_SETSPECIFIC(uring_key, r);
+    MUTEX_LOCK(uring_lock);
+    r->next = uring_list;
+    uring_list = r;
+    MUTEX_UNLOCK(uring_lock);
+  }
+  return r;
+}
+
+/* waits for nwait of the reads in flight. short reads are completed by
+   read_rest(). */
+static sen_rc
+uring_reap(uring *r, struct aiocb **iocbs, int *inflight, int nwait)
+{
+  sen_rc rc = sen_success;
+  int warned = 0;
+  while (nwait) {
+    struct io_uring_cqe *cqe;
+    struct aiocb *cb;
+    unsigned int head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+      if (syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS,
+                  NULL, 0) < 0 && errno != EINTR) {
+        /* can't return before they are done, since they write to the
+           buffers. they are completed without io_uring_enter anyway. */
+        if (!warned++) {
+          SEN_LOG(sen_log_error, "io_uring_enter failed (%s)", strerror(errno));
+        }
+        sched_yield();
+      }
+      continue;
+    }
+    cqe = &r->cqes[head & *r->cq_mask];
+    cb = iocbs[cqe->user_data];
+    if (cqe->res < 0) {
+      SEN_LOG(sen_log_error, "io_uring read failed (%s)", strerror(-cqe->res));
+      rc = sen_file_operation_error;
+    } else if (cqe->res < cb->aio_nbytes && !rc) {
+      rc = read_rest(cb, cqe->res);
+    }
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    (*inflight)--;
+    nwait--;
+  }
+  return rc;
+}
+
+/* reads them by readv in the ring, URING_ENTRIES at a time. it never
+   returns with a read in flight, even on an error. */
+static sen_rc
+uring_read(uring *r, struct aiocb **iocbs, struct iovec *iovs, int count)
+{
+  sen_rc rc = sen_success, rc2;
+  int i = 0, inflight = 0;
+  while (i < count && !rc) {
+    unsigned int tail = *r->sq_tail, n = 0, submitted = 0;
+    int ret;
+    while (i < count && n < r->entries) {
+      unsigned int idx = (tail + n) & *r->sq_mask;
+      struct io_uring_sqe *sqe = &r->sqes[idx];
+      struct aiocb *cb = iocbs[i];
+      iovs[i].iov_base = (void *)cb->aio_buf;
+      iovs[i].iov_len = cb->aio_nbytes;
+      memset(sqe, 0, sizeof(struct io_uring_sqe));
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = cb->aio_fildes;
+      sqe->off = cb->aio_offset;
+      sqe->addr = (uintptr_t)&iovs[i];
+      sqe->len = 1;
+      sqe->user_data = i;
+      r->sq_array[idx] = idx;
+      i++;
+      n++;
+    }
+    __atomic_store_n(r->sq_tail, tail + n, __ATOMIC_RELEASE);
+    /* the kernel may take fewer of them than asked */
+    while (submitted < n && !rc) {
+      if ((ret = syscall(__NR_io_uring_enter, r->fd, n - submitted, 0, 0,
+                         NULL, 0)) > 0) {
+        submitted += ret;
+        inflight += ret;
+      } else if (ret < 0 && errno == EINTR) {
+        continue;
+      } else if (ret < 0 && (errno == EAGAIN || errno == EBUSY) && inflight) {
+        rc = uring_reap(r, iocbs, &inflight, inflight);
+      } else {
+        SEN_LOG(sen_log_error, "io_uring_enter failed (%s)",
+                ret < 0 ? strerror(errno) : "no entries submitted");
+        rc = sen_external_error;
+      }
+    }
+    if (submitted < n) {
+      /* takes back the ones not submitted */
+      __atomic_store_n(r->sq_tail, tail + submitted, __ATOMIC_RELEASE);
+    }
+    if ((rc2 = uring_reap(r, iocbs, &inflight, inflight)) && !rc) { rc = rc2; }
+  }
+  return rc;
+}
+#endif /* USE_IO_URING */
+
+void
+sen_io_aio_init(void)
+{
+  const char *b = getenv("SEN_AIO_BACKEND");
+  if (b) {
+    if (!strcmp(b, "posix")) {
+      sen_aio_backend = sen_aio_posix;
+    } else if (!strcmp(b, "pread")) {
+      sen_aio_backend = sen_aio_pread;
+    } else {
+      sen_aio_backend = sen_aio_uring;
+    }
+  }
+#ifdef USE_IO_URING
+  if (!uring_key_created && !THREAD_KEY_CREATE(&uring_key, uring_close)) {
+    MUTEX_INIT(uring_lock);
+    uring_key_created = 1;
+  }
+#else /* USE_IO_URING */
+  if (sen_aio_backend == sen_aio_uring) { sen_aio_backend = sen_aio_posix; }
+#endif /* USE_IO_URING */
+}
+
+void
+sen_io_aio_fin(void)
+{
+#ifdef USE_IO_URING
+  if (uring_key_created) {
+    uring *r;
+    THREAD_SETSPECIFIC(uring_key, NULL);
+    THREAD_KEY_DELETE(uring_key);
+    MUTEX_LOCK(uring_lock);
+    while ((r = uring_list)) {
+      uring_list = r->next;
+      uring_free(r);
+    }
+    MUTEX_UNLOCK(uring_lock);
+    MUTEX_DESTROY(uring_lock);
+    uring_key_created = 0;
+  }
+#endif /* USE_IO_URING */
+}
+
+/* reads all of them, by the backend given by SEN_AIO_BACKEND. */
+static sen_rc
+read_batch(struct aiocb **iocbs, struct iovec *iovs, int count)
+{
+  int i;
+#ifdef USE_IO_URING
+  if (sen_aio_backend == sen_aio_uring) {
+    uring *r = uring_get();
+    if (r) { return uring_read(r, iocbs, iovs, count); }
+  }
+#endif /* USE_IO_URING */
+  if (sen_aio_backend == sen_aio_pread) {
+    for (i = 0; i < count; i++) {
+      sen_rc rc;
+      if ((rc = read_rest(iocbs[i], 0))) { return rc; }
+    }
+    return sen_success;
+  }
+  if (lio_listio(LIO_WAIT, iocbs, count, NULL) < 0) {
+    perror("lio_listio");
+    return sen_external_error;
+  }
+  return sen_success;
+}
+
 sen_rc
 sen_io_win_mapv(sen_io_win **list, sen_ctx *ctx, int nent)
 {
   int i;
+  sen_rc rc = sen_success;
   sen_io_win *iw;
-  struct aiocb *iocbs[MAX_REQUEST];
-  struct aiocb iocb[MAX_REQUEST];
-  CacheIOOper oper[MAX_REQUEST];
-  int count = 0;
+  struct aiocb **iocbs;
+  struct aiocb *iocb;
+  struct iovec *iovs;
+  CacheIOOper *oper;
+  int count = 0, nbypasses = 0;
 
   sen_io_win **clist = list;
   int cl = 0;
 
+  /* too large for the stack of a thread, if they are of the max requests */
+  if (!(iocbs = SEN_MALLOC((sizeof(struct aiocb *) + sizeof(struct aiocb) +
+                            sizeof(struct iovec) + sizeof(CacheIOOper)) * nent))) {
+    return sen_memory_exhausted;
+  }
+  iocb = (struct aiocb *)(iocbs + nent);
+  iovs = (struct iovec *)(iocb + nent);
+  oper = (CacheIOOper *)(iovs + nent);
+
 retry:
   for (i = 0; i < nent; i++) {
     iw = list[i];
@@ -677,14 +1024,16 @@ retry:
         pos = (bseg % segments_per_file) * segment_size + offset + base;
         if (!size || !io || segment + nseg > io->header->max_segment ||
             fno != (bseg + nseg - 1) / segments_per_file) {
-          return sen_abnormal_error;
+          rc = sen_abnormal_error;
+          goto exit;
         }
         fi = &io->fis[fno];
         if (!sen_opened(fi)) {
             char path[PATH_MAX];
             gen_pathname(io->path, path, fno);
             if (sen_open(fi, path, O_RDWR|O_CREAT|O_DIRECT, SEN_IO_FILE_SIZE)) {
-                return sen_internal_error;
+                rc = sen_internal_error;
+                goto exit;
             }
         }
         {
@@ -728,7 +1077,8 @@ retry:
 
                 /* allocate aligned memory */
                 if (posix_memalign(&p, MEM_ALIGN, vsize) != 0) {
-                    return sen_external_error;
+                    rc = sen_external_error;
+                    goto exit;
                 }
                 iocb[count].aio_buf = p;
                 iocb[count].aio_nbytes = vsize;
@@ -741,6 +1091,7 @@ retry:
 
                 /* aio count up */
                 count++;
+                nbypasses++;
             }
             iw->addr = p;
             iw->segment = segment;
@@ -751,7 +1102,8 @@ retry:
         } /* End  AIO + DIO + cache hack */
     } else {
         if (!sen_io_win_map(iw->io, ctx, iw, iw->segment, iw->offset, iw->size, iw->mode)) {
-            return sen_internal_error;
+            rc = sen_internal_error;
+            goto exit;
         }
     }
   }
@@ -760,11 +1112,11 @@ retry:
       if (count > 0) {
           int c;
 
-          /* aio_read () */
-          if (lio_listio (LIO_WAIT, iocbs, count, NULL) < 0) {
-              perror ("lio_listio");
-              return sen_external_error;
+          /* all of them at once */
+          if ((rc = read_batch(iocbs, iovs, count))) {
+              goto exit;
           }
+          sen_cache_count_aio (count - nbypasses, nbypasses);
           for (c=0;c<count;c++) {
               /* cache data is now VALID */
               if (oper[c].cd) oper[c].cd->flag = CACHE_VALID;
@@ -781,15 +1133,157 @@ retry:
           nent = cl;    /* number of iw */
           cl = 0;
           count = 0;
+          nbypasses = 0;
           usleep(1);
           goto retry;
       } else
           dp("-- No Reading state CacheData. --\n");
   }
-  return sen_success;
+exit :
+  SEN_FREE(iocbs);
+  return rc;
 }
 #endif /* USE_AIO */
 
+/* lets the kernel start reading the window which will be mapped by
+   sen_io_win_map(.., sen_io_rdonly) soon, so that the windows of a query
+   are read in parallel rather than one after another. */
+sen_rc
+sen_io_win_prefetch(sen_io *io, uint32_t segment, uint32_t offset, uint32_t size)
+{
+  off_t pos;
+  int fno, base;
+  fileinfo *fi;
+  uint32_t nseg, bseg, s;
+  uint32_t segment_size = io->header->segment_size;
+  uint32_t segments_per_file = SEN_IO_FILE_SIZE / segment_size;
+  if (offset >= segment_size) {
+    segment += offset / segment_size;
+    offset = offset % segment_size;
+  }
+  nseg = (offset + size + segment_size - 1) / segment_size;
+  bseg = segment + io->base_seg;
+  fno = bseg / segments_per_file;
+  base = fno ? 0 : io->base - io->base_seg * segment_size;
+  pos = (bseg % segments_per_file) * segment_size + offset + base;
+  if (!size || segment + nseg > io->header->max_segment ||
+      fno != (bseg + nseg - 1) / segments_per_file) {
+    return sen_invalid_argument;
+  }
+  /* they are read from the page cache of the mapping */
+  for (s = segment; s < segment + nseg && io->maps[s].map; s++) ;
+  if (s == segment + nseg) { return sen_success; }
+  fi = &io->fis[fno];
+  if (!sen_opened(fi)) {
+    char path[PATH_MAX];
+    sen_rc rc;
+    gen_pathname(io->path, path, fno);
+    if ((rc = sen_open(fi, path, O_RDWR|O_CREAT, SEN_IO_FILE_SIZE))) { return rc; }
+  }
+  sen_fadvise_willneed(fi, pos, size);
+  return sen_success;
+}
+
+#define PRELOAD_BUFSIZE (1 << 20)
+
+/* reads the nsegs segments from segno of io into the page cache, in the
+   order of the files. with SEN_PRELOAD_READ, they are read by large
+   preads, otherwise the kernel is asked to read them ahead. with
+   SEN_PRELOAD_MAP, they are also mapped and faulted in. they are read
+   up to *budget bytes, and *budget is decremented by them. */
+sen_rc
+sen_io_preload(sen_io *io, uint32_t segno, uint32_t nsegs, int flags, uint64_t *budget)
+{
+  sen_rc rc = sen_success;
+  byte *buf = NULL;
+  uint32_t seg, n, max;
+  uint32_t segment_size = io->header->segment_size;
+  uint32_t segments_per_file = SEN_IO_FILE_SIZE / segment_size;
+  if (io->v08p || io->header->curr_size <= io->base) { return sen_success; }
+  max = (uint32_t) ((io->header->curr_size - io->base + segment_size - 1) / segment_size);
+  if (max > io->header->max_segment) { max = io->header->max_segment; }
+  if (segno >= max) { return sen_success; }
+  if (nsegs > max - segno) { nsegs = max - segno; }
+  if (*budget / segment_size < nsegs) { nsegs = (uint32_t) (*budget / segment_size); }
+  if ((flags & SEN_PRELOAD_READ) && nsegs) {
+    if (!(buf = SEN_GMALLOC(PRELOAD_BUFSIZE))) { return sen_memory_exhausted; }
+  }
+  for (seg = segno; seg < segno + nsegs; seg += n) {
+    struct stat st;
+    char path[PATH_MAX];
+    uint64_t size, done;
+    uint32_t bseg = seg + io->base_seg;
+    uint32_t fno = bseg / segments_per_file;
+    uint32_t base = fno ? 0 : io->base - io->base_seg * segment_size;
+    off_t pos = (bseg % segments_per_file) * segment_size + base;
+    fileinfo *fi = &io->fis[fno];
+    /* up to the end of the file */
+    n = segments_per_file - bseg % segments_per_file;
+    if (n > segno + nsegs - seg) { n = segno + nsegs - seg; }
+    gen_pathname(io->path, path, fno);
+    if (stat(path, &st) || st.st_size <= pos) { continue; }
+    size = (uint64_t) n * segment_size;
+    if (size > st.st_size - pos) { size = st.st_size - pos; }
+    if (!sen_opened(fi) && (rc = sen_open(fi, path, O_RDWR, SEN_IO_FILE_SIZE))) { break; }
+    if (buf) {
+      for (done = 0; done < size; done += PRELOAD_BUFSIZE) {
+        size_t len = (size - done < PRELOAD_BUFSIZE) ? (size_t) (size - done) : PRELOAD_BUFSIZE;
+        if ((rc = sen_pread(fi, buf, len, pos + done))) { break; }
+      }
+      if (rc) { break; }
+    } else {
+      sen_fadvise_willneed(fi, pos, size);
+    }
+    if ((flags & SEN_PRELOAD_MAP)) {
+      uint32_t s, se = seg + (uint32_t) (size / segment_size);
+      for (s = seg; s < se; s++) {
+        void *p = sen_io_seg_ref(io, s);
+        if (p) {
+          sen_madvise_seg(p, segment_size, SEN_IO_POPULATE);
+          sen_io_seg_unref(io, s);
+        }
+      }
+    }
+    *budget -= size;
+  }
+  if (buf) { SEN_GFREE(buf); }
+  return rc;
+}
+
+typedef struct {
+  uint32_t segno;
+  uint32_t age;
+} hot_seg;
+
+static int
+hot_seg_compare(const void *a, const void *b)
+{
+  uint32_t x = ((const hot_seg *)a)->age, y = ((const hot_seg *)b)->age;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* stores the segments of io which are mapped now into segs, the most
+   recently used first, up to max of them. returns the number of them. */
+uint32_t
+sen_io_hot_segs(sen_io *io, uint32_t *segs, uint32_t max)
+{
+  hot_seg *hots;
+  uint32_t s, n = 0, max_segment = io->header->max_segment;
+  if (!max || !(hots = SEN_GMALLOC(sizeof(hot_seg) * max_segment))) { return 0; }
+  for (s = 0; s < max_segment; s++) {
+    sen_io_mapinfo *info = &io->maps[s];
+    if (info->map) {
+      hots[n].segno = s;
+      hots[n++].age = io->count - info->count;
+    }
+  }
+  qsort(hots, n, sizeof(hot_seg), hot_seg_compare);
+  if (n > max) { n = max; }
+  for (s = 0; s < n; s++) { segs[s] = hots[s].segno; }
+  SEN_GFREE(hots);
+  return n;
+}
+
 sen_rc
 sen_io_win_unmap(sen_io_win *iw)
 {
@@ -819,6 +1313,13 @@ sen_io_win_unmap(sen_io_win *iw)
     // if (nseg > 1) { /* auto unmap is not implemented yet */
     if (nseg > 0) {
       SEN_MUNMAP(&iw->fmo, ((byte *)iw->addr) - iw->offset, nseg * segment_size);
+#ifdef USE_AIO
+      if (sen_aio_enabled) {
+        int fno = (iw->segment + io->base_seg) / segments_per_file;
+        fileinfo *fi = &io->fis[fno];
+        sen_cache_mark_invalid(fi->dev, fi->inode, iw->pos, iw->size);
+      }
+#endif /* USE_AIO */
     } else {
       rc = sen_io_seg_unref(io, iw->segment);
 #ifdef USE_AIO
@@ -878,6 +1379,7 @@ sen_io_win_unmap(sen_io_win *iw)
     if (!sen_open(fi, path, O_RDWR|O_CREAT, SEN_IO_FILE_SIZE)) {\
       if ((info->map = SEN_MMAP(&info->fmo, fi, pos, segment_size))) {\
         uint32_t nmaps;\
+        sen_madvise_seg(info->map, segment_size, io->options & sen_io_map_options);\
         SEN_ATOMIC_ADD_EX(&io->nmaps, 1, nmaps);\
         if (!io->v08p) {\
           uint64_t tail = io->base + (segno + 1) * segment_size;\
@@ -888,6 +1390,7 @@ sen_io_win_unmap(sen_io_win *iw)
   } else {\
     if ((info->map = SEN_MMAP(&info->fmo, fi, pos, segment_size))) {\
       uint32_t nmaps;\
+      sen_madvise_seg(info->map, segment_size, io->options & sen_io_map_options);\
       SEN_ATOMIC_ADD_EX(&io->nmaps, 1, nmaps);\
       if (!io->v08p) {\
         uint64_t tail = io->base + (segno + 1) * segment_size;\
@@ -1275,6 +1778,18 @@ sen_pwrite(fileinfo *fi, void *buf, size_t count, off_t offset)
   return rc;
 }
 
+inline static void
+sen_fadvise_willneed(fileinfo *fi, off_t offset, size_t count)
+{
+  /* not implemented */
+}
+
+inline static void
+sen_madvise_seg(void *start, size_t length, uint32_t options)
+{
+  /* not implemented */
+}
+
 #else /* WIN32 */
 
 inline static unsigned int
@@ -1421,4 +1936,30 @@ sen_pwrite(fileinfo *fi, void *buf, size_t count, off_t offset)
   return sen_success;
 }
 
+inline static void
+sen_fadvise_willneed(fileinfo *fi, off_t offset, size_t count)
+{
+#ifdef POSIX_FADV_WILLNEED
+  /* only a hint, so that the failure is ignored */
+  posix_fadvise(fi->fd, offset, count, POSIX_FADV_WILLNEED);
+#endif /* POSIX_FADV_WILLNEED */
+}
+
+inline static void
+sen_madvise_seg(void *start, size_t length, uint32_t options)
+{
+#ifdef MADV_HUGEPAGE
+  /* before prefaulting, so that the huge pages are faulted in */
+  if ((options & SEN_IO_HUGEPAGE)) { madvise(start, length, MADV_HUGEPAGE); }
+#endif /* MADV_HUGEPAGE */
+  if ((options & SEN_IO_POPULATE)) {
+    volatile byte *p, *pe = (byte *)start + length;
+#ifdef MADV_POPULATE_READ
+    if (!madvise(start, length, MADV_POPULATE_READ)) { return; }
+#endif /* MADV_POPULATE_READ */
+    /* touches a byte of each page instead */
+    for (p = start; p < pe; p += pagesize) { (void) *p; }
+  }
+}
+
 #endif /* WIN32 */
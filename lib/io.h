@@ -50,6 +50,15 @@ typedef enum {
   sen_io_manual
 } sen_io_mode;
 
+/* options of the segment mappings, or'ed to sen_io_mode */
+#define SEN_IO_POPULATE  0x100 /* prefault a segment when it is mapped */
+#define SEN_IO_HUGEPAGE  0x200 /* back the segments by transparent huge pages */
+#define SEN_IO_MODE_MASK 0xff
+
+/* the options of the above which are enabled. none by default, and they
+   are given by SEN_MAP_POPULATE and SEN_MAP_HUGEPAGE on sen_init */
+extern int sen_io_map_options;
+
 typedef struct _sen_io sen_io;
 
 typedef struct {
@@ -91,6 +100,7 @@ struct _sen_io {
   struct _sen_io_fileinfo *fis;
   uint32_t nmaps;
   uint32_t count;
+  uint32_t options;
   uint8_t v08p;
 };
 
@@ -106,7 +116,14 @@ void *sen_io_header(sen_io *io);
 void *sen_io_win_map(sen_io *io, sen_ctx *ctx, sen_io_win *iw, uint32_t segment,
 		     uint32_t offset, uint32_t size, sen_io_rw_mode mode);
 sen_rc sen_io_win_mapv(sen_io_win **list, sen_ctx *ctx, int nent);
+sen_rc sen_io_win_prefetch(sen_io *io, uint32_t segment, uint32_t offset, uint32_t size);
+sen_rc sen_io_preload(sen_io *io, uint32_t segno, uint32_t nsegs, int flags, uint64_t *budget);
+uint32_t sen_io_hot_segs(sen_io *io, uint32_t *segs, uint32_t max);
 sen_rc sen_io_win_unmap(sen_io_win *iw);
+#ifdef USE_AIO
+void sen_io_aio_init(void);
+void sen_io_aio_fin(void);
+#endif /* USE_AIO */
 
 void * sen_io_seg_ref(sen_io *io, uint32_t segno);
 sen_rc sen_io_seg_unref(sen_io *io, uint32_t segno);
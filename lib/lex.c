@@ -19,6 +19,161 @@
 #include <ctype.h>
 #include "lex.h"
 
+#define LEX_TOKEN(lex,str,len) do {\
+  if ((lex)->tlen < len) {\
+    unsigned char *buf = SEN_REALLOC((lex)->token, (len) + 1);\
+    if (!(buf)) { (lex)->status = sen_lex_done; return SEN_SYM_NIL; }\
+    (lex)->token = buf;\
+    (lex)->tlen = len;\
+  }\
+  memcpy((lex)->token, str, len);\
+  (lex)->token[len] = '\0';\
+} while (0)
+
+inline static sen_id lex_defer(sen_lex *lex);
+
+/* returns the id of lex->token. with lex->cache, the ids are looked up
+   in it first, and sym is accessed under lex->lock, so that lexes on
+   several threads can share sym. */
+static sen_id
+lex_lookup(sen_lex *lex)
+{
+  sen_id tid, *v;
+  if (lex->entries) { return lex_defer(lex); }
+  if (!lex->cache) {
+    return (lex->flags & SEN_LEX_ADD)
+      ? sen_sym_get(lex->sym, lex->token) : sen_sym_at(lex->sym, lex->token);
+  }
+  if (sen_set_at(lex->cache, lex->token, (void **) &v)) { return *v; }
+  MUTEX_LOCK(*lex->lock);
+  tid = (lex->flags & SEN_LEX_ADD)
+    ? sen_sym_get(lex->sym, lex->token) : sen_sym_at(lex->sym, lex->token);
+  MUTEX_UNLOCK(*lex->lock);
+  if (tid && sen_set_get(lex->cache, lex->token, (void **) &v)) { *v = tid; }
+  return tid;
+}
+
+/* batch
+
+   with SEN_LEX_BATCH, the tokens are not looked up one by one. the lexer
+   runs ahead up to SEN_LEX_BATCH_SIZE tokens, which are kept with the
+   members of sen_lex after each of them, and they are looked up at once
+   by sen_sym_get_many or sen_sym_at_many. then sen_lex_next returns them
+   one by one, as if they were looked up on the way. */
+
+/* records the token of the entry being lexed, and returns a dummy id so
+   that the lexer goes on. */
+inline static sen_id
+lex_defer(sen_lex *lex)
+{
+  sen_ctx *ctx = lex->nstr->ctx;
+  sen_lex_entry *e = &lex->entries[lex->nentries];
+  uint32_t tlen = strlen((char *)lex->token);
+  if (lex->tokens_len + tlen + 1 > lex->tokens_size) {
+    uint32_t size = (lex->tokens_len + tlen + 1) * 2;
+    unsigned char *buf = SEN_REALLOC(lex->tokens, size);
+    if (!buf) { return SEN_SYM_NIL; }
+    lex->tokens = buf;
+    lex->tokens_size = size;
+  }
+  memcpy(lex->tokens + lex->tokens_len, lex->token, tlen + 1);
+  e->token = lex->tokens_len;
+  e->tlen = tlen;
+  e->lookup = 1;
+  lex->tokens_len += tlen + 1;
+  return 1;
+}
+
+inline static sen_rc
+lex_lookup_many(sen_lex *lex, const void **keys, int n, sen_id *ids)
+{
+  sen_rc rc;
+  int i, nmisses = 0;
+  sen_id *v, mids[SEN_LEX_BATCH_SIZE];
+  const void *mkeys[SEN_LEX_BATCH_SIZE];
+  if (!lex->cache) {
+    return (lex->flags & SEN_LEX_ADD)
+      ? sen_sym_get_many(lex->sym, keys, n, ids) : sen_sym_at_many(lex->sym, keys, n, ids);
+  }
+  for (i = 0; i < n; i++) {
+    if (sen_set_at(lex->cache, keys[i], (void **) &v)) {
+      ids[i] = *v;
+    } else {
+      ids[i] = SEN_SYM_NIL;
+      mkeys[nmisses++] = keys[i];
+    }
+  }
+  if (!nmisses) { return sen_success; }
+  MUTEX_LOCK(*lex->lock);
+  rc = (lex->flags & SEN_LEX_ADD)
+    ? sen_sym_get_many(lex->sym, mkeys, nmisses, mids)
+    : sen_sym_at_many(lex->sym, mkeys, nmisses, mids);
+  MUTEX_UNLOCK(*lex->lock);
+  for (nmisses = 0, i = 0; i < n; i++) {
+    if (ids[i]) { continue; }
+    if ((ids[i] = mids[nmisses++]) && sen_set_get(lex->cache, keys[i], (void **) &v)) {
+      *v = ids[i];
+    }
+  }
+  return rc;
+}
+
+inline static sen_id lex_next(sen_lex *lex);
+
+/* lexes the next batch, and looks its tokens up. */
+static void
+lex_fill(sen_lex *lex)
+{
+  int i, n = 0;
+  sen_lex_entry *e;
+  sen_id ids[SEN_LEX_BATCH_SIZE];
+  const void *keys[SEN_LEX_BATCH_SIZE];
+  lex->nentries = 0;
+  lex->centry = 0;
+  lex->tokens_len = 0;
+  while (lex->nentries < SEN_LEX_BATCH_SIZE && lex->status != sen_lex_done) {
+    e = &lex->entries[lex->nentries];
+    e->lookup = 0;
+    e->tid = lex_next(lex);
+    e->pos = lex->pos;
+    e->len = lex->len;
+    e->offset = lex->offset;
+    e->status = lex->status;
+    e->force_prefix = lex->force_prefix;
+    lex->nentries++;
+  }
+  for (i = 0; i < lex->nentries; i++) {
+    e = &lex->entries[i];
+    if (e->lookup && e->tid) { keys[n++] = lex->tokens + e->token; }
+  }
+  if (n) { lex_lookup_many(lex, keys, n, ids); }
+  for (n = 0, i = 0; i < lex->nentries; i++) {
+    e = &lex->entries[i];
+    if (!e->lookup || !e->tid) { continue; }
+    if (!(e->tid = ids[n++])) { e->status = sen_lex_not_found; }
+  }
+}
+
+inline static sen_id
+lex_batch_next(sen_lex *lex)
+{
+  sen_lex_entry *e;
+  sen_ctx *ctx = lex->nstr->ctx;
+  if (lex->centry == lex->nentries) {
+    if (lex->status == sen_lex_done) { return SEN_SYM_NIL; }
+    lex_fill(lex);
+    if (!lex->nentries) { return SEN_SYM_NIL; }
+  }
+  e = &lex->entries[lex->centry++];
+  if (e->lookup) { LEX_TOKEN(lex, lex->tokens + e->token, e->tlen); }
+  lex->pos = e->pos;
+  lex->len = e->len;
+  lex->offset = e->offset;
+  lex->status = e->status;
+  lex->force_prefix = e->force_prefix;
+  return e->tid;
+}
+
 /* ngram */
 
 inline static sen_lex *
@@ -28,6 +183,8 @@ sen_ngram_open(sen_sym *sym, sen_nstr *nstr, uint8_t flags)
   sen_ctx *ctx = nstr->ctx;
   if (!(lex = SEN_MALLOC(sizeof(sen_lex)))) { return NULL; }
   lex->sym = sym;
+  lex->cache = NULL;
+  lex->lock = NULL;
 #ifndef NO_MECAB
   lex->mecab = NULL;
 #endif /* NO_MECAB */
@@ -50,22 +207,11 @@ sen_ngram_open(sen_sym *sym, sen_nstr *nstr, uint8_t flags)
   return lex;
 }
 
-#define LEX_TOKEN(lex,str,len) do {\
-  if ((lex)->tlen < len) {\
-    char *buf = SEN_REALLOC((lex)->token, (len) + 1);\
-    if (!(buf)) { (lex)->status = sen_lex_done; return SEN_SYM_NIL; }\
-    (lex)->token = buf;\
-    (lex)->tlen = len;\
-  }\
-  memcpy((lex)->token, str, len);\
-  (lex)->token[len] = '\0';\
-} while (0)
 
 inline static sen_id
 sen_ngram_next(sen_lex *lex)
 {
   sen_id tid;
-  sen_sym *sym = lex->sym;
   sen_ctx *ctx = lex->nstr->ctx;
   uint_least8_t *cp = NULL;
   int32_t len = 0, pos;
@@ -89,7 +235,7 @@ sen_ngram_next(sen_lex *lex)
           return SEN_SYM_NIL;
         }
         LEX_TOKEN(lex, p, blen);
-        tid = (lex->flags & SEN_LEX_ADD) ? sen_sym_get(sym, lex->token) : sen_sym_at(sym, lex->token);
+        tid = lex_lookup(lex);
         lex->skip = len;
       }
     } else if (lex->uni_digit && SEN_NSTR_CTYPE(*cp) == sen_str_digit) {
@@ -107,7 +253,7 @@ sen_ngram_next(sen_lex *lex)
           return SEN_SYM_NIL;
         }
         LEX_TOKEN(lex, p, blen);
-        tid = (lex->flags & SEN_LEX_ADD) ? sen_sym_get(sym, lex->token) : sen_sym_at(sym, lex->token);
+        tid = lex_lookup(lex);
         lex->skip = len;
       }
     } else if (lex->uni_symbol && SEN_NSTR_CTYPE(*cp) == sen_str_symbol) {
@@ -125,7 +271,7 @@ sen_ngram_next(sen_lex *lex)
           return SEN_SYM_NIL;
         }
         LEX_TOKEN(lex, p, blen);
-        tid = (lex->flags & SEN_LEX_ADD) ? sen_sym_get(sym, lex->token) : sen_sym_at(sym, lex->token);
+        tid = lex_lookup(lex);
         lex->skip = len;
       }
     } else {
@@ -133,8 +279,8 @@ sen_ngram_next(sen_lex *lex)
 #ifdef PRE_DEFINED_UNSPLIT_WORDS
       {
         const unsigned char *key = NULL;
-        if ((tid = sen_sym_common_prefix_search(sym, p))) {
-          if (!(key = _sen_sym_key(sym, tid))) {
+        if ((tid = sen_sym_common_prefix_search(lex->sym, p))) {
+          if (!(key = _sen_sym_key(lex->sym, tid))) {
             lex->status = sen_lex_not_found;
             return SEN_SYM_NIL;
           }
@@ -179,7 +325,7 @@ sen_ngram_next(sen_lex *lex)
           return SEN_SYM_NIL;
         }
         LEX_TOKEN(lex, p, blen);
-        tid = (lex->flags & SEN_LEX_ADD) ? sen_sym_get(sym, lex->token) : sen_sym_at(sym, lex->token);
+        tid = lex_lookup(lex);
         lex->skip = 1;
       }
     }
@@ -225,6 +371,8 @@ sen_mecab_open(sen_sym *sym, sen_nstr *nstr, uint8_t flags)
   sen_ctx *ctx = nstr->ctx;
   if (!(lex = SEN_MALLOC(sizeof(sen_lex)))) { return NULL; }
   lex->sym = sym;
+  lex->cache = NULL;
+  lex->lock = NULL;
   // sen_log("(%s)", str);
   SOLE_MECAB_CONFIRM;
   if (!sole_mecab) {
@@ -275,7 +423,6 @@ inline static sen_id
 sen_mecab_next(sen_lex *lex)
 {
   sen_id tid;
-  sen_sym *sym = lex->sym;
   sen_ctx *ctx = lex->nstr->ctx;
   uint32_t size;
   int32_t len, offset = lex->offset + lex->len;
@@ -296,7 +443,7 @@ sen_mecab_next(sen_lex *lex)
   }
   size = (uint32_t)(p - lex->next);
   LEX_TOKEN(lex, lex->next, size);
-  tid = (lex->flags & SEN_LEX_ADD) ? sen_sym_get(sym, lex->token) : sen_sym_at(sym, lex->token);
+  tid = lex_lookup(lex);
   {
     int cl;
     while ((cl = sen_isspace(p, lex->encoding))) { p += cl; }
@@ -326,6 +473,8 @@ sen_delimited_open(sen_sym *sym, sen_nstr *nstr, uint8_t flags)
   const char *p;
   if (!(lex = SEN_MALLOC(sizeof(sen_lex)))) { return NULL; }
   lex->sym = sym;
+  lex->cache = NULL;
+  lex->lock = NULL;
 #ifndef NO_MECAB
   lex->mecab = NULL;
 #endif /* NO_MECAB */
@@ -354,7 +503,6 @@ inline static sen_id
 sen_delimited_next(sen_lex *lex)
 {
   sen_id tid;
-  sen_sym *sym = lex->sym;
   sen_ctx *ctx = lex->nstr->ctx;
   uint32_t size;
   int32_t len, offset = lex->offset + lex->len;
@@ -375,7 +523,7 @@ sen_delimited_next(sen_lex *lex)
   }
   size = (uint32_t)(p - lex->next);
   LEX_TOKEN(lex, lex->next, size);
-  tid = (lex->flags & SEN_LEX_ADD) ? sen_sym_get(sym, lex->token) : sen_sym_at(sym, lex->token);
+  tid = lex_lookup(lex);
   {
     int cl;
     while ((cl = sen_isspace(p, lex->encoding))) { p += cl; }
@@ -422,6 +570,7 @@ sen_lex_fin(void)
 sen_lex *
 sen_lex_open(sen_sym *sym, const char *str, size_t str_len, uint8_t flags)
 {
+  sen_lex *lex;
   sen_nstr *nstr;
   int nflag, type;
   if (!sym) {
@@ -446,21 +595,38 @@ sen_lex_open(sen_sym *sym, const char *str, size_t str_len, uint8_t flags)
 #ifdef NO_MECAB
     return NULL;
 #else /* NO_MECAB */
-    return sen_mecab_open(sym, nstr, flags);
+    lex = sen_mecab_open(sym, nstr, flags);
+    break;
 #endif /* NO_MECAB */
   case SEN_INDEX_NGRAM :
-    return sen_ngram_open(sym, nstr, flags);
+    lex = sen_ngram_open(sym, nstr, flags);
+    break;
   case SEN_INDEX_DELIMITED :
-    return sen_delimited_open(sym, nstr, flags);
+    lex = sen_delimited_open(sym, nstr, flags);
+    break;
   default :
     return NULL;
   }
+  if (lex) {
+    sen_ctx *ctx = nstr->ctx;
+    lex->entries = NULL;
+    lex->nentries = 0;
+    lex->centry = 0;
+    lex->tokens = NULL;
+    lex->tokens_size = 0;
+    lex->tokens_len = 0;
+    if ((flags & SEN_LEX_BATCH) &&
+        !(lex->entries = SEN_MALLOC(sizeof(sen_lex_entry) * SEN_LEX_BATCH_SIZE))) {
+      sen_lex_close(lex);
+      return NULL;
+    }
+  }
+  return lex;
 }
 
-sen_rc
-sen_lex_next(sen_lex *lex)
+inline static sen_id
+lex_next(sen_lex *lex)
 {
-  /* if (!lex) { return sen_invalid_argument; } */
   switch ((lex->sym->flags & SEN_INDEX_TOKENIZER_MASK)) {
   case SEN_INDEX_MORPH_ANALYSE :
 #ifdef NO_MECAB
@@ -477,6 +643,13 @@ sen_lex_next(sen_lex *lex)
   }
 }
 
+sen_rc
+sen_lex_next(sen_lex *lex)
+{
+  /* if (!lex) { return sen_invalid_argument; } */
+  return lex->entries ? lex_batch_next(lex) : lex_next(lex);
+}
+
 sen_rc
 sen_lex_close(sen_lex *lex)
 {
@@ -486,6 +659,8 @@ sen_lex_close(sen_lex *lex)
     // if (lex->mecab) { mecab_destroy(lex->mecab); }
     if (lex->buf) { SEN_FREE(lex->buf); }
     if (lex->token) { SEN_REALLOC(lex->token, 0); }
+    if (lex->tokens) { SEN_REALLOC(lex->tokens, 0); }
+    if (lex->entries) { SEN_FREE(lex->entries); }
     SEN_FREE(lex);
     return sen_success;
   } else {
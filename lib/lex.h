@@ -39,9 +39,27 @@ extern "C" {
 
 #define SEN_LEX_ADD 1
 #define SEN_LEX_UPD 2
+#define SEN_LEX_BATCH 4 /* look the tokens up by batches of SEN_LEX_BATCH_SIZE */
+
+#define SEN_LEX_BATCH_SIZE 64
+
+/* a token of a batch, and the members of sen_lex when it is returned */
+typedef struct {
+  sen_id tid;
+  uint32_t token;
+  uint32_t tlen;
+  int32_t pos;
+  int32_t len;
+  uint32_t offset;
+  uint8_t status;
+  uint8_t force_prefix;
+  uint8_t lookup;
+} sen_lex_entry;
 
 typedef struct {
   sen_sym *sym;
+  sen_set *cache;
+  sen_mutex *lock;
   unsigned char *buf;
   const unsigned char *orig;
   const unsigned char *next;
@@ -63,6 +81,12 @@ typedef struct {
   uint8_t uni_symbol;
   uint8_t force_prefix;
   sen_encoding encoding;
+  sen_lex_entry *entries;
+  uint32_t nentries;
+  uint32_t centry;
+  unsigned char *tokens;
+  uint32_t tokens_size;
+  uint32_t tokens_len;
 } sen_lex;
 
 enum {
@@ -305,7 +305,7 @@ get_expr(sen_query *q)
 static const char *
 get_weight_vector(sen_query *query, const char *source)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   const char *p;
 
   if (!query->opt.weight_vector &&
@@ -417,7 +417,7 @@ sen_query *
 sen_query_open(const char *str, unsigned int str_len,
                sen_sel_operator default_op, int max_exprs, sen_encoding encoding)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_query *q;
   int max_cells = max_exprs * 4;
   if (!(q = SEN_MALLOC(sizeof(sen_query) + max_cells * sizeof(cell) + str_len + 1))) {
@@ -462,7 +462,7 @@ sen_query_rest(sen_query *q, const char ** const rest)
 sen_rc
 sen_query_close(sen_query *q)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!q) { return sen_invalid_argument; }
   if (q->opt.weight_vector) {
     SEN_FREE(q->opt.weight_vector);
@@ -740,7 +740,7 @@ scan_query(sen_query *q, sen_nstr *nstr, sen_id section, cell *c, snip_cond **sc
 static sen_rc
 alloc_snip_conds(sen_query *q)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!(q->snip_conds = SEN_CALLOC(sizeof(snip_cond) * q->cur_expr))) {
     SEN_LOG(sen_log_alert, "snip_cond allocation failed");
     return sen_memory_exhausted;
@@ -156,6 +156,7 @@ typedef int sen_sock;
 typedef pthread_t sen_thread;
 typedef pthread_mutex_t sen_mutex;
 #define THREAD_CREATE(thread,func,arg) (pthread_create(&(thread), NULL, (func), (arg)))
+#define THREAD_JOIN(thread) (pthread_join((thread), NULL))
 #define MUTEX_INIT(m) pthread_mutex_init(&m, NULL)
 #define MUTEX_LOCK(m) pthread_mutex_lock(&m)
 #define MUTEX_UNLOCK(m) pthread_mutex_unlock(&m)
@@ -164,7 +165,15 @@ typedef pthread_mutex_t sen_mutex;
 typedef pthread_cond_t sen_cond;
 #define COND_INIT(c) pthread_cond_init(&c, NULL)
 #define COND_SIGNAL(c) pthread_cond_signal(&c)
+#define COND_BROADCAST(c) pthread_cond_broadcast(&c)
 #define COND_WAIT(c,m) pthread_cond_wait(&c, &m)
+/* waits until the time_t t at most */
+#define COND_TIMEDWAIT(c,m,t) do {\
+  struct timespec _ts;\
+  _ts.tv_sec = (t);\
+  _ts.tv_nsec = 0;\
+  pthread_cond_timedwait(&c, &m, &_ts);\
+} while (0)
 
 typedef pthread_key_t sen_thread_key;
 #define THREAD_KEY_CREATE pthread_key_create
@@ -185,6 +194,10 @@ typedef int sen_thread_key;
 typedef uintptr_t sen_thread;
 typedef CRITICAL_SECTION sen_mutex;
 #define THREAD_CREATE(thread,func,arg) (((thread)=_beginthreadex(NULL, 0, (func), (arg), 0, NULL)) == NULL)
+#define THREAD_JOIN(thread) do {\
+  WaitForSingleObject((HANDLE)(thread), INFINITE);\
+  CloseHandle((HANDLE)(thread));\
+} while (0)
 #define MUTEX_INIT(m) InitializeCriticalSection(&m)
 #define MUTEX_LOCK(m) EnterCriticalSection(&m)
 #define MUTEX_UNLOCK(m) LeaveCriticalSection(&m)
@@ -197,7 +210,9 @@ typedef CRITICAL_SECTION sen_mutex;
 typedef int sen_cond;
 #define COND_INIT(c) ((c) = 0)
 #define COND_SIGNAL(c)
+#define COND_BROADCAST(c)
 #define COND_WAIT(c,m) do { MUTEX_UNLOCK(m); usleep(1000); MUTEX_LOCK(m); } while (0)
+#define COND_TIMEDWAIT(c,m,t) COND_WAIT(c,m)
 /* todo : must be enhanced! */
 
 #endif /* HAVE_PTHREAD_H */
@@ -219,6 +234,9 @@ typedef int sen_cond;
 #define SEN_BIT_SCAN_REV(v,r)   for (r = 31; r && !((1 << r) & v); r--)
 #endif /* ATOMIC ADD */
 
+#define SEN_MEMORY_BARRIER() __sync_synchronize()
+#define SEN_PREFETCH(p) __builtin_prefetch(p)
+
 #ifdef __i386__ /* ATOMIC 64BIT SET */
 #define SEN_SET_64BIT(p,v) \
   __asm__ __volatile__ ("\txchgl %%esi, %%ebx\n1:\n\txchgl %%esi, %%ebx\n\tmovl (%0), %%eax\n\tmovl 4(%0), %%edx\n\tlock; cmpxchg8b(%0)\n\tjnz 1b\n\txchgl %%ebx, %%esi" : : "D"(p), "S"(*(((uint32_t *)&(v))+0)), "c"(*(((uint32_t *)&(v))+1)) : "ax", "dx", "memory");
@@ -240,10 +258,15 @@ typedef int sen_cond;
 
 /* todo */
 #define SEN_BIT_SCAN_REV(v,r)   for (r = 31; r && !((1 << r) & v); r--)
+#define SEN_MEMORY_BARRIER() MemoryBarrier()
+#define SEN_PREFETCH(p)
 
 #else /* __GNUC__ */
 /* todo */
 #define SEN_BIT_SCAN_REV(v,r)   for (r = 31; r && !((1 << r) & v); r--)
+/* todo */
+#define SEN_MEMORY_BARRIER()
+#define SEN_PREFETCH(p)
 #endif /* __GNUC__ */
 
 typedef uint8_t byte;
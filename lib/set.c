@@ -30,6 +30,23 @@
 
 #define STEP(x) (((x) >> 2) | 0x1010101)
 
+/* in the hash mode, tags[i] is a byte taken from the hash of the entry
+   which index[i] points, TAG_EMPTY if index[i] is NULL, or TAG_GARBAGE if
+   it is GARBAGE. a probe reads the entry only when its tag agrees, so that
+   the entries of the other keys in the chain are not touched. the byte is
+   taken from the top of the hash multiplied, since int keys are their own
+   hash and their high bits are often 0. */
+
+#define TAG_EMPTY 0
+#define TAG_GARBAGE 1
+
+inline static uint8_t
+tag_of(uint32_t h)
+{
+  uint8_t t = (h * 0x9e3779b1U) >> 24;
+  return t > TAG_GARBAGE ? t : t + 2;
+}
+
 typedef struct _sen_set_element entry;
 typedef struct _sen_set_element_str entry_str;
 
@@ -39,7 +56,7 @@ inline static entry *
 entry_new(sen_set *set)
 {
   entry *e;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (set->garbages) {
     e = set->garbages;
     set->garbages = *((entry **)e);
@@ -64,7 +81,7 @@ sen_set *
 sen_set_open(uint32_t key_size, uint32_t value_size, uint32_t init_size)
 {
   sen_set *set;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   uint32_t entry_size, n, mod;
   for (n = INITIAL_INDEX_SIZE; n < init_size; n *= 2);
   switch (key_size) {
@@ -91,6 +108,11 @@ sen_set_open(uint32_t key_size, uint32_t value_size, uint32_t init_size)
     SEN_FREE(set);
     return NULL;
   }
+  if (!(set->tags = SEN_CALLOC(n))) {
+    SEN_FREE(set->index);
+    SEN_FREE(set);
+    return NULL;
+  }
   return set;
 }
 
@@ -98,40 +120,36 @@ sen_rc
 sen_set_reset(sen_set * set, uint32_t ne)
 {
   uint32_t i, j, m, n, s;
-  entry **index, *e, **sp, **dp;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  entry **index, *e, **sp;
+  uint8_t *tags;
+  sen_ctx *ctx = sen_ctx_current();
   if (!ne) { ne = set->n_entries * 2; }
   if (ne > INT_MAX) { return sen_memory_exhausted; }
   for (n = INITIAL_INDEX_SIZE; n <= ne; n *= 2);
   if (!(index = SEN_CALLOC(n * sizeof(entry *)))) { return sen_memory_exhausted; }
+  if (!(tags = SEN_CALLOC(n))) {
+    SEN_FREE(index);
+    return sen_memory_exhausted;
+  }
   m = n - 1;
-  if (set->key_size) {
-    for (j = set->max_offset + 1, sp = set->index; j; j--, sp++) {
-      e = *sp;
-      if (!e || (e == GARBAGE)) { continue; }
-      for (i = e->key, s = STEP(i); ; i += s) {
-        dp = index + (i & m);
-        if (!*dp) { break; }
-      }
-      *dp = e;
-    }
-  } else {
-    for (j = set->max_offset + 1, sp = set->index; j; j--, sp++) {
-      e = *sp;
-      if (!e || (e == GARBAGE)) { continue; }
-      for (i = SEN_SET_STRHASH(e), s = STEP(i); ; i += s) {
-        dp = index + (i & m);
-        if (!*dp) { break; }
-      }
-      *dp = e;
-    }
+  for (j = set->max_offset + 1, sp = set->index; j; j--, sp++) {
+    uint32_t h;
+    e = *sp;
+    if (!e || (e == GARBAGE)) { continue; }
+    h = set->key_size ? e->key : SEN_SET_STRHASH(e);
+    for (i = h, s = STEP(i); tags[i & m]; i += s);
+    index[i & m] = e;
+    tags[i & m] = tag_of(h);
   }
   {
     entry **i0 = set->index;
+    uint8_t *t0 = set->tags;
     set->index = index;
+    set->tags = tags;
     set->max_offset = m;
     set->n_garbages = 0;
     SEN_FREE(i0);
+    SEN_FREE(t0);
   }
   return sen_success;
 }
@@ -140,7 +158,7 @@ sen_rc
 sen_set_close(sen_set * set)
 {
   uint32_t i;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!set) { return sen_invalid_argument; }
   if (!set->key_size) {
     entry *e, **sp;
@@ -154,6 +172,7 @@ sen_set_close(sen_set * set)
     if (set->chunks[i]) { SEN_FREE(set->chunks[i]); }
   }
   SEN_FREE(set->index);
+  SEN_FREE(set->tags);
   SEN_FREE(set);
   return sen_success;
 }
@@ -169,32 +188,50 @@ sen_set_info(sen_set *set, unsigned *key_size, unsigned *value_size,
   return sen_success;
 }
 
+/* the hash of binary keys and of strings is computed a word at a time,
+   and mixed like MurmurHash3, so that keys which differ only in a few
+   bits don't collide in the low bits of the hash, which pick the slot. */
 inline static uint32_t
-str_hash(const unsigned char *p)
+bin_hash(const uint8_t *p, uint32_t length)
 {
-  uint32_t r;
-  for (r = 0; *p; p++) { r = (r * 1021) + *p; }
+  uint32_t r = length, w;
+  for (; length >= sizeof(uint32_t); length -= sizeof(uint32_t), p += sizeof(uint32_t)) {
+    memcpy(&w, p, sizeof(uint32_t));
+    w *= 0xcc9e2d51;
+    w = (w << 15) | (w >> 17);
+    r ^= w * 0x1b873593;
+    r = (r << 13) | (r >> 19);
+    r = r * 5 + 0xe6546b64;
+  }
+  for (w = 0; length--;) { w = (w << 8) | p[length]; }
+  w *= 0xcc9e2d51;
+  w = (w << 15) | (w >> 17);
+  r ^= w * 0x1b873593;
+  r ^= r >> 16;
+  r *= 0x85ebca6b;
+  r ^= r >> 13;
+  r *= 0xc2b2ae35;
+  r ^= r >> 16;
   return r;
 }
 
 inline static uint32_t
-bin_hash(const uint8_t *p, uint32_t length)
+str_hash(const unsigned char *p)
 {
-  uint32_t r;
-  for (r = 0; length--; p++) { r = (r * 1021) + *p; }
-  return r;
+  return bin_hash(p, strlen((const char *)p));
 }
 
 sen_set_eh *
 sen_set_int_at(sen_set *set, const uint32_t *key, void **value)
 {
-  entry *e, **ep, **index = set->index;
+  entry *e, **index = set->index;
+  uint8_t t, *tags = set->tags;
   uint32_t h = *key, i, m = set->max_offset, s = STEP(h);
-  for (i = h; ep = index + (i & m), (e = *ep); i += s) {
-    if (e == GARBAGE) { continue; }
-    if (e->key == h) {
+  for (i = h, t = tag_of(h); tags[i & m]; i += s) {
+    if (tags[i & m] != t) { continue; }
+    if ((e = index[i & m])->key == h) {
       if (value) { *value = e->dummy; }
-      return ep;
+      return index + (i & m);
     }
   }
   return NULL;
@@ -203,13 +240,15 @@ sen_set_int_at(sen_set *set, const uint32_t *key, void **value)
 sen_set_eh *
 sen_set_str_at(sen_set *set, const char *key, void **value)
 {
-  entry *e, **ep, **index = set->index;
+  entry *e, **index = set->index;
+  uint8_t t, *tags = set->tags;
   uint32_t h = str_hash((unsigned char *)key), i, m = set->max_offset, s = STEP(h);
-  for (i = h; ep = index + (i & m), (e = *ep); i += s) {
-    if (e == GARBAGE) { continue; }
+  for (i = h, t = tag_of(h); tags[i & m]; i += s) {
+    if (tags[i & m] != t) { continue; }
+    e = index[i & m];
     if (SEN_SET_STRHASH(e) == h && !strcmp(key, SEN_SET_STRKEY(e))) {
       if (value) { *value = SEN_SET_STRVAL(e); }
-      return (sen_set_eh *) ep;
+      return (sen_set_eh *) (index + (i & m));
     }
   }
   return NULL;
@@ -218,25 +257,116 @@ sen_set_str_at(sen_set *set, const char *key, void **value)
 sen_set_eh *
 sen_set_bin_at(sen_set *set, const void *key, void **value)
 {
-  entry *e, **ep, **index = set->index;
+  entry *e, **index = set->index;
+  uint8_t t, *tags = set->tags;
   uint32_t h = bin_hash(key, set->key_size), i, m = set->max_offset, s = STEP(h);
-  for (i = h; ep = index + (i & m), (e = *ep); i += s) {
-    if (e == GARBAGE) { continue; }
+  for (i = h, t = tag_of(h); tags[i & m]; i += s) {
+    if (tags[i & m] != t) { continue; }
+    e = index[i & m];
     if (e->key == h && !memcmp(key, e->dummy, set->key_size)) {
       if (value) { *value = SEN_SET_BINVAL(e, set); }
-      return ep;
+      return index + (i & m);
     }
   }
   return NULL;
 }
 
+/* in the array mode, the entries of int keys are stored in the chunk
+   SEN_SET_MAX_CHUNK in the ascending order of the keys, and the i-th slot
+   of the index points the i-th entry, or is GARBAGE if it is deleted.
+   curr_entry is the number of the entries stored, and array_size is the
+   capacity of the chunk. a key out of the order, or over the capacity,
+   turns the set into a hash. the keys are often looked up in their order,
+   so the search starts from array_hint, the position last found. */
+
+#define ARRAY_ENTRY(set,i) \
+  ((entry *)((set)->chunks[SEN_SET_MAX_CHUNK] + (set)->entry_size * (i)))
+#define ARRAY_KEY(set,i) (ARRAY_ENTRY(set,i)->key)
+
+/* returns the position of the first entry at or after i whose key is not
+   less than key. the keys before i must be less than key. */
+inline static uint32_t
+array_seek(sen_set *set, uint32_t i, uint32_t key)
+{
+  uint32_t c, h, s = 1, n = set->curr_entry;
+  if (i >= n || ARRAY_KEY(set, i) >= key) { return i; }
+  while (i + s < n && ARRAY_KEY(set, i + s) < key) {
+    i += s;
+    s <<= 1;
+  }
+  for (h = (i + s < n) ? i + s : n, i++; i < h;) {
+    c = (i + h) >> 1;
+    if (ARRAY_KEY(set, c) < key) { i = c + 1; } else { h = c; }
+  }
+  return i;
+}
+
+inline static sen_set_eh *
+array_at(sen_set *set, const uint32_t *key, void **value)
+{
+  entry *e, **ep;
+  uint32_t i = set->array_hint;
+  if (i >= set->curr_entry || ARRAY_KEY(set, i) > *key) { i = 0; }
+  if ((i = array_seek(set, i, *key)) == set->curr_entry) { return NULL; }
+  set->array_hint = i;
+  ep = set->index + i;
+  if ((e = *ep) == GARBAGE || e->key != *key) { return NULL; }
+  if (value) { *value = e->dummy; }
+  return ep;
+}
+
+/* returns NULL if the key can't be stored in the array. */
+inline static sen_set_eh *
+array_get(sen_set *set, const uint32_t *key, void **value)
+{
+  entry *e, **ep;
+  uint32_t i = set->curr_entry;
+  if (i && ARRAY_KEY(set, i - 1) >= *key) {
+    if (ARRAY_KEY(set, i - 1) == *key) {
+      i--;
+    } else {
+      i = array_seek(set, 0, *key);
+      if (ARRAY_KEY(set, i) != *key) { return NULL; }
+    }
+    e = ARRAY_ENTRY(set, i);
+    ep = set->index + i;
+    if (*ep == GARBAGE) {
+      memset(e, 0, set->entry_size);
+      e->key = *key;
+      *ep = e;
+      set->n_entries++;
+      set->n_garbages--;
+    }
+  } else {
+    if (i >= set->array_size) { return NULL; }
+    e = ARRAY_ENTRY(set, i);
+    e->key = *key;
+    ep = set->index + i;
+    *ep = e;
+    set->curr_entry++;
+    set->n_entries++;
+  }
+  if (value) { *value = e->dummy; }
+  return ep;
+}
+
+/* the entries stay in the chunk of the array. */
+inline static sen_rc
+array_fin(sen_set *set)
+{
+  sen_rc rc;
+  if ((rc = sen_set_reset(set, 0))) { return rc; }
+  set->curr_entry = 0;
+  set->arrayp = 0;
+  return sen_success;
+}
+
 sen_set_eh *
 sen_set_at(sen_set *set, const void *key, void **value)
 {
   if (set->arrayp) {
-    if (sen_set_reset(set, 0)) { return NULL; }
-    set->curr_entry = 0;
-    set->arrayp = 0;
+    if (set->key_size == sizeof(uint32_t)) { return array_at(set, key, value); }
+    if (array_fin(set)) { return NULL; }
   }
   switch (set->key_size) {
   case 0 :
@@ -253,13 +383,14 @@ sen_set_int_get(sen_set *set, const uint32_t *key, void **value)
 {
   static int _ncalls = 0, _ncolls = 0;
   entry *e, **ep, **np = NULL, **index = set->index;
+  uint8_t t, *tags = set->tags;
   uint32_t h = *key, i, m = set->max_offset, s = STEP(h);
   _ncalls++;
-  for (i = h; ep = index + (i & m), e = *ep; i += s) {
-    if (e == GARBAGE) {
+  for (i = h, t = tag_of(h); ep = index + (i & m), tags[i & m]; i += s) {
+    if (tags[i & m] == TAG_GARBAGE) {
       if (!np) { np = ep; }
-    } else {
-      if (e->key == h) { goto exit; }
+    } else if (tags[i & m] == t) {
+      if ((e = *ep)->key == h) { goto exit; }
     }
     if (!(++_ncolls % 1000000) && (_ncolls > _ncalls)) {
       if (_ncolls < 0 || _ncalls < 0) {
@@ -277,6 +408,7 @@ sen_set_int_get(sen_set *set, const uint32_t *key, void **value)
   if (!(e = entry_new(set))) { return NULL; }
   e->key = h;
   *ep = e;
+  tags[ep - index] = t;
   set->n_entries++;
 exit :
   if (value) { *value = e->dummy; }
@@ -286,13 +418,15 @@ exit :
 inline static sen_set_eh *
 sen_set_str_get(sen_set *set, const char *key, void **value)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   entry *e, **ep, **np = NULL, **index = set->index;
+  uint8_t t, *tags = set->tags;
   uint32_t h = str_hash((unsigned char *)key), i, m = set->max_offset, s = STEP(h);
-  for (i = h; ep = index + (i & m), e = *ep; i += s) {
-    if (e == GARBAGE) {
+  for (i = h, t = tag_of(h); ep = index + (i & m), tags[i & m]; i += s) {
+    if (tags[i & m] == TAG_GARBAGE) {
       if (!np) { np = ep; }
-    } else {
+    } else if (tags[i & m] == t) {
+      e = *ep;
       if (SEN_SET_STRHASH(e) == h && !strcmp(key, SEN_SET_STRKEY(e))) { goto exit; }
     }
   }
@@ -310,6 +444,7 @@ sen_set_str_get(sen_set *set, const char *key, void **value)
       ep = np;
     }
     *ep = e;
+    tags[ep - index] = t;
     set->n_entries++;
   }
 exit :
@@ -321,11 +456,13 @@ inline static sen_set_eh *
 sen_set_bin_get(sen_set *set, const void *key, void **value)
 {
   entry *e, **ep, **np = NULL, **index = set->index;
+  uint8_t t, *tags = set->tags;
   uint32_t h = bin_hash(key, set->key_size), i, m = set->max_offset, s = STEP(h);
-  for (i = h; ep = index + (i & m), e = *ep; i += s) {
-    if (e == GARBAGE) {
+  for (i = h, t = tag_of(h); ep = index + (i & m), tags[i & m]; i += s) {
+    if (tags[i & m] == TAG_GARBAGE) {
       if (!np) { np = ep; }
-    } else {
+    } else if (tags[i & m] == t) {
+      e = *ep;
       if (e->key == h && !memcmp(key, e->dummy, set->key_size)) {
         goto exit;
       }
@@ -339,6 +476,7 @@ sen_set_bin_get(sen_set *set, const void *key, void **value)
   e->key = h;
   memcpy(e->dummy, key, set->key_size);
   *ep = e;
+  tags[ep - index] = t;
   set->n_entries++;
 exit :
   if (value) { *value = &e->dummy[set->key_size]; }
@@ -350,9 +488,11 @@ sen_set_get(sen_set *set, const void *key, void **value)
 {
   if (!set) { return NULL; }
   if (set->arrayp) {
-    if (sen_set_reset(set, 0)) { return NULL; }
-    set->curr_entry = 0;
-    set->arrayp = 0;
+    if (set->key_size == sizeof(uint32_t)) {
+      sen_set_eh *ep = array_get(set, key, value);
+      if (ep) { return ep; }
+    }
+    if (array_fin(set)) { return NULL; }
   } else if ((set->n_entries + set->n_garbages) * 2 > set->max_offset) {
     sen_set_reset(set, 0);
   }
@@ -370,13 +510,16 @@ sen_rc
 sen_set_del(sen_set *set, sen_set_eh *ep)
 {
   entry *e;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!set || !ep || !*ep) { return sen_invalid_argument; }
   e = *ep;
   *ep = GARBAGE;
   if (!set->key_size) { SEN_FREE(SEN_SET_STRKEY(e)); }
-  *((entry **)e) = set->garbages;
-  set->garbages = e;
+  if (!set->arrayp) {
+    set->tags[ep - set->index] = TAG_GARBAGE;
+    *((entry **)e) = set->garbages;
+    set->garbages = e;
+  }
   set->n_entries--;
   set->n_garbages++;
   return sen_success;
@@ -386,13 +529,13 @@ sen_set_cursor *
 sen_set_cursor_open(sen_set *set)
 {
   sen_set_cursor *c;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (!set) { return NULL; }
   if (!(c = SEN_MALLOC(sizeof(sen_set_cursor)))) { return NULL; }
   c->set = set;
   c->index = set->index;
   c->curr = set->index;
-  c->rest = set->max_offset + 1;
+  c->rest = set->arrayp ? set->curr_entry : set->max_offset + 1;
   return c;
 }
 
@@ -436,7 +579,7 @@ sen_set_cursor_next(sen_set_cursor *c, void **key, void **value)
 sen_rc
 sen_set_cursor_close(sen_set_cursor *cursor)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   SEN_FREE(cursor);
   return sen_success;
 }
@@ -616,6 +759,127 @@ sort_func(sen_set *set, entry **res, int limit,
   }
 }
 
+/* when limit is less than 1/TOPK_RATIO of the entries, the top limit
+   entries are taken by a heap of limit entries in a pass over the index,
+   and only they are sorted. */
+#define TOPK_RATIO 16
+
+/* otherwise, the int keys of RADIX_MIN entries or more are sorted all by
+   a radix sort of RADIX_BITS bits a pass, which is faster than the
+   partial quick sort of the pointers even for a limit of 1/TOPK_RATIO. */
+#define RADIX_MIN 4096
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_PASSES ((32 + RADIX_BITS - 1) / RADIX_BITS)
+
+/* res is a max-heap of the limit entries of the smallest keys so far. */
+inline static int
+topk_int(sen_set *set, entry **res, int limit, int offset, int dir)
+{
+  int32_t ck;
+  uint32_t i, j, j2, n = 0, m = set->max_offset, rest = set->n_entries;
+  entry *e, **index = set->index;
+  for (i = 0; rest && i <= m; i++) {
+    if (!(e = index[i]) || e == GARBAGE) { continue; }
+    rest--;
+    ck = INT_OFFSET_VAL(e);
+    if (n < limit) {
+      for (j = n++; j; j = j2) {
+        j2 = (j - 1) >> 1;
+        if (INT_OFFSET_VAL(res[j2]) >= ck) { break; }
+        res[j] = res[j2];
+      }
+    } else {
+      if (ck >= INT_OFFSET_VAL(*res)) { continue; }
+      for (j = 0; (j2 = j * 2 + 1) < n; j = j2) {
+        if (j2 + 1 < n && INT_OFFSET_VAL(res[j2 + 1]) > INT_OFFSET_VAL(res[j2])) { j2++; }
+        if (INT_OFFSET_VAL(res[j2]) <= ck) { break; }
+        res[j] = res[j2];
+      }
+    }
+    res[j] = e;
+  }
+  return n;
+}
+
+inline static int
+topk_func(sen_set *set, entry **res, int limit,
+          int(*func)(sen_set *, entry **, sen_set *, entry **, void *),
+          void *arg, void *arg0, int dir)
+{
+  uint32_t i, j, j2, n = 0, m = set->max_offset, rest = set->n_entries;
+  entry *e, **index = set->index;
+  for (i = 0; rest && i <= m; i++) {
+    if (!(e = index[i]) || e == GARBAGE) { continue; }
+    rest--;
+    if (n < limit) {
+      for (j = n++; j; j = j2) {
+        j2 = (j - 1) >> 1;
+        if (func(arg0, &res[j2], arg0, &e, arg) * dir >= 0) { break; }
+        res[j] = res[j2];
+      }
+    } else {
+      if (func(arg0, &e, arg0, res, arg) * dir >= 0) { continue; }
+      for (j = 0; (j2 = j * 2 + 1) < n; j = j2) {
+        if (j2 + 1 < n && func(arg0, &res[j2 + 1], arg0, &res[j2], arg) * dir > 0) { j2++; }
+        if (func(arg0, &res[j2], arg0, &e, arg) * dir <= 0) { break; }
+        res[j] = res[j2];
+      }
+    }
+    res[j] = e;
+  }
+  return n;
+}
+
+/* sorts all the entries by the int keys. returns sen_memory_exhausted
+   if the buffers can't be allocated, then sort_int is used. */
+inline static sen_rc
+radix_int(sen_set *set, entry **res, int offset, int dir)
+{
+  sen_ctx *ctx = sen_ctx_current();
+  uint32_t i, d, k, sum, m = set->max_offset, n = set->n_entries;
+  uint32_t *buf, *keys, *keys2, *tk, (*counts)[RADIX_SIZE];
+  entry *e, **out = res, **tmp, **te, **index = set->index;
+  if (!(buf = SEN_MALLOC(sizeof(uint32_t) * n * 2 + sizeof(entry *) * n +
+                         sizeof(uint32_t) * RADIX_SIZE * RADIX_PASSES))) {
+    return sen_memory_exhausted;
+  }
+  keys = buf;
+  keys2 = keys + n;
+  tmp = (entry **)(keys2 + n);
+  counts = (uint32_t (*)[RADIX_SIZE])(tmp + n);
+  memset(counts, 0, sizeof(uint32_t) * RADIX_SIZE * RADIX_PASSES);
+  /* the sign bit is flipped, so that the keys are sorted as unsigned */
+  for (i = 0, k = 0; k < n && i <= m; i++) {
+    if (!(e = index[i]) || e == GARBAGE) { continue; }
+    keys[k] = (uint32_t)INT_OFFSET_VAL(e) ^ 0x80000000;
+    for (d = 0; d < RADIX_PASSES; d++) {
+      counts[d][(keys[k] >> (d * RADIX_BITS)) & (RADIX_SIZE - 1)]++;
+    }
+    res[k++] = e;
+  }
+  for (d = 0; d < RADIX_PASSES; d++) {
+    uint32_t shift = d * RADIX_BITS, *c = counts[d];
+    /* a pass is skipped if all the keys have the same digit */
+    if (c[(keys[0] >> shift) & (RADIX_SIZE - 1)] == n) { continue; }
+    for (i = 0, sum = 0; i < RADIX_SIZE; i++) {
+      k = c[i];
+      c[i] = sum;
+      sum += k;
+    }
+    for (i = 0; i < n; i++) {
+      k = c[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+      keys2[k] = keys[i];
+      tmp[k] = res[i];
+    }
+    tk = keys; keys = keys2; keys2 = tk;
+    te = res; res = tmp; tmp = te;
+  }
+  if (res != out) { memcpy(out, res, sizeof(entry *) * n); }
+  SEN_FREE(buf);
+  return sen_success;
+}
+
 inline static int
 func_str(sen_set *sa, entry **a, sen_set *sb, entry **b, void *arg)
 {
@@ -631,9 +895,11 @@ func_bin(sen_set *sa, entry **a, sen_set *sb, entry **b, void *arg)
 sen_set_eh *
 sen_set_sort(sen_set *set, int limit, sen_set_sort_optarg *optarg)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   entry **res;
-  int dir = 1;
+  int dir = 1, offset = 0, topk;
+  int (*func)(sen_set *, entry **, sen_set *, entry **, void *) = NULL;
+  void *arg = NULL, *arg0 = NULL;
   if (!set) {
     SEN_LOG(sen_log_warning, "sen_set_sort: invalid argument !");
     return NULL;
@@ -642,34 +908,52 @@ sen_set_sort(sen_set *set, int limit, sen_set_sort_optarg *optarg)
     SEN_LOG(sen_log_warning, "no entry in the set passed for sen_set_sort");
     return NULL;
   }
-  if (!(res = SEN_MALLOC(sizeof(entry *) * set->n_entries))) {
+  if (!limit || limit > set->n_entries) { limit = set->n_entries; }
+  topk = limit <= set->n_entries / TOPK_RATIO;
+  if (!(res = SEN_MALLOC(sizeof(entry *) * (topk ? limit : set->n_entries)))) {
     SEN_LOG(sen_log_alert, "allocation of entries failed on sen_set_sort !");
     return NULL;
   }
-  if (!limit || limit > set->n_entries) { limit = set->n_entries; }
   if (optarg) {
     dir = (optarg->mode == sen_sort_ascending) ? 1 : -1;
     if (optarg->compar) {
-      sort_func(set, res, limit, optarg->compar, optarg->compar_arg,
-                optarg->compar_arg0 ? optarg->compar_arg0 : set, dir);
-      goto exit;
+      func = optarg->compar;
+      arg = optarg->compar_arg;
+      arg0 = optarg->compar_arg0 ? optarg->compar_arg0 : set;
     } else if (optarg->compar_arg) {
-      sort_int(set, res, limit, ((intptr_t)optarg->compar_arg) / sizeof(int32_t), dir);
-      goto exit;
+      offset = ((intptr_t)optarg->compar_arg) / sizeof(int32_t);
+    } else {
+      optarg = NULL;
     }
   }
-  switch (set->key_size) {
-  case 0 :
-    sort_func(set, res, limit, func_str, NULL, NULL, dir);
-    break;
-  case sizeof(uint32_t) :
-    sort_int(set, res, limit, 0, dir);
-    break;
-  default :
-    sort_func(set, res, limit, func_bin, (void *)(intptr_t)set->key_size, NULL, dir);
-    break;
+  if (!optarg) {
+    switch (set->key_size) {
+    case 0 :
+      func = func_str;
+      break;
+    case sizeof(uint32_t) :
+      break;
+    default :
+      func = func_bin;
+      arg = (void *)(intptr_t)set->key_size;
+      break;
+    }
+  }
+  if (func) {
+    if (topk) {
+      limit = topk_func(set, res, limit, func, arg, arg0, dir);
+      _sort_func(res, res + limit - 1, limit, func, arg, arg0, dir);
+    } else {
+      sort_func(set, res, limit, func, arg, arg0, dir);
+    }
+  } else {
+    if (topk) {
+      limit = topk_int(set, res, limit, offset, dir);
+      _sort_int(res, res + limit - 1, limit, offset, dir);
+    } else if (set->n_entries < RADIX_MIN || radix_int(set, res, offset, dir)) {
+      sort_int(set, res, limit, offset, dir);
+    }
   }
-exit :
   return res;
 }
 
@@ -694,6 +978,115 @@ sen_set_element_info(sen_set *set, const sen_set_eh *e, void **key, void **value
   return sen_success;
 }
 
+/* set operations of two sets in the array mode of int keys, by merging
+   them in the order of the keys. */
+
+inline static int
+array_both(sen_set *a, sen_set *b)
+{
+  return a->arrayp && b->arrayp && a->key_size == sizeof(uint32_t);
+}
+
+/* b is appended to a if all of its keys follow the ones of a, otherwise
+   they are merged into a new chunk. the values of a are left for the
+   keys in both. */
+static sen_rc
+array_union(sen_set *a, sen_set *b)
+{
+  byte *chunk, *dp;
+  entry *e, **index, **ep;
+  uint32_t i, j, n, size, ne = a->curr_entry, nb = b->curr_entry;
+  sen_ctx *ctx = sen_ctx_current();
+  for (j = 0; j < nb && b->index[j] == GARBAGE; j++);
+  if (j == nb) { return sen_success; }
+  if (!ne || ARRAY_KEY(a, ne - 1) < ARRAY_KEY(b, j)) {
+    if (ne + b->n_entries <= a->array_size) {
+      for (; j < nb; j++) {
+        if (b->index[j] == GARBAGE) { continue; }
+        e = ARRAY_ENTRY(a, ne);
+        memcpy(e, ARRAY_ENTRY(b, j), a->entry_size);
+        a->index[ne++] = e;
+      }
+      a->curr_entry = ne;
+      a->n_entries += b->n_entries;
+      return sen_success;
+    }
+  }
+  size = a->n_entries + b->n_entries;
+  if (size < a->array_size) { size = a->array_size; }
+  for (n = INITIAL_INDEX_SIZE; n <= size; n *= 2);
+  if (!(chunk = SEN_CALLOC(a->entry_size * size))) { return sen_memory_exhausted; }
+  if (!(index = SEN_CALLOC(n * sizeof(entry *)))) {
+    SEN_FREE(chunk);
+    return sen_memory_exhausted;
+  }
+  for (i = 0, dp = chunk, ep = index; i < ne || j < nb;) {
+    if (i < ne && a->index[i] == GARBAGE) { i++; continue; }
+    if (j < nb && b->index[j] == GARBAGE) { j++; continue; }
+    if (j == nb || (i < ne && ARRAY_KEY(a, i) <= ARRAY_KEY(b, j))) {
+      if (j < nb && ARRAY_KEY(a, i) == ARRAY_KEY(b, j)) { j++; }
+      e = ARRAY_ENTRY(a, i++);
+    } else {
+      e = ARRAY_ENTRY(b, j++);
+    }
+    memcpy(dp, e, a->entry_size);
+    *ep++ = (entry *)dp;
+    dp += a->entry_size;
+  }
+  SEN_FREE(a->chunks[SEN_SET_MAX_CHUNK]);
+  SEN_FREE(a->index);
+  a->chunks[SEN_SET_MAX_CHUNK] = chunk;
+  a->index = index;
+  a->max_offset = n - 1;
+  a->array_size = size;
+  a->curr_entry = a->n_entries = ep - index;
+  a->n_garbages = 0;
+  return sen_success;
+}
+
+static void
+array_subtract(sen_set *a, sen_set *b)
+{
+  uint32_t i = 0, j;
+  for (j = 0; j < b->curr_entry; j++) {
+    if (b->index[j] == GARBAGE) { continue; }
+    if ((i = array_seek(a, i, ARRAY_KEY(b, j))) == a->curr_entry) { break; }
+    if (a->index[i] != GARBAGE && ARRAY_KEY(a, i) == ARRAY_KEY(b, j)) {
+      sen_set_del(a, a->index + i);
+    }
+  }
+}
+
+static void
+array_intersect(sen_set *a, sen_set *b)
+{
+  uint32_t i, j = 0;
+  for (i = 0; i < a->curr_entry; i++) {
+    if (a->index[i] == GARBAGE) { continue; }
+    j = array_seek(b, j, ARRAY_KEY(a, i));
+    if (j == b->curr_entry || b->index[j] == GARBAGE ||
+        ARRAY_KEY(b, j) != ARRAY_KEY(a, i)) {
+      sen_set_del(a, a->index + i);
+    }
+  }
+}
+
+static int
+array_difference(sen_set *a, sen_set *b)
+{
+  uint32_t i, j = 0, count = 0;
+  for (i = 0; i < a->curr_entry; i++) {
+    if (a->index[i] == GARBAGE) { continue; }
+    if ((j = array_seek(b, j, ARRAY_KEY(a, i))) == b->curr_entry) { break; }
+    if (b->index[j] != GARBAGE && ARRAY_KEY(b, j) == ARRAY_KEY(a, i)) {
+      sen_set_del(b, b->index + j);
+      sen_set_del(a, a->index + i);
+      count++;
+    }
+  }
+  return count;
+}
+
 sen_set *
 sen_set_union(sen_set *a, sen_set *b)
 {
@@ -701,6 +1094,10 @@ sen_set_union(sen_set *a, sen_set *b)
   entry *e, **ep;
   uint32_t i, key_size = a->key_size, value_size = a->value_size;
   if (key_size != b->key_size || value_size != b->value_size) { return NULL; }
+  if (array_both(a, b) && !array_union(a, b)) {
+    sen_set_close(b);
+    return a;
+  }
   for (i = b->n_entries, ep = b->index; i; ep++) {
     if ((e = *ep) && e != GARBAGE) {
       switch (key_size) {
@@ -736,6 +1133,11 @@ sen_set_subtract(sen_set *a, sen_set *b)
   entry *e, **ep, **dp;
   uint32_t i, key_size = a->key_size;
   if (key_size != b->key_size) { return NULL; }
+  if (array_both(a, b)) {
+    array_subtract(a, b);
+    sen_set_close(b);
+    return a;
+  }
   for (i = b->n_entries, ep = b->index; i; ep++) {
     if ((e = *ep) && e != GARBAGE) {
       switch (key_size) {
@@ -764,6 +1166,11 @@ sen_set_intersect(sen_set *a, sen_set *b)
   entry *e, **ep;
   uint32_t i, key_size = a->key_size;
   if (key_size != b->key_size) { return NULL; }
+  if (array_both(a, b)) {
+    array_intersect(a, b);
+    sen_set_close(b);
+    return a;
+  }
   for (i = a->n_entries, ep = a->index; i; ep++) {
     if ((e = *ep) && e != GARBAGE) {
       switch (key_size) {
@@ -792,6 +1199,7 @@ sen_set_difference(sen_set *a, sen_set *b)
   entry *e, **ep, **dp;
   uint32_t count = 0, i, key_size = a->key_size;
   if (key_size != b->key_size) { return -1; }
+  if (array_both(a, b)) { return array_difference(a, b); }
   for (i = a->n_entries, ep = a->index; i; ep++) {
     if ((e = *ep) && e != GARBAGE) {
       switch (key_size) {
@@ -819,16 +1227,21 @@ sen_set_difference(sen_set *a, sen_set *b)
 sen_rc
 sen_set_array_init(sen_set *set, uint32_t size)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_rc rc;
+  sen_ctx *ctx = sen_ctx_current();
   SEN_ASSERT(!set->n_entries);
   SEN_ASSERT(!set->garbages);
-  set->arrayp = 1;
-  set->curr_entry = 0;
+  if ((rc = sen_set_reset(set, size))) { return rc; }
   if (set->chunks[SEN_SET_MAX_CHUNK]) {
     SEN_FREE(set->chunks[SEN_SET_MAX_CHUNK]);
   }
   if (!(set->chunks[SEN_SET_MAX_CHUNK] = SEN_CALLOC(set->entry_size * size))) {
+    set->arrayp = 0;
     return sen_memory_exhausted;
   }
-  return sen_set_reset(set, size);
+  set->arrayp = 1;
+  set->curr_entry = 0;
+  set->array_size = size;
+  set->array_hint = 0;
+  return sen_success;
 }
@@ -40,8 +40,11 @@ struct _sen_set {
   uint32_t n_garbages;
   uint32_t curr_entry;
   uint32_t curr_chunk;
+  uint32_t array_size;
+  uint32_t array_hint;
   sen_set_eh garbages;
   sen_set_eh *index;
+  uint8_t *tags;
   uint8_t arrayp;
   byte *chunks[SEN_SET_MAX_CHUNK + 1];
 };
@@ -81,9 +84,10 @@ struct _sen_set_element_str {
 #define SEN_SET_INT_ADD(set,k,v)\
 {\
   sen_set *_set = set;\
-  sen_set_eh *eh = _set->index + _set->n_entries++;\
+  sen_set_eh *eh = _set->index + _set->curr_entry;\
   byte *chunk = _set->chunks[SEN_SET_MAX_CHUNK];\
   struct _sen_set_element *e = (void *)(chunk + _set->entry_size * _set->curr_entry++);\
+  _set->n_entries++;\
   e->key = *((uint32_t *)k);\
   *eh = (sen_set_eh)e;\
   v = (void *)e->dummy;\
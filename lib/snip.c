@@ -297,7 +297,7 @@ sen_snip_add_cond(sen_snip *snip,
 {
   sen_rc rc;
   snip_cond *cond;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
 
   if (!snip || !keyword || !keyword_len || snip->cond_len >= MAX_SNIP_COND_COUNT) {
     return sen_invalid_argument;
@@ -378,7 +378,7 @@ sen_snip_open(sen_encoding encoding, int flags, unsigned int width,
               const char *defaultclosetag, unsigned int defaultclosetag_len,
               sen_snip_mapping *mapping)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_snip *ret = NULL;
   if (!(ret = SEN_MALLOC(sizeof(sen_snip)))) {
     SEN_LOG(sen_log_alert, "sen_snip allocation failed on sen_snip_open");
@@ -447,7 +447,7 @@ exec_clean(sen_snip *snip)
 sen_rc
 sen_snip_close(sen_snip *snip)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   snip_cond *cond, *cond_end;
   if (!snip) { return sen_invalid_argument; }
   if (snip->flags & SEN_SNIP_COPY_TAG) {
@@ -391,7 +391,7 @@ sen_ja_ref(sen_ja *ja, sen_id id, uint32_t *value_len)
     *value_len = vsize;
     return (byte *)value + vpos;
 #else /* USE_SEG_MAP */
-    sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+    sen_ctx *ctx = sen_ctx_current();
     sen_io_win iw;
     EINFO_GET(&einfo[pos], jag, vpos, vsize);
     value = sen_io_win_map(ja->io, ctx, &iw, jag, vpos, vsize, sen_io_rdonly);
@@ -408,7 +408,7 @@ sen_ja_unref(sen_ja *ja, sen_id id, void *value, uint32_t value_len)
   if (!value) { return sen_invalid_argument; }
 #ifndef USE_SEG_MAP
   {
-    sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+    sen_ctx *ctx = sen_ctx_current();
     SEN_FREE(value);
   }
 #endif /* USE_SEG_MAP */
@@ -434,7 +434,7 @@ sen_ja_put(sen_ja *ja, sen_id id, void *value, int value_len, int flags)
         memcpy((byte *)iw.addr + old_len, value, value_len);
 #else /* USE_SEG_MAP */
         void *buf;
-        sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+        sen_ctx *ctx = sen_ctx_current();
         if (!(buf = SEN_MALLOC(old_len + value_len))) { return sen_memory_exhausted; }
         if ((rc = sen_ja_alloc(ja, old_len + value_len, &einfo, &iw))) {
           SEN_FREE(buf);
@@ -722,7 +722,7 @@ sen_ja_remove(const char *path)
 void *
 sen_ja_ref(sen_ja *ja, sen_id id, uint32_t *value_len)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_io_ja_einfo *ep;
   uint32_t lseg = id >> JA_ESEG_WIDTH;
   uint32_t lpos = id & JA_ESEG_MASK;
@@ -747,7 +747,7 @@ sen_ja_ref(sen_ja *ja, sen_id id, uint32_t *value_len)
 sen_rc
 sen_ja_unref(sen_ja *ja, sen_id id, void *value, uint32_t value_len)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   SEN_FREE((void *)(((uintptr_t) value) - sizeof(sen_io_ja_ehead)));
   return sen_success;
 }
@@ -806,7 +806,7 @@ sen_rc
 sen_ja_put(sen_ja *ja, sen_id id, void *value, int value_len, int flags)
 {
   sen_rc rc = sen_success;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   uint32_t newpos = 0;
   sen_io_ja_einfo *ep;
   {
@@ -871,7 +871,7 @@ static sen_rc
 sen_ja_defrag_seg(sen_ja *ja, uint32_t dseg)
 {
   sen_rc rc = sen_success;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_io_win iw;
   uint32_t epos = dseg << JA_EPOS_WIDTH;
   uint32_t segsize = (1 << JA_DSEG_WIDTH);
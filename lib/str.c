@@ -29,6 +29,13 @@
 #define __USE_ISOC99
 #include <math.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif /* __AVX2__ */
+
 static sen_set *prefix = NULL;
 static sen_set *suffix = NULL;
 
@@ -640,37 +647,116 @@ normalize_utf8(sen_nstr *nstr)
   return sen_success;
 }
 
-/* Assume that nstr->flags is always zero */
-inline static sen_rc
-fast_normalize_utf8(sen_nstr *nstr)
+/*
+ * Copy the leading run of printable ascii in [s, e) into d, folding
+ * upper case letters to lower case, and return the length of the run.
+ *
+ * sen_nfkc_map1() maps printable ascii to itself except for 'A'-'Z',
+ * and no ascii character is ever a suffix of sen_nfkc_map2(), so such
+ * a run can be copied without looking up each character. The run ends
+ * at the first control or non-ascii byte, or at e.
+ */
+inline static size_t
+fast_copy_ascii(const unsigned char *s, const unsigned char *e, unsigned char *d)
 {
-	sen_ctx *ctx = nstr->ctx;
-	const unsigned char *s, *s_, *p, *p2, *pe, *e;
-	unsigned char *d, *d_, *de;
-	size_t ls, lp, size = nstr->orig_blen;
-	int		normed = 0;
-	size_t	ds = 0;
+	const unsigned char *s0 = s;
 
-	ds = size * 3;
-	nstr->norm = SEN_MALLOC(ds + 1);
-	if (nstr->norm == NULL)
-		return sen_memory_exhausted;
+#ifdef __AVX2__
+	{
+		const __m256i lo = _mm256_set1_epi8(0x1f);
+		const __m256i ua = _mm256_set1_epi8('A' - 1);
+		const __m256i uz = _mm256_set1_epi8('Z' + 1);
+		const __m256i bit = _mm256_set1_epi8(0x20);
+
+		for (; s + 32 <= e; s += 32, d += 32)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i *)s);
+			/* bytes >= 0x80 are negative, so this also rejects non-ascii */
+			unsigned int m = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, lo));
+			__m256i up;
+
+			if (m)
+				break;
+			up = _mm256_and_si256(_mm256_cmpgt_epi8(v, ua), _mm256_cmpgt_epi8(uz, v));
+			v = _mm256_or_si256(v, _mm256_and_si256(up, bit));
+			_mm256_storeu_si256((__m256i *)d, v);
+		}
+	}
+#endif /* __AVX2__ */
+#ifdef __SSE2__
+	{
+		const __m128i lo = _mm_set1_epi8(0x1f);
+		const __m128i ua = _mm_set1_epi8('A' - 1);
+		const __m128i uz = _mm_set1_epi8('Z' + 1);
+		const __m128i bit = _mm_set1_epi8(0x20);
+
+		for (; s + 16 <= e; s += 16, d += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)s);
+			int		m = _mm_movemask_epi8(_mm_cmpgt_epi8(v, lo)) ^ 0xffff;
+			__m128i up;
+
+			if (m)
+				break;
+			up = _mm_and_si128(_mm_cmpgt_epi8(v, ua), _mm_cmplt_epi8(v, uz));
+			v = _mm_or_si128(v, _mm_and_si128(up, bit));
+			_mm_storeu_si128((__m128i *)d, v);
+		}
+	}
+#endif /* __SSE2__ */
+	for (; s < e; s++, d++)
+	{
+		unsigned char c = *s;
+
+		if (c < 0x20 || c >= 0x80)
+			break;
+		*d = ((unsigned char)(c - 'A') < 26) ? c | 0x20 : c;
+	}
+	return (size_t)(s - s0);
+}
 
-	d = (unsigned char *)nstr->norm;
-	de = d + ds;
-	d_ = NULL;
-	e = (unsigned char *)nstr->orig + size;
+/*
+ * Normalize the UTF-8 string [s, e) into the buffer [d, de).
+ *
+ * The result is written straight into the given buffer, so the caller
+ * owns all of the memory and nothing is allocated here. When the buffer
+ * is too short, the rest of the string is still scanned and the number
+ * of bytes needed is returned; the contents of the buffer are undefined
+ * in that case. The last character which did not fit is kept in a small
+ * local buffer, because sen_nfkc_map2() needs it as the prefix.
+ * The result is not null-terminated.
+ *
+ * Assume that nstr->flags is always zero.
+ */
+inline static size_t
+fast_normalize_utf8_buf(const unsigned char *s, const unsigned char *e,
+						unsigned char *d, unsigned char *de)
+{
+	const unsigned char *p, *p2, *pe;
+	unsigned char *d0 = d, *d_ = NULL;
+	unsigned char tail[8];
+	size_t ls, lp, l_ = 0, over = 0;
 
-	for (s = s_ = (unsigned char *)nstr->orig; ; s += ls)
+	for (; ; s += ls)
 	{
+		if (!over && s < e && *s >= 0x20 && *s < 0x80)
+		{
+			size_t	room = (size_t)(de - d);
+
+			ls = fast_copy_ascii(s, ((size_t)(e - s) < room) ? e : s + room, d);
+			if (ls)
+			{
+				d += ls;
+				d_ = d - 1;
+				continue;
+			}
+		}
+
 		if (!(ls = fast_sen_str_charlen_utf8(s, e)))
 			break;
 
 		if ((p = (unsigned char *)sen_nfkc_map1(s)))
-		{
 			pe = p + strlen((char *)p);
-			normed = 1;
-		}
 		else
 		{
 			p = s;
@@ -681,70 +767,66 @@ fast_normalize_utf8(sen_nstr *nstr)
 		{
 			p = p2;
 			pe = p + strlen((char *)p);
-			d = d_;
-			normed = 1;
+			/* Drop the previous character; it is composed into p */
+			if (d_ == tail)
+				over -= l_;
+			else
+				d = d_;
 		}
 
 		/* Skip unprintable ascii */
 		if (*p < 0x20)
-		{
-			normed = 0;
 			continue;
-		}
 
-		if (normed)
+		for (; p < pe; p += lp)
 		{
-			for (; ; p += lp)
+			lp = fast_sen_str_charlen_utf8(p, pe);
+			if (!over && d + lp <= de)
 			{
-				if (!(lp = fast_sen_str_charlen_utf8(p, pe)))
-					break;
-
-				if (de <= d + lp)
-				{
-					unsigned char *norm;
-
-					ds += (ds >> 1) + lp;
-					if (!(norm = SEN_REALLOC(nstr->norm, ds + 1)))
-					{
-						SEN_FREE(nstr->norm); nstr->norm = NULL;
-						return sen_memory_exhausted;
-					}
-					de = norm + ds;
-					d = norm + (d - (unsigned char *)nstr->norm);
-					nstr->norm = norm;
-				}
-
 				memcpy(d, p, lp);
 				d_ = d;
 				d += lp;
 			}
-
-			normed = 0;
-		}
-		else
-		{
-			if (de <= d + ls)
+			else
 			{
-				unsigned char *norm;
-
-				ds += (ds >> 1) + ls;
-				if (!(norm = SEN_REALLOC(nstr->norm, ds + 1)))
-				{
-					SEN_FREE(nstr->norm); nstr->norm = NULL;
-					return sen_memory_exhausted;
-				}
-				de = norm + ds;
-				d = norm + (d - (unsigned char *)nstr->norm);
-				nstr->norm = norm;
+				memcpy(tail, p, lp);
+				d_ = tail;
+				over += lp;
 			}
-
-			memcpy(d, p, ls);
-			d_ = d;
-			d += ls;
+			l_ = lp;
 		}
 	}
-	*d = '\0';
-	nstr->norm_blen = (size_t)(d - (unsigned char *)nstr->norm);
+	return (size_t)(d - d0) + over;
+}
+
+/* Assume that nstr->flags is always zero */
+inline static sen_rc
+fast_normalize_utf8(sen_nstr *nstr)
+{
+	sen_ctx *ctx = nstr->ctx;
+	const unsigned char *s = (unsigned char *)nstr->orig;
+	const unsigned char *e = s + nstr->orig_blen;
+	size_t ds = nstr->orig_blen * 3, len;
+
+	nstr->norm = SEN_MALLOC(ds + 1);
+	if (nstr->norm == NULL)
+		return sen_memory_exhausted;
+
+	len = fast_normalize_utf8_buf(s, e, (unsigned char *)nstr->norm,
+								  (unsigned char *)nstr->norm + ds);
+	if (len > ds)
+	{
+		/* Rare: some characters (e.g. U+FDFA) expand more than 3 times */
+		SEN_FREE(nstr->norm);
+		ds = len;
+		nstr->norm = SEN_MALLOC(ds + 1);
+		if (nstr->norm == NULL)
+			return sen_memory_exhausted;
+		len = fast_normalize_utf8_buf(s, e, (unsigned char *)nstr->norm,
+									  (unsigned char *)nstr->norm + ds);
+	}
+	nstr->norm[len] = '\0';
+	nstr->norm_blen = len;
 	return sen_success;
 }
 #endif /* NO_NFKC */
@@ -1330,7 +1412,7 @@ sen_nstr *
 sen_nstr_open(const char *str, size_t str_len, sen_encoding encoding, int flags)
 {
   sen_rc rc;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_nstr *nstr;
   if (!str) { return NULL; }
   if (!(nstr = SEN_MALLOC(sizeof(sen_nstr)))) {
@@ -1381,7 +1463,7 @@ sen_nstr_open(const char *str, size_t str_len, sen_encoding encoding, int flags)
 sen_nstr *
 fast_sen_nstr_open(const char *str, size_t str_len)
 {
-	sen_ctx *ctx = &sen_gctx;
+	sen_ctx *ctx = sen_ctx_current();
 	sen_nstr *nstr = NULL;
 
 	if (!str)
@@ -1418,7 +1500,7 @@ sen_fakenstr_open(const char *str, size_t str_len, sen_encoding encoding, int fl
 {
   /* TODO: support SEN_STR_REMOVEBLANK flag and ctypes */
   sen_nstr *nstr;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
 
   if (!(nstr = SEN_MALLOC(sizeof(sen_nstr)))) {
     SEN_LOG(sen_log_alert, "memory allocation on sen_fakenstr_open failed !");
@@ -1853,7 +1935,7 @@ sen_str_getopt(int argc, char * const argv[], const sen_str_getopt_opt *opts,
       if (*++v == '-') {
         found = 0;
         for (o = opts; o->opt != '\0' || o->longopt != NULL; o++) {
-          if (o->longopt && !strcmp(v, o->longopt)) {
+          if (o->longopt && !strcmp(v + 1, o->longopt)) {
             op_getopt_flag(flags, o, argc, argv, &i);
             found = 1;
             break;
@@ -1902,7 +1984,7 @@ sen_rc
 sen_rbuf_resize(sen_rbuf *buf, size_t newsize)
 {
   char *head;
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   newsize += sen_rbuf_margin_size + 1;
   newsize = (newsize + (UNIT_MASK)) & ~UNIT_MASK;
   head = buf->head - (buf->head ? sen_rbuf_margin_size : 0);
@@ -2065,7 +2147,7 @@ sen_rbuf_str_esc(sen_rbuf *buf, const char *s, int len, sen_encoding encoding)
 sen_rc
 sen_rbuf_fin(sen_rbuf *buf)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   if (buf->head) {
     SEN_REALLOC(buf->head - sen_rbuf_margin_size, 0);
     buf->head = NULL;
@@ -2090,7 +2172,7 @@ sen_lbuf_init(sen_lbuf *buf)
 void *
 sen_lbuf_add(sen_lbuf *buf, size_t size)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_lbuf_node *node = SEN_MALLOC(size + (size_t)(&((sen_lbuf_node *)0)->val));
   if (!node) { return NULL;  }
   node->next = NULL;
@@ -2103,7 +2185,7 @@ sen_lbuf_add(sen_lbuf *buf, size_t size)
 sen_rc
 sen_lbuf_fin(sen_lbuf *buf)
 {
-  sen_ctx *ctx = &sen_gctx; /* todo : replace it with the local ctx */
+  sen_ctx *ctx = sen_ctx_current();
   sen_lbuf_node *cur, *next;
   for (cur = buf->head; cur; cur = next) {
     next = cur->next;
@@ -2155,28 +2237,35 @@ sen_str_normalize(const char *str, unsigned int str_len,
   return len;
 }
 
-/* Assume that current encoding is UTF-8 */
+/*
+ * Assume that current encoding is UTF-8.
+ *
+ * Unlike sen_str_normalize(), the normalized string is written straight
+ * into nstrbuf and no memory is allocated.
+ */
 int
 fast_sen_str_normalize(const char *str, unsigned int str_len,
 					   char *nstrbuf, int buf_size)
 {
-	int len;
-	sen_nstr *nstr;
+	size_t len;
+	unsigned char *d = (unsigned char *)nstrbuf;
 
-	if (!(nstr = fast_sen_nstr_open(str, str_len)))
+	if (!str)
 		return -1;
+	if (buf_size < 0 || !nstrbuf)
+		buf_size = 0;
+
+	len = fast_normalize_utf8_buf((const unsigned char *)str,
+								  (const unsigned char *)str + str_len,
+								  d, d + buf_size);
 
 	/*
 	 * If the buffer size is short to store for the normalized string,
-     * the required size is returned (to inform the caller to cast me again).
+	 * the required size is returned (to inform the caller to cast me again).
+	 * In that case the contents of nstrbuf are undefined.
 	 */
-	len = (int)nstr->norm_blen;
-
-	if (buf_size > len)
-		memcpy(nstrbuf, nstr->norm, len + 1);
-	else if (buf_size == len)
-		/* NB: non-NULL-terminated */
-		memcpy(nstrbuf, nstr->norm, len);
-	sen_nstr_close(nstr);
-	return len;
+	if (len < (size_t)buf_size)
+		nstrbuf[len] = '\0';
+	/* else if buf_size == len, NB: non-NULL-terminated */
+	return (int)len;
 }
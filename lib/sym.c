@@ -43,6 +43,8 @@ int sen_sym_del_with_sis08(sen_sym *sym, sen_id id,
 #define SEN_SYM_DELETED (SEN_SYM_MAX_ID + 1)
 
 #define SEN_SYM_SEGMENT_SIZE 0x400000
+/* the pat nodes are walked from the root on every lookup */
+#define SEN_SYM_IO_MODE (sen_io_auto|SEN_IO_HUGEPAGE|SEN_IO_POPULATE)
 #define W_OF_KEY_IN_A_SEGMENT 22
 #define W_OF_PAT_IN_A_SEGMENT 18
 #define W_OF_SIS_IN_A_SEGMENT 19
@@ -63,7 +65,8 @@ struct sen_sym_header {
   int32_t curr_del2;
   int32_t curr_del3;
   uint32_t lock;
-  uint32_t reserved[18];
+  uint32_t ndels;
+  uint32_t reserved[17];
   uint16_t keyarray[SEN_SYM_MAX_SEGMENT];
   uint16_t patarray[SEN_SYM_MAX_SEGMENT];
   uint16_t sisarray[SEN_SYM_MAX_SEGMENT];
@@ -112,7 +115,7 @@ nth_bit(const byte *key, uint32_t n)
 
 /* segment operation */
 
-inline static sen_rc
+static sen_rc
 segment_new(sen_sym *sym, int segtype)
 {
   int i;
@@ -481,6 +484,94 @@ delinfo_new(sen_sym *sym)
   return res;
 }
 
+/* lookup cache
+
+   a lookup walks the pat nodes from the root one bit at a time, and each
+   of them is likely to be in another cache line. the ids found are kept
+   in a hash of buckets of a cache line each, so that a lookup which hits
+   the cache touches the bucket, the pat node and the key only. the cache
+   is private to the process. the id of a key does not change while it
+   lives, so only the deletes, which are counted in the header shared by
+   the processes, make the cache stale, and it is cleared on them.
+
+   the cache is read without a lock, since an id found in it is checked
+   against the key of its node. it is written by the threads with
+   cache_lock held, so that an entry put by a lookup which started
+   before a delete never survives the clear after it. the cache takes 8
+   bytes per entry, up to SEN_SYM_CACHE_DEFAULT entries unless
+   SEN_SYM_CACHE is given. */
+
+#define CACHE_WAYS 8 /* the entries in a bucket of 64 bytes */
+#define CACHE_MIN_BUCKETS 0x400
+
+uint32_t sen_sym_cache_max = SEN_SYM_CACHE_DEFAULT;
+
+inline static uint32_t
+cache_hash(const uint8_t *key, size_t size)
+{
+  uint32_t h;
+  for (h = 0; size--; key++) { h = (h * 1021) + *key; }
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  return h;
+}
+
+inline static void
+cache_open(sen_sym *sym)
+{
+  uint32_t n = CACHE_MIN_BUCKETS, max = sen_sym_cache_max / CACHE_WAYS;
+  sym->cache = NULL;
+  sym->cache_ndels = sym->header->ndels;
+  if (!max) { return; }
+  while (n < max && n * CACHE_WAYS < sym->header->nrecords * 2) { n <<= 1; }
+  if (n > max) { n = max; }
+  if ((sym->cache = SEN_GCALLOC(sizeof(uint64_t) * CACHE_WAYS * n))) {
+    sym->cache_mask = n - 1;
+    MUTEX_INIT(sym->cache_lock);
+  }
+}
+
+inline static sen_id
+cache_at(sen_sym *sym, const void *key, size_t size, uint32_t h)
+{
+  int i;
+  sen_id id;
+  pat_node *rn;
+  const uint8_t *k;
+  uint64_t *b = sym->cache + (h & sym->cache_mask) * CACHE_WAYS;
+  if (sym->cache_ndels != sym->header->ndels) {
+    MUTEX_LOCK(sym->cache_lock);
+    if (sym->cache_ndels != sym->header->ndels) {
+      sym->cache_ndels = sym->header->ndels;
+      memset(sym->cache, 0, sizeof(uint64_t) * CACHE_WAYS * (sym->cache_mask + 1));
+    }
+    MUTEX_UNLOCK(sym->cache_lock);
+    return SEN_SYM_NIL;
+  }
+  for (i = 0; i < CACHE_WAYS; i++) {
+    if ((uint32_t)(b[i] >> 32) != h || !(id = (sen_id) b[i])) { continue; }
+    if (id > sym->header->curr_rec || !(rn = pat_at(sym, id))) { continue; }
+    if ((k = pat_node_get_key(sym, rn)) && !memcmp(k, key, size)) { return id; }
+  }
+  return SEN_SYM_NIL;
+}
+
+/* ndels is the one when the lookup of id started. */
+inline static void
+cache_put(sen_sym *sym, uint32_t h, sen_id id, uint32_t ndels)
+{
+  int i;
+  uint64_t *b = sym->cache + (h & sym->cache_mask) * CACHE_WAYS;
+  MUTEX_LOCK(sym->cache_lock);
+  if (ndels == sym->header->ndels && ndels == sym->cache_ndels) {
+    for (i = 0; i < CACHE_WAYS && b[i]; i++) ;
+    if (i == CACHE_WAYS) { i = (h >> 29) ^ (id & 7); }
+    b[i] = ((uint64_t) h << 32) | id;
+  }
+  MUTEX_UNLOCK(sym->cache_lock);
+}
+
 /* sym operation */
 
 sen_sym *
@@ -497,7 +588,7 @@ sen_sym_create(const char *path, uint32_t key_size,
     return sen_sym_create08(path, key_size, flags, encoding);
   }
   io = sen_io_create(path, SEN_SYM_HEADER_SIZE, SEN_SYM_SEGMENT_SIZE,
-                     SEN_SYM_MAX_SEGMENT, sen_io_auto, SEN_SYM_MAX_SEGMENT);
+                     SEN_SYM_MAX_SEGMENT, SEN_SYM_IO_MODE, SEN_SYM_MAX_SEGMENT);
   if (!io) { return NULL; }
   if (encoding == sen_enc_default) { encoding = sen_gctx.encoding; }
   header = sen_io_header(io);
@@ -533,6 +624,7 @@ sen_sym_create(const char *path, uint32_t key_size,
     sym->pataddrs[i] = NULL;
     sym->sisaddrs[i] = NULL;
   }
+  header->ndels = 0;
   if (!(node0 = pat_get(sym, 0))) {
     sen_io_close(io);
     SEN_GFREE(sym);
@@ -541,6 +633,7 @@ sen_sym_create(const char *path, uint32_t key_size,
   node0->r = 0;
   node0->l = 0;
   node0->key = 0;
+  cache_open(sym);
   return sym;
 }
 
@@ -552,7 +645,7 @@ sen_sym_open(const char *path)
   sen_sym *sym;
   struct sen_sym_header *header;
   ERRCLR(NULL);
-  io = sen_io_open(path, sen_io_auto, 8192);
+  io = sen_io_open(path, SEN_SYM_IO_MODE, 8192);
   if (!io) { return NULL; }
   header = sen_io_header(io);
   if (memcmp(header->idstr, SEN_IDSTR, 16)) {
@@ -581,6 +674,7 @@ sen_sym_open(const char *path)
     SEN_GFREE(sym);
     return NULL;
   }
+  cache_open(sym);
   return sym;
 }
 
@@ -589,6 +683,10 @@ sen_sym_close(sen_sym *sym)
 {
   sen_rc rc;
   if (!sym) { return sen_invalid_argument; }
+  if (!sym->v08p && sym->cache) {
+    MUTEX_DESTROY(sym->cache_lock);
+    SEN_GFREE(sym->cache);
+  }
   rc = sen_io_close(sym->io);
   SEN_GFREE(sym);
   return rc;
@@ -719,11 +817,18 @@ chop(sen_sym *sym, const char **key, uint32_t *lkey)
 sen_id
 sen_sym_get(sen_sym *sym, const void *key)
 {
-  uint32_t new, lkey = 0;
+  uint32_t new, lkey = 0, h = 0, ndels = 0;
   sen_id r0;
   if (!sym || !key) { return SEN_SYM_NIL; }
   if (sym->v08p) { return sen_sym_get08(sym, key); }
+  if (sym->cache) {
+    size_t size = sym->key_size ? sym->key_size : strlen(key) + 1;
+    h = cache_hash(key, size);
+    if ((r0 = cache_at(sym, key, size, h))) { return r0; }
+    ndels = sym->cache_ndels;
+  }
   r0 = _sen_sym_get(sym, (uint8_t *)key, &new, &lkey);
+  if (r0 && sym->cache) { cache_put(sym, h, r0, ndels); }
   if (r0 && (sym->flags & SEN_SYM_WITH_SIS) &&
       (*((uint8_t *)key) & 0x80)) { // todo: refine!!
     sis_node *sl, *sr;
@@ -760,17 +865,26 @@ sen_sym_at(sen_sym *sym, const void *key)
   pat_node *rn;
   int c = -1;
   size_t len;
+  uint32_t h = 0, ndels = 0;
   if (!sym || !key) { return SEN_SYM_NIL; }
   len = sym->key_size * 8;
   if (sym->v08p) { return sen_sym_at08(sym, key); }
   if (!len) { len = (strlen(key) + 1) * 8; }
+  if (sym->cache) {
+    h = cache_hash(key, len >> 3);
+    if ((r = cache_at(sym, key, len >> 3, h))) { return r; }
+    ndels = sym->cache_ndels;
+  }
   for (r = pat_at(sym, 0)->r; r; r = nth_bit((uint8_t *)key, c) ? rn->r : rn->l) {
     if (!(rn = pat_at(sym, r))) { break; /* corrupt? */ }
     if (len <= rn->check) { break; }
     if (rn->check <= c) {
       const uint8_t *k = pat_node_get_key(sym, rn);
       if (!k) { break; }
-      if (!memcmp(k, key, len >> 3)) { return r; }
+      if (!memcmp(k, key, len >> 3)) {
+        if (sym->cache) { cache_put(sym, h, r, ndels); }
+        return r;
+      }
       break;
     }
     c = rn->check;
@@ -778,6 +892,95 @@ sen_sym_at(sen_sym *sym, const void *key)
   return SEN_SYM_NIL;
 }
 
+/* the descents of up to MANY_WIDTH keys are interleaved. the pat node of
+   the next step of a key is prefetched, and read after the others have
+   stepped, so that the cache misses of the keys overlap. */
+#define MANY_WIDTH 16
+
+typedef struct {
+  sen_id r;
+  int c;
+  int k;
+  uint32_t h;
+  size_t len;
+} many_state;
+
+sen_rc
+sen_sym_at_many(sen_sym *sym, const void **keys, int n, sen_id *ids)
+{
+  int i, j, m, nactive;
+  uint32_t ndels;
+  pat_node *rn;
+  many_state st[MANY_WIDTH];
+  if (!sym || !keys || !ids || n < 0) { return sen_invalid_argument; }
+  if (sym->v08p) {
+    for (i = 0; i < n; i++) { ids[i] = sen_sym_at08(sym, keys[i]); }
+    return sen_success;
+  }
+  for (i = 0; i < n; i += m) {
+    m = (n - i < MANY_WIDTH) ? n - i : MANY_WIDTH;
+    for (j = 0; j < m; j++) {
+      size_t size = sym->key_size ? sym->key_size : strlen(keys[i + j]) + 1;
+      st[j].k = i + j;
+      st[j].len = size * 8;
+      if (sym->cache) {
+        st[j].h = cache_hash(keys[i + j], size);
+        SEN_PREFETCH(sym->cache + (st[j].h & sym->cache_mask) * CACHE_WAYS);
+      }
+    }
+    for (nactive = 0, j = 0; j < m; j++) {
+      if (sym->cache && (ids[i + j] = cache_at(sym, keys[i + j], st[j].len >> 3, st[j].h))) {
+        continue;
+      }
+      ids[i + j] = SEN_SYM_NIL;
+      st[nactive] = st[j];
+      st[nactive].c = -1;
+      if ((st[nactive].r = pat_at(sym, 0)->r) && (rn = pat_at(sym, st[nactive].r))) {
+        SEN_PREFETCH(rn);
+      }
+      nactive++;
+    }
+    ndels = sym->cache_ndels;
+    while (nactive) {
+      for (j = 0; j < nactive;) {
+        many_state *s = &st[j];
+        const uint8_t *key = keys[s->k];
+        if (s->r && (rn = pat_at(sym, s->r)) && rn->check < s->len) {
+          if (s->c < rn->check) {
+            s->c = rn->check;
+            s->r = nth_bit(key, s->c) ? rn->r : rn->l;
+            if (s->r && (rn = pat_at(sym, s->r))) { SEN_PREFETCH(rn); }
+            j++;
+            continue;
+          } else {
+            const uint8_t *k = pat_node_get_key(sym, rn);
+            if (k && !memcmp(k, key, s->len >> 3)) {
+              ids[s->k] = s->r;
+              if (sym->cache) { cache_put(sym, s->h, s->r, ndels); }
+            }
+          }
+        }
+        *s = st[--nactive];
+      }
+    }
+  }
+  return sen_success;
+}
+
+/* the keys found are looked up at once, and the others are added one by
+   one in their order, so that the ids are the same as sen_sym_get gives. */
+sen_rc
+sen_sym_get_many(sen_sym *sym, const void **keys, int n, sen_id *ids)
+{
+  int i;
+  sen_rc rc;
+  if ((rc = sen_sym_at_many(sym, keys, n, ids))) { return rc; }
+  for (i = 0; i < n; i++) {
+    if (!ids[i] && !(ids[i] = sen_sym_get(sym, keys[i]))) { rc = sen_other_error; }
+  }
+  return rc;
+}
+
 sen_id
 sen_sym_nextid(sen_sym *sym, const void *key)
 {
@@ -1044,6 +1247,7 @@ _sen_sym_del(sen_sym *sym, const char *key, int shared)
     }
   }
   sym->header->nrecords--;
+  sym->header->ndels++;
   return sen_success;
 }
 
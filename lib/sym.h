@@ -68,8 +68,17 @@ struct _sen_sym {
   void *keyaddrs[SEN_SYM_MAX_SEGMENT];
   void *pataddrs[SEN_SYM_MAX_SEGMENT];
   void *sisaddrs[SEN_SYM_MAX_SEGMENT];
+  uint64_t *cache;
+  uint32_t cache_mask;
+  uint32_t cache_ndels;
+  sen_mutex cache_lock;    /* guards the writes to cache */
 };
 
+/* the maximum number of the ids cached by a sym for its lookups, given by
+   SEN_SYM_CACHE on sen_init. 0 disables the cache */
+#define SEN_SYM_CACHE_DEFAULT 0x100000
+extern uint32_t sen_sym_cache_max;
+
 const char *_sen_sym_key(sen_sym *sym, sen_id id);
 // sen_id sen_sym_del_with_sis(sen_sym *sym, sen_id id);
 int sen_sym_del_with_sis(sen_sym *sym, sen_id id,
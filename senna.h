@@ -41,13 +41,20 @@ extern "C" {
 #define SEN_INDEX_DELIMITED                     0x0020
 #define SEN_INDEX_ENABLE_SUFFIX_SEARCH          0x0100
 #define SEN_INDEX_DISABLE_SUFFIX_SEARCH         0x0200
+#define SEN_INDEX_SKIP_ENTRIES                  0x0400
 #define SEN_INDEX_WITH_VGRAM                    0x1000
 #define SEN_INDEX_SHARED_LEXICON                0x2000
+#define SEN_INDEX_BLOCK_CODEC                   0x4000
 #define SEN_INDEX_WITH_VACUUM                   0x8000
 
 /* 16 tokenizers can be registered */
 #define SEN_INDEX_TOKENIZER_MASK                0x00f0
 
+/* flags of sen_index_preload */
+#define SEN_PRELOAD_READ                        0x0001
+#define SEN_PRELOAD_MAP                         0x0002
+#define SEN_PRELOAD_CHUNK                       0x0004
+
 #define SEN_SYM_MAX_KEY_SIZE                    8192
 
 #define SEN_SYM_WITH_SIS                        0x80000000
@@ -173,6 +180,7 @@ typedef struct _sen_set sen_set;
 typedef struct _sen_sym sen_sym;
 typedef struct _sen_inv sen_inv;
 typedef struct _sen_index sen_index;
+typedef struct _sen_index_bulk sen_index_bulk;
 typedef struct _sen_records sen_records;
 typedef struct _sen_set_cursor sen_set_cursor;
 typedef struct _sen_set_element *sen_set_eh;
@@ -316,7 +324,9 @@ sen_rc sen_ctx_load(sen_ctx *c, const char *path);
 sen_rc sen_ctx_send(sen_ctx *c, char *str, unsigned int str_len, int flags);
 sen_rc sen_ctx_recv(sen_ctx *c, char **str, unsigned int *str_len, int *flags);
 sen_rc sen_ctx_close(sen_ctx *c);
+sen_rc sen_ctx_use(sen_ctx *c);
 sen_rc sen_ctx_info_get(sen_ctx *c, sen_ctx_info *info);
+sen_rc sen_ctx_select_threads_set(sen_ctx *c, int nthreads);
 
 /******** basic API ********/
 
@@ -384,16 +394,35 @@ sen_index *sen_index_open_with_keys_lexicon(const char *path, sen_sym *keys,
                                             sen_sym *lexicon);
 sen_rc sen_index_update(sen_index *i, const void *key, unsigned int section,
                         sen_values *oldvalues, sen_values *newvalues);
+sen_index_bulk *sen_index_bulk_open(sen_index *i, int nthreads, unsigned int run_memory);
+sen_rc sen_index_bulk_add(sen_index_bulk *b, const void *key,
+                          const char *value, unsigned int value_len);
+sen_rc sen_index_bulk_finish(sen_index_bulk *b);
 sen_rc sen_index_select(sen_index *i,
                         const char *string, unsigned int string_len,
                         sen_records *r,
                         sen_sel_operator op, sen_select_optarg *optarg);
+sen_rc sen_index_select_topk(sen_index *i,
+                             const char *string, unsigned int string_len,
+                             sen_records *r, sen_sel_operator op,
+                             sen_select_optarg *optarg, int limit);
 sen_rc sen_index_info(sen_index *i, int *key_size, int *flags,
                       int *initial_n_segments, sen_encoding *encoding,
                       unsigned *nrecords_keys, unsigned *file_size_keys,
                       unsigned *nrecords_lexicon, unsigned *file_size_lexicon,
                       unsigned long long *inv_seg_size,
                       unsigned long long *inv_chunk_size);
+sen_rc sen_index_merger_start(sen_index *i);
+sen_rc sen_index_merger_stop(sen_index *i);
+sen_rc sen_index_merger_info(sen_index *i, unsigned *nqueued, unsigned *max_queued,
+                             unsigned *nmerges, unsigned *nwaits,
+                             unsigned long long *total_usec,
+                             unsigned long long *max_usec);
+sen_rc sen_index_set_map_budget(sen_index *i, unsigned int size_mb);
+sen_rc sen_index_preload(sen_index *i, int flags, unsigned int budget_mb,
+                         const char *hot_path);
+sen_rc sen_index_profile_start(sen_index *i, unsigned int interval);
+sen_rc sen_index_profile_stop(sen_index *i);
 int sen_index_path(sen_index *i, char *pathbuf, int buf_size);
 /*
 sen_set *sen_index_related_terms(sen_index *index, const char *string,
@@ -456,6 +485,13 @@ sen_id sen_sym_get(sen_sym *sym, const void *key);
  * If no matches are found return SEN_SYM_NIL
  */
 sen_id sen_sym_at(sen_sym *sym, const void *key);
+
+/* Lookup the n keys at once, and store their IDs into ids.
+ * sen_sym_get_many creates the entries which are not found,
+ * sen_sym_at_many stores SEN_SYM_NIL for them.
+ */
+sen_rc sen_sym_get_many(sen_sym *sym, const void **keys, int n, sen_id *ids);
+sen_rc sen_sym_at_many(sen_sym *sym, const void **keys, int n, sen_id *ids);
 sen_rc sen_sym_del(sen_sym *sym, const void *key);
 unsigned int sen_sym_size(sen_sym *sym);
 int sen_sym_key(sen_sym *sym, sen_id id, void *keybuf, int buf_size);
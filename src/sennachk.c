@@ -26,6 +26,11 @@
 #ifdef HAVE_UCONTEXT_H
 #include <ucontext.h>
 #endif /* HAVE_UCONTEXT_H */
+#ifdef USE_AIO
+#include <dirent.h>
+#include <sys/stat.h>
+#include "lib/cache.h"
+#endif /* USE_AIO */
 
 #ifdef WIN32
 #include <errno.h>
@@ -44,6 +49,8 @@ sen_rc sen_index_clear_lock(sen_index *i);
 #define CHK_DUMP_LEXICON (1 << 0)
 #define CHK_THROUGH_SEGV (1 << 1)
 #define CHK_UNLOCK       (1 << 2)
+#define CHK_CACHE        (1 << 3)
+#define CHK_PRELOAD      (1 << 4)
 
 typedef enum {
   type_unknown = 0,
@@ -75,6 +82,8 @@ typedef struct {
 volatile unsigned int segvcount = 0;
 senchk_file *chkfile = NULL;
 int chkflags = 0;
+char *preload_budget = NULL;
+char *preload_hot = NULL;
 sigjmp_buf sigret;
 
 static void
@@ -683,6 +692,10 @@ handleopt(int argc, char **argv)
     {'l', "lexdump", NULL, CHK_DUMP_LEXICON, getopt_op_on},
     {'t', "throughsegv", NULL, CHK_THROUGH_SEGV, getopt_op_on},
     {'u', "unlock", NULL, CHK_UNLOCK, getopt_op_on},
+    {'c', "cache", NULL, CHK_CACHE, getopt_op_on},
+    {'p', "preload", NULL, CHK_PRELOAD, getopt_op_on},
+    {'b', "budget", &preload_budget, 0, getopt_op_none},
+    {'h', "hot", &preload_hot, 0, getopt_op_none},
     {'\0', NULL, NULL, 0, 0}
   };
 
@@ -694,6 +707,140 @@ handleopt(int argc, char **argv)
   }
 }
 
+#ifdef USE_AIO
+#define MAX_CACHE_FILES 256
+
+typedef struct {
+  dev_t dev;
+  ino_t inode;
+  char name[PATH_MAX];
+} senchk_cache_file;
+
+typedef struct {
+  senchk_cache_file files[MAX_CACHE_FILES];
+  unsigned int n_files;
+  unsigned int block;
+  FILE *fp;
+} senchk_cache_files;
+
+/* names the files in the directory of path which start with its name */
+static void
+cache_files_init(senchk_cache_files *cf, const char *path)
+{
+  DIR *d;
+  struct dirent *e;
+  struct stat st;
+  const char *base;
+  char dir[PATH_MAX];
+  size_t dlen, blen;
+  cf->n_files = 0;
+  if (!path) { return; }
+  if ((base = strrchr(path, '/'))) {
+    dlen = base - path;
+    base++;
+  } else {
+    dlen = 0;
+    base = path;
+  }
+  if (dlen >= PATH_MAX - 1) { return; }
+  if (dlen) {
+    memcpy(dir, path, dlen);
+  } else {
+    dir[dlen++] = '.';
+  }
+  dir[dlen] = '\0';
+  blen = strlen(base);
+  if (!(d = opendir(dir))) { return; }
+  while ((e = readdir(d)) && cf->n_files < MAX_CACHE_FILES) {
+    senchk_cache_file *f = &cf->files[cf->n_files];
+    if (strncmp(e->d_name, base, blen)) { continue; }
+    snprintf(f->name, PATH_MAX, "%s/%s", dir, e->d_name);
+    if (stat(f->name, &st) || !S_ISREG(st.st_mode)) { continue; }
+    f->dev = st.st_dev;
+    f->inode = st.st_ino;
+    cf->n_files++;
+  }
+  closedir(d);
+}
+
+static void
+show_cache_file(dev_t dev, ino_t inode, unsigned int nvalid,
+                unsigned int nreading, void *arg)
+{
+  senchk_cache_files *cf = arg;
+  const char *name = "";
+  unsigned int i;
+  for (i = 0; i < cf->n_files; i++) {
+    if (cf->files[i].dev == dev && cf->files[i].inode == inode) {
+      name = cf->files[i].name;
+      break;
+    }
+  }
+  fprintf(cf->fp, "   %6lu %10lu %10u %10u %10.1f  %s\n",
+          (unsigned long)dev, (unsigned long)inode, nvalid, nreading,
+          (double)nvalid * cf->block / (1024 * 1024), name);
+}
+
+static double
+ratio(uint64_t n, uint64_t total)
+{
+  return total ? (double)n * 100 / total : 0.0;
+}
+
+/* shows the statistics of the shm cache, and the files in it */
+static int
+show_cache(const char *path, FILE *fp)
+{
+  CacheStat st;
+  static senchk_cache_files cf;
+  uint64_t lookups;
+  if (sen_cache_attach()) {
+    fprintf(fp, "* cannot attach to the cache. SEN_CACHE_SIZE, SEN_CACHE_BLOCK and"
+            " SEN_HASH_SIZE should be the same as those of the processes using it.\n");
+    return -1;
+  }
+  sen_cache_stat(&st);
+  lookups = st.hits + st.waits + st.misses;
+  fprintf(fp,
+          "  Cache infomation:\n"
+          "   - cache_size (MB)         : %10u\n"
+          "   - cache_block             : %10u\n"
+          "   - shards                  : %10u\n"
+          "   - blocks                  : %10u\n"
+          "   - valid blocks            : %10u (%5.1f%%)\n"
+          "   - reading blocks          : %10u\n"
+          "   - referenced blocks       : %10u\n"
+          "   - lookups                 : %10llu\n"
+          "   - hits                    : %10llu (%5.1f%%)\n"
+          "   - waits on reading        : %10llu (%5.1f%%)\n"
+          "   - misses                  : %10llu (%5.1f%%)\n"
+          "   - misses with no room     : %10llu\n"
+          "   - evictions               : %10llu\n"
+          "   - invalidations           : %10llu\n"
+          "   - aio reads               : %10llu\n"
+          "   - aio reads out of cache  : %10llu\n"
+          "   - contended shard locks   : %10llu\n"
+          "   - sleeps on shard locks   : %10llu\n",
+          st.cache_size, st.cache_block, st.nshards, st.nblocks,
+          st.nvalid, ratio(st.nvalid, st.nblocks), st.nreading, st.nreferenced,
+          (unsigned long long)lookups,
+          (unsigned long long)st.hits, ratio(st.hits, lookups),
+          (unsigned long long)st.waits, ratio(st.waits, lookups),
+          (unsigned long long)st.misses, ratio(st.misses, lookups),
+          (unsigned long long)st.nomems, (unsigned long long)st.evictions,
+          (unsigned long long)st.invalidations, (unsigned long long)st.reads,
+          (unsigned long long)st.bypasses, (unsigned long long)st.lock_waits,
+          (unsigned long long)st.lock_sleeps);
+  show_delimiter(fp);
+  cache_files_init(&cf, path);
+  cf.block = st.cache_block;
+  cf.fp = fp;
+  fprintf(fp, "  Files in cache:\n"
+          "      dev      inode      valid    reading   MB valid  path\n");
+  return sen_cache_residency(show_cache_file, &cf);
+}
+#endif /* USE_AIO */
+
 static void
 show_seninfo(FILE *fp)
 {
@@ -714,6 +861,33 @@ show_seninfo(FILE *fp)
           version, confopt, sen_enctostr(denc), nseg, pmt);
 }
 
+/* reads the files of the index on path into the page cache */
+static int
+preload_index(const char *path, FILE *fp)
+{
+  sen_rc rc;
+  sen_index *i;
+  sen_timeval t0, t1;
+  unsigned int budget = preload_budget ? atoi(preload_budget) : 0;
+  if (!(i = sen_index_open(path))) {
+    fprintf(fp, "cannot open index (%s)\n", path);
+    return -1;
+  }
+  sen_timeval_now(&t0);
+  rc = sen_index_preload(i, SEN_PRELOAD_READ|SEN_PRELOAD_CHUNK, budget, preload_hot);
+  sen_timeval_now(&t1);
+  fprintf(fp,
+          "  Preload:\n"
+          "   - Budget                  : %u MB%s\n"
+          "   - Hot Set                 : %s\n"
+          "   - Result                  : %d\n"
+          "   - Time                    : %.3f sec\n",
+          budget, budget ? "" : " (all)", preload_hot ? preload_hot : "(none)", rc,
+          (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1000000.0);
+  sen_index_close(i);
+  return rc ? -1 : 0;
+}
+
 static void
 usage(void)
 {
@@ -723,6 +897,12 @@ usage(void)
           "  --lexdump, -l     : print lex words on checking inv file\n"
           "  --throughsegv, -t : run without trap SIGSEGV\n"
           "  --unlock, -u      : unlock index lock\n"
+          "  --cache, -c       : show the statistics of the shm cache instead of\n"
+          "                      checking, and its blocks of senna-file if given\n"
+          "  --preload, -p     : read the files of the index into the page cache\n"
+          "                      instead of checking, so that it gets warm\n"
+          "  --budget, -b MB   : read up to MB megabytes with --preload\n"
+          "  --hot, -h file    : read only the segments listed in file with --preload\n"
           "senna-file: <index path> or <db path>\n");
 }
 
@@ -736,11 +916,32 @@ main(int argc, char *argv[])
   struct sigaction m;
 #endif /* WIN32 */
 
-  if (!(path = handleopt(argc, argv))) {
+  if (!(path = handleopt(argc, argv)) && !(chkflags & CHK_CACHE)) {
     usage();
     return 1;
   }
 
+  if (chkflags & CHK_CACHE) {
+#ifdef USE_AIO
+    show_delimiter(stdout);
+    ret = show_cache(path, stdout);
+    show_delimiter(stdout);
+    return ret ? 1 : 0;
+#else /* USE_AIO */
+    puts("* senna is built without the shm cache (--enable-aio).");
+    return 1;
+#endif /* USE_AIO */
+  }
+
+  if (chkflags & CHK_PRELOAD) {
+    sen_init();
+    show_delimiter(stdout);
+    ret = preload_index(path, stdout);
+    show_delimiter(stdout);
+    sen_fin();
+    return ret ? 1 : 0;
+  }
+
   if (!(chkflags & CHK_THROUGH_SEGV)) {
 #ifdef WIN32
     if (signal(SIGSEGV, trapsegv) == SIG_ERR) {
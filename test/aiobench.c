@@ -0,0 +1,160 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of the chunk reads of sen_index_select.
+   usage: aiobench path [ndocs [nqueries [cold]]]
+   an index of ndocs generated documents is built on path with a few
+   segments, so that most of the postings are flushed to the chunks.
+   then nqueries searches of two words are run, and their latencies
+   are reported. with the --enable-aio build and SEN_AIO_ENABLED=1,
+   the chunks are read by O_DIRECT through the backend given by
+   SEN_AIO_BACKEND (uring, posix or pread), so that the reads which
+   miss the shm cache go to the device. otherwise, the chunks are read
+   by pread, after they are hinted by posix_fadvise. if cold is 1, the
+   chunk file is dropped from the page cache before each search, so
+   that the reads of the default build go to the device too. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 20000
+#define DEFAULT_NQUERIES 2000
+#define NWORDS 1000
+#define DOCSIZE 4096
+#define INITIAL_N_SEGMENTS 16
+
+static char words[NWORDS][16];
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+double_compare(const void *a, const void *b)
+{
+  double d = *((const double *)a) - *((const double *)b);
+  return d < 0 ? -1 : d > 0 ? 1 : 0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* writes back the chunk file of the index on path, and drops it from the
+   page cache. */
+static void
+drop_cache(const char *path)
+{
+  int fd;
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "%s.SEN.i.c", path);
+  if ((fd = open(buf, O_RDONLY)) < 0) { return; }
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j, n, ndocs, nqueries, cold;
+  char doc[DOCSIZE], query[64], *p;
+  const char *backend;
+  double *t, t0, total = 0;
+  sen_index *index;
+  sen_select_optarg optarg;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs [nqueries [cold]]]\n", argv[0]);
+    return -1;
+  }
+  ndocs = (argc > 2) ? atoi(argv[2]) : DEFAULT_NDOCS;
+  nqueries = (argc > 3) ? atoi(argv[3]) : DEFAULT_NQUERIES;
+  cold = (argc > 4) ? atoi(argv[4]) : 0;
+  if (!(t = malloc(sizeof(double) * nqueries))) { return -1; }
+  sen_init();
+  gen_words();
+  sen_index_remove(argv[1]);
+  if (!(index = sen_index_create(argv[1], sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM,
+                                 INITIAL_N_SEGMENTS, sen_enc_utf8))) {
+    fprintf(stderr, "index create failed (%s)\n", argv[1]);
+    return -1;
+  }
+  srand(2);
+  for (i = 1; i <= ndocs; i++) {
+    n = 10 + rand() % 100;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", pick_word());
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  sen_index_close(index);
+  if (!(index = sen_index_open(argv[1]))) {
+    fprintf(stderr, "index open failed (%s)\n", argv[1]);
+    return -1;
+  }
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.mode = sen_sel_exact;
+  srand(3);
+  for (i = 0; i < nqueries; i++) {
+    sen_records *r;
+    snprintf(query, sizeof(query), "%s %s", words[rand() % NWORDS], words[rand() % NWORDS]);
+    if (!(r = sen_records_open(sen_rec_document, sen_rec_none, 0))) { break; }
+    if (cold) { drop_cache(argv[1]); }
+    t0 = now();
+    sen_index_select(index, query, strlen(query), r, sen_sel_or, &optarg);
+    t[i] = now() - t0;
+    total += t[i];
+    sen_records_close(r);
+  }
+  qsort(t, nqueries, sizeof(double), double_compare);
+  backend = getenv("SEN_AIO_BACKEND");
+  printf("%-8s %-4s %8d queries  p50 %8.1f usec  p99 %8.1f usec  avg %8.1f usec\n",
+         backend ? backend : "default", cold ? "cold" : "warm", nqueries,
+         t[nqueries / 2] * 1000000, t[nqueries * 99 / 100] * 1000000,
+         total / nqueries * 1000000);
+  free(t);
+  sen_index_close(index);
+  sen_index_remove(argv[1]);
+  sen_fin();
+  return 0;
+}
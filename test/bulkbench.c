@@ -0,0 +1,263 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of sen_index_bulk.
+   usage: bulkbench path [ndocs [nthreads [run_memory]]]
+   an index of ndocs generated documents is built on path by
+   sen_index_upd, and another one by sen_index_bulk with nthreads
+   workers and run_memory bytes of the postings in memory. the build times are reported, and the search results of
+   the two are compared, before and after some more documents are
+   added and updated by sen_index_upd. it is done once with the byte
+   coded postings, and once with SEN_INDEX_BLOCK_CODEC. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 20000
+#define DEFAULT_NTHREADS 4
+#define NWORDS 1000
+#define DOCSIZE 4096
+
+static char words[NWORDS][16];
+static unsigned int run_memory = 0;
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static char *
+gen_doc(int id, char *doc)
+{
+  int j, n;
+  char *p;
+  srand(id);
+  n = 10 + rand() % 100;
+  for (p = doc, j = 0; j < n; j++) {
+    p += sprintf(p, "%s ", pick_word());
+  }
+  return doc;
+}
+
+static sen_index *
+build_upd(const char *path, int ndocs, int flags)
+{
+  int i;
+  char doc[DOCSIZE];
+  sen_index *index;
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM|flags, 0,
+                                 sen_enc_utf8))) {
+    return NULL;
+  }
+  for (i = 1; i <= ndocs; i++) {
+    gen_doc(i, doc);
+    sen_index_upd(index, &i, NULL, 0, doc, strlen(doc));
+  }
+  return index;
+}
+
+static sen_index *
+build_bulk(const char *path, int ndocs, int flags, int nthreads)
+{
+  int i;
+  char doc[DOCSIZE];
+  sen_rc rc;
+  sen_index *index;
+  sen_index_bulk *bulk;
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM|flags, 0,
+                                 sen_enc_utf8))) {
+    return NULL;
+  }
+  if (!(bulk = sen_index_bulk_open(index, nthreads, run_memory))) {
+    sen_index_close(index);
+    return NULL;
+  }
+  for (i = 1; i <= ndocs; i++) {
+    gen_doc(i, doc);
+    if ((rc = sen_index_bulk_add(bulk, &i, doc, strlen(doc)))) {
+      fprintf(stderr, "sen_index_bulk_add failed (%d)\n", rc);
+      break;
+    }
+  }
+  if ((rc = sen_index_bulk_finish(bulk))) {
+    fprintf(stderr, "sen_index_bulk_finish failed (%d)\n", rc);
+    sen_index_close(index);
+    return NULL;
+  }
+  return index;
+}
+
+/* adds ndocs / 10 documents, and updates every 50th document */
+static void
+update(sen_index *index, int ndocs)
+{
+  int i;
+  char odoc[DOCSIZE], doc[DOCSIZE];
+  for (i = ndocs + 1; i <= ndocs + ndocs / 10; i++) {
+    gen_doc(i, doc);
+    sen_index_upd(index, &i, NULL, 0, doc, strlen(doc));
+  }
+  for (i = 1; i <= ndocs; i += 50) {
+    gen_doc(i, odoc);
+    gen_doc(i + ndocs * 2, doc);
+    sen_index_upd(index, &i, odoc, strlen(odoc), doc, strlen(doc));
+  }
+}
+
+/* the scores of near are not compared, since they depend on the order
+   in which the cursors are visited, and that order is decided by
+   sen_inv_estimate_size, which differs whether the postings are in
+   the buffers or in the chunks. */
+static int
+compare_records(sen_records *a, sen_records *b, int with_score)
+{
+  int key, score;
+  if (sen_records_nhits(a) != sen_records_nhits(b)) { return 1; }
+  sen_records_rewind(a);
+  while (sen_records_next(a, &key, sizeof(int), &score)) {
+    if (!sen_records_find(b, &key)) { return 1; }
+    if (with_score && sen_records_find(b, &key) != score) { return 1; }
+  }
+  return 0;
+}
+
+/* returns the number of the queries whose results differ */
+static int
+compare(sen_index *a, sen_index *b)
+{
+  int i, m, ndiffs = 0;
+  char query[64];
+  sen_select_optarg optarg;
+  sen_sel_mode modes[] = {sen_sel_exact, sen_sel_prefix, sen_sel_near};
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.max_interval = 8;
+  for (m = 0; m < 3; m++) {
+    optarg.mode = modes[m];
+    srand(3);
+    for (i = 0; i < NWORDS; i++) {
+      sen_records *ra, *rb;
+      switch (modes[m]) {
+      case sen_sel_near :
+        snprintf(query, sizeof(query), "%s %s", pick_word(), pick_word());
+        break;
+      case sen_sel_prefix :
+        snprintf(query, sizeof(query), "%.2s", words[i]);
+        break;
+      default :
+        snprintf(query, sizeof(query), "%.15s", words[i]);
+        break;
+      }
+      ra = sen_records_open(sen_rec_document, sen_rec_none, 0);
+      rb = sen_records_open(sen_rec_document, sen_rec_none, 0);
+      if (!ra || !rb) { return -1; }
+      sen_index_select(a, query, strlen(query), ra, sen_sel_or, &optarg);
+      sen_index_select(b, query, strlen(query), rb, sen_sel_or, &optarg);
+      if (compare_records(ra, rb, modes[m] != sen_sel_near)) { ndiffs++; }
+      sen_records_close(ra);
+      sen_records_close(rb);
+    }
+  }
+  return ndiffs;
+}
+
+static int
+run(const char *path, const char *name, int flags, int ndocs, int nthreads)
+{
+  char bpath[1024];
+  sen_index *a, *b;
+  unsigned long long ca, cb;
+  double t0, ta, tb;
+  int d0, d1;
+  snprintf(bpath, sizeof(bpath), "%s.bulk", path);
+  t0 = now();
+  if (!(a = build_upd(path, ndocs, flags))) {
+    fprintf(stderr, "index create failed (%s)\n", path);
+    return -1;
+  }
+  ta = now() - t0;
+  t0 = now();
+  if (!(b = build_bulk(bpath, ndocs, flags, nthreads))) {
+    fprintf(stderr, "bulk build failed (%s)\n", bpath);
+    sen_index_close(a);
+    return -1;
+  }
+  tb = now() - t0;
+  sen_index_info(a, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &ca);
+  sen_index_info(b, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &cb);
+  printf("%-8s %8d docs  upd %8.3f sec  chunk %10llu bytes\n", name, ndocs, ta, ca);
+  printf("%-8s %8d docs  bulk %7.3f sec  chunk %10llu bytes  (%d threads)\n",
+         name, ndocs, tb, cb, nthreads);
+  d0 = compare(a, b);
+  update(a, ndocs);
+  update(b, ndocs);
+  d1 = compare(a, b);
+  printf("%-8s differences  %d queries after build, %d after update\n", name, d0, d1);
+  sen_index_close(a);
+  sen_index_close(b);
+  sen_index_remove(path);
+  sen_index_remove(bpath);
+  return d0 || d1;
+}
+
+int
+main(int argc, char **argv)
+{
+  int ndocs = DEFAULT_NDOCS, nthreads = DEFAULT_NTHREADS, rc = 0;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs [nthreads [run_memory]]]\n", argv[0]);
+    return -1;
+  }
+  if (argc > 2) { ndocs = atoi(argv[2]); }
+  if (argc > 3) { nthreads = atoi(argv[3]); }
+  if (argc > 4) { run_memory = atoi(argv[4]); }
+  sen_init();
+  gen_words();
+  if (run(argv[1], "byte", 0, ndocs, nthreads)) { rc = 1; }
+  if (run(argv[1], "block", SEN_INDEX_BLOCK_CODEC, ndocs, nthreads)) { rc = 1; }
+  sen_fin();
+  return rc;
+}
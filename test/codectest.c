@@ -0,0 +1,165 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* test of the block codec of the postings in chunks.
+   the same generated documents are put to an index with the byte coded
+   chunks and to one with SEN_INDEX_BLOCK_CODEC, some of them are
+   deleted, and the indexes are opened again. NDOCS documents fill the
+   buffers several times, so that the frequent words are block coded.
+   then words, phrases of a rare and a frequent word, near searches and
+   prefixes are searched, and the records of the two indexes are
+   compared. returns 1 if any of them differ. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "senna.h"
+
+#define NDOCS 30000
+#define NQUERIES 200
+#define NWORDS 1000
+#define DOCSIZE 4096
+
+static const char *paths[2] = { "codectest.byte", "codectest.block" };
+static char words[NWORDS][16];
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static int
+gen_doc(int id, char *doc)
+{
+  int j, n;
+  char *p;
+  srand(id);
+  n = 10 + rand() % 100;
+  for (p = doc, j = 0; j < n; j++) { p += sprintf(p, "%s ", pick_word()); }
+  return p - doc;
+}
+
+static sen_index *
+build(const char *path, int flags)
+{
+  int i, len;
+  char doc[DOCSIZE];
+  sen_index *index;
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM|flags, 0,
+                                 sen_enc_utf8))) {
+    return NULL;
+  }
+  for (i = 1; i <= NDOCS; i++) {
+    len = gen_doc(i, doc);
+    sen_index_upd(index, &i, NULL, 0, doc, len);
+  }
+  for (i = 7; i <= NDOCS; i += 7) {
+    len = gen_doc(i, doc);
+    sen_index_upd(index, &i, doc, len, NULL, 0);
+  }
+  sen_index_close(index);
+  return sen_index_open(path);
+}
+
+/* returns 1 if the records of a and b differ. */
+static int
+compare(sen_records *a, sen_records *b)
+{
+  int key, sa, sb;
+  if (sen_records_nhits(a) != sen_records_nhits(b)) { return 1; }
+  sen_records_rewind(a);
+  while (sen_records_next(a, &key, sizeof(int), &sa)) {
+    if (!sen_records_at(b, &key, 0, 0, &sb, NULL) || sa != sb) { return 1; }
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, k, ndiffs = 0, nhits = 0;
+  char query[64];
+  sen_index *index[2];
+  sen_records *r[2];
+  sen_select_optarg optarg;
+  sen_init();
+  gen_words();
+  if (!(index[0] = build(paths[0], 0)) ||
+      !(index[1] = build(paths[1], SEN_INDEX_BLOCK_CODEC))) {
+    fprintf(stderr, "codectest: index create failed\n");
+    return 1;
+  }
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.max_interval = 8;
+  srand(3);
+  for (i = 0; i < NQUERIES; i++) {
+    const char *w = i % 2 ? words[200 + rand() % (NWORDS - 200)] : pick_word();
+    switch (i % 4) {
+    case 0 :
+      snprintf(query, sizeof(query), "%s", pick_word());
+      optarg.mode = sen_sel_exact;
+      break;
+    case 1 :
+      snprintf(query, sizeof(query), "%s %s", w, words[rand() % 20]);
+      optarg.mode = sen_sel_exact;
+      break;
+    case 2 :
+      snprintf(query, sizeof(query), "%s %s", pick_word(), pick_word());
+      optarg.mode = sen_sel_near;
+      break;
+    default :
+      snprintf(query, sizeof(query), "%.2s", pick_word());
+      optarg.mode = sen_sel_prefix;
+      break;
+    }
+    for (k = 0; k < 2; k++) {
+      if (!(r[k] = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return 1; }
+      sen_index_select(index[k], query, strlen(query), r[k], sen_sel_or, &optarg);
+    }
+    nhits += sen_records_nhits(r[0]);
+    if (compare(r[0], r[1])) {
+      fprintf(stderr, "codectest: records differ for \"%s\" (%d, %d hits)\n",
+              query, sen_records_nhits(r[0]), sen_records_nhits(r[1]));
+      ndiffs++;
+    }
+    for (k = 0; k < 2; k++) { sen_records_close(r[k]); }
+  }
+  for (k = 0; k < 2; k++) {
+    sen_index_close(index[k]);
+    sen_index_remove(paths[k]);
+  }
+  printf("codectest %d queries  %d hits  differences %d\n", NQUERIES, nhits, ndiffs);
+  sen_fin();
+  return ndiffs ? 1 : 0;
+}
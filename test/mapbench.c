@@ -0,0 +1,186 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of the options of the segment mappings.
+   usage: mapbench path [ndocs [nqueries]]
+   an index of ndocs generated documents with a large vocabulary is built
+   on path. then, for each combination of SEN_MAP_POPULATE and
+   SEN_MAP_HUGEPAGE, a child process opens the index and runs nqueries
+   searches of a word. the time to open the index, the latency of the
+   first searches, which fault the segments in, and of the rest, and the
+   number of page faults are reported. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 20000
+#define DEFAULT_NQUERIES 20000
+#define NWORDS 200000
+#define DOCSIZE 8192
+#define NFIRST 1000
+
+static char words[NWORDS][16];
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+double_compare(const void *a, const void *b)
+{
+  double d = *((const double *)a) - *((const double *)b);
+  return d < 0 ? -1 : d > 0 ? 1 : 0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 4 + rand() % 10;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+static int
+build(const char *path, int ndocs)
+{
+  int i, j, n;
+  char doc[DOCSIZE], *p;
+  sen_index *index;
+  sen_init();
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_DELIMITED,
+                                 0, sen_enc_utf8))) {
+    fprintf(stderr, "index create failed (%s)\n", path);
+    return -1;
+  }
+  srand(2);
+  for (i = 1; i <= ndocs; i++) {
+    n = 20 + rand() % 100;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", words[rand() % NWORDS]);
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  sen_index_close(index);
+  sen_fin();
+  return 0;
+}
+
+static int
+run(const char *path, int nqueries, int populate, int hugepage)
+{
+  int i;
+  long faults;
+  double *t, t0, topen, first = 0, rest = 0;
+  struct rusage ru0, ru1;
+  sen_index *index;
+  sen_select_optarg optarg;
+  if (!(t = malloc(sizeof(double) * nqueries))) { return -1; }
+  setenv("SEN_MAP_POPULATE", populate ? "1" : "0", 1);
+  setenv("SEN_MAP_HUGEPAGE", hugepage ? "1" : "0", 1);
+  sen_init();
+  getrusage(RUSAGE_SELF, &ru0);
+  t0 = now();
+  if (!(index = sen_index_open(path))) {
+    fprintf(stderr, "index open failed (%s)\n", path);
+    return -1;
+  }
+  topen = now() - t0;
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.mode = sen_sel_exact;
+  srand(3);
+  for (i = 0; i < nqueries; i++) {
+    sen_records *r;
+    const char *w = words[rand() % NWORDS];
+    if (!(r = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return -1; }
+    t0 = now();
+    sen_index_select(index, w, strlen(w), r, sen_sel_or, &optarg);
+    t[i] = now() - t0;
+    if (i < NFIRST) { first += t[i]; } else { rest += t[i]; }
+    sen_records_close(r);
+  }
+  getrusage(RUSAGE_SELF, &ru1);
+  faults = (ru1.ru_minflt - ru0.ru_minflt) + (ru1.ru_majflt - ru0.ru_majflt);
+  qsort(t, nqueries, sizeof(double), double_compare);
+  printf("populate %d hugepage %d  open %8.1f usec  first %d %7.1f usec  "
+         "rest p50 %6.1f avg %6.1f usec  faults %ld\n",
+         populate, hugepage, topen * 1000000, NFIRST,
+         first / NFIRST * 1000000, t[nqueries / 2] * 1000000,
+         nqueries > NFIRST ? rest / (nqueries - NFIRST) * 1000000 : 0.0, faults);
+  free(t);
+  sen_index_close(index);
+  sen_fin();
+  return 0;
+}
+
+/* each step runs in a child process, which has its own sen_init */
+static int
+spawn(const char *path, int ndocs, int nqueries, int o)
+{
+  int status;
+  pid_t pid;
+  fflush(stdout);
+  if ((pid = fork()) == -1) {
+    fprintf(stderr, "fork failed\n");
+    return -1;
+  }
+  if (!pid) {
+    exit((o < 0 ? build(path, ndocs) : run(path, nqueries, o & 1, o >> 1)) ? 1 : 0);
+  }
+  if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+    fprintf(stderr, "%s failed\n", o < 0 ? "build" : "run");
+    return -1;
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int ndocs, nqueries, o;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs [nqueries]]\n", argv[0]);
+    return -1;
+  }
+  ndocs = (argc > 2) ? atoi(argv[2]) : DEFAULT_NDOCS;
+  nqueries = (argc > 3) ? atoi(argv[3]) : DEFAULT_NQUERIES;
+  if (nqueries <= NFIRST) { nqueries = NFIRST + 1; }
+  gen_words();
+  if (spawn(argv[1], ndocs, nqueries, -1)) { return -1; }
+  for (o = 0; o < 4; o++) {
+    if (spawn(argv[1], ndocs, nqueries, o)) { break; }
+  }
+  sen_init();
+  sen_index_remove(argv[1]);
+  sen_fin();
+  return 0;
+}
@@ -0,0 +1,248 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of the merger thread.
+   usage: mergebench path [ndocs]
+   ndocs generated documents are added to an index on path by
+   sen_index_upd, and then every 20th of them is updated. it is done
+   once with the buffers flushed by the writer, and once with the merger
+   thread. the latencies of sen_index_upd and the stats of the merger
+   are reported, and the search results of the two indexes are
+   compared, while the merges may still be pending, and after the
+   merger is stopped. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 50000
+#define NWORDS 1000
+#define DOCSIZE 4096
+#define NBUCKETS 32
+/* few segments, so that the buffers of the terms get full */
+#define INITIAL_N_SEGMENTS 16
+
+static char words[NWORDS][16];
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static char *
+gen_doc(int id, char *doc)
+{
+  int j, n;
+  char *p;
+  srand(id);
+  n = 10 + rand() % 100;
+  for (p = doc, j = 0; j < n; j++) {
+    p += sprintf(p, "%s ", pick_word());
+  }
+  return doc;
+}
+
+/* histogram of latencies by powers of 2 usec */
+typedef struct {
+  unsigned n[NBUCKETS];
+  unsigned count;
+  double max;
+} latency;
+
+static void
+latency_add(latency *l, double t)
+{
+  int b = 0;
+  unsigned usec = (unsigned) (t * 1000000);
+  while (usec > 1 && b < NBUCKETS - 1) { usec >>= 1; b++; }
+  l->n[b]++;
+  l->count++;
+  if (t > l->max) { l->max = t; }
+}
+
+/* returns the upper bound of the latency below which q of them are */
+static double
+latency_quantile(latency *l, double q)
+{
+  int b;
+  unsigned n = 0;
+  for (b = 0; b < NBUCKETS; b++) {
+    if ((n += l->n[b]) >= l->count * q) { break; }
+  }
+  return (2 << b) / 1000000.0;
+}
+
+static sen_index *
+build(const char *path, int ndocs, int mergerp, latency *l, double *t)
+{
+  int i;
+  double t0, t1;
+  char odoc[DOCSIZE], doc[DOCSIZE];
+  sen_index *index;
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM,
+                                 INITIAL_N_SEGMENTS, sen_enc_utf8))) {
+    return NULL;
+  }
+  if (mergerp && sen_index_merger_start(index)) {
+    sen_index_close(index);
+    return NULL;
+  }
+  memset(l, 0, sizeof(latency));
+  *t = now();
+  for (i = 1; i <= ndocs; i++) {
+    gen_doc(i, doc);
+    t0 = now();
+    sen_index_upd(index, &i, NULL, 0, doc, strlen(doc));
+    t1 = now();
+    latency_add(l, t1 - t0);
+  }
+  for (i = 1; i <= ndocs; i += 20) {
+    gen_doc(i, odoc);
+    gen_doc(i + ndocs, doc);
+    t0 = now();
+    sen_index_upd(index, &i, odoc, strlen(odoc), doc, strlen(doc));
+    t1 = now();
+    latency_add(l, t1 - t0);
+  }
+  *t = now() - *t;
+  return index;
+}
+
+static int
+compare_records(sen_records *a, sen_records *b)
+{
+  int key, score;
+  if (sen_records_nhits(a) != sen_records_nhits(b)) { return 1; }
+  sen_records_rewind(a);
+  while (sen_records_next(a, &key, sizeof(int), &score)) {
+    if (sen_records_find(b, &key) != score) { return 1; }
+  }
+  return 0;
+}
+
+/* returns the number of the queries whose results differ */
+static int
+compare(sen_index *a, sen_index *b)
+{
+  int i, m, ndiffs = 0;
+  char query[64];
+  sen_select_optarg optarg;
+  sen_sel_mode modes[] = {sen_sel_exact, sen_sel_prefix};
+  memset(&optarg, 0, sizeof(optarg));
+  for (m = 0; m < 2; m++) {
+    optarg.mode = modes[m];
+    for (i = 0; i < NWORDS; i++) {
+      sen_records *ra, *rb;
+      if (modes[m] == sen_sel_prefix) {
+        snprintf(query, sizeof(query), "%.2s", words[i]);
+      } else {
+        snprintf(query, sizeof(query), "%.15s", words[i]);
+      }
+      ra = sen_records_open(sen_rec_document, sen_rec_none, 0);
+      rb = sen_records_open(sen_rec_document, sen_rec_none, 0);
+      if (!ra || !rb) { return -1; }
+      sen_index_select(a, query, strlen(query), ra, sen_sel_or, &optarg);
+      sen_index_select(b, query, strlen(query), rb, sen_sel_or, &optarg);
+      if (compare_records(ra, rb)) { ndiffs++; }
+      sen_records_close(ra);
+      sen_records_close(rb);
+    }
+  }
+  return ndiffs;
+}
+
+static void
+report(const char *name, latency *l, double t)
+{
+  printf("%-8s %8.3f sec  upd avg %7.1f usec  99%% < %7.1f  99.9%% < %7.1f  max %8.1f usec\n",
+         name, t, t / l->count * 1000000,
+         latency_quantile(l, 0.99) * 1000000, latency_quantile(l, 0.999) * 1000000,
+         l->max * 1000000);
+}
+
+int
+main(int argc, char **argv)
+{
+  int ndocs = DEFAULT_NDOCS, d0, d1;
+  char mpath[1024];
+  sen_index *a, *b;
+  latency la, lb;
+  double ta, tb;
+  unsigned nqueued, max_queued, nmerges, nwaits;
+  unsigned long long total_usec, max_usec;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs]\n", argv[0]);
+    return -1;
+  }
+  if (argc > 2) { ndocs = atoi(argv[2]); }
+  snprintf(mpath, sizeof(mpath), "%s.merger", argv[1]);
+  sen_init();
+  gen_words();
+  if (!(a = build(argv[1], ndocs, 0, &la, &ta))) {
+    fprintf(stderr, "index create failed (%s)\n", argv[1]);
+    return -1;
+  }
+  report("flush", &la, ta);
+  if (!(b = build(mpath, ndocs, 1, &lb, &tb))) {
+    fprintf(stderr, "index create failed (%s)\n", mpath);
+    sen_index_close(a);
+    return -1;
+  }
+  report("merger", &lb, tb);
+  sen_index_merger_info(b, &nqueued, &max_queued, &nmerges, &nwaits,
+                        &total_usec, &max_usec);
+  printf("merger   %u merges  avg %.1f usec  max %llu usec  queued %u (max %u)  waits %u\n",
+         nmerges, nmerges ? (double) total_usec / nmerges : 0.0, max_usec,
+         nqueued, max_queued, nwaits);
+  d0 = compare(a, b);
+  sen_index_merger_stop(b);
+  d1 = compare(a, b);
+  printf("differences  %d queries with the merger, %d after it is stopped\n", d0, d1);
+  sen_index_close(a);
+  sen_index_close(b);
+  sen_index_remove(argv[1]);
+  sen_index_remove(mpath);
+  sen_fin();
+  return d0 || d1;
+}
@@ -0,0 +1,227 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of fast_sen_str_normalize.
+   usage: normbench [file [loops]]
+   each line of file is normalized loops times. without file,
+   ascii-heavy, mixed japanese and random character corpora
+   are generated.
+   the nfkc lookups are also measured for each character,
+   by the table form and by the switch form. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define BUFSIZE 65536
+#define CORPUS_SIZE (4 * 1024 * 1024)
+#define DEFAULT_LOOPS 20
+
+static char buffer[BUFSIZE * 3];
+
+/* lib/nfkc.c */
+const char *sen_nfkc_map1(const unsigned char *str);
+const char *sen_nfkc_map2(const unsigned char *prefix, const unsigned char *suffix);
+/* nfkcswitch.c */
+const char *sen_nfkc_map1_switch(const unsigned char *str);
+const char *sen_nfkc_map2_switch(const unsigned char *prefix, const unsigned char *suffix);
+
+static const char *ascii_words[] = {
+  "http://www.example.com/index.html", "The", "quick", "brown", "fox",
+  "jumps", "over", "the", "lazy", "dog.", "SELECT", "id_12345", "2013-01-07",
+  "PostgreSQL", "full-text", "search", "/usr/local/lib", "foo@example.org"
+};
+
+static const char *ja_words[] = {
+  "\xe5\x85\xa8\xe6\x96\x87\xe6\xa4\x9c\xe7\xb4\xa2", /* zenbun kensaku */
+  "\xe3\x81\xaf", "\xe3\x81\xae", "\xe3\x82\x92",
+  "\xe3\x83\x87\xe3\x83\xbc\xe3\x82\xbf\xe3\x83\x99\xe3\x83\xbc\xe3\x82\xb9",
+  "\xef\xbd\xb6\xef\xbe\x80\xef\xbd\xb6\xef\xbe\x85", /* hankaku katakana */
+  "\xef\xbc\xa1\xef\xbc\xa2\xef\xbc\xa3", /* zenkaku alphabet */
+  "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "\xe3\x80\x82", "Senna", "2013"
+};
+
+/* code point ranges for the random corpus */
+static const unsigned int random_ranges[][2] = {
+  {0x3041, 0x3096}, /* hiragana */
+  {0x30A1, 0x30FA}, /* katakana */
+  {0x4E00, 0x9FA5}, /* kanji */
+  {0xFF61, 0xFF9F}, /* hankaku katakana */
+  {0xFF01, 0xFF5E}, /* zenkaku ascii */
+  {0x0041, 0x007A}  /* ascii */
+};
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static char *
+gen_corpus(const char **words, int nwords, size_t size, size_t *len)
+{
+  char *corpus, *p;
+  size_t col = 0;
+  if (!(corpus = malloc(size + 256))) { return NULL; }
+  srand(1);
+  for (p = corpus; p < corpus + size;) {
+    const char *w = words[rand() % nwords];
+    size_t l = strlen(w);
+    memcpy(p, w, l);
+    p += l;
+    col += l;
+    if (col > 80) {
+      *p++ = '\n';
+      col = 0;
+    } else {
+      *p++ = ' ';
+    }
+  }
+  *p = '\0';
+  *len = p - corpus;
+  return corpus;
+}
+
+static char *
+gen_random_corpus(size_t size, size_t *len)
+{
+  char *corpus;
+  unsigned char *p, *e;
+  size_t col = 0;
+  int nranges = sizeof(random_ranges) / sizeof(random_ranges[0]);
+  if (!(corpus = malloc(size + 256))) { return NULL; }
+  srand(1);
+  for (p = (unsigned char *)corpus, e = p + size; p < e;) {
+    const unsigned int *r = random_ranges[rand() % nranges];
+    unsigned int c = r[0] + rand() % (r[1] - r[0] + 1);
+    if (c < 0x80) {
+      *p++ = c;
+      col++;
+    } else {
+      *p++ = 0xe0 | (c >> 12);
+      *p++ = 0x80 | ((c >> 6) & 0x3f);
+      *p++ = 0x80 | (c & 0x3f);
+      col += 3;
+    }
+    if (col > 80) {
+      *p++ = '\n';
+      col = 0;
+    }
+  }
+  *p = '\0';
+  *len = (char *)p - corpus;
+  return corpus;
+}
+
+static void
+bench(const char *name, const char *corpus, size_t len, int loops)
+{
+  int i;
+  size_t nbytes = 0, nout = 0;
+  const char *p, *e = corpus + len, *nl;
+  double t0, t;
+  t0 = now();
+  for (i = 0; i < loops; i++) {
+    for (p = corpus; p < e; p = nl + 1) {
+      int r;
+      if (!(nl = memchr(p, '\n', e - p))) { nl = e; }
+      if (nl - p > BUFSIZE) { continue; }
+      r = fast_sen_str_normalize(p, nl - p, buffer, sizeof(buffer));
+      if (r > 0) { nout += r; }
+      nbytes += nl - p;
+    }
+  }
+  t = now() - t0;
+  printf("%-16s %10lu bytes -> %10lu bytes  %8.3f sec  %8.1f MB/s\n",
+         name, (unsigned long)nbytes, (unsigned long)nout, t,
+         nbytes / t / (1024 * 1024));
+}
+
+static void
+bench_nfkc(const char *name, const char *corpus, size_t len, int loops,
+           const char *(*map1)(const unsigned char *),
+           const char *(*map2)(const unsigned char *, const unsigned char *))
+{
+  int i;
+  unsigned int l;
+  size_t nchars = 0, nhits = 0;
+  const unsigned char *p, *prev, *e = (const unsigned char *)corpus + len;
+  double t0, t;
+  t0 = now();
+  for (i = 0; i < loops; i++) {
+    for (prev = NULL, p = (const unsigned char *)corpus; p < e; prev = p, p += l) {
+      if (!(l = sen_str_charlen((const char *)p, sen_enc_utf8))) { break; }
+      if (map1(p)) { nhits++; }
+      if (prev && map2(prev, p)) { nhits++; }
+      nchars++;
+    }
+  }
+  t = now() - t0;
+  printf("%-16s %10lu chars  %8lu hits  %8.3f sec  %8.1f Mchars/s\n",
+         name, (unsigned long)nchars, (unsigned long)nhits, t, nchars / t / 1000000);
+}
+
+static void
+bench_all(const char *name, const char *corpus, size_t len, int loops)
+{
+  char label[64];
+  bench(name, corpus, len, loops);
+  snprintf(label, sizeof(label), "%s/table", name);
+  bench_nfkc(label, corpus, len, loops, sen_nfkc_map1, sen_nfkc_map2);
+  snprintf(label, sizeof(label), "%s/switch", name);
+  bench_nfkc(label, corpus, len, loops, sen_nfkc_map1_switch, sen_nfkc_map2_switch);
+}
+
+int
+main(int argc, char **argv)
+{
+  char *corpus;
+  size_t len;
+  int loops = DEFAULT_LOOPS;
+  sen_init();
+  if (argc > 2) { loops = atoi(argv[2]); }
+  if (argc > 1) {
+    FILE *fp;
+    if (!(fp = fopen(argv[1], "r"))) { perror(argv[1]); return -1; }
+    if (!(corpus = malloc(CORPUS_SIZE * 16 + 1))) { return -1; }
+    len = fread(corpus, 1, CORPUS_SIZE * 16, fp);
+    fclose(fp);
+    bench_all(argv[1], corpus, len, loops);
+    free(corpus);
+  } else {
+    if ((corpus = gen_corpus(ascii_words, sizeof(ascii_words) / sizeof(char *),
+                             CORPUS_SIZE, &len))) {
+      bench_all("ascii", corpus, len, loops);
+      free(corpus);
+    }
+    if ((corpus = gen_corpus(ja_words, sizeof(ja_words) / sizeof(char *),
+                             CORPUS_SIZE, &len))) {
+      bench_all("japanese", corpus, len, loops);
+      free(corpus);
+    }
+    if ((corpus = gen_random_corpus(CORPUS_SIZE, &len))) {
+      bench_all("random", corpus, len, loops);
+      free(corpus);
+    }
+  }
+  sen_fin();
+  return 0;
+}
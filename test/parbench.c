@@ -0,0 +1,152 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of the parallel sen_index_select.
+   usage: parbench path [ndocs [nqueries [nthreads]]]
+   an index of ndocs generated documents is built on path. then
+   nqueries searches of a phrase and of a near of two frequent words
+   are run by one thread, and by nthreads threads given by
+   sen_ctx_select_threads_set. the average latencies are reported,
+   with the number of the queries whose results differ. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 50000
+#define DEFAULT_NQUERIES 100
+#define DEFAULT_NTHREADS 4
+#define NWORDS 1000
+#define DOCSIZE 4096
+
+static char words[NWORDS][16];
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static int
+compare_records(sen_records *a, sen_records *b)
+{
+  int key, score;
+  if (sen_records_nhits(a) != sen_records_nhits(b)) { return 1; }
+  sen_records_rewind(a);
+  while (sen_records_next(a, &key, sizeof(int), &score)) {
+    if (sen_records_find(b, &key) != score) { return 1; }
+  }
+  return 0;
+}
+
+static int
+run(sen_index *index, sen_sel_mode mode, const char *name, int nqueries, int nthreads)
+{
+  int i, ndiffs = 0;
+  char query[64];
+  double t0, ta = 0, tb = 0;
+  sen_select_optarg optarg;
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.mode = mode;
+  optarg.max_interval = 8;
+  srand(3);
+  for (i = 0; i < nqueries; i++) {
+    sen_records *ra, *rb;
+    snprintf(query, sizeof(query), "%s %s", words[rand() % 20], words[rand() % 20]);
+    ra = sen_records_open(sen_rec_document, sen_rec_none, 0);
+    rb = sen_records_open(sen_rec_document, sen_rec_none, 0);
+    if (!ra || !rb) { return -1; }
+    sen_ctx_select_threads_set(NULL, 1);
+    t0 = now();
+    sen_index_select(index, query, strlen(query), ra, sen_sel_or, &optarg);
+    ta += now() - t0;
+    sen_ctx_select_threads_set(NULL, nthreads);
+    t0 = now();
+    sen_index_select(index, query, strlen(query), rb, sen_sel_or, &optarg);
+    tb += now() - t0;
+    if (compare_records(ra, rb)) { ndiffs++; }
+    sen_records_close(ra);
+    sen_records_close(rb);
+  }
+  sen_ctx_select_threads_set(NULL, 1);
+  printf("%-8s %6d queries  1 thread %9.1f usec  %d threads %9.1f usec  differences %d\n",
+         name, nqueries, ta / nqueries * 1000000, nthreads, tb / nqueries * 1000000, ndiffs);
+  return ndiffs;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j, n, ndocs, nqueries, nthreads, rc = 0;
+  char doc[DOCSIZE], *p;
+  sen_index *index;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs [nqueries [nthreads]]]\n", argv[0]);
+    return -1;
+  }
+  ndocs = (argc > 2) ? atoi(argv[2]) : DEFAULT_NDOCS;
+  nqueries = (argc > 3) ? atoi(argv[3]) : DEFAULT_NQUERIES;
+  nthreads = (argc > 4) ? atoi(argv[4]) : DEFAULT_NTHREADS;
+  if (nthreads < 1) { nthreads = 1; }
+  sen_init();
+  gen_words();
+  sen_index_remove(argv[1]);
+  if (!(index = sen_index_create(argv[1], sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM, 0,
+                                 sen_enc_utf8))) {
+    fprintf(stderr, "index create failed (%s)\n", argv[1]);
+    return -1;
+  }
+  srand(2);
+  for (i = 1; i <= ndocs; i++) {
+    n = 10 + rand() % 200;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", pick_word());
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  if (run(index, sen_sel_exact, "phrase", nqueries, nthreads)) { rc = 1; }
+  if (run(index, sen_sel_near, "near", nqueries, nthreads)) { rc = 1; }
+  sen_index_close(index);
+  sen_index_remove(argv[1]);
+  sen_fin();
+  return rc;
+}
@@ -0,0 +1,218 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* test of the parallel sen_index_select.
+   an index of NDOCS short documents of a few words is built, so that
+   each of the words has enough postings to be searched in parallel.
+   phrases and near searches of two words, with and without a weight
+   func, are run by one thread and by 2 and 4 threads given by
+   sen_ctx_select_threads_set, through sen_gctx and through a ctx of its
+   own, and the records are compared. then NCALLERS threads run the
+   queries at once through sen_gctx, so that they contend for the threads
+   of sen_gctx. the func must be called only by the thread calling
+   sen_index_select. returns 1 if any of the records differ or the func
+   is called by another thread. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "senna.h"
+
+#define NDOCS 100000
+#define NQUERIES 40
+#define NCALLERS 4
+#define NWORDS 8
+#define DOCSIZE 256
+
+static const char *path = "partest.idx";
+static int nforeign_calls = 0;
+static const char *words[NWORDS] = {
+  "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel"
+};
+
+typedef struct {
+  sen_index *index;
+  sen_records **ra;
+  int ndiffs;
+  pthread_t thread;
+} caller;
+
+/* arg is the thread calling sen_index_select */
+static int
+weight_func(sen_records *r, const void *key, int section, void *arg)
+{
+  if (!pthread_equal(pthread_self(), *((pthread_t *)arg))) { nforeign_calls++; }
+  return *((const int *)key) % 3 + 1;
+}
+
+/* b is only looked up, so that it can be shared by threads. */
+static int
+compare(sen_records *a, sen_records *b)
+{
+  int key, score;
+  if (sen_records_nhits(a) != sen_records_nhits(b)) { return 1; }
+  sen_records_rewind(a);
+  while (sen_records_next(a, &key, sizeof(int), &score)) {
+    if (sen_records_find(b, &key) != score) { return 1; }
+  }
+  return 0;
+}
+
+/* the records of the i-th query by the current number of threads */
+static sen_records *
+select_query(sen_index *index, int i)
+{
+  char query[64];
+  pthread_t self = pthread_self();
+  sen_records *r;
+  sen_select_optarg optarg;
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.mode = i % 2 ? sen_sel_near : sen_sel_exact;
+  optarg.max_interval = 4;
+  if (i % 4 == 3) {
+    optarg.func = weight_func;
+    optarg.func_arg = &self;
+  }
+  snprintf(query, sizeof(query), "%s %s", words[i % NWORDS], words[(i * 3 + 1) % NWORDS]);
+  if (!(r = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return NULL; }
+  sen_index_select(index, query, strlen(query), r, sen_sel_or, &optarg);
+  return r;
+}
+
+/* the records of the queries by 1 thread */
+static int
+select_serial(sen_index *index, sen_records **ra)
+{
+  int i;
+  sen_ctx_select_threads_set(NULL, 1);
+  for (i = 0; i < NQUERIES; i++) {
+    if (!(ra[i] = select_query(index, i))) {
+      while (i--) { sen_records_close(ra[i]); }
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* runs the queries by 1 thread, then by nthreads threads of the current
+   ctx, so that the ctxs of the workers are used by the queries in turn.
+   returns the number of the queries whose records differ. */
+static int
+run(sen_index *index, int nthreads)
+{
+  int i, ndiffs = 0;
+  sen_records *ra[NQUERIES], *rb;
+  if (select_serial(index, ra)) { return NQUERIES; }
+  sen_ctx_select_threads_set(NULL, nthreads);
+  for (i = 0; i < NQUERIES; i++) {
+    if (!(rb = select_query(index, i)) || compare(rb, ra[i])) {
+      fprintf(stderr, "partest: records of query %d differ (%d threads)\n", i, nthreads);
+      ndiffs++;
+    }
+    if (rb) { sen_records_close(rb); }
+    sen_records_close(ra[i]);
+  }
+  return ndiffs;
+}
+
+static void *
+call(void *arg)
+{
+  int i, j;
+  caller *c = arg;
+  sen_records *rb;
+  for (j = 0; j < 4; j++) {
+    for (i = 0; i < NQUERIES; i++) {
+      if (!(rb = select_query(c->index, i)) || compare(rb, c->ra[i])) { c->ndiffs++; }
+      if (rb) { sen_records_close(rb); }
+    }
+  }
+  return NULL;
+}
+
+/* runs the queries by 1 thread, then by NCALLERS threads at once, each
+   of which runs them 4 times by nthreads threads of sen_gctx. returns
+   the number of the queries whose records differ. */
+static int
+run_callers(sen_index *index, int nthreads)
+{
+  int i, ndiffs = 0;
+  caller callers[NCALLERS];
+  sen_records *ra[NQUERIES];
+  if (select_serial(index, ra)) { return NQUERIES; }
+  sen_ctx_select_threads_set(NULL, nthreads);
+  for (i = 0; i < NCALLERS; i++) {
+    callers[i].index = index;
+    callers[i].ra = ra;
+    callers[i].ndiffs = 0;
+    if (pthread_create(&callers[i].thread, NULL, call, &callers[i])) {
+      callers[i].ndiffs = NQUERIES;
+      callers[i].index = NULL;
+    }
+  }
+  for (i = 0; i < NCALLERS; i++) {
+    if (callers[i].index) { pthread_join(callers[i].thread, NULL); }
+    if (callers[i].ndiffs) {
+      fprintf(stderr, "partest: records of %d queries differ (caller %d, %d threads)\n",
+              callers[i].ndiffs, i, nthreads);
+    }
+    ndiffs += callers[i].ndiffs;
+  }
+  for (i = 0; i < NQUERIES; i++) { sen_records_close(ra[i]); }
+  return ndiffs;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j, n, ndiffs = 0;
+  char doc[DOCSIZE], *p;
+  sen_ctx *ctx;
+  sen_index *index;
+  sen_init();
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM, 0,
+                                 sen_enc_utf8))) {
+    fprintf(stderr, "partest: index create failed (%s)\n", path);
+    return 1;
+  }
+  srand(2);
+  for (i = 1; i <= NDOCS; i++) {
+    n = 4 + rand() % 12;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", words[rand() % NWORDS]);
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  ndiffs += run(index, 4);
+  ndiffs += run(index, 2);
+  ndiffs += run_callers(index, 4);
+  if ((ctx = sen_ctx_open(NULL, 0))) {
+    sen_ctx_use(ctx);
+    ndiffs += run(index, 4);
+    sen_ctx_close(ctx);
+  }
+  sen_ctx_select_threads_set(NULL, 1);
+  sen_index_close(index);
+  sen_index_remove(path);
+  printf("partest %d queries  differences %d  calls of func by other threads %d\n",
+         NQUERIES * (3 + NCALLERS * 4), ndiffs, nforeign_calls);
+  sen_fin();
+  return (ndiffs || nforeign_calls) ? 1 : 0;
+}
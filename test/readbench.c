@@ -0,0 +1,240 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of the searches running along with the updates.
+   usage: readbench path [ndocs [nreaders]]
+   an index of ndocs generated documents is built on path. then a writer
+   thread adds ndocs more documents by sen_index_upd, while nreaders
+   threads search it without any lock. the latencies of sen_index_select
+   are reported, and each search is checked to find the same documents
+   among the first ndocs as it did before the writer started. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 20000
+#define DEFAULT_NREADERS 2
+#define MAX_READERS 64
+#define NWORDS 1000
+#define DOCSIZE 4096
+#define NBUCKETS 32
+/* few segments, so that the buffers are flushed while searched */
+#define INITIAL_N_SEGMENTS 16
+
+static char words[NWORDS][16];
+static int nhits[NWORDS];
+static sen_index *idx;
+static int ndocs;
+static volatile int writing;
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static char *
+gen_doc(int id, char *doc)
+{
+  int j, n;
+  char *p;
+  srand(id);
+  n = 10 + rand() % 100;
+  for (p = doc, j = 0; j < n; j++) {
+    p += sprintf(p, "%s ", pick_word());
+  }
+  return doc;
+}
+
+/* histogram of latencies by powers of 2 usec */
+typedef struct {
+  unsigned n[NBUCKETS];
+  unsigned count;
+  double total;
+  double max;
+} latency;
+
+static void
+latency_add(latency *l, double t)
+{
+  int b = 0;
+  unsigned usec = (unsigned) (t * 1000000);
+  while (usec > 1 && b < NBUCKETS - 1) { usec >>= 1; b++; }
+  l->n[b]++;
+  l->count++;
+  l->total += t;
+  if (t > l->max) { l->max = t; }
+}
+
+static void
+latency_merge(latency *l, latency *m)
+{
+  int b;
+  for (b = 0; b < NBUCKETS; b++) { l->n[b] += m->n[b]; }
+  l->count += m->count;
+  l->total += m->total;
+  if (m->max > l->max) { l->max = m->max; }
+}
+
+/* returns the upper bound of the latency below which q of them are */
+static double
+latency_quantile(latency *l, double q)
+{
+  int b;
+  unsigned n = 0;
+  for (b = 0; b < NBUCKETS; b++) {
+    if ((n += l->n[b]) >= l->count * q) { break; }
+  }
+  return (2 << b) / 1000000.0;
+}
+
+/* returns the number of the documents among the first ndocs which have
+   word w, or -1 */
+static int
+search(int w, latency *l)
+{
+  int key, n = 0;
+  double t0;
+  sen_records *r;
+  sen_select_optarg optarg;
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.mode = sen_sel_exact;
+  if (!(r = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return -1; }
+  t0 = now();
+  sen_index_select(idx, words[w], strlen(words[w]), r, sen_sel_or, &optarg);
+  if (l) { latency_add(l, now() - t0); }
+  sen_records_rewind(r);
+  while (sen_records_next(r, &key, sizeof(int), NULL)) {
+    if (key <= ndocs) { n++; }
+  }
+  sen_records_close(r);
+  return n;
+}
+
+typedef struct {
+  pthread_t thread;
+  int id;
+  latency l;
+  unsigned nerrors;
+} reader;
+
+static void *
+read_work(void *arg)
+{
+  reader *rd = arg;
+  sen_ctx *ctx = sen_ctx_open(NULL, 0);
+  unsigned seed = rd->id;
+  if (ctx) { sen_ctx_use(ctx); }
+  while (writing) {
+    int w = rand_r(&seed) % NWORDS;
+    if (search(w, &rd->l) != nhits[w]) { rd->nerrors++; }
+  }
+  if (ctx) {
+    sen_ctx_use(NULL);
+    sen_ctx_close(ctx);
+  }
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, nreaders = DEFAULT_NREADERS;
+  unsigned nerrors = 0;
+  char doc[DOCSIZE];
+  double t0, tw;
+  latency l;
+  reader readers[MAX_READERS];
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs [nreaders]]\n", argv[0]);
+    return -1;
+  }
+  ndocs = (argc > 2) ? atoi(argv[2]) : DEFAULT_NDOCS;
+  if (argc > 3) { nreaders = atoi(argv[3]); }
+  if (nreaders < 1 || nreaders > MAX_READERS) { nreaders = DEFAULT_NREADERS; }
+  sen_init();
+  gen_words();
+  sen_index_remove(argv[1]);
+  if (!(idx = sen_index_create(argv[1], sizeof(int),
+                               SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM,
+                               INITIAL_N_SEGMENTS, sen_enc_utf8))) {
+    fprintf(stderr, "index create failed (%s)\n", argv[1]);
+    return -1;
+  }
+  for (i = 1; i <= ndocs; i++) {
+    gen_doc(i, doc);
+    sen_index_upd(idx, &i, NULL, 0, doc, strlen(doc));
+  }
+  for (i = 0; i < NWORDS; i++) { nhits[i] = search(i, NULL); }
+  memset(readers, 0, sizeof(readers));
+  writing = 1;
+  for (i = 0; i < nreaders; i++) {
+    readers[i].id = i + 1;
+    if (pthread_create(&readers[i].thread, NULL, read_work, &readers[i])) {
+      fprintf(stderr, "pthread_create failed\n");
+      return -1;
+    }
+  }
+  t0 = now();
+  for (i = ndocs + 1; i <= ndocs * 2; i++) {
+    gen_doc(i, doc);
+    sen_index_upd(idx, &i, NULL, 0, doc, strlen(doc));
+  }
+  tw = now() - t0;
+  writing = 0;
+  memset(&l, 0, sizeof(latency));
+  for (i = 0; i < nreaders; i++) {
+    pthread_join(readers[i].thread, NULL);
+    latency_merge(&l, &readers[i].l);
+    nerrors += readers[i].nerrors;
+  }
+  printf("writer   %8d docs  %8.3f sec\n", ndocs, tw);
+  printf("readers  %8u selects (%d threads)  avg %7.1f usec  99%% < %7.1f  max %8.1f usec\n",
+         l.count, nreaders, l.count ? l.total / l.count * 1000000 : 0.0,
+         latency_quantile(&l, 0.99) * 1000000, l.max * 1000000);
+  printf("errors   %u selects missed or found extra documents\n", nerrors);
+  sen_index_close(idx);
+  sen_index_remove(argv[1]);
+  sen_fin();
+  return nerrors ? 1 : 0;
+}
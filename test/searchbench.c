@@ -0,0 +1,228 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of sen_index_select.
+   usage: searchbench path [ndocs [nqueries]]
+   an index of ndocs generated documents is built on path, and
+   nqueries searches are run in each select mode, first through
+   sen_gctx, then through a ctx installed by sen_ctx_use(), whose
+   arena holds the transient objects of a select.
+   the p50/p99 latency and the number of malloc calls per search
+   are reported. it is done once with the byte coded postings, once
+   with SEN_INDEX_SKIP_ENTRIES and once with SEN_INDEX_BLOCK_CODEC. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 10000
+#define DEFAULT_NQUERIES 5000
+#define NWORDS 1000
+
+static char words[NWORDS][16];
+static unsigned long nmallocs = 0;
+
+#ifdef __GLIBC__
+/* count the malloc calls of the whole process, libsenna included. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+  nmallocs++;
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+  nmallocs++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  nmallocs++;
+  return __libc_realloc(ptr, size);
+}
+#endif /* __GLIBC__ */
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+double_compare(const void *a, const void *b)
+{
+  double d = *((const double *)a) - *((const double *)b);
+  return d < 0 ? -1 : d > 0 ? 1 : 0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static sen_index *
+build(const char *path, int ndocs, int flags)
+{
+  int i, j, n;
+  char doc[4096], *p;
+  sen_index *index;
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM|flags, 0,
+                                 sen_enc_utf8))) {
+    return NULL;
+  }
+  srand(2);
+  for (i = 1; i <= ndocs; i++) {
+    n = 10 + rand() % 100;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", pick_word());
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  return index;
+}
+
+static void
+bench(sen_index *index, const char *name, sen_sel_mode mode, int nqueries)
+{
+  int i;
+  char query[64];
+  double *t, t0, total = 0;
+  unsigned long m0, nm = 0;
+  sen_select_optarg optarg;
+  if (!(t = malloc(sizeof(double) * nqueries))) { return; }
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.mode = mode;
+  optarg.max_interval = 8;
+  srand(3);
+  for (i = 0; i < nqueries; i++) {
+    sen_records *r;
+    switch (mode) {
+    case sen_sel_near :
+      snprintf(query, sizeof(query), "%s %s", pick_word(), pick_word());
+      break;
+    case sen_sel_prefix :
+      snprintf(query, sizeof(query), "%.2s", pick_word());
+      break;
+    default :
+      snprintf(query, sizeof(query), "%s", pick_word());
+      break;
+    }
+    if (!(r = sen_records_open(sen_rec_document, sen_rec_none, 0))) { break; }
+    m0 = nmallocs;
+    t0 = now();
+    sen_index_select(index, query, strlen(query), r, sen_sel_or, &optarg);
+    t[i] = now() - t0;
+    nm += nmallocs - m0;
+    total += t[i];
+    sen_records_close(r);
+  }
+  qsort(t, i, sizeof(double), double_compare);
+  printf("%-18s %8d queries  p50 %8.1f usec  p99 %8.1f usec  avg %8.1f usec"
+         "  %6.1f mallocs/query\n",
+         name, i, t[i / 2] * 1000000, t[i - 1 - i / 100] * 1000000,
+         total / i * 1000000, (double)nm / i);
+  free(t);
+}
+
+static void
+bench_all(sen_index *index, const char *name, int nqueries)
+{
+  char label[64];
+  snprintf(label, sizeof(label), "%s/exact", name);
+  bench(index, label, sen_sel_exact, nqueries);
+  snprintf(label, sizeof(label), "%s/prefix", name);
+  bench(index, label, sen_sel_prefix, nqueries);
+  snprintf(label, sizeof(label), "%s/near", name);
+  bench(index, label, sen_sel_near, nqueries);
+}
+
+static void
+run(const char *path, const char *name, int flags, int ndocs, int nqueries)
+{
+  sen_ctx *ctx;
+  sen_index *index;
+  char label[64];
+  unsigned long long chunk_size;
+  double t0;
+  t0 = now();
+  if (!(index = build(path, ndocs, flags))) {
+    fprintf(stderr, "index create failed (%s)\n", path);
+    return;
+  }
+  sen_index_info(index, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                 NULL, &chunk_size);
+  printf("%-18s %8d docs     build %8.3f sec  chunk %10llu bytes\n",
+         name, ndocs, now() - t0, chunk_size);
+  snprintf(label, sizeof(label), "%s/gctx", name);
+  bench_all(index, label, nqueries);
+  if ((ctx = sen_ctx_open(NULL, 0))) {
+    sen_ctx_use(ctx);
+    snprintf(label, sizeof(label), "%s/ctx", name);
+    bench_all(index, label, nqueries);
+    sen_ctx_close(ctx);
+  }
+  sen_index_close(index);
+  sen_index_remove(path);
+}
+
+int
+main(int argc, char **argv)
+{
+  int ndocs = DEFAULT_NDOCS, nqueries = DEFAULT_NQUERIES;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs [nqueries]]\n", argv[0]);
+    return -1;
+  }
+  if (argc > 2) { ndocs = atoi(argv[2]); }
+  if (argc > 3) { nqueries = atoi(argv[3]); }
+  sen_init();
+  gen_words();
+  run(argv[1], "byte", 0, ndocs, nqueries);
+  run(argv[1], "skip", SEN_INDEX_SKIP_ENTRIES, ndocs, nqueries);
+  run(argv[1], "block", SEN_INDEX_BLOCK_CODEC, ndocs, nqueries);
+  sen_fin();
+  return 0;
+}
@@ -0,0 +1,160 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of the lookups of sen_set.
+   usage: setbench [nkeys [nloops]]
+   nkeys keys of dense ints, of random ints, of 8 byte binaries and of
+   strings are added to a set by sen_set_get. then they are looked up
+   by sen_set_at in a random order, keys not in the set are looked up,
+   and both are looked up again after three quarters of the keys are
+   deleted. the average time of each operation is reported, with the
+   number of the lookups whose results are wrong. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NKEYS 1000000
+#define DEFAULT_NLOOPS 3
+#define NKINDS 4
+#define NOPS 5
+#define KEYSIZE 16
+#define KEYWORDS (KEYSIZE / sizeof(unsigned int))
+
+static const char *kind_names[NKINDS] = { "dense", "random", "binary", "string" };
+static const char *op_names[NOPS] = { "get", "at", "miss", "at/del", "miss/del" };
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* the i-th key of a kind. the keys of i >= nkeys aren't in the set. */
+static void
+gen_key(int kind, int i, unsigned int *key)
+{
+  unsigned int r = (unsigned int)i * 2654435761U;
+  switch (kind) {
+  case 0 :
+    key[0] = i + 1;
+    break;
+  case 1 :
+    key[0] = r ^ (r >> 15);
+    break;
+  case 2 :
+    key[0] = i / 8 + 1;
+    key[1] = i % 8;
+    break;
+  default :
+    snprintf((char *)key, KEYSIZE, "w%x", r);
+    break;
+  }
+}
+
+static unsigned int
+key_size(int kind)
+{
+  return kind == 2 ? 8 : kind == 3 ? 0 : sizeof(int);
+}
+
+/* looks up the keys of the order shifted by offset. every fourth key is
+   left after the deletion. returns the number of the wrong results. */
+static int
+lookup(sen_set *set, int kind, const int *order, int n, int offset, int nkeys, int deleted)
+{
+  int i, k, nerrors = 0;
+  unsigned int key[KEYWORDS];
+  void *v;
+  for (i = 0; i < n; i++) {
+    k = order[i] + offset;
+    gen_key(kind, k, key);
+    if (sen_set_at(set, key, &v)) {
+      if (k >= nkeys || (deleted && k % 4) || *((int *)v) != k) { nerrors++; }
+    } else {
+      if (k < nkeys && !(deleted && k % 4)) { nerrors++; }
+    }
+  }
+  return nerrors;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j, k, l, n, nloops, nerrors = 0, *order;
+  unsigned int key[KEYWORDS];
+  double t0, t[NKINDS][NOPS];
+  void *v;
+  sen_set *set;
+  sen_set_eh *eh;
+  n = (argc > 1) ? atoi(argv[1]) : DEFAULT_NKEYS;
+  nloops = (argc > 2) ? atoi(argv[2]) : DEFAULT_NLOOPS;
+  if (n < 4) { n = 4; }
+  if (!(order = malloc(sizeof(int) * n))) { return -1; }
+  srand(1);
+  for (i = 0; i < n; i++) { order[i] = i; }
+  for (i = n - 1; i > 0; i--) {
+    j = rand() % (i + 1);
+    k = order[i]; order[i] = order[j]; order[j] = k;
+  }
+  memset(t, 0, sizeof(t));
+  sen_init();
+  for (l = 0; l < nloops; l++) {
+    for (k = 0; k < NKINDS; k++) {
+      if (!(set = sen_set_open(key_size(k), sizeof(int), 0))) { return -1; }
+      t0 = now();
+      for (i = 0; i < n; i++) {
+        gen_key(k, i, key);
+        if (sen_set_get(set, key, &v)) { *((int *)v) = i; }
+      }
+      t[k][0] += now() - t0;
+      t0 = now();
+      nerrors += lookup(set, k, order, n, 0, n, 0);
+      t[k][1] += now() - t0;
+      t0 = now();
+      nerrors += lookup(set, k, order, n, n, n, 0);
+      t[k][2] += now() - t0;
+      for (i = 0; i < n; i++) {
+        if (!(i % 4)) { continue; }
+        gen_key(k, i, key);
+        if ((eh = sen_set_at(set, key, NULL))) { sen_set_del(set, eh); }
+      }
+      t0 = now();
+      nerrors += lookup(set, k, order, n, 0, n, 1);
+      t[k][3] += now() - t0;
+      t0 = now();
+      nerrors += lookup(set, k, order, n, n, n, 1);
+      t[k][4] += now() - t0;
+      sen_set_close(set);
+    }
+  }
+  for (k = 0; k < NKINDS; k++) {
+    printf("%-7s %8d keys", kind_names[k], n);
+    for (i = 0; i < NOPS; i++) {
+      printf("  %s %6.1f", op_names[i], t[k][i] / nloops / n * 1000000000);
+    }
+    printf(" nsec\n");
+  }
+  printf("errors %d\n", nerrors);
+  free(order);
+  sen_fin();
+  return nerrors ? 1 : 0;
+}
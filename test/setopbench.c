@@ -0,0 +1,160 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of the set operations of sen_records.
+   usage: setopbench path [ndocs [nqueries]]
+   an index of ndocs generated documents is built on path. then, for
+   nqueries pairs of frequent words, the records of each word are
+   selected, and combined by sen_records_union, intersect, subtract and
+   difference, and by a select of the second word with sen_sel_and. the
+   average time of each operation is reported, with a checksum of the
+   results, which doesn't depend on how the records are stored. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 50000
+#define DEFAULT_NQUERIES 100
+#define NWORDS 1000
+#define DOCSIZE 4096
+#define NOPS 5
+
+static char words[NWORDS][16];
+static const char *op_names[NOPS] = { "union", "intersect", "subtract", "difference", "and" };
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static sen_records *
+select_word(sen_index *index, const char *word, sen_records *r, sen_sel_operator op)
+{
+  if (!r && !(r = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return NULL; }
+  sen_index_select(index, word, strlen(word), r, op, NULL);
+  return r;
+}
+
+static unsigned int
+checksum(sen_records *r)
+{
+  int key, score;
+  unsigned int sum = sen_records_nhits(r);
+  sen_records_rewind(r);
+  while (sen_records_next(r, &key, sizeof(int), &score)) {
+    sum += (unsigned int)key * 31 + (unsigned int)score;
+  }
+  return sum;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j, n, o, ndocs, nqueries;
+  unsigned int sums[NOPS];
+  char doc[DOCSIZE], *p;
+  double t0, t[NOPS];
+  sen_index *index;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs [nqueries]]\n", argv[0]);
+    return -1;
+  }
+  ndocs = (argc > 2) ? atoi(argv[2]) : DEFAULT_NDOCS;
+  nqueries = (argc > 3) ? atoi(argv[3]) : DEFAULT_NQUERIES;
+  sen_init();
+  gen_words();
+  sen_index_remove(argv[1]);
+  if (!(index = sen_index_create(argv[1], sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM, 0,
+                                 sen_enc_utf8))) {
+    fprintf(stderr, "index create failed (%s)\n", argv[1]);
+    return -1;
+  }
+  srand(2);
+  for (i = 1; i <= ndocs; i++) {
+    n = 10 + rand() % 200;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", pick_word());
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  memset(t, 0, sizeof(t));
+  memset(sums, 0, sizeof(sums));
+  srand(3);
+  for (i = 0; i < nqueries; i++) {
+    const char *wa = words[rand() % 20], *wb = words[rand() % 20];
+    for (o = 0; o < NOPS; o++) {
+      sen_records *ra, *rb;
+      if (!(ra = select_word(index, wa, NULL, sen_sel_or))) { return -1; }
+      if (o == 4) {
+        t0 = now();
+        select_word(index, wb, ra, sen_sel_and);
+        t[o] += now() - t0;
+      } else {
+        if (!(rb = select_word(index, wb, NULL, sen_sel_or))) { return -1; }
+        t0 = now();
+        switch (o) {
+        case 0 : sen_records_union(ra, rb); break;
+        case 1 : sen_records_intersect(ra, rb); break;
+        case 2 : sen_records_subtract(ra, rb); break;
+        case 3 : sums[o] += sen_records_difference(ra, rb); break;
+        }
+        t[o] += now() - t0;
+        if (o == 3) {
+          sums[o] += checksum(rb);
+          sen_records_close(rb);
+        }
+      }
+      sums[o] += checksum(ra);
+      sen_records_close(ra);
+    }
+  }
+  for (o = 0; o < NOPS; o++) {
+    printf("%-10s %6d queries %9.1f usec  checksum %08x\n",
+           op_names[o], nqueries, t[o] / nqueries * 1000000, sums[o]);
+  }
+  sen_index_close(index);
+  sen_index_remove(argv[1]);
+  sen_fin();
+  return 0;
+}
@@ -0,0 +1,231 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* test of the set operations of sen_records.
+   the records of a word, which are kept in a sorted array, the records
+   of two words, which are turned into a hash, and the records of a word
+   and another, which are an array with deleted entries, are combined
+   by sen_records_union, subtract, intersect and difference, in each
+   pair of the three kinds. the results are compared with the ones
+   computed from the keys and the scores of the operands. returns 1 if
+   any of them differ. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "senna.h"
+
+#define NDOCS 5000
+#define NQUERIES 20
+#define NWORDS 1000
+#define NKINDS 3
+#define NOPS 4
+#define DOCSIZE 4096
+
+typedef struct {
+  int key;
+  int score;
+} hit;
+
+static const char *path = "setoptest.idx";
+static const char *op_names[NOPS] = { "union", "subtract", "intersect", "difference" };
+static char words[NWORDS][16];
+static hit *ha, *hb, *hc, *hd;
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static void
+select_word(sen_index *index, const char *word, sen_records *r, sen_sel_operator op)
+{
+  sen_index_select(index, word, strlen(word), r, op, NULL);
+}
+
+/* records of a word, of the union of two words, or of the intersection
+   of two words. */
+static sen_records *
+open_records(sen_index *index, int kind, const char *w1, const char *w2)
+{
+  sen_records *r;
+  if (!(r = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return NULL; }
+  select_word(index, w1, r, sen_sel_or);
+  if (kind == 1) { select_word(index, w2, r, sen_sel_or); }
+  if (kind == 2) { select_word(index, w2, r, sen_sel_and); }
+  return r;
+}
+
+static int
+hit_compare(const void *a, const void *b)
+{
+  return ((const hit *)a)->key - ((const hit *)b)->key;
+}
+
+/* puts the records of r to hits in the order of the keys. */
+static int
+dump(sen_records *r, hit *hits)
+{
+  int n = 0;
+  sen_records_rewind(r);
+  while (n < NDOCS && sen_records_next(r, &hits[n].key, sizeof(int), &hits[n].score)) { n++; }
+  qsort(hits, n, sizeof(hit), hit_compare);
+  return n;
+}
+
+static int
+find(const hit *hits, int n, int key)
+{
+  hit k, *h;
+  k.key = key;
+  h = bsearch(&k, hits, n, sizeof(hit), hit_compare);
+  return h ? h - hits : -1;
+}
+
+/* puts the expected result of the op on a and b to c, and of b after
+   the difference to d. returns the number of the records of c. */
+static int
+expect(int op, const hit *a, int na, const hit *b, int nb, hit *c, hit *d, int *nd)
+{
+  int i, j, nc = 0;
+  *nd = 0;
+  for (i = 0; i < na; i++) {
+    j = find(b, nb, a[i].key);
+    if (op == 0 || ((op == 1 || op == 3) && j < 0)) {
+      c[nc++] = a[i];
+    } else if (op == 2 && j >= 0) {
+      c[nc++] = na > nb ? b[j] : a[i];
+    }
+  }
+  for (j = 0; j < nb; j++) {
+    if (find(a, na, b[j].key) < 0) {
+      if (op == 0) { c[nc++] = b[j]; }
+      if (op == 3) { d[(*nd)++] = b[j]; }
+    }
+  }
+  qsort(c, nc, sizeof(hit), hit_compare);
+  return nc;
+}
+
+static int
+differ(const hit *a, int na, const hit *b, int nb)
+{
+  return na != nb || memcmp(a, b, sizeof(hit) * na);
+}
+
+/* returns 1 if the result of the op on the records of the kinds differs. */
+static int
+check(sen_index *index, int op, int ka, int kb, const char **w)
+{
+  int na, nb, nc, nd, count = 0, ndiffs = 0;
+  sen_records *ra, *rb, *rc;
+  if (!(ra = open_records(index, ka, w[0], w[1])) ||
+      !(rb = open_records(index, kb, w[2], w[3]))) {
+    return 1;
+  }
+  na = dump(ra, ha);
+  nb = dump(rb, hb);
+  nc = expect(op, ha, na, hb, nb, hc, hd, &nd);
+  switch (op) {
+  case 0 : rc = sen_records_union(ra, rb); break;
+  case 1 : rc = sen_records_subtract(ra, rb); break;
+  case 2 : rc = sen_records_intersect(ra, rb); break;
+  default :
+    rc = ra;
+    count = sen_records_difference(ra, rb);
+    break;
+  }
+  if (!rc) { return 1; }
+  if (differ(hc, nc, ha, dump(rc, ha))) { ndiffs++; }
+  if (op == 3) {
+    if (count != na - nc) { ndiffs++; }
+    if (differ(hd, nd, hb, dump(rb, hb))) { ndiffs++; }
+    sen_records_close(rb);
+  }
+  sen_records_close(rc);
+  if (ndiffs) {
+    fprintf(stderr, "setoptest: %s of kinds %d and %d differs for %s %s / %s %s\n",
+            op_names[op], ka, kb, w[0], w[1], w[2], w[3]);
+  }
+  return ndiffs ? 1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j, n, o, ka, kb, ndiffs = 0;
+  char doc[DOCSIZE], *p;
+  const char *w[4];
+  sen_index *index;
+  sen_init();
+  gen_words();
+  ha = malloc(sizeof(hit) * NDOCS);
+  hb = malloc(sizeof(hit) * NDOCS);
+  hc = malloc(sizeof(hit) * NDOCS);
+  hd = malloc(sizeof(hit) * NDOCS);
+  if (!ha || !hb || !hc || !hd) { return 1; }
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM, 0,
+                                 sen_enc_utf8))) {
+    fprintf(stderr, "setoptest: index create failed (%s)\n", path);
+    return 1;
+  }
+  srand(2);
+  for (i = 1; i <= NDOCS; i++) {
+    n = 10 + rand() % 100;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", pick_word());
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  srand(3);
+  for (i = 0; i < NQUERIES; i++) {
+    for (j = 0; j < 4; j++) { w[j] = words[rand() % 40]; }
+    for (o = 0; o < NOPS; o++) {
+      for (ka = 0; ka < NKINDS; ka++) {
+        for (kb = 0; kb < NKINDS; kb++) {
+          ndiffs += check(index, o, ka, kb, w);
+        }
+      }
+    }
+  }
+  sen_index_close(index);
+  sen_index_remove(path);
+  printf("setoptest %d checks  differences %d\n", NQUERIES * NOPS * NKINDS * NKINDS, ndiffs);
+  free(ha);
+  free(hb);
+  free(hc);
+  free(hd);
+  sen_fin();
+  return ndiffs ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of sen_set_sort.
+   usage: sortbench [nentries [nloops]]
+   a set of nentries int keys with random int values is sorted by the
+   values, with a limit of 10, of a quarter of the entries and of all
+   of them, both by the int values and by a compar function. the
+   average time of each is reported, and the results are checked
+   against the full sort. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NENTRIES 1000000
+#define DEFAULT_NLOOPS 10
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+value_of(sen_set *set, sen_set_eh *eh)
+{
+  void *v;
+  sen_set_element_info(set, eh, NULL, &v);
+  return *((int *)v);
+}
+
+static int
+value_compar(sen_set *sa, sen_set_eh *a, sen_set *sb, sen_set_eh *b, void *arg)
+{
+  int x = value_of(sa, a), y = value_of(sb, b);
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+/* returns the number of the limit values which are out of order or
+   differ from the full sort. */
+static int
+check(sen_set *set, sen_set_eh *sorted, int limit, const int *expected)
+{
+  int i, nerrors = 0;
+  for (i = 0; i < limit; i++) {
+    if (value_of(set, sorted + i) != expected[i]) { nerrors++; }
+  }
+  return nerrors;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, l, f, n, nloops, limit, nerrors = 0, *expected;
+  void *v;
+  double t0, t;
+  sen_set *set;
+  sen_set_eh *sorted;
+  sen_set_sort_optarg arg;
+  n = (argc > 1) ? atoi(argv[1]) : DEFAULT_NENTRIES;
+  nloops = (argc > 2) ? atoi(argv[2]) : DEFAULT_NLOOPS;
+  if (n < 10) { n = 10; }
+  if (!(expected = malloc(sizeof(int) * n))) { return -1; }
+  sen_init();
+  if (!(set = sen_set_open(sizeof(int), sizeof(int), 0))) { return -1; }
+  srand(1);
+  for (i = 1; i <= n; i++) {
+    if (sen_set_get(set, &i, &v)) { *((int *)v) = rand() % (n * 4); }
+  }
+  arg.mode = sen_sort_descending;
+  arg.compar = NULL;
+  arg.compar_arg = (void *)sizeof(int);
+  arg.compar_arg0 = NULL;
+  if (!(sorted = sen_set_sort(set, 0, &arg))) { return -1; }
+  for (i = 0; i < n; i++) {
+    expected[i] = value_of(set, sorted + i);
+    if (i && expected[i] > expected[i - 1]) { nerrors++; }
+  }
+  free(sorted);
+  for (f = 0; f < 2; f++) {
+    arg.compar = f ? value_compar : NULL;
+    for (l = 0; l < 3; l++) {
+      limit = l == 0 ? 10 : l == 1 ? n / 4 : n;
+      t = 0;
+      for (i = 0; i < nloops; i++) {
+        t0 = now();
+        sorted = sen_set_sort(set, limit, &arg);
+        t += now() - t0;
+        if (!sorted) { return -1; }
+        nerrors += check(set, sorted, limit, expected);
+        free(sorted);
+      }
+      printf("%-6s %9d entries  limit %9d  %10.1f usec\n",
+             f ? "compar" : "int", n, limit, t / nloops * 1000000);
+    }
+  }
+  printf("errors %d\n", nerrors);
+  sen_set_close(set);
+  free(expected);
+  sen_fin();
+  return nerrors ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of the lookups of sen_sym.
+   usage: symbench path [nkeys [nlookups]]
+   a sym of nkeys bigrams of utf-8 kana and kanji, as a lexicon of an
+   ngram index has, is built on path. then, with the default lookup cache
+   and without it (SEN_SYM_CACHE=0), a child process looks up nlookups keys by
+   sen_sym_at, and by sen_sym_get with 1% of new keys, deletes some of
+   them and looks them up again. the time per lookup and the sum of the ids found, which must be
+   the same for both, are reported. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "senna.h"
+
+#define DEFAULT_NKEYS 1000000
+#define DEFAULT_NLOOKUPS 4000000
+#define NCHARS 2000
+#define NDELS 1000
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* the n-th key. the characters are from U+3041, so 3 bytes each */
+static void
+gen_key(unsigned int n, char *key)
+{
+  int i;
+  unsigned int c[2];
+  c[0] = 0x3041 + (n % NCHARS);
+  c[1] = 0x3041 + (n / NCHARS) % NCHARS;
+  for (i = 0; i < 2; i++) {
+    key[i * 3] = 0xe0 | (c[i] >> 12);
+    key[i * 3 + 1] = 0x80 | ((c[i] >> 6) & 0x3f);
+    key[i * 3 + 2] = 0x80 | (c[i] & 0x3f);
+  }
+  key[6] = '\0';
+}
+
+static int
+build(const char *path, int nkeys)
+{
+  int i;
+  char key[8];
+  sen_sym *sym;
+  sen_init();
+  sen_sym_remove(path);
+  if (!(sym = sen_sym_create(path, 0, 0, sen_enc_utf8))) {
+    fprintf(stderr, "sym create failed (%s)\n", path);
+    return -1;
+  }
+  for (i = 0; i < nkeys; i++) {
+    gen_key((unsigned int) i, key);
+    sen_sym_get(sym, key);
+  }
+  sen_sym_close(sym);
+  sen_fin();
+  return 0;
+}
+
+/* the lookups of the keys in the order of a text are skewed */
+static unsigned int
+pick_key(int nkeys)
+{
+  return (unsigned int) (rand() % 4 ? rand() % (nkeys / 50 + 1) : rand() % nkeys);
+}
+
+static int
+run(const char *path, int nkeys, int nlookups, int cache)
+{
+  int i;
+  char key[8];
+  double t0, tat, tget;
+  unsigned long long sum = 0, sumdel = 0;
+  sen_sym *sym;
+  if (cache) {
+    unsetenv("SEN_SYM_CACHE");
+  } else {
+    setenv("SEN_SYM_CACHE", "0", 1);
+  }
+  sen_init();
+  if (!(sym = sen_sym_open(path))) {
+    fprintf(stderr, "sym open failed (%s)\n", path);
+    return -1;
+  }
+  srand(2);
+  t0 = now();
+  for (i = 0; i < nlookups; i++) {
+    gen_key(pick_key(nkeys), key);
+    sum += sen_sym_at(sym, key);
+  }
+  tat = now() - t0;
+  srand(3);
+  t0 = now();
+  for (i = 0; i < nlookups; i++) {
+    gen_key(pick_key(nkeys) + (rand() % 100 ? 0 : nkeys), key);
+    sum += sen_sym_get(sym, key);
+  }
+  tget = now() - t0;
+  for (i = 0; i < NDELS; i++) {
+    gen_key((unsigned int) i * 7, key);
+    sen_sym_del(sym, key);
+  }
+  for (i = 0; i < NDELS * 7; i++) {
+    gen_key((unsigned int) i, key);
+    sumdel += sen_sym_at(sym, key);
+  }
+  printf("cache %d  nrecords %u  at %6.1f nsec  get %6.1f nsec  sum %llu %llu\n",
+         cache, sen_sym_size(sym), tat / nlookups * 1000000000,
+         tget / nlookups * 1000000000, sum, sumdel);
+  sen_sym_close(sym);
+  sen_fin();
+  return 0;
+}
+
+/* each step runs in a child process, which has its own sen_init */
+static int
+spawn(const char *path, int nkeys, int nlookups, int o)
+{
+  int status;
+  pid_t pid;
+  fflush(stdout);
+  if ((pid = fork()) == -1) {
+    fprintf(stderr, "fork failed\n");
+    return -1;
+  }
+  if (!pid) {
+    exit((o < 0 ? build(path, nkeys) : run(path, nkeys, nlookups, o)) ? 1 : 0);
+  }
+  if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+    fprintf(stderr, "%s failed\n", o < 0 ? "build" : "run");
+    return -1;
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int nkeys, nlookups, o;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [nkeys [nlookups]]\n", argv[0]);
+    return -1;
+  }
+  nkeys = (argc > 2) ? atoi(argv[2]) : DEFAULT_NKEYS;
+  nlookups = (argc > 3) ? atoi(argv[3]) : DEFAULT_NLOOKUPS;
+  /* it is built again for each run, which deletes some keys */
+  for (o = 0; o < 2; o++) {
+    if (spawn(argv[1], nkeys, nlookups, -1)) { return -1; }
+    if (spawn(argv[1], nkeys, nlookups, o)) { return -1; }
+  }
+  sen_init();
+  sen_sym_remove(argv[1]);
+  sen_fin();
+  return 0;
+}
@@ -0,0 +1,171 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* benchmark of sen_index_select_topk.
+   usage: topkbench path [ndocs [nqueries [limit]]]
+   an index of ndocs generated documents is built on path. then
+   nqueries searches of a word, of a phrase of two frequent words and
+   of a similar text of eight words are run, and the limit records of
+   the highest scores are taken by sen_records_sort, once from all the
+   matching records, and once from sen_index_select_topk. the
+   average latencies are reported, with the number of the queries
+   whose scores differ. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "senna.h"
+
+#define DEFAULT_NDOCS 50000
+#define DEFAULT_NQUERIES 200
+#define DEFAULT_LIMIT 10
+#define NWORDS 1000
+#define DOCSIZE 4096
+
+static char words[NWORDS][16];
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+/* a similar text of nwords words, a phrase of two frequent words or a word */
+static void
+gen_query(sen_sel_mode mode, int nwords, char *query, int size)
+{
+  int j;
+  char *p = query;
+  if (mode == sen_sel_similar) {
+    for (j = 0; j < nwords; j++) {
+      p += snprintf(p, size - (p - query), "%s ", pick_word());
+    }
+  } else if (nwords == 2) {
+    snprintf(query, size, "%s %s", words[rand() % 20], words[rand() % 20]);
+  } else {
+    snprintf(query, size, "%s", words[rand() % 200]);
+  }
+}
+
+/* puts the scores of the top limit records to scores. returns the number of them.
+   when top is 0, all the matching records are selected. */
+static int
+select_top(sen_index *index, const char *query, sen_select_optarg *optarg,
+           int top, int limit, int *scores)
+{
+  int n = 0, key;
+  sen_records *r;
+  if (!(r = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return -1; }
+  sen_index_select_topk(index, query, strlen(query), r, sen_sel_or, optarg, top);
+  sen_records_sort(r, limit, NULL);
+  while (n < limit && sen_records_next(r, &key, sizeof(int), &scores[n])) { n++; }
+  sen_records_close(r);
+  return n;
+}
+
+static int
+run(sen_index *index, sen_sel_mode mode, int nwords, const char *name,
+    int nqueries, int limit)
+{
+  int i, na, nb, ndiffs = 0, *sa, *sb;
+  char query[256];
+  double t0, ta = 0, tb = 0;
+  sen_select_optarg optarg;
+  if (!(sa = malloc(sizeof(int) * limit * 2))) { return -1; }
+  sb = sa + limit;
+  memset(&optarg, 0, sizeof(optarg));
+  optarg.mode = mode;
+  optarg.similarity_threshold = 8;
+  srand(3);
+  for (i = 0; i < nqueries; i++) {
+    gen_query(mode, nwords, query, sizeof(query));
+    t0 = now();
+    na = select_top(index, query, &optarg, 0, limit, sa);
+    ta += now() - t0;
+    t0 = now();
+    nb = select_top(index, query, &optarg, limit, limit, sb);
+    tb += now() - t0;
+    if (na != nb || memcmp(sa, sb, sizeof(int) * na)) { ndiffs++; }
+  }
+  printf("%-8s %6d queries  all %9.1f usec  limit %d %9.1f usec  differences %d\n",
+         name, nqueries, ta / nqueries * 1000000, limit, tb / nqueries * 1000000, ndiffs);
+  free(sa);
+  return ndiffs;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j, n, ndocs, nqueries, limit, rc = 0;
+  char doc[DOCSIZE], *p;
+  sen_index *index;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s path [ndocs [nqueries [limit]]]\n", argv[0]);
+    return -1;
+  }
+  ndocs = (argc > 2) ? atoi(argv[2]) : DEFAULT_NDOCS;
+  nqueries = (argc > 3) ? atoi(argv[3]) : DEFAULT_NQUERIES;
+  limit = (argc > 4) ? atoi(argv[4]) : DEFAULT_LIMIT;
+  if (limit < 1) { limit = 1; }
+  sen_init();
+  gen_words();
+  sen_index_remove(argv[1]);
+  if (!(index = sen_index_create(argv[1], sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM, 0,
+                                 sen_enc_utf8))) {
+    fprintf(stderr, "index create failed (%s)\n", argv[1]);
+    return -1;
+  }
+  srand(2);
+  for (i = 1; i <= ndocs; i++) {
+    n = 10 + rand() % 200;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", pick_word());
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  if (run(index, sen_sel_exact, 1, "word", nqueries, limit)) { rc = 1; }
+  if (run(index, sen_sel_exact, 2, "phrase", nqueries, limit)) { rc = 1; }
+  if (run(index, sen_sel_similar, 8, "similar", nqueries, limit)) { rc = 1; }
+  sen_index_close(index);
+  sen_index_remove(argv[1]);
+  sen_fin();
+  return rc;
+}
@@ -0,0 +1,166 @@
+/* Copyright(C) 2004 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* test of sen_index_select_topk.
+   words, phrases of two frequent words, near searches and similar
+   texts are searched in an index of generated documents, by
+   sen_index_select and by sen_index_select_topk with limits of 1, 10
+   and 100. the top k records must have the same scores as the top k
+   of sen_index_select, and the score of each of them must be the one
+   it has in the records of sen_index_select. returns 1 if they don't. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "senna.h"
+
+#define NDOCS 10000
+#define NQUERIES 100
+#define NWORDS 1000
+#define DOCSIZE 4096
+#define MAX_LIMIT 100
+
+static const char *path = "topktest.idx";
+static const int limits[] = { 1, 10, MAX_LIMIT };
+static char words[NWORDS][16];
+
+static void
+gen_words(void)
+{
+  int i, j, l;
+  srand(1);
+  for (i = 0; i < NWORDS; i++) {
+    l = 3 + rand() % 8;
+    for (j = 0; j < l; j++) { words[i][j] = 'a' + rand() % 26; }
+    words[i][l] = '\0';
+  }
+}
+
+/* skewed, so that some words are frequent */
+static const char *
+pick_word(void)
+{
+  int r = rand() % 100;
+  return words[r < 50 ? rand() % 20 : r < 80 ? rand() % 200 : rand() % NWORDS];
+}
+
+static void
+gen_query(int i, char *query, int size, sen_select_optarg *optarg)
+{
+  int j;
+  char *p = query;
+  memset(optarg, 0, sizeof(sen_select_optarg));
+  switch (i % 4) {
+  case 0 :
+    snprintf(query, size, "%s", words[rand() % 200]);
+    optarg->mode = sen_sel_exact;
+    break;
+  case 1 :
+    snprintf(query, size, "%s %s", words[rand() % 20], words[rand() % 20]);
+    optarg->mode = sen_sel_exact;
+    break;
+  case 2 :
+    snprintf(query, size, "%s %s", words[rand() % 20], words[rand() % 20]);
+    optarg->mode = sen_sel_near;
+    optarg->max_interval = 8;
+    break;
+  default :
+    for (j = 0; j < 8; j++) {
+      p += snprintf(p, size - (p - query), "%s ", pick_word());
+    }
+    optarg->mode = sen_sel_similar;
+    optarg->similarity_threshold = 8;
+    break;
+  }
+}
+
+/* puts the scores of the records of r to scores, in descending order. */
+static int
+top_scores(sen_records *r, int limit, int *scores)
+{
+  int n = 0, key;
+  sen_records_sort(r, limit, NULL);
+  while (n < limit && sen_records_next(r, &key, sizeof(int), &scores[n])) { n++; }
+  return n;
+}
+
+/* returns 1 if the records of top aren't the top limit records of all. */
+static int
+compare(sen_records *all, sen_records *top, int limit)
+{
+  int i, n, key, score, sa[MAX_LIMIT], sb[MAX_LIMIT];
+  n = sen_records_nhits(all) < limit ? sen_records_nhits(all) : limit;
+  if (sen_records_nhits(top) != n) { return 1; }
+  sen_records_rewind(top);
+  while (sen_records_next(top, &key, sizeof(int), &score)) {
+    if (!sen_records_at(all, &key, 0, 0, &sa[0], NULL) || sa[0] != score) { return 1; }
+  }
+  if (top_scores(all, limit, sa) != n || top_scores(top, limit, sb) != n) { return 1; }
+  for (i = 0; i < n; i++) {
+    if (sa[i] != sb[i]) { return 1; }
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j, k, n, ndiffs = 0;
+  char doc[DOCSIZE], query[256], *p;
+  sen_index *index;
+  sen_records *all, *top;
+  sen_select_optarg optarg;
+  sen_init();
+  gen_words();
+  sen_index_remove(path);
+  if (!(index = sen_index_create(path, sizeof(int),
+                                 SEN_INDEX_NORMALIZE|SEN_INDEX_NGRAM, 0,
+                                 sen_enc_utf8))) {
+    fprintf(stderr, "topktest: index create failed (%s)\n", path);
+    return 1;
+  }
+  srand(2);
+  for (i = 1; i <= NDOCS; i++) {
+    n = 10 + rand() % 200;
+    for (p = doc, j = 0; j < n; j++) {
+      p += sprintf(p, "%s ", pick_word());
+    }
+    sen_index_upd(index, &i, NULL, 0, doc, p - doc);
+  }
+  srand(3);
+  for (i = 0; i < NQUERIES; i++) {
+    gen_query(i, query, sizeof(query), &optarg);
+    if (!(all = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return 1; }
+    sen_index_select(index, query, strlen(query), all, sen_sel_or, &optarg);
+    for (k = 0; k < sizeof(limits) / sizeof(limits[0]); k++) {
+      if (!(top = sen_records_open(sen_rec_document, sen_rec_none, 0))) { return 1; }
+      sen_index_select_topk(index, query, strlen(query), top, sen_sel_or, &optarg, limits[k]);
+      if (compare(all, top, limits[k])) {
+        fprintf(stderr, "topktest: top %d records differ for \"%s\" (mode %d)\n",
+                limits[k], query, optarg.mode);
+        ndiffs++;
+      }
+      sen_records_close(top);
+    }
+    sen_records_close(all);
+  }
+  sen_index_close(index);
+  sen_index_remove(path);
+  printf("topktest %d queries  differences %d\n", NQUERIES, ndiffs);
+  sen_fin();
+  return ndiffs ? 1 : 0;
+}
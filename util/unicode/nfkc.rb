@@ -299,6 +299,104 @@ def generate_map2(file, map2)
   gen_map2_sub(file, suffix, 0)
 end
 
+NFKC_BLOCK_BITS = 6
+NFKC_PAIR_BITS = 14
+
+def pool_offset(pool, str)
+  unless pool[:offsets][str]
+    pool[:offsets][str] = pool[:size]
+    pool[:strs].push(str)
+    pool[:size] += str.unpack('C*').size + 1
+  end
+  pool[:offsets][str]
+end
+
+def pair_hash(prefix, suffix)
+  ((((prefix << 16) ^ suffix) * 2654435761) & 0xffffffff) >> (32 - NFKC_PAIR_BITS)
+end
+
+def print_cols(file, items, width)
+  line = ' '
+  items.each{|item|
+    if line.size + item.size + 1 > width
+      file.puts line
+      line = ' '
+    end
+    line += ' ' + item
+  }
+  file.puts line if line.size > 1
+end
+
+def generate_table(file, map1, map2)
+  pool = {:offsets => {}, :strs => [], :size => 1}
+  values = {}
+  map1.keys.sort.each{|src|
+    c, = src.unpack('U*')
+    values[c] = pool_offset(pool, map1[src])
+  }
+  raise 'too large string pool for map1' if pool[:size] > 0x8000
+  pairs = {}
+  map2.keys.sort.each{|src|
+    prefix, suffix = src.unpack('U*')
+    raise "too large suffix in map2 #{src}" if suffix > 0xffff
+    values[suffix] = (values[suffix] || 0) | 0x8000
+    pairs[[prefix, suffix]] = pool_offset(pool, map2[src])
+  }
+  raise 'too large string pool' if pool[:size] > 0x10000
+  raise 'too many pairs in map2' if pairs.size * 4 > (1 << NFKC_PAIR_BITS) * 3
+
+  bsize = 1 << NFKC_BLOCK_BITS
+  max_code = ((values.keys.max >> NFKC_BLOCK_BITS) + 1) << NFKC_BLOCK_BITS
+  blocks = {}
+  block_list = []
+  index = []
+  0.step(max_code - 1, bsize){|b|
+    blk = (b...b + bsize).collect{|c| values[c] || 0}
+    unless blocks[blk]
+      blocks[blk] = block_list.size
+      block_list.push(blk)
+    end
+    index.push(blocks[blk])
+  }
+  slots = Array.new(1 << NFKC_PAIR_BITS)
+  pairs.keys.sort.each{|key|
+    h = pair_hash(key[0], key[1])
+    h = (h + 1) & ((1 << NFKC_PAIR_BITS) - 1) while slots[h]
+    slots[h] = key + [pairs[key]]
+  }
+
+  file.printf("#define NFKC_BLOCK_BITS %d\n", NFKC_BLOCK_BITS)
+  file.printf("#define NFKC_MAX_CODE 0x%X\n", max_code)
+  file.puts("#define NFKC_SUFFIX 0x8000")
+  file.printf("#define NFKC_PAIR_BITS %d\n", NFKC_PAIR_BITS)
+  file.puts
+  file.puts('static const char nfkc_pool[] =')
+  print_cols(file, ['"\0"'] + pool[:strs].collect{|str|
+               '"' + str.unpack('C*').collect{|b| format('\x%02X', b)}.join + '\0"'
+             }, 78)
+  file.puts(';')
+  file.puts
+  file.puts('static const uint16_t nfkc_index[] = {')
+  print_cols(file, index.collect{|i| format('%d,', i)}, 78)
+  file.puts('};')
+  file.puts
+  file.puts('static const uint16_t nfkc_blocks[] = {')
+  block_list.each{|blk|
+    print_cols(file, blk.collect{|v| format('0x%04X,', v)}, 78)
+  }
+  file.puts('};')
+  file.puts
+  file.puts('static const struct {')
+  file.puts('  uint32_t prefix;')
+  file.puts('  uint16_t suffix;')
+  file.puts('  uint16_t offset;')
+  file.puts('} nfkc_pairs[] = {')
+  print_cols(file, slots.collect{|slot|
+               slot ? format('{0x%04X, 0x%04X, %d},', slot[0], slot[1], slot[2]) : '{0, 0, 0},'
+             }, 78)
+  file.puts('};')
+end
+
 template = <<END
 /* Copyright(C) 2004 Brazil
 don't edit this file by hand. it generated automatically by nfkc.rb
@@ -314,22 +412,88 @@ sen_nfkc_ctype(const unsigned char *str)
 %  return -1;
 }
 
+/* the mappings are looked up in two-stage tables. the switch trees
+   which they used to be are generated into test/nfkcswitch.c for
+   normbench. */
+
+%
+#define NFKC_PAIR_HASH(p,s) \\
+  ((uint32_t)((((uint32_t)(p) << 16) ^ (s)) * 2654435761U) >> (32 - NFKC_PAIR_BITS))
+
+/* returns NFKC_MAX_CODE for malformed or overlong sequences,
+   which never match any key of the switch trees */
+inline static uint32_t
+nfkc_code(const unsigned char *s)
+{
+  uint32_t c = s[0];
+  if (c < 0x80) { return c; }
+  if (c < 0xC2 || (s[1] & 0xC0) != 0x80) { return NFKC_MAX_CODE; }
+  if (c < 0xE0) { return ((c & 0x1F) << 6) | (s[1] & 0x3F); }
+  if ((s[2] & 0xC0) != 0x80) { return NFKC_MAX_CODE; }
+  if (c < 0xF0) {
+    c = ((c & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+    return c < 0x800 ? NFKC_MAX_CODE : c;
+  }
+  if (c >= 0xF8 || (s[3] & 0xC0) != 0x80) { return NFKC_MAX_CODE; }
+  c = ((c & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+  return c < 0x10000 ? NFKC_MAX_CODE : c;
+}
+
+inline static uint32_t
+nfkc_value(uint32_t c)
+{
+  if (c >= NFKC_MAX_CODE) { return 0; }
+  return nfkc_blocks[(nfkc_index[c >> NFKC_BLOCK_BITS] << NFKC_BLOCK_BITS) +
+                     (c & ((1 << NFKC_BLOCK_BITS) - 1))];
+}
+
 const char *
 sen_nfkc_map1(const unsigned char *str)
 {
-%  return 0;
+  uint32_t v = nfkc_value(nfkc_code(str)) & ~NFKC_SUFFIX;
+  return v ? nfkc_pool + v : 0;
 }
 
 const char *
 sen_nfkc_map2(const unsigned char *prefix, const unsigned char *suffix)
 {
-%  return 0;
+  uint32_t p, s = nfkc_code(suffix), h;
+  if (!(nfkc_value(s) & NFKC_SUFFIX)) { return 0; }
+  p = nfkc_code(prefix);
+  for (h = NFKC_PAIR_HASH(p, s); nfkc_pairs[h].offset;
+       h = (h + 1) & ((1 << NFKC_PAIR_BITS) - 1)) {
+    if (nfkc_pairs[h].prefix == p && nfkc_pairs[h].suffix == s) {
+      return nfkc_pool + nfkc_pairs[h].offset;
+    }
+  }
+  return 0;
 }
 
 #endif /* NO_NFKC */
 
 END
 
+switch_template = <<END
+/* Copyright(C) 2004 Brazil
+don't edit this file by hand. it generated automatically by nfkc.rb
+*/
+
+/* the switch trees which sen_nfkc_map1 and sen_nfkc_map2 of lib/nfkc.c
+   used to be, for normbench to compare the tables with. */
+
+const char *
+sen_nfkc_map1_switch(const unsigned char *str)
+{
+%  return 0;
+}
+
+const char *
+sen_nfkc_map2_switch(const unsigned char *prefix, const unsigned char *suffix)
+{
+%  return 0;
+}
+END
+
 ######## main #######
 
 ARGV.each{|arg|
@@ -362,6 +526,17 @@ STDERR.puts('generating ctype code..')
 outf.print(tmps.shift)
 generate_blockcode_ctype(outf, 'gc')
 
+STDERR.puts('generating table..')
+outf.print(tmps.shift)
+generate_table(outf, map1, map2)
+
+outf.print(tmps.shift)
+outf.close
+
+outf = open('nfkcswitch.c', 'w')
+
+tmps = switch_template.split(/%/)
+
 STDERR.puts('generating map1 code..')
 outf.print(tmps.shift)
 generate_map1(outf, map1, 0)